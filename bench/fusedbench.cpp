@@ -0,0 +1,143 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// The zero skip's check and an in-order hash over the same chunks: as
+// TransferPipeline did it before (check each chunk when its read
+// completes, hash it later when its write has completed and other chunks
+// have been read in between) against one fused pass per chunk
+// (FusedStage<ZeroCheckStage, HashStage>, while the chunk is in the
+// cache).  Prints GB/s for each hash.
+//
+//     fusedbench [total MiB] [chunk KiB] [chunks in flight]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "bufferpool.h"
+#include "crc32.h"
+#include "sha.h"
+#include "testutil.h"
+#include "transferstages.h"
+#include "xxh3.h"
+#include "zerodetect.h"
+
+namespace
+{
+
+struct Crc32cHash
+{
+	uint32_t crc;
+
+	Crc32cHash() : crc(0) {}
+	void addData(const char* data, size_t bytes) { crc = crc32cUpdate(crc, data, bytes); }
+};
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+template <class Hash>
+void run(const char* name, const std::vector<char*>& chunks, size_t chunkbytes, size_t lag, int rounds)
+{
+	const double total = (double)chunks.size() * chunkbytes * rounds;
+	size_t zeros = 0;
+
+	// Separate: the hash of a chunk trails its zero check by lag chunks
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round)
+	{
+		Hash hash;
+		HashStage<Hash> stage(hash);
+		for (size_t i = 0; i < chunks.size() + lag; ++i)
+		{
+			if (i < chunks.size() && isZeroFilled(chunks[i], chunkbytes))
+			{
+				++zeros;
+			}
+			if (i >= lag)
+			{
+				stage.process(chunks[i - lag], chunkbytes);
+			}
+		}
+	}
+	double separate = seconds(started);
+
+	// Fused: both in one pass as each chunk's read completes
+	started = std::chrono::steady_clock::now();
+	for (int round = 0; round < rounds; ++round)
+	{
+		Hash hash;
+		HashStage<Hash> stage(hash);
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			ZeroCheckStage check;
+			FusedStage<ZeroCheckStage, HashStage<Hash> > fused(check, stage);
+			fused.process(chunks[i], chunkbytes);
+			if (check.allZero())
+			{
+				--zeros;
+			}
+		}
+	}
+	double fused = seconds(started);
+
+	printf("%-8s separate %6.2f GB/s   fused %6.2f GB/s   %+5.1f%%%s\n", name, total / separate / 1e9, total / fused / 1e9,
+		(separate / fused - 1.0) * 100.0, (zeros != 0) ? "   (zero counts differ!)" : "");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	size_t totalmib = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : 256;
+	size_t chunkkib = (argc > 2) ? (size_t)strtoul(argv[2], NULL, 10) : 512;
+	size_t depth = (argc > 3) ? (size_t)strtoul(argv[3], NULL, 10) : 8;
+	size_t chunkbytes = chunkkib * 1024;
+	if (chunkbytes == 0 || totalmib * 1024 < chunkkib)
+	{
+		fprintf(stderr, "usage: fusedbench [total MiB] [chunk KiB] [chunks in flight]\n");
+		return 2;
+	}
+
+	// Pipeline-sized chunks, one in eight all zeros
+	std::vector<char*> chunks(totalmib * 1024 / chunkkib);
+	TestRandom random(1u);
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		chunks[i] = alignedAlloc(chunkbytes, BufferPool::ALIGNMENT);
+		random.fill(chunks[i], chunkbytes);
+		if (i % 8 == 3)
+		{
+			memset(chunks[i], 0, chunkbytes);
+		}
+	}
+	printf("%zu MiB in %zu KiB chunks, hash %zu chunks behind the zero check; zero detect %s, SHA %s, CRC %s\n",
+		totalmib, chunkkib, depth, zeroDetectKernel(), shaKernel(), crc32Kernel());
+	run<Crc32cHash>("CRC32C", chunks, chunkbytes, depth, 4);
+	run<Xxh3Hash>("XXH3", chunks, chunkbytes, depth, 4);
+	run<Sha256Hash>("SHA256", chunks, chunkbytes, depth, 1);
+	for (char* chunk : chunks)
+	{
+		alignedFree(chunk);
+	}
+	return 0;
+}
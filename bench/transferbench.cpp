@@ -0,0 +1,138 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// File to file throughput of TransferPipeline::copy() and compare() over
+// BlockDevice, one line per way of moving the data, on a page-cached test
+// file (run it twice, or drop the caches in between, to see cold reads).
+// The direct cases open both files unbuffered, so they go to the disk
+// every time, and the buffered compare after them reads an uncached sink.
+//
+//     transferbench [MiB] [directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "blockdevice.h"
+#include "bufferpool.h"
+#include "mappedfile.h"
+#include "testutil.h"
+#include "transferpipeline.h"
+
+namespace
+{
+
+struct Case
+{
+	const char* name;
+	bool compare;
+	bool kernelcopy;
+	bool mapped;
+	bool direct;
+};
+
+TransferPipeline::Endpoint endpoint(const BlockDevice* device)
+{
+	return TransferPipeline::Endpoint(device->handle(), (device->isUnbuffered() && device->isRegularFile()) ? (unsigned long long)BufferPool::ALIGNMENT : 1ull);
+}
+
+bool makeSource(const std::string& path, size_t mib)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	std::vector<char> block(1024 * 1024);
+	TestRandom random(7u);
+	bool ok = true;
+	for (size_t i = 0; i < mib && ok; ++i)
+	{
+		random.fill(block.data(), block.size());
+		ok = fwrite(block.data(), 1, block.size(), file) == block.size();
+	}
+	return fclose(file) == 0 && ok;
+}
+
+void run(const Case& test, const std::string& sourcepath, const std::string& sinkpath)
+{
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open(sourcepath, BlockDevice::ACCESS_READ, test.direct, &error);
+	BlockDevice* sink = BlockDevice::open(sinkpath, test.compare ? BlockDevice::ACCESS_READ : BlockDevice::ACCESS_CREATE, test.direct, &error);
+	if (source == NULL || sink == NULL)
+	{
+		printf("%-28s cannot open (%lu)\n", test.name, error);
+		delete source;
+		delete sink;
+		return;
+	}
+	// The mapping serves chunks in place of reads of the source
+	MappedFile mapping(source->handle(), test.mapped ? source->size() : 0ull);
+	TransferPipeline::Endpoint from = endpoint(source);
+	if (test.mapped && mapping.isValid())
+	{
+		from.mapping = &mapping;
+	}
+	BufferPool pool;
+	TransferPipeline pipeline(pool, source->sectorSize(), 2048ull, 8u);
+	pipeline.setKernelCopy(test.kernelcopy);
+	unsigned long long numsectors = source->numberOfSectors();
+	TransferPipeline::Result result = test.compare
+		? pipeline.compare(numsectors, from, endpoint(sink), TransferPipeline::ProgressFunc())
+		: pipeline.copy(numsectors, from, endpoint(sink), TransferPipeline::ProgressFunc());
+	double seconds = pipeline.elapsedSeconds();
+	printf("%-28s %8.0f MB/s   %s%s\n", test.name, (seconds > 0.0) ? source->size() / seconds / 1024.0 / 1024.0 : 0.0,
+		pipeline.engineName(), (result == TransferPipeline::RESULT_OK) ? "" : "   FAILED");
+	delete sink;
+	delete source;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	size_t mib = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : 1024;
+	std::string directory = (argc > 2) ? argv[2] : ".";
+	std::string sourcepath = directory + "/transferbench-source.img";
+	std::string sinkpath = directory + "/transferbench-sink.img";
+	if (mib == 0 || !makeSource(sourcepath, mib))
+	{
+		fprintf(stderr, "usage: transferbench [MiB] [directory]\n");
+		return 2;
+	}
+	printf("%zu MiB, 1 MiB chunks, 8 in flight\n", mib);
+
+	const Case cases[] = {
+		{ "copy, chunk buffers", false, false, false, false },
+		{ "copy, mapped source", false, false, true, false },
+		{ "copy, kernel", false, true, false, false },
+		{ "copy, direct", false, false, false, true },
+		{ "compare", true, false, false, false },
+		{ "compare, mapped source", true, false, true, false },
+		{ "compare, direct", true, false, false, true },
+	};
+	for (const Case& test : cases)
+	{
+		run(test, sourcepath, sinkpath);
+	}
+	remove(sinkpath.c_str());
+	remove(sourcepath.c_str());
+	return 0;
+}
@@ -0,0 +1,114 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// GB/s of firstNonZeroByte() over all-zero buffers (the whole buffer is
+// scanned) for every kernel this CPU can run, from a buffer that stays in
+// L1 to one four times the size of most last level caches.
+//
+//     zerodetectbench [seconds per measurement]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "bufferpool.h"
+#include "cpufeatures.h"
+#include "zerodetect.h"
+
+namespace
+{
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+double measure(const char* data, size_t bytes, double duration)
+{
+	size_t found = 0;
+	unsigned long long rounds = 0ull;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double elapsed;
+	do
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			found += firstNonZeroByte(data, bytes);
+		}
+		rounds += 16ull;
+		elapsed = seconds(start);
+	}
+	while (elapsed < duration);
+	// Keeps the calls from being optimised away
+	if (found != rounds * bytes)
+	{
+		fprintf(stderr, "non-zero byte in a zero buffer\n");
+		exit(1);
+	}
+	return (double)rounds * bytes / elapsed / 1e9;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	double duration = (argc > 1) ? atof(argv[1]) : 0.5;
+	const size_t sizes[] = { 4096, 256 * 1024, 4 * 1024 * 1024, 128 * 1024 * 1024 };
+	const size_t largest = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+	char* data = alignedAlloc(largest, BufferPool::ALIGNMENT);
+	if (data == NULL || duration <= 0.0)
+	{
+		fprintf(stderr, "usage: zerodetectbench [seconds per measurement]\n");
+		return 2;
+	}
+	memset(data, 0, largest);
+
+	// Every feature, then without AVX2, then none
+	CpuFeatures all = { true, true, true, true, true, true, true };
+	CpuFeatures noavx2 = all;
+	noavx2.avx2 = false;
+	CpuFeatures none = { false, false, false, false, false, false, false };
+	const CpuFeatures sets[] = { all, noavx2, none };
+	const char* previous = "";
+	printf("%-8s", "kernel");
+	for (size_t size : sizes)
+	{
+		printf(" %9zu KiB", size / 1024);
+	}
+	printf("\n");
+	for (const CpuFeatures& set : sets)
+	{
+		selectZeroDetectKernel(set);
+		if (strcmp(zeroDetectKernel(), previous) == 0)
+		{
+			continue;
+		}
+		previous = zeroDetectKernel();
+		printf("%-8s", previous);
+		for (size_t size : sizes)
+		{
+			printf(" %8.1f GB/s", measure(data, size, duration));
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+	alignedFree(data);
+	return 0;
+}
@@ -26,7 +26,7 @@ INCLUDEPATH += .
 #CONFIG += release
 DEFINES -= UNICODE
 QT += widgets
-LIBS += -luser32
+LIBS += -luser32 -ladvapi32
 VERSION = 1.0.3
 VERSTR = '\\"$${VERSION}\\"'
 DEFINES += VER=\"$${VERSTR}\"
@@ -37,20 +37,61 @@ QMAKE_TARGET_DESCRIPTION = "Image Writer for Windows to write USB and SD images"
 QMAKE_TARGET_COPYRIGHT = "Copyright (C) 2009-2019 Windows ImageWriter Team"
 
 # Input
-HEADERS += disk.h\
+HEADERS += asyncio.h \
+           blake3.h \
+           blockdevice.h \
+           bufferpool.h \
+           chunkcontroller.h \
+           cpufeatures.h \
+           crc32.h \
+           digestset.h \
+           disk.h\
            driveList.h \
            mainwindow.h\
            droppablelineedit.h \
-           elapsedtimer.h
+           elapsedtimer.h \
+           filecache.h \
+           hashcache.h \
+           mappedfile.h \
+           parallelhash.h \
+           sha.h \
+           sparseimage.h \
+           transfercontrol.h \
+           transferpipeline.h \
+           transferstages.h \
+           transferworker.h \
+           virtualdisk.h \
+           xxh3.h \
+           zerodetect.h
 
 FORMS += mainwindow.ui
 
-SOURCES += disk.cpp\
+SOURCES += asyncio.cpp \
+           blake3.cpp \
+           blockdevice.cpp \
+           bufferpool.cpp \
+           chunkcontroller.cpp \
+           cpufeatures.cpp \
+           crc32.cpp \
+           digestset.cpp \
+           disk.cpp\
            driveList.cpp \
            main.cpp\
            mainwindow.cpp\
            droppablelineedit.cpp \
-           elapsedtimer.cpp
+           elapsedtimer.cpp \
+           filecache.cpp \
+           hashcache.cpp \
+           mappedfile.cpp \
+           parallelhash.cpp \
+           sha.cpp \
+           sparseimage.cpp \
+           transfercontrol.cpp \
+           transferpipeline.cpp \
+           transferworker.cpp \
+           virtualdisk.cpp \
+           xxh3.cpp \
+           zerodetect.cpp
 
 RESOURCES += gui_icons.qrc translations.qrc
 
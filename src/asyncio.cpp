@@ -0,0 +1,799 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include <deque>
+#include <vector>
+#include "asyncio.h"
+
+#ifdef _WIN32
+
+// Overlapped I/O with one manual-reset event per slot.  Completions are
+// collected with WaitForMultipleObjects, so the queue depth is capped at
+// MAXIMUM_WAIT_OBJECTS.
+class OverlappedIo : public AsyncIo
+{
+public:
+	OverlappedIo(unsigned int queuedepth);
+	~OverlappedIo();
+	void submit(IoRequest* request);
+	IoRequest* wait(unsigned int timeoutms = WAIT_FOREVER);
+	void cancel();
+	const char* name() const { return "overlapped"; }
+
+private:
+	struct Slot
+	{
+		OVERLAPPED overlapped;
+		IoRequest* request;
+	};
+
+	void complete(Slot* slot, BOOL ok, DWORD bytes);
+
+	std::vector<Slot> slots;
+	std::vector<HANDLE> events;
+	std::deque<IoRequest*> done;
+};
+
+OverlappedIo::OverlappedIo(unsigned int queuedepth) : AsyncIo(queuedepth)
+{
+	slots.resize(depth);
+	events.resize(depth);
+	for (unsigned int i = 0; i < depth; ++i)
+	{
+		slots[i].request = NULL;
+		events[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
+}
+
+OverlappedIo::~OverlappedIo()
+{
+	// Never free an OVERLAPPED the kernel may still write to
+	while (wait() != NULL)
+	{
+	}
+	for (HANDLE event : events)
+	{
+		CloseHandle(event);
+	}
+}
+
+void OverlappedIo::complete(Slot* slot, BOOL ok, DWORD bytes)
+{
+	IoRequest* request = slot->request;
+	DWORD err = ok ? ERROR_SUCCESS : GetLastError();
+	// Reading past the end of a file is a short read, not an error
+	if (err == ERROR_HANDLE_EOF)
+	{
+		err = ERROR_SUCCESS;
+		bytes = 0;
+	}
+	request->transferred = bytes;
+	request->error = err;
+	slot->request = NULL;
+	done.push_back(request);
+}
+
+void OverlappedIo::submit(IoRequest* request)
+{
+	Slot* slot = NULL;
+	unsigned int index = 0;
+	for (; index < depth; ++index)
+	{
+		if (slots[index].request == NULL)
+		{
+			slot = &slots[index];
+			break;
+		}
+	}
+	++inflight;
+	if (slot == NULL)
+	{
+		request->transferred = 0;
+		request->error = ERROR_TOO_MANY_CMDS;
+		done.push_back(request);
+		return;
+	}
+
+	memset(&slot->overlapped, 0, sizeof(slot->overlapped));
+	slot->overlapped.Offset = (DWORD)(request->offset & 0xFFFFFFFFull);
+	slot->overlapped.OffsetHigh = (DWORD)(request->offset >> 32);
+	slot->overlapped.hEvent = events[index];
+	slot->request = request;
+	ResetEvent(events[index]);
+
+	DWORD bytes = 0;
+	BOOL ok = (request->op == IoRequest::OP_READ)
+		? ReadFile(request->handle, request->data, request->length, &bytes, &slot->overlapped)
+		: WriteFile(request->handle, request->data, request->length, &bytes, &slot->overlapped);
+	if (ok)
+	{
+		// Completed synchronously (always the case on non-overlapped handles)
+		complete(slot, TRUE, bytes);
+	}
+	else if (GetLastError() != ERROR_IO_PENDING)
+	{
+		complete(slot, FALSE, 0);
+	}
+}
+
+IoRequest* OverlappedIo::wait(unsigned int timeoutms)
+{
+	if (done.empty())
+	{
+		std::vector<HANDLE> pending;
+		std::vector<Slot*> owners;
+		for (unsigned int i = 0; i < depth; ++i)
+		{
+			if (slots[i].request != NULL)
+			{
+				pending.push_back(events[i]);
+				owners.push_back(&slots[i]);
+			}
+		}
+		if (pending.empty())
+		{
+			return NULL;
+		}
+		DWORD result = WaitForMultipleObjects((DWORD)pending.size(), pending.data(), FALSE, (timeoutms == WAIT_FOREVER) ? INFINITE : timeoutms);
+		if (result == WAIT_FAILED)
+		{
+			// Not a timeout: the wait will keep failing, so abort whatever is
+			// in flight and fail it with the wait's error rather than have
+			// the caller poll forever
+			DWORD err = GetLastError();
+			cancel();
+			for (Slot* slot : owners)
+			{
+				DWORD bytes = 0;
+				GetOverlappedResult(slot->request->handle, &slot->overlapped, &bytes, TRUE);
+				SetLastError(err);
+				complete(slot, FALSE, 0);
+			}
+		}
+		else if (result == WAIT_TIMEOUT || result >= WAIT_OBJECT_0 + pending.size())
+		{
+			return NULL;
+		}
+		else
+		{
+			Slot* slot = owners[result - WAIT_OBJECT_0];
+			DWORD bytes = 0;
+			BOOL ok = GetOverlappedResult(slot->request->handle, &slot->overlapped, &bytes, FALSE);
+			complete(slot, ok, bytes);
+		}
+	}
+	IoRequest* request = done.front();
+	done.pop_front();
+	--inflight;
+	return request;
+}
+
+void OverlappedIo::cancel()
+{
+	// Aborted requests signal their event like any other completion
+	for (Slot& slot : slots)
+	{
+		if (slot.request != NULL)
+		{
+			CancelIoEx(slot.request->handle, &slot.overlapped);
+		}
+	}
+}
+
+AsyncIo* AsyncIo::create(unsigned int queuedepth)
+{
+	if (queuedepth < 1)
+	{
+		queuedepth = 1;
+	}
+	if (queuedepth > MAXIMUM_WAIT_OBJECTS)
+	{
+		queuedepth = MAXIMUM_WAIT_OBJECTS;
+	}
+	return new OverlappedIo(queuedepth);
+}
+
+#else // POSIX
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+// pread/pwrite on a small pool of threads, one request per thread.  Works
+// on any POSIX system; used when io_uring is missing or refused.
+class ThreadPoolIo : public AsyncIo
+{
+public:
+	ThreadPoolIo(unsigned int queuedepth);
+	~ThreadPoolIo();
+	void submit(IoRequest* request);
+	IoRequest* wait(unsigned int timeoutms = WAIT_FOREVER);
+	void cancel();
+	const char* name() const { return "thread pool"; }
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque<IoRequest*> queued;
+	std::deque<IoRequest*> done;
+	std::mutex lock;
+	std::condition_variable queuedChanged;
+	std::condition_variable doneChanged;
+	bool stopping;
+};
+
+ThreadPoolIo::ThreadPoolIo(unsigned int queuedepth) : AsyncIo(queuedepth), stopping(false)
+{
+	for (unsigned int i = 0; i < depth; ++i)
+	{
+		workers.push_back(std::thread(&ThreadPoolIo::workerLoop, this));
+	}
+}
+
+ThreadPoolIo::~ThreadPoolIo()
+{
+	while (wait() != NULL)
+	{
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	queuedChanged.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPoolIo::workerLoop()
+{
+	for (;;)
+	{
+		IoRequest* request;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			queuedChanged.wait(guard, [this] { return stopping || !queued.empty(); });
+			if (queued.empty())
+			{
+				return;
+			}
+			request = queued.front();
+			queued.pop_front();
+		}
+
+		// Loop over short transfers; a read returning 0 is EOF
+		unsigned long total = 0;
+		unsigned long err = 0;
+		while (total < request->length)
+		{
+			ssize_t n = (request->op == IoRequest::OP_READ)
+				? pread(request->handle, request->data + total, request->length - total, (off_t)(request->offset + total))
+				: pwrite(request->handle, request->data + total, request->length - total, (off_t)(request->offset + total));
+			if (n < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				err = (unsigned long)errno;
+				break;
+			}
+			if (n == 0)
+			{
+				if (request->op == IoRequest::OP_WRITE)
+				{
+					err = EIO;
+				}
+				break;
+			}
+			total += (unsigned long)n;
+		}
+		request->transferred = total;
+		request->error = err;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done.push_back(request);
+		}
+		doneChanged.notify_one();
+	}
+}
+
+void ThreadPoolIo::submit(IoRequest* request)
+{
+	++inflight;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queued.push_back(request);
+	}
+	queuedChanged.notify_one();
+}
+
+IoRequest* ThreadPoolIo::wait(unsigned int timeoutms)
+{
+	if (inflight == 0)
+	{
+		return NULL;
+	}
+	std::unique_lock<std::mutex> guard(lock);
+	if (timeoutms == WAIT_FOREVER)
+	{
+		doneChanged.wait(guard, [this] { return !done.empty(); });
+	}
+	else if (!doneChanged.wait_for(guard, std::chrono::milliseconds(timeoutms), [this] { return !done.empty(); }))
+	{
+		return NULL;
+	}
+	IoRequest* request = done.front();
+	done.pop_front();
+	--inflight;
+	return request;
+}
+
+void ThreadPoolIo::cancel()
+{
+	// A pread/pwrite that has started cannot be interrupted, but nothing
+	// still queued behind it needs to run
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		while (!queued.empty())
+		{
+			IoRequest* request = queued.front();
+			queued.pop_front();
+			request->transferred = 0;
+			request->error = ECANCELED;
+			done.push_back(request);
+		}
+	}
+	doneChanged.notify_all();
+}
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+// io_uring through the raw system calls (no liburing dependency).  Uses
+// READV/WRITEV so it runs on any kernel that has io_uring at all (5.1+).
+class UringIo : public AsyncIo
+{
+public:
+	static UringIo* open(unsigned int queuedepth);
+	~UringIo();
+	void submit(IoRequest* request);
+	IoRequest* wait(unsigned int timeoutms = WAIT_FOREVER);
+	void cancel();
+	const char* name() const { return "io_uring"; }
+
+private:
+	struct Slot
+	{
+		IoRequest* request;
+		struct iovec iov;
+		unsigned long total;
+	};
+
+	// user_data of the cancel requests and no-ops, whose completions are dropped
+	static const unsigned long long CANCEL_TAG = ~0ull;
+
+	UringIo(unsigned int queuedepth);
+	bool setup();
+	void queueSlot(unsigned int index);
+	void queueCancel(unsigned int index);
+	bool enter(unsigned int submit, unsigned int wait);
+	void failAll(unsigned long err);
+
+	int ringfd;
+	void* sqRing;
+	void* cqRing;
+	struct io_uring_sqe* sqes;
+	size_t sqRingSize;
+	size_t cqRingSize;
+	size_t sqesSize;
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqMask;
+	struct io_uring_cqe* cqes;
+	unsigned int unsubmitted;
+	bool canceling;
+	unsigned long broken;   // errno that made the ring unusable, 0 while it works
+
+	std::vector<Slot> slots;
+	std::vector<unsigned int> freeSlots;
+	std::deque<IoRequest*> done;
+};
+
+UringIo::UringIo(unsigned int queuedepth)
+	: AsyncIo(queuedepth), ringfd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes((struct io_uring_sqe*)MAP_FAILED),
+	sqRingSize(0), cqRingSize(0), sqesSize(0), unsubmitted(0), canceling(false), broken(0)
+{
+	slots.resize(depth);
+	for (unsigned int i = depth; i > 0; --i)
+	{
+		freeSlots.push_back(i - 1);
+	}
+}
+
+UringIo* UringIo::open(unsigned int queuedepth)
+{
+	UringIo* engine = new UringIo(queuedepth);
+	if (!engine->setup())
+	{
+		delete engine;
+		return NULL;
+	}
+	return engine;
+}
+
+bool UringIo::setup()
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ringfd = (int)syscall(__NR_io_uring_setup, depth, &params);
+	if (ringfd < 0)
+	{
+		return false;
+	}
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cqRingSize > sqRingSize)
+		{
+			sqRingSize = cqRingSize;
+		}
+		cqRingSize = sqRingSize;
+	}
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		return false;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cqRing = sqRing;
+	}
+	else
+	{
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			return false;
+		}
+	}
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = (struct io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		return false;
+	}
+
+	char* sq = (char*)sqRing;
+	char* cq = (char*)cqRing;
+	sqHead = (unsigned*)(sq + params.sq_off.head);
+	sqTail = (unsigned*)(sq + params.sq_off.tail);
+	sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	sqArray = (unsigned*)(sq + params.sq_off.array);
+	cqHead = (unsigned*)(cq + params.cq_off.head);
+	cqTail = (unsigned*)(cq + params.cq_off.tail);
+	cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+UringIo::~UringIo()
+{
+	if (sqes != MAP_FAILED && ringfd >= 0)
+	{
+		while (wait() != NULL)
+		{
+		}
+	}
+	if (sqes != MAP_FAILED)
+	{
+		munmap(sqes, sqesSize);
+	}
+	if (cqRing != MAP_FAILED && cqRing != sqRing)
+	{
+		munmap(cqRing, cqRingSize);
+	}
+	if (sqRing != MAP_FAILED)
+	{
+		munmap(sqRing, sqRingSize);
+	}
+	if (ringfd >= 0)
+	{
+		close(ringfd);
+	}
+}
+
+void UringIo::queueSlot(unsigned int index)
+{
+	Slot& slot = slots[index];
+	IoRequest* request = slot.request;
+	unsigned tail = *sqTail;
+	unsigned sqIndex = tail & *sqMask;
+	struct io_uring_sqe* sqe = &sqes[sqIndex];
+
+	slot.iov.iov_base = request->data + slot.total;
+	slot.iov.iov_len = request->length - slot.total;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (request->op == IoRequest::OP_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+	sqe->fd = request->handle;
+	sqe->addr = (unsigned long long)(uintptr_t)&slot.iov;
+	sqe->len = 1;
+	sqe->off = request->offset + slot.total;
+	sqe->user_data = index;
+	sqArray[sqIndex] = sqIndex;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	++unsubmitted;
+}
+
+void UringIo::queueCancel(unsigned int index)
+{
+	unsigned tail = *sqTail;
+	unsigned sqIndex = tail & *sqMask;
+	struct io_uring_sqe* sqe = &sqes[sqIndex];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = index;
+	sqe->user_data = CANCEL_TAG;
+	sqArray[sqIndex] = sqIndex;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	++unsubmitted;
+}
+
+bool UringIo::enter(unsigned int submit, unsigned int wait)
+{
+	for (;;)
+	{
+		int ret = (int)syscall(__NR_io_uring_enter, ringfd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (ret >= 0)
+		{
+			unsubmitted -= (unsigned int)ret;
+			return true;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			return false;
+		}
+		submit = unsubmitted;
+	}
+}
+
+// io_uring_enter() or poll() failed for good: nothing more will be reaped
+// from the ring, so every busy slot is failed with err and handed back
+// through done, and later requests fail the same way
+void UringIo::failAll(unsigned long err)
+{
+	broken = err;
+	for (unsigned int i = 0; i < depth; ++i)
+	{
+		IoRequest* request = slots[i].request;
+		if (request != NULL)
+		{
+			request->transferred = slots[i].total;
+			request->error = err;
+			slots[i].request = NULL;
+			freeSlots.push_back(i);
+			done.push_back(request);
+		}
+	}
+}
+
+void UringIo::submit(IoRequest* request)
+{
+	++inflight;
+	if (freeSlots.empty() || broken != 0)
+	{
+		request->transferred = 0;
+		request->error = (broken != 0) ? broken : EBUSY;
+		done.push_back(request);
+		return;
+	}
+	unsigned int index = freeSlots.back();
+	freeSlots.pop_back();
+	slots[index].request = request;
+	slots[index].total = 0;
+	queueSlot(index);
+	// Submitted right away so the device starts on it while we do other work
+	if (!enter(unsubmitted, 0))
+	{
+		// The kernel took nothing from the ring: turn the entry into a no-op
+		// whose completion is dropped, and fail the request here
+		unsigned long err = (unsigned long)errno;
+		struct io_uring_sqe* sqe = &sqes[(*sqTail - 1) & *sqMask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_NOP;
+		sqe->user_data = CANCEL_TAG;
+		slots[index].request = NULL;
+		freeSlots.push_back(index);
+		request->transferred = 0;
+		request->error = err;
+		done.push_back(request);
+	}
+}
+
+IoRequest* UringIo::wait(unsigned int timeoutms)
+{
+	while (done.empty())
+	{
+		if (inflight == 0)
+		{
+			return NULL;
+		}
+		if (broken != 0)
+		{
+			// failAll() already handed back everything the ring held
+			return NULL;
+		}
+		unsigned head = *cqHead;
+		if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+		{
+			if (timeoutms == WAIT_FOREVER)
+			{
+				if (!enter(unsubmitted, 1))
+				{
+					failAll((unsigned long)errno);
+				}
+				continue;
+			}
+			// The ring polls readable while completions are waiting
+			if (unsubmitted > 0 && !enter(unsubmitted, 0))
+			{
+				failAll((unsigned long)errno);
+				continue;
+			}
+			struct pollfd pfd;
+			pfd.fd = ringfd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			int ready = poll(&pfd, 1, (int)timeoutms);
+			if (ready == 0)
+			{
+				return NULL;
+			}
+			if (ready < 0 && errno != EINTR)
+			{
+				failAll((unsigned long)errno);
+			}
+			continue;
+		}
+		struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+		unsigned long long userdata = cqe->user_data;
+		int res = cqe->res;
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+		if (userdata == CANCEL_TAG)
+		{
+			continue;
+		}
+		unsigned int index = (unsigned int)userdata;
+
+		Slot& slot = slots[index];
+		IoRequest* request = slot.request;
+		bool finished = true;
+		request->error = 0;
+		if (res < 0)
+		{
+			request->error = (unsigned long)-res;
+		}
+		else if (res == 0)
+		{
+			// EOF on a read; a write that makes no progress is an error
+			if (request->op == IoRequest::OP_WRITE)
+			{
+				request->error = EIO;
+			}
+		}
+		else
+		{
+			slot.total += (unsigned long)res;
+			if (slot.total < request->length && canceling)
+			{
+				request->error = ECANCELED;
+			}
+			else if (slot.total < request->length)
+			{
+				// Short transfer: queue the remainder in the same slot
+				queueSlot(index);
+				enter(unsubmitted, 0);
+				finished = false;
+			}
+		}
+		if (finished)
+		{
+			request->transferred = slot.total;
+			slot.request = NULL;
+			freeSlots.push_back(index);
+			done.push_back(request);
+		}
+	}
+	IoRequest* request = done.front();
+	done.pop_front();
+	--inflight;
+	return request;
+}
+void UringIo::cancel()
+{
+	if (canceling)
+	{
+		return;
+	}
+	canceling = true;
+	if (broken != 0)
+	{
+		return;
+	}
+	// With everything earlier submitted the SQ ring has room for one cancel
+	// per busy slot, and the CQ ring (twice the size) for their completions
+	// on top of the requests'
+	if (unsubmitted > 0)
+	{
+		enter(unsubmitted, 0);
+	}
+	for (unsigned int i = 0; i < depth; ++i)
+	{
+		if (slots[i].request != NULL)
+		{
+			queueCancel(i);
+		}
+	}
+	enter(unsubmitted, 0);
+}
+#endif // HAVE_IO_URING
+
+AsyncIo* AsyncIo::create(unsigned int queuedepth)
+{
+	if (queuedepth < 1)
+	{
+		queuedepth = 1;
+	}
+#ifdef HAVE_IO_URING
+	// Kernels without io_uring, or sandboxes that block it, get the pool
+	AsyncIo* uring = UringIo::open(queuedepth);
+	if (uring != NULL)
+	{
+		return uring;
+	}
+#endif
+	return new ThreadPoolIo(queuedepth);
+}
+
+#endif // _WIN32
@@ -0,0 +1,92 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#ifdef _WIN32
+#ifndef WINVER
+#define WINVER 0x0601
+#endif
+#include <windows.h>
+typedef HANDLE IoHandle;
+#else
+typedef int IoHandle;
+#endif
+
+// One positional read or write.  The owner fills in the first block, the
+// engine fills in transferred/error when the request completes.
+struct IoRequest
+{
+	enum Op { OP_READ = 0, OP_WRITE };
+
+	Op op;
+	IoHandle handle;
+	unsigned long long offset;
+	char* data;
+	unsigned long length;
+	void* context;              // owner's cookie, untouched by the engine
+
+	unsigned long transferred;  // bytes moved; a read stops short only at EOF
+	unsigned long error;        // 0, or the Win32 error code / errno
+};
+
+// Keeps up to queueDepth() requests in flight and hands them back as they
+// complete, which may be in any order.  Every request carries its own
+// offset, there is no shared file pointer.  Not thread safe: use one
+// engine per thread.
+//
+// Windows uses overlapped I/O, so handles that should really run in
+// parallel must be opened with FILE_FLAG_OVERLAPPED (synchronous handles
+// still work, one request at a time).  Linux uses io_uring and falls back
+// to a pread/pwrite thread pool when io_uring is unavailable.
+//
+// cancel() asks for everything in flight to be aborted (CancelIoEx,
+// IORING_OP_ASYNC_CANCEL; the thread pool drops requests it has not
+// started).  Aborted requests still come back through wait(), with error
+// set to ERROR_OPERATION_ABORTED / ECANCELED; requests the device has
+// already taken may complete normally instead.
+class AsyncIo
+{
+public:
+	static const unsigned int WAIT_FOREVER = 0xFFFFFFFFu;
+
+	static AsyncIo* create(unsigned int queuedepth);
+	virtual ~AsyncIo() {}
+
+	unsigned int queueDepth() const { return depth; }
+	unsigned int inFlight() const { return inflight; }
+	bool full() const { return inflight >= depth; }
+
+	// Must not be called while full(); failures are reported by wait()
+	virtual void submit(IoRequest* request) = 0;
+	// Next completed request, blocking up to timeoutms; NULL when nothing
+	// is in flight or the timeout passed first (inFlight() tells which)
+	virtual IoRequest* wait(unsigned int timeoutms = WAIT_FOREVER) = 0;
+	virtual void cancel() = 0;
+	virtual const char* name() const = 0;
+
+protected:
+	AsyncIo(unsigned int depth) : depth(depth), inflight(0) {}
+
+	unsigned int depth;
+	unsigned int inflight;
+};
+
+#endif // ASYNCIO_H
@@ -0,0 +1,451 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include <thread>
+#include "blake3.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define BLAKE3_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static const uint32_t IV[8] = {
+	0x6A09E667u, 0xBB67AE85u, 0x3C6EF372u, 0xA54FF53Au, 0x510E527Fu, 0x9B05688Cu, 0x1F83D9ABu, 0x5BE0CD19u
+};
+// The message word order of each round: the permutation applied 0..6 times
+static const unsigned char SCHEDULE[7][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static const uint32_t CHUNK_START = 1u << 0;
+static const uint32_t CHUNK_END = 1u << 1;
+static const uint32_t PARENT = 1u << 2;
+static const uint32_t ROOT = 1u << 3;
+
+static const size_t BLOCK_BYTES = 64;
+static const unsigned int SUBTREE_LEVEL = 10;  // log2 of the chunks in a subtree
+static const unsigned int MAX_THREADS = 16;
+
+static uint32_t rotr(uint32_t x, int r)
+{
+	return (x >> r) | (x << (32 - r));
+}
+
+static inline void g(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d, uint32_t x, uint32_t y)
+{
+	a = a + b + x;
+	d = rotr(d ^ a, 16);
+	c = c + d;
+	b = rotr(b ^ c, 12);
+	a = a + b + y;
+	d = rotr(d ^ a, 8);
+	c = c + d;
+	b = rotr(b ^ c, 7);
+}
+
+// The compression function; out gets all 16 words, the first 8 are the
+// chaining value.  Block words are little-endian, as is every target
+static void compress(const uint32_t cv[8], const unsigned char block[64], unsigned long long counter, uint32_t blockbytes, uint32_t flags, uint32_t out[16])
+{
+	uint32_t m[16];
+	memcpy(m, block, sizeof(m));
+	uint32_t s[16] = {
+		cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+		IV[0], IV[1], IV[2], IV[3], (uint32_t)counter, (uint32_t)(counter >> 32), blockbytes, flags
+	};
+	for (int round = 0; round < 7; ++round)
+	{
+		const unsigned char* w = SCHEDULE[round];
+		g(s[0], s[4], s[8], s[12], m[w[0]], m[w[1]]);
+		g(s[1], s[5], s[9], s[13], m[w[2]], m[w[3]]);
+		g(s[2], s[6], s[10], s[14], m[w[4]], m[w[5]]);
+		g(s[3], s[7], s[11], s[15], m[w[6]], m[w[7]]);
+		g(s[0], s[5], s[10], s[15], m[w[8]], m[w[9]]);
+		g(s[1], s[6], s[11], s[12], m[w[10]], m[w[11]]);
+		g(s[2], s[7], s[8], s[13], m[w[12]], m[w[13]]);
+		g(s[3], s[4], s[9], s[14], m[w[14]], m[w[15]]);
+	}
+	// out may be cv
+	for (int i = 0; i < 8; ++i)
+	{
+		out[i + 8] = s[i + 8] ^ cv[i];
+		out[i] = s[i] ^ s[i + 8];
+	}
+}
+
+static void storeCv(const uint32_t cv[8], unsigned char block[32])
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		block[4 * i] = (unsigned char)cv[i];
+		block[4 * i + 1] = (unsigned char)(cv[i] >> 8);
+		block[4 * i + 2] = (unsigned char)(cv[i] >> 16);
+		block[4 * i + 3] = (unsigned char)(cv[i] >> 24);
+	}
+}
+
+// A parent node over two children; extraflags is ROOT for the top one
+static void parentCv(const uint32_t left[8], const uint32_t right[8], uint32_t extraflags, uint32_t out[16])
+{
+	unsigned char block[64];
+	storeCv(left, block);
+	storeCv(right, block + 32);
+	compress(IV, block, 0ull, (uint32_t)BLOCK_BYTES, PARENT | extraflags, out);
+}
+
+Blake3Hash::Blake3Hash(unsigned int threads)
+	: threads(threads), stackdepth(0)
+{
+	if (this->threads == 0)
+	{
+		this->threads = std::thread::hardware_concurrency();
+	}
+	if (this->threads == 0)
+	{
+		this->threads = 1;
+	}
+	if (this->threads > MAX_THREADS)
+	{
+		this->threads = MAX_THREADS;
+	}
+	pending.reserve(this->threads * SUBTREE_BYTES);
+	startChunk(chunk, 0ull);
+}
+
+void Blake3Hash::startChunk(ChunkState& chunk, unsigned long long counter)
+{
+	memcpy(chunk.cv, IV, sizeof(chunk.cv));
+	chunk.counter = counter;
+	chunk.blockbytes = 0;
+	chunk.blocks = 0;
+}
+
+// Everything but the last block, which waits for finalisation
+void Blake3Hash::updateChunk(ChunkState& chunk, const unsigned char* data, size_t bytes)
+{
+	while (bytes > 0)
+	{
+		if (chunk.blockbytes == BLOCK_BYTES)
+		{
+			uint32_t out[16];
+			compress(chunk.cv, chunk.block, chunk.counter, (uint32_t)BLOCK_BYTES, (chunk.blocks == 0) ? CHUNK_START : 0u, out);
+			memcpy(chunk.cv, out, sizeof(chunk.cv));
+			chunk.blocks++;
+			chunk.blockbytes = 0;
+		}
+		size_t take = BLOCK_BYTES - chunk.blockbytes;
+		if (take > bytes)
+		{
+			take = bytes;
+		}
+		memcpy(chunk.block + chunk.blockbytes, data, take);
+		chunk.blockbytes += take;
+		data += take;
+		bytes -= take;
+	}
+}
+
+// Hashes four inputs of the same number of blocks side by side: chunks
+// (counter counting up from the first) or parent nodes (one block, counter
+// 0).  out gets the four chaining values, 32 bytes each.
+#ifdef BLAKE3_SSE2
+static inline __m128i rotr128(__m128i x, int r)
+{
+	return _mm_or_si128(_mm_srli_epi32(x, r), _mm_slli_epi32(x, 32 - r));
+}
+
+static inline void g4(__m128i& a, __m128i& b, __m128i& c, __m128i& d, __m128i x, __m128i y)
+{
+	a = _mm_add_epi32(_mm_add_epi32(a, b), x);
+	d = rotr128(_mm_xor_si128(d, a), 16);
+	c = _mm_add_epi32(c, d);
+	b = rotr128(_mm_xor_si128(b, c), 12);
+	a = _mm_add_epi32(_mm_add_epi32(a, b), y);
+	d = rotr128(_mm_xor_si128(d, a), 8);
+	c = _mm_add_epi32(c, d);
+	b = rotr128(_mm_xor_si128(b, c), 7);
+}
+
+// Rows of four words from four inputs become four columns
+static inline void transpose(__m128i& r0, __m128i& r1, __m128i& r2, __m128i& r3)
+{
+	__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+	__m128i t1 = _mm_unpacklo_epi32(r2, r3);
+	__m128i t2 = _mm_unpackhi_epi32(r0, r1);
+	__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+	r0 = _mm_unpacklo_epi64(t0, t1);
+	r1 = _mm_unpackhi_epi64(t0, t1);
+	r2 = _mm_unpacklo_epi64(t2, t3);
+	r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+static void hash4(const unsigned char* const inputs[4], size_t blocks, unsigned long long counter, bool chunks, unsigned char* out)
+{
+	__m128i h[8];
+	for (int i = 0; i < 8; ++i)
+	{
+		h[i] = _mm_set1_epi32((int)IV[i]);
+	}
+	unsigned long long step = chunks ? 1ull : 0ull;
+	const __m128i counterlo = _mm_setr_epi32((int)(uint32_t)counter, (int)(uint32_t)(counter + step),
+		(int)(uint32_t)(counter + 2 * step), (int)(uint32_t)(counter + 3 * step));
+	const __m128i counterhi = _mm_setr_epi32((int)(uint32_t)(counter >> 32), (int)(uint32_t)((counter + step) >> 32),
+		(int)(uint32_t)((counter + 2 * step) >> 32), (int)(uint32_t)((counter + 3 * step) >> 32));
+	for (size_t b = 0; b < blocks; ++b)
+	{
+		uint32_t flags = PARENT;
+		if (chunks)
+		{
+			flags = (b == 0) ? CHUNK_START : 0u;
+			if (b == blocks - 1)
+			{
+				flags |= CHUNK_END;
+			}
+		}
+		__m128i m[16];
+		for (int q = 0; q < 4; ++q)
+		{
+			for (int k = 0; k < 4; ++k)
+			{
+				m[4 * q + k] = _mm_loadu_si128((const __m128i*)(inputs[k] + b * BLOCK_BYTES + 16 * q));
+			}
+			transpose(m[4 * q], m[4 * q + 1], m[4 * q + 2], m[4 * q + 3]);
+		}
+		__m128i v[16] = {
+			h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+			_mm_set1_epi32((int)IV[0]), _mm_set1_epi32((int)IV[1]), _mm_set1_epi32((int)IV[2]), _mm_set1_epi32((int)IV[3]),
+			counterlo, counterhi, _mm_set1_epi32((int)BLOCK_BYTES), _mm_set1_epi32((int)flags)
+		};
+		for (int round = 0; round < 7; ++round)
+		{
+			const unsigned char* w = SCHEDULE[round];
+			g4(v[0], v[4], v[8], v[12], m[w[0]], m[w[1]]);
+			g4(v[1], v[5], v[9], v[13], m[w[2]], m[w[3]]);
+			g4(v[2], v[6], v[10], v[14], m[w[4]], m[w[5]]);
+			g4(v[3], v[7], v[11], v[15], m[w[6]], m[w[7]]);
+			g4(v[0], v[5], v[10], v[15], m[w[8]], m[w[9]]);
+			g4(v[1], v[6], v[11], v[12], m[w[10]], m[w[11]]);
+			g4(v[2], v[7], v[8], v[13], m[w[12]], m[w[13]]);
+			g4(v[3], v[4], v[9], v[14], m[w[14]], m[w[15]]);
+		}
+		for (int i = 0; i < 8; ++i)
+		{
+			h[i] = _mm_xor_si128(v[i], v[i + 8]);
+		}
+	}
+	transpose(h[0], h[1], h[2], h[3]);
+	transpose(h[4], h[5], h[6], h[7]);
+	for (int k = 0; k < 4; ++k)
+	{
+		_mm_storeu_si128((__m128i*)(out + 32 * k), h[k]);
+		_mm_storeu_si128((__m128i*)(out + 32 * k + 16), h[k + 4]);
+	}
+}
+#else
+static void hash4(const unsigned char* const inputs[4], size_t blocks, unsigned long long counter, bool chunks, unsigned char* out)
+{
+	for (int k = 0; k < 4; ++k)
+	{
+		uint32_t state[16];
+		memcpy(state, IV, sizeof(IV));
+		for (size_t b = 0; b < blocks; ++b)
+		{
+			uint32_t flags = PARENT;
+			if (chunks)
+			{
+				flags = (b == 0) ? CHUNK_START : 0u;
+				if (b == blocks - 1)
+				{
+					flags |= CHUNK_END;
+				}
+			}
+			compress(state, inputs[k] + b * BLOCK_BYTES, chunks ? counter + k : 0ull, (uint32_t)BLOCK_BYTES, flags, state);
+		}
+		storeCv(state, out + 32 * k);
+	}
+}
+#endif
+
+// Chaining value of the full subtree of SUBTREE_BYTES at data, whose first
+// chunk is chunk number counter
+void Blake3Hash::subtreeCv(const unsigned char* data, unsigned long long counter, uint32_t cv[8])
+{
+	static const size_t CHUNKS = SUBTREE_BYTES / CHUNK_BYTES;
+	// Chaining values as bytes, so a pair of them is a parent's block
+	std::vector<unsigned char> cvs(CHUNKS * 32);
+	for (size_t i = 0; i < CHUNKS; i += 4)
+	{
+		const unsigned char* inputs[4] = {
+			data + i * CHUNK_BYTES, data + (i + 1) * CHUNK_BYTES, data + (i + 2) * CHUNK_BYTES, data + (i + 3) * CHUNK_BYTES
+		};
+		hash4(inputs, CHUNK_BYTES / BLOCK_BYTES, counter + i, true, &cvs[i * 32]);
+	}
+	size_t nodes = CHUNKS;
+	for (; nodes > 4; nodes /= 2)
+	{
+		for (size_t i = 0; i < nodes / 2; i += 4)
+		{
+			const unsigned char* inputs[4] = { &cvs[2 * i * 32], &cvs[2 * (i + 1) * 32], &cvs[2 * (i + 2) * 32], &cvs[2 * (i + 3) * 32] };
+			unsigned char out[4 * 32];
+			hash4(inputs, 1, 0ull, false, out);
+			memcpy(&cvs[i * 32], out, sizeof(out));
+		}
+	}
+	uint32_t words[4][8];
+	memcpy(words, cvs.data(), sizeof(words));
+	uint32_t left[16];
+	uint32_t right[16];
+	parentCv(words[0], words[1], 0u, left);
+	parentCv(words[2], words[3], 0u, right);
+	parentCv(left, right, 0u, left);
+	memcpy(cv, left, 8 * sizeof(uint32_t));
+}
+
+// Merges with the stack while the node just finished completes a larger
+// one; nodes counts the nodes of its size so far, itself included
+void Blake3Hash::pushCv(const uint32_t cv[8], unsigned long long nodes)
+{
+	uint32_t merged[16];
+	memcpy(merged, cv, 8 * sizeof(uint32_t));
+	while ((nodes & 1ull) == 0ull)
+	{
+		--stackdepth;
+		parentCv(stack[stackdepth], merged, 0u, merged);
+		nodes >>= 1;
+	}
+	memcpy(stack[stackdepth], merged, 8 * sizeof(uint32_t));
+	++stackdepth;
+}
+
+// Whole subtrees, starting at a subtree boundary with nothing pending
+void Blake3Hash::hashSubtrees(const unsigned char* data, size_t subtrees)
+{
+	std::vector<uint32_t> cvs(subtrees * 8);
+	unsigned long long first = chunk.counter;
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < subtrees; ++i)
+	{
+		workers.push_back(std::thread(&Blake3Hash::subtreeCv, data + i * SUBTREE_BYTES,
+			first + i * (SUBTREE_BYTES / CHUNK_BYTES), &cvs[i * 8]));
+	}
+	subtreeCv(data, first, &cvs[0]);
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	for (size_t i = 0; i < subtrees; ++i)
+	{
+		unsigned long long chunks = first + (i + 1) * (SUBTREE_BYTES / CHUNK_BYTES);
+		pushCv(&cvs[i * 8], chunks >> SUBTREE_LEVEL);
+	}
+	startChunk(chunk, first + subtrees * (SUBTREE_BYTES / CHUNK_BYTES));
+}
+
+// One chunk at a time, the way the specification describes it
+void Blake3Hash::addSerial(const unsigned char* data, size_t bytes)
+{
+	while (bytes > 0)
+	{
+		size_t chunkbytes = chunk.blocks * BLOCK_BYTES + chunk.blockbytes;
+		if (chunkbytes == CHUNK_BYTES)
+		{
+			uint32_t out[16];
+			compress(chunk.cv, chunk.block, chunk.counter, (uint32_t)chunk.blockbytes, ((chunk.blocks == 0) ? CHUNK_START : 0u) | CHUNK_END, out);
+			unsigned long long next = chunk.counter + 1;
+			pushCv(out, next);
+			startChunk(chunk, next);
+			chunkbytes = 0;
+		}
+		size_t take = CHUNK_BYTES - chunkbytes;
+		if (take > bytes)
+		{
+			take = bytes;
+		}
+		updateChunk(chunk, data, take);
+		data += take;
+		bytes -= take;
+	}
+}
+
+void Blake3Hash::addData(const char* data, size_t bytes)
+{
+	const unsigned char* input = (const unsigned char*)data;
+	const size_t batch = threads * SUBTREE_BYTES;
+	while (bytes > 0)
+	{
+		// Straight from the caller's buffer when a whole batch is there
+		// and more follows
+		if (pending.empty() && bytes > batch)
+		{
+			hashSubtrees(input, threads);
+			input += batch;
+			bytes -= batch;
+			continue;
+		}
+		if (pending.size() == batch)
+		{
+			hashSubtrees(pending.data(), threads);
+			pending.clear();
+		}
+		size_t take = batch - pending.size();
+		if (take > bytes)
+		{
+			take = bytes;
+		}
+		pending.insert(pending.end(), input, input + take);
+		input += take;
+		bytes -= take;
+	}
+}
+
+void Blake3Hash::result(unsigned char digest[DIGEST_BYTES]) const
+{
+	// On a copy, so more data could still follow
+	Blake3Hash copy(*this);
+	copy.addSerial(pending.data(), pending.size());
+	const ChunkState& last = copy.chunk;
+	uint32_t flags = ((last.blocks == 0) ? CHUNK_START : 0u) | CHUNK_END;
+	uint32_t out[16];
+	if (copy.stackdepth == 0)
+	{
+		unsigned char block[64];
+		memset(block, 0, sizeof(block));
+		memcpy(block, last.block, last.blockbytes);
+		compress(last.cv, block, last.counter, (uint32_t)last.blockbytes, flags | ROOT, out);
+	}
+	else
+	{
+		unsigned char block[64];
+		memset(block, 0, sizeof(block));
+		memcpy(block, last.block, last.blockbytes);
+		compress(last.cv, block, last.counter, (uint32_t)last.blockbytes, flags, out);
+		for (size_t i = copy.stackdepth; i-- > 0;)
+		{
+			parentCv(copy.stack[i], out, (i == 0) ? ROOT : 0u, out);
+		}
+	}
+	storeCv(out, digest);
+}
@@ -0,0 +1,74 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// BLAKE3 (unkeyed, 256-bit output), streaming.  Input is cut into 1 KiB
+// chunks that are hashed independently and combined in a binary tree, so
+// whole subtrees of SUBTREE_BYTES can be hashed on separate threads:
+// addData() collects one subtree per thread and hashes the batch in
+// parallel once it knows more data follows (the last one has to stay
+// back to be finalised as the root).  With one thread everything runs on
+// the caller's.
+class Blake3Hash
+{
+public:
+	static const size_t DIGEST_BYTES = 32;
+	static const size_t CHUNK_BYTES = 1024;
+	static const size_t SUBTREE_BYTES = 1024 * CHUNK_BYTES;
+
+	// threads 0 takes one per core
+	explicit Blake3Hash(unsigned int threads = 0);
+
+	void addData(const char* data, size_t bytes);
+	void result(unsigned char digest[DIGEST_BYTES]) const;
+
+	unsigned int threadCount() const { return threads; }
+
+private:
+	struct ChunkState
+	{
+		uint32_t cv[8];
+		unsigned long long counter;
+		unsigned char block[64];
+		size_t blockbytes;
+		unsigned int blocks;  // compressed so far
+	};
+
+	static void startChunk(ChunkState& chunk, unsigned long long counter);
+	static void updateChunk(ChunkState& chunk, const unsigned char* data, size_t bytes);
+	static void subtreeCv(const unsigned char* data, unsigned long long counter, uint32_t cv[8]);
+
+	void hashSubtrees(const unsigned char* data, size_t subtrees);
+	void addSerial(const unsigned char* data, size_t bytes);
+	void pushCv(const uint32_t cv[8], unsigned long long nodes);
+
+	unsigned int threads;
+	std::vector<unsigned char> pending;  // up to one subtree per thread
+	ChunkState chunk;
+	uint32_t stack[54][8];               // subtree CVs waiting for a sibling
+	size_t stackdepth;
+};
+
+#endif // BLAKE3_H
@@ -0,0 +1,570 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <climits>
+#include <cstring>
+#include <vector>
+#include "blockdevice.h"
+#include "bufferpool.h"
+
+#ifdef _WIN32
+
+#include "disk.h"
+
+// Thin wrapper around the quiet disk.cpp primitives
+class WinBlockDevice : public BlockDevice
+{
+public:
+	WinBlockDevice(HANDLE handle, bool regularfile, bool nobuffering, bool owned = true) : owned(owned)
+	{
+		fd = handle;
+		regular = regularfile;
+		unbuffered = nobuffering;
+	}
+	~WinBlockDevice()
+	{
+		if (owned)
+		{
+			CloseHandle(fd);
+		}
+	}
+
+	bool readGeometry(unsigned long* error);
+	bool lock(unsigned long* error);
+	bool unlock(unsigned long* error);
+	bool flush(unsigned long* error);
+	bool setSize(unsigned long long size, unsigned long* error);
+	bool preallocate(unsigned long long size, unsigned long* error);
+	bool discard(unsigned long long startsector, unsigned long long numsectors, bool* readszero, unsigned long* error);
+	bool readSectors(char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error);
+	bool writeSectors(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error);
+
+private:
+	bool owned;
+};
+
+bool WinBlockDevice::readGeometry(unsigned long* error)
+{
+	if (regular)
+	{
+		LARGE_INTEGER filesize;
+		if (!GetFileSizeEx(fd, &filesize))
+		{
+			*error = GetLastError();
+			return false;
+		}
+		bytes = (unsigned long long)filesize.QuadPart;
+		return true;
+	}
+	DISK_GEOMETRY_EX diskgeometry;
+	DWORD junk;
+	if (!syncDeviceIoControl(fd, IOCTL_DISK_GET_DRIVE_GEOMETRY_EX, NULL, 0, &diskgeometry, sizeof(diskgeometry), &junk))
+	{
+		*error = GetLastError();
+		return false;
+	}
+	if (diskgeometry.Geometry.BytesPerSector == 0)
+	{
+		*error = ERROR_INVALID_DATA;
+		return false;
+	}
+	bytes = (unsigned long long)diskgeometry.DiskSize.QuadPart;
+	sectorsize = (unsigned long long)diskgeometry.Geometry.BytesPerSector;
+	return true;
+}
+
+bool WinBlockDevice::lock(unsigned long* error)
+{
+	DWORD junk;
+	if (!regular && (!syncDeviceIoControl(fd, FSCTL_LOCK_VOLUME, NULL, 0, NULL, 0, &junk) ||
+		!syncDeviceIoControl(fd, FSCTL_DISMOUNT_VOLUME, NULL, 0, NULL, 0, &junk)))
+	{
+		*error = GetLastError();
+		return false;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
+
+bool WinBlockDevice::unlock(unsigned long* error)
+{
+	DWORD junk;
+	if (!regular && !syncDeviceIoControl(fd, FSCTL_UNLOCK_VOLUME, NULL, 0, NULL, 0, &junk))
+	{
+		*error = GetLastError();
+		return false;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
+
+bool WinBlockDevice::flush(unsigned long* error)
+{
+	if (!FlushFileBuffers(fd))
+	{
+		*error = GetLastError();
+		return false;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
+
+bool WinBlockDevice::setSize(unsigned long long size, unsigned long* error)
+{
+	DWORD err;
+	bool result = setFileSize(fd, size, &err);
+	*error = err;
+	if (result)
+	{
+		bytes = size;
+	}
+	return result;
+}
+
+bool WinBlockDevice::preallocate(unsigned long long size, unsigned long* error)
+{
+	DWORD err;
+	bool validdata;
+	bool result = preallocateFile(fd, size, &validdata, &err);
+	*error = err;
+	if (result)
+	{
+		bytes = size;
+	}
+	return result;
+}
+
+bool WinBlockDevice::discard(unsigned long long startsector, unsigned long long numsectors, bool* readszero, unsigned long* error)
+{
+	DWORD err = ERROR_SUCCESS;
+	if (!regular)
+	{
+		bool ok = discardSectors(fd, startsector, numsectors, sectorsize, readszero, &err);
+		*error = err;
+		return ok;
+	}
+	// Deallocated in sparse files, zero-filled in others; reads zero either way
+	FILE_ZERO_DATA_INFORMATION zero;
+	zero.FileOffset.QuadPart = (LONGLONG)(startsector * sectorsize);
+	zero.BeyondFinalZero.QuadPart = (LONGLONG)((startsector + numsectors) * sectorsize);
+	DWORD junk = 0;
+	*readszero = false;
+	if (!syncDeviceIoControl(fd, FSCTL_SET_ZERO_DATA, &zero, sizeof(zero), NULL, 0, &junk))
+	{
+		*error = GetLastError();
+		return false;
+	}
+	*readszero = true;
+	*error = 0;
+	return true;
+}
+
+bool WinBlockDevice::readSectors(char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error)
+{
+	DWORD err;
+	bool result = readSectorsToBuffer(fd, data, startsector, numsectors, sectorsize, &err, unbuffered && regular);
+	*error = err;
+	return result;
+}
+
+bool WinBlockDevice::writeSectors(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error)
+{
+	DWORD err;
+	bool result = writeSectorsFromBuffer(fd, data, startsector, numsectors, sectorsize, &err, unbuffered && regular);
+	*error = err;
+	return result;
+}
+
+BlockDevice* BlockDevice::open(const std::string& path, Access access, bool unbuffered, unsigned long* error)
+{
+	int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0);
+	std::vector<wchar_t> widepath((length > 0) ? length : 1, L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, widepath.data(), length);
+
+	// Same access and sharing as getHandleOnDevice/getHandleOnFile
+	bool regular = (path.compare(0, 4, "\\\\.\\") != 0);
+	DWORD desired = (access == ACCESS_READ) ? GENERIC_READ : GENERIC_WRITE;
+	DWORD share = regular ? ((access == ACCESS_READ) ? FILE_SHARE_READ : 0) : (FILE_SHARE_READ | FILE_SHARE_WRITE);
+	DWORD disposition = (access == ACCESS_CREATE) ? CREATE_ALWAYS : OPEN_EXISTING;
+	DWORD flags = FILE_FLAG_OVERLAPPED | (unbuffered ? (FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH) : 0);
+	HANDLE handle = CreateFileW(widepath.data(), desired, share, NULL, disposition, flags, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		*error = GetLastError();
+		return NULL;
+	}
+
+	WinBlockDevice* device = new WinBlockDevice(handle, regular, unbuffered);
+	if (!device->readGeometry(error))
+	{
+		delete device;
+		return NULL;
+	}
+	*error = ERROR_SUCCESS;
+	return device;
+}
+
+BlockDevice* BlockDevice::attach(IoHandle handle, bool regularfile, bool unbuffered, unsigned long* error)
+{
+	WinBlockDevice* device = new WinBlockDevice(handle, regularfile, unbuffered, false);
+	if (!device->readGeometry(error))
+	{
+		delete device;
+		return NULL;
+	}
+	*error = ERROR_SUCCESS;
+	return device;
+}
+
+#else // POSIX
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#endif
+
+class PosixBlockDevice : public BlockDevice
+{
+public:
+	PosixBlockDevice(int descriptor, bool nobuffering, bool owned = true) : owned(owned)
+	{
+		fd = descriptor;
+		unbuffered = nobuffering;
+	}
+	~PosixBlockDevice()
+	{
+		if (owned)
+		{
+			close(fd);
+		}
+	}
+
+	bool readGeometry(unsigned long* error);
+	bool lock(unsigned long* error);
+	bool unlock(unsigned long* error);
+	bool flush(unsigned long* error);
+	bool setSize(unsigned long long size, unsigned long* error);
+	bool preallocate(unsigned long long size, unsigned long* error);
+	bool discard(unsigned long long startsector, unsigned long long numsectors, bool* readszero, unsigned long* error);
+	bool readSectors(char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error);
+	bool writeSectors(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error);
+
+private:
+	bool checkRange(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error) const;
+	unsigned long long transferSize(unsigned long long length) const;
+
+	bool owned;
+};
+
+bool PosixBlockDevice::readGeometry(unsigned long* error)
+{
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		*error = (unsigned long)errno;
+		return false;
+	}
+	if (S_ISREG(info.st_mode))
+	{
+		regular = true;
+		bytes = (unsigned long long)info.st_size;
+		return true;
+	}
+#ifdef __linux__
+	if (S_ISBLK(info.st_mode))
+	{
+		unsigned long long devicebytes = 0ull;
+		int logicalsector = 0;
+		if (ioctl(fd, BLKGETSIZE64, &devicebytes) != 0 || ioctl(fd, BLKSSZGET, &logicalsector) != 0)
+		{
+			*error = (unsigned long)errno;
+			return false;
+		}
+		bytes = devicebytes;
+		sectorsize = (logicalsector > 0) ? (unsigned long long)logicalsector : 512ull;
+		return true;
+	}
+#endif
+	*error = (unsigned long)ENOTBLK;
+	return false;
+}
+
+bool PosixBlockDevice::lock(unsigned long* error)
+{
+	// Advisory only, but udisks, systemd and other imagers honour it
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		*error = (unsigned long)errno;
+		return false;
+	}
+#ifdef __linux__
+	// Drop cached blocks so reads see the media, not a stale page cache
+	if (!regular && ioctl(fd, BLKFLSBUF, 0) != 0)
+	{
+		*error = (unsigned long)errno;
+		flock(fd, LOCK_UN);
+		return false;
+	}
+#endif
+	*error = 0;
+	return true;
+}
+
+bool PosixBlockDevice::unlock(unsigned long* error)
+{
+	if (flock(fd, LOCK_UN) != 0)
+	{
+		*error = (unsigned long)errno;
+		return false;
+	}
+	*error = 0;
+	return true;
+}
+
+bool PosixBlockDevice::flush(unsigned long* error)
+{
+	if (fsync(fd) != 0)
+	{
+		*error = (unsigned long)errno;
+		return false;
+	}
+	*error = 0;
+	return true;
+}
+
+bool PosixBlockDevice::setSize(unsigned long long size, unsigned long* error)
+{
+	if (ftruncate(fd, (off_t)size) != 0)
+	{
+		*error = (unsigned long)errno;
+		return false;
+	}
+	bytes = size;
+	*error = 0;
+	return true;
+}
+
+bool PosixBlockDevice::preallocate(unsigned long long size, unsigned long* error)
+{
+	// Unwritten extents read as zeros, so nothing stale shows through
+	int result = posix_fallocate(fd, 0, (off_t)size);
+	if (result != 0)
+	{
+		*error = (unsigned long)result;
+		return false;
+	}
+	bytes = size;
+	*error = 0;
+	return true;
+}
+
+bool PosixBlockDevice::discard(unsigned long long startsector, unsigned long long numsectors, bool* readszero, unsigned long* error)
+{
+	*readszero = false;
+	*error = 0;
+#ifdef __linux__
+	unsigned long long range[2] = { startsector * sectorsize, numsectors * sectorsize };
+	// A punched hole reads as zeros; on block devices (4.9+) the kernel
+	// only does it when the device can zero without writing, and fails
+	// otherwise
+	if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)range[0], (off_t)range[1]) == 0)
+	{
+		*readszero = true;
+		return true;
+	}
+	*error = (unsigned long)errno;
+	// A plain discard still saves flash wear, but the blocks may read back
+	// as anything
+	if (!regular && ioctl(fd, BLKDISCARD, range) == 0)
+	{
+		*error = 0;
+		return true;
+	}
+	if (!regular)
+	{
+		*error = (unsigned long)errno;
+	}
+	return false;
+#else
+	(void)startsector;
+	(void)numsectors;
+	*error = (unsigned long)EOPNOTSUPP;
+	return false;
+#endif
+}
+
+bool PosixBlockDevice::checkRange(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error) const
+{
+	if (numsectors == 0 || data == NULL ||
+		startsector > ULLONG_MAX / sectorsize || numsectors > ULLONG_MAX / sectorsize)
+	{
+		*error = (unsigned long)EINVAL;
+		return false;
+	}
+	return true;
+}
+
+unsigned long long PosixBlockDevice::transferSize(unsigned long long length) const
+{
+	// O_DIRECT on a file only takes whole filesystem blocks
+	if (unbuffered && regular)
+	{
+		return (length + BufferPool::ALIGNMENT - 1) / BufferPool::ALIGNMENT * BufferPool::ALIGNMENT;
+	}
+	return length;
+}
+
+bool PosixBlockDevice::readSectors(char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error)
+{
+	if (!checkRange(data, startsector, numsectors, error))
+	{
+		return false;
+	}
+	unsigned long long length = numsectors * sectorsize;
+	unsigned long long iosize = transferSize(length);
+	unsigned long long offset = startsector * sectorsize;
+	unsigned long long total = 0ull;
+	while (total < iosize)
+	{
+		ssize_t n = pread(fd, data + total, (size_t)(iosize - total), (off_t)(offset + total));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			*error = (unsigned long)errno;
+			return false;
+		}
+		if (n == 0)
+		{
+			break;
+		}
+		total += (unsigned long long)n;
+	}
+	if (total < length)
+	{
+		memset(data + total, 0, (size_t)(length - total));
+	}
+	*error = 0;
+	return true;
+}
+
+bool PosixBlockDevice::writeSectors(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error)
+{
+	if (!checkRange(data, startsector, numsectors, error))
+	{
+		return false;
+	}
+	unsigned long long iosize = transferSize(numsectors * sectorsize);
+	unsigned long long offset = startsector * sectorsize;
+	unsigned long long total = 0ull;
+	while (total < iosize)
+	{
+		ssize_t n = pwrite(fd, data + total, (size_t)(iosize - total), (off_t)(offset + total));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			*error = (unsigned long)errno;
+			return false;
+		}
+		if (n == 0)
+		{
+			*error = (unsigned long)EIO;
+			return false;
+		}
+		total += (unsigned long long)n;
+	}
+	if (regular && offset + total > bytes)
+	{
+		bytes = offset + total;
+	}
+	*error = 0;
+	return true;
+}
+
+BlockDevice* BlockDevice::open(const std::string& path, Access access, bool unbuffered, unsigned long* error)
+{
+	int flags = O_CLOEXEC;
+	if (access == ACCESS_READ)
+	{
+		flags |= O_RDONLY;
+	}
+	else
+	{
+		flags |= O_RDWR | ((access == ACCESS_CREATE) ? (O_CREAT | O_TRUNC) : 0);
+	}
+	int fd = -1;
+#ifdef O_DIRECT
+	if (unbuffered)
+	{
+		fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+		// tmpfs and some FUSE filesystems refuse O_DIRECT; use the cache there
+		if (fd < 0 && errno == EINVAL)
+		{
+			unbuffered = false;
+		}
+	}
+#else
+	unbuffered = false;
+#endif
+	if (fd < 0)
+	{
+		fd = ::open(path.c_str(), flags, 0644);
+	}
+	if (fd < 0)
+	{
+		*error = (unsigned long)errno;
+		return NULL;
+	}
+
+	PosixBlockDevice* device = new PosixBlockDevice(fd, unbuffered);
+	if (!device->readGeometry(error))
+	{
+		delete device;
+		return NULL;
+	}
+	*error = 0;
+	return device;
+}
+
+BlockDevice* BlockDevice::attach(IoHandle handle, bool regularfile, bool unbuffered, unsigned long* error)
+{
+	// fstat() tells files from devices here
+	(void)regularfile;
+	PosixBlockDevice* device = new PosixBlockDevice(handle, unbuffered, false);
+	if (!device->readGeometry(error))
+	{
+		delete device;
+		return NULL;
+	}
+	*error = 0;
+	return device;
+}
+
+#endif // _WIN32
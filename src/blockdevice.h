@@ -0,0 +1,87 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef BLOCKDEVICE_H
+#define BLOCKDEVICE_H
+
+#include <string>
+#include "asyncio.h"
+
+// A raw device (or an image file standing in for one) behind the same
+// primitives disk.cpp offers on Windows: open, geometry, exclusive lock and
+// positional sector I/O.  Errors are reported as Win32 codes / errno and
+// never shown to the user, so this can run outside the GUI.
+//
+// Windows opens \\.\PhysicalDriveN or a file with CreateFile (overlapped,
+// so handle() can be given to AsyncIo).  POSIX opens a block device or a
+// regular file; geometry comes from BLKGETSIZE64/BLKSSZGET, exclusivity
+// from flock() plus BLKFLSBUF, and unbuffered access uses O_DIRECT.
+class BlockDevice
+{
+public:
+	enum Access { ACCESS_READ = 0, ACCESS_WRITE, ACCESS_CREATE };
+
+	// path is UTF-8; returns NULL and sets *error when it cannot be opened
+	static BlockDevice* open(const std::string& path, Access access, bool unbuffered, unsigned long* error);
+	// Wraps a handle opened elsewhere (getHandleOnDevice/getHandleOnFile),
+	// which stays open when the BlockDevice is deleted.  regularfile says
+	// whether it is an image file; Windows cannot tell from the handle.
+	static BlockDevice* attach(IoHandle handle, bool regularfile, bool unbuffered, unsigned long* error);
+	virtual ~BlockDevice() {}
+
+	IoHandle handle() const { return fd; }
+	// Regular files have no sector size of their own and report 512
+	bool isRegularFile() const { return regular; }
+	bool isUnbuffered() const { return unbuffered; }
+	unsigned long long size() const { return bytes; }
+	unsigned long long sectorSize() const { return sectorsize; }
+	// Rounded up, like getFileSizeInSectors(), so a partial last sector counts
+	unsigned long long numberOfSectors() const { return (bytes + sectorsize - 1) / sectorsize; }
+
+	// Exclusive access for the duration of a transfer (lock + dismount on
+	// Windows, flock + buffer cache flush on POSIX)
+	virtual bool lock(unsigned long* error) = 0;
+	virtual bool unlock(unsigned long* error) = 0;
+	// Push written data to the media
+	virtual bool flush(unsigned long* error) = 0;
+	// Exact size for regular files, e.g. to cut off the padding of the last chunk
+	virtual bool setSize(unsigned long long size, unsigned long* error) = 0;
+	// Reserve space for a regular file about to be written up to size, so it
+	// is laid out in one go; cut it back with setSize() to what was written
+	virtual bool preallocate(unsigned long long size, unsigned long* error) = 0;
+	// Give a range back to the device (TRIM / discard, a punched hole for
+	// files).  *readszero is set when the range is then guaranteed to read
+	// as zeros, so writing zero chunks into it can be skipped.
+	virtual bool discard(unsigned long long startsector, unsigned long long numsectors, bool* readszero, unsigned long* error) = 0;
+	// Same contract as readSectorsToBuffer/writeSectorsFromBuffer: reads
+	// past the end are zero-filled, unbuffered transfers are padded
+	virtual bool readSectors(char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error) = 0;
+	virtual bool writeSectors(const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long* error) = 0;
+
+protected:
+	BlockDevice() : fd(), regular(false), unbuffered(false), bytes(0ull), sectorsize(512ull) {}
+
+	IoHandle fd;
+	bool regular;
+	bool unbuffered;
+	unsigned long long bytes;
+	unsigned long long sectorsize;
+};
+
+#endif // BLOCKDEVICE_H
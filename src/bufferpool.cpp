@@ -0,0 +1,166 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "bufferpool.h"
+
+char* alignedAlloc(size_t bytes, size_t alignment)
+{
+#ifdef _WIN32
+	return (char*)_aligned_malloc(bytes, alignment);
+#else
+	void* buffer = NULL;
+	if (posix_memalign(&buffer, alignment, bytes) != 0)
+	{
+		return NULL;
+	}
+	return (char*)buffer;
+#endif
+}
+
+void alignedFree(char* buffer)
+{
+#ifdef _WIN32
+	_aligned_free(buffer);
+#else
+	free(buffer);
+#endif
+}
+
+BufferPool::BufferPool(size_t buffersize)
+	: buffersize(buffersize), totalbytes(0ull), peakbytes(0ull), reused(0ull)
+{
+}
+
+BufferPool::~BufferPool()
+{
+	// Anything still borrowed at this point is reclaimed as well
+	for (auto& entry : owned)
+	{
+		alignedFree(entry.first);
+	}
+}
+
+void BufferPool::reserve(size_t bytes)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (bytes <= buffersize)
+	{
+		return;
+	}
+	buffersize = bytes;
+	for (char* buffer : idle)
+	{
+		totalbytes -= owned[buffer];
+		owned.erase(buffer);
+		alignedFree(buffer);
+	}
+	idle.clear();
+}
+
+size_t BufferPool::bufferSize() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return buffersize;
+}
+
+char* BufferPool::acquire()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (!idle.empty())
+	{
+		char* buffer = idle.back();
+		idle.pop_back();
+		++reused;
+		return buffer;
+	}
+	// Round up to a whole number of pages so the tail of a buffer can be
+	// used for an aligned (padded) transfer as well
+	size_t bytes = (buffersize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+	char* buffer = alignedAlloc((bytes == 0) ? ALIGNMENT : bytes, ALIGNMENT);
+	if (buffer == NULL)
+	{
+		return NULL;
+	}
+	owned[buffer] = bytes;
+	totalbytes += bytes;
+	if (totalbytes > peakbytes)
+	{
+		peakbytes = totalbytes;
+	}
+	return buffer;
+}
+
+void BufferPool::release(char* buffer)
+{
+	if (buffer == NULL)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	auto entry = owned.find(buffer);
+	if (entry == owned.end())
+	{
+		return;
+	}
+	// Buffers handed out before the last reserve() are too small to reuse
+	if (entry->second < buffersize)
+	{
+		totalbytes -= entry->second;
+		owned.erase(entry);
+		alignedFree(buffer);
+		return;
+	}
+	idle.push_back(buffer);
+}
+
+void BufferPool::trim()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (char* buffer : idle)
+	{
+		totalbytes -= owned[buffer];
+		owned.erase(buffer);
+		alignedFree(buffer);
+	}
+	idle.clear();
+	buffersize = 0;
+	for (auto& entry : owned)
+	{
+		if (entry.second > buffersize)
+		{
+			buffersize = entry.second;
+		}
+	}
+}
+
+unsigned long long BufferPool::allocationsAvoided() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return reused;
+}
+
+unsigned long long BufferPool::peakBytes() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return peakbytes;
+}
@@ -0,0 +1,71 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Recycled, fixed-size sector buffers.  Every buffer starts on a page
+// boundary (which also satisfies any sector size up to 4K), so the same
+// buffers can later be handed to unbuffered I/O.  Thread safe.
+class BufferPool
+{
+public:
+	static const size_t ALIGNMENT = 4096;
+
+	BufferPool(size_t buffersize = 0);
+	~BufferPool();
+
+	// Make sure every buffer handed out from now on holds at least bytes;
+	// idle buffers that are too small are dropped.
+	void reserve(size_t bytes);
+	size_t bufferSize() const;
+
+	char* acquire();
+	void release(char* buffer);
+	// Frees the idle buffers, and shrinks the buffer size back to what is
+	// still borrowed, so a pool kept between transfers holds no memory
+	void trim();
+
+	// Number of acquire() calls served without going to the allocator
+	unsigned long long allocationsAvoided() const;
+	// Largest amount of memory the pool has held at one time
+	unsigned long long peakBytes() const;
+
+private:
+	BufferPool(const BufferPool&);
+	BufferPool& operator=(const BufferPool&);
+
+	mutable std::mutex lock;
+	size_t buffersize;
+	std::vector<char*> idle;
+	std::unordered_map<char*, size_t> owned;
+	unsigned long long totalbytes;
+	unsigned long long peakbytes;
+	unsigned long long reused;
+};
+
+char* alignedAlloc(size_t bytes, size_t alignment);
+void alignedFree(char* buffer);
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,230 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <sstream>
+#include "chunkcontroller.h"
+
+// Shortest epoch worth judging, and the improvement that counts as one
+static const double EPOCH_SECONDS = 0.25;
+static const double GAIN = 1.05;
+static const double LOSS = 0.85;
+// A request this many times slower than average (and at least
+// STALL_SECONDS) is a stall rather than noise
+static const double STALL_FACTOR = 8.0;
+static const double STALL_SECONDS = 0.5;
+// Requests slower than this make cancel feel stuck
+static const double LATENCY_TARGET = 0.5;
+// Flat epochs in a row before probing upwards again
+static const unsigned int PROBE_AFTER = 4;
+static const unsigned long long MAX_CHUNK_BYTES = 8ull * 1024ull * 1024ull;
+
+ChunkController::ChunkController(unsigned long long sectorsize, unsigned long long chunksectors, unsigned int depth, unsigned int maxdepth, LogFunc log)
+	: sectorsize(sectorsize), depth(depth), initialdepth(depth), maxdepth(maxdepth), logger(log),
+	epochbytes(0ull), epochchunks(0), besttput(0.0), avglatency(0.0), lastgrown(KNOB_CHUNK), grew(false), nextknob(KNOB_CHUNK), holds(0)
+{
+	minchunk = (sectorsize > GRANULE) ? sectorsize : GRANULE;
+	maxchunk = (MAX_CHUNK_BYTES > minchunk) ? MAX_CHUNK_BYTES : minchunk;
+	initialchunk = roundChunk(chunksectors * sectorsize);
+	chunk = initialchunk;
+	if (this->maxdepth < 1)
+	{
+		this->maxdepth = 1;
+	}
+	if (initialdepth < 1)
+	{
+		initialdepth = 1;
+	}
+	if (initialdepth > this->maxdepth)
+	{
+		initialdepth = this->maxdepth;
+	}
+	this->depth = initialdepth;
+}
+
+unsigned long long ChunkController::roundChunk(unsigned long long bytes) const
+{
+	bytes = bytes / minchunk * minchunk;
+	if (bytes < minchunk)
+	{
+		bytes = minchunk;
+	}
+	if (bytes > maxchunk)
+	{
+		bytes = maxchunk;
+	}
+	return bytes;
+}
+
+void ChunkController::log(const std::string& message) const
+{
+	if (logger)
+	{
+		logger("Adaptive transfer: " + message);
+	}
+}
+
+void ChunkController::start()
+{
+	chunk = initialchunk;
+	depth = initialdepth;
+	epochstart = std::chrono::steady_clock::now();
+	epochbytes = 0ull;
+	epochchunks = 0;
+	besttput = 0.0;
+	avglatency = 0.0;
+	grew = false;
+	nextknob = KNOB_CHUNK;
+	holds = 0;
+	std::ostringstream msg;
+	msg << "start at chunk " << chunk / 1024 << " KiB, depth " << depth << " (max " << maxchunk / 1024 << " KiB, " << maxdepth << ")";
+	log(msg.str());
+}
+
+void ChunkController::requestDone(double seconds)
+{
+	if (avglatency > 0.0 && seconds > STALL_SECONDS && seconds > STALL_FACTOR * avglatency)
+	{
+		// Back off at once instead of queueing more work behind it, and
+		// judge the next epoch on its own
+		std::ostringstream msg;
+		msg << "stall, request took " << (int)(seconds * 1000.0) << " ms (average " << (int)(avglatency * 1000.0) << " ms)";
+		shrink(KNOB_CHUNK, msg.str().c_str());
+		shrink(KNOB_DEPTH, msg.str().c_str());
+		besttput = 0.0;
+		resetEpoch();
+	}
+	avglatency = (avglatency > 0.0) ? (0.8 * avglatency + 0.2 * seconds) : seconds;
+}
+
+void ChunkController::chunkDone(unsigned long long bytes)
+{
+	epochbytes += bytes;
+	++epochchunks;
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - epochstart).count();
+	if (elapsed >= EPOCH_SECONDS && epochchunks >= depth)
+	{
+		endEpoch(elapsed);
+	}
+}
+
+void ChunkController::resumed()
+{
+	log("resumed");
+	resetEpoch();
+}
+
+void ChunkController::endEpoch(double seconds)
+{
+	double tput = (double)epochbytes / seconds;
+	std::ostringstream msg;
+	msg << "epoch " << (int)(tput / 1024.0 / 1024.0) << " MB/s at chunk " << chunk / 1024 << " KiB, depth " << depth
+		<< ", latency " << (int)(avglatency * 1000.0) << " ms";
+	log(msg.str());
+
+	if (avglatency > LATENCY_TARGET && chunk > minchunk)
+	{
+		shrink(KNOB_CHUNK, "latency above target");
+		besttput = 0.0;
+	}
+	else if (tput > besttput * GAIN)
+	{
+		besttput = tput;
+		grow();
+	}
+	else if (grew && tput < besttput * LOSS)
+	{
+		shrink(lastgrown, "throughput dropped");
+		besttput = tput;
+	}
+	else if (holds + 1 >= PROBE_AFTER)
+	{
+		// The device may have room now that it did not have before
+		log("probe");
+		grow();
+	}
+	else
+	{
+		if (tput > besttput)
+		{
+			besttput = tput;
+		}
+		grew = false;
+		++holds;
+		log("hold");
+		resetEpoch();
+		return;
+	}
+	holds = 0;
+	resetEpoch();
+}
+
+void ChunkController::resetEpoch()
+{
+	epochstart = std::chrono::steady_clock::now();
+	epochbytes = 0ull;
+	epochchunks = 0;
+}
+
+void ChunkController::grow()
+{
+	// Try the knob whose turn it is, the other one if that is maxed out
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		Knob knob = nextknob;
+		nextknob = (knob == KNOB_CHUNK) ? KNOB_DEPTH : KNOB_CHUNK;
+		std::ostringstream msg;
+		if (knob == KNOB_CHUNK && chunk < maxchunk)
+		{
+			chunk = roundChunk(chunk + initialchunk);
+			msg << "grow chunk to " << chunk / 1024 << " KiB";
+		}
+		else if (knob == KNOB_DEPTH && depth < maxdepth)
+		{
+			++depth;
+			msg << "grow depth to " << depth;
+		}
+		else
+		{
+			continue;
+		}
+		lastgrown = knob;
+		grew = true;
+		log(msg.str());
+		return;
+	}
+	grew = false;
+	log("at maximum chunk size and depth");
+}
+
+void ChunkController::shrink(Knob knob, const char* reason)
+{
+	std::ostringstream msg;
+	if (knob == KNOB_CHUNK)
+	{
+		chunk = roundChunk(chunk / 2);
+		msg << reason << ", shrink chunk to " << chunk / 1024 << " KiB";
+	}
+	else
+	{
+		depth = (depth > 1) ? depth / 2 : 1;
+		msg << reason << ", shrink depth to " << depth;
+	}
+	grew = false;
+	log(msg.str());
+}
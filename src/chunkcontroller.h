@@ -0,0 +1,91 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef CHUNKCONTROLLER_H
+#define CHUNKCONTROLLER_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+// Tunes the chunk size and the number of chunks in flight while a transfer
+// runs.  Throughput is measured over short epochs; while it keeps improving
+// the controller grows one knob additively (alternating chunk size and
+// queue depth), and when it gets worse it halves the knob it last grew.
+// A request that takes far longer than usual (e.g. a throttling SD card)
+// counts as a stall and halves both at once, and chunks that take longer
+// than the latency target are shrunk so cancel stays responsive.
+// Chunk sizes are kept to multiples of GRANULE so unbuffered offsets stay
+// aligned.  Every decision is passed to the log callback.
+class ChunkController
+{
+public:
+	typedef std::function<void(const std::string& message)> LogFunc;
+
+	static const unsigned long long GRANULE = 64ull * 1024ull;
+
+	ChunkController(unsigned long long sectorsize, unsigned long long chunksectors, unsigned int depth, unsigned int maxdepth, LogFunc log = LogFunc());
+
+	// Upper bounds, used to size the buffers and slots of a run
+	unsigned long long maxChunkSectors() const { return maxchunk / sectorsize; }
+	unsigned int maxQueueDepth() const { return maxdepth; }
+	// Current operating point
+	unsigned long long chunkSectors() const { return chunk / sectorsize; }
+	unsigned int queueDepth() const { return depth; }
+
+	// Called by TransferPipeline at the start of a run, for every request
+	// that completes and for every chunk that is fully done
+	void start();
+	void requestDone(double seconds);
+	void chunkDone(unsigned long long bytes);
+	// After a pause; the time spent paused must not count against the epoch
+	void resumed();
+
+private:
+	enum Knob { KNOB_CHUNK = 0, KNOB_DEPTH };
+
+	void endEpoch(double seconds);
+	void resetEpoch();
+	void grow();
+	void shrink(Knob knob, const char* reason);
+	void log(const std::string& message) const;
+	unsigned long long roundChunk(unsigned long long bytes) const;
+
+	unsigned long long sectorsize;
+	unsigned long long chunk;       // bytes
+	unsigned long long initialchunk;
+	unsigned long long minchunk;
+	unsigned long long maxchunk;
+	unsigned int depth;
+	unsigned int initialdepth;
+	unsigned int maxdepth;
+	LogFunc logger;
+
+	std::chrono::steady_clock::time_point epochstart;
+	unsigned long long epochbytes;
+	unsigned int epochchunks;
+	double besttput;                // bytes/s of the best epoch so far
+	double avglatency;              // moving average of request latency, seconds
+	Knob lastgrown;
+	bool grew;
+	Knob nextknob;
+	unsigned int holds;             // flat epochs since the last change
+};
+
+#endif // CHUNKCONTROLLER_H
@@ -0,0 +1,102 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include "cpufeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPUFEATURES_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef CPUFEATURES_X86
+static void cpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, leaf, subleaf);
+	for (int i = 0; i < 4; ++i)
+	{
+		regs[i] = (unsigned int)info[i];
+	}
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif // CPUFEATURES_X86
+
+static CpuFeatures detect()
+{
+	CpuFeatures features = { false, false, false, false, false, false, false };
+#ifdef CPUFEATURES_X86
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxleaf = regs[0];
+	if (maxleaf < 1)
+	{
+		return features;
+	}
+	cpuid(1, 0, regs);
+	features.sse2 = (regs[3] & (1u << 26)) != 0;
+	features.ssse3 = (regs[2] & (1u << 9)) != 0;
+	features.sse41 = (regs[2] & (1u << 19)) != 0;
+	features.sse42 = (regs[2] & (1u << 20)) != 0;
+	features.pclmul = (regs[2] & (1u << 1)) != 0;
+	// AVX and OSXSAVE, and the OS saving the YMM state on context switches
+	bool avx = (regs[2] & (1u << 27)) != 0 && (regs[2] & (1u << 28)) != 0 && (xgetbv0() & 0x6) == 0x6;
+	if (maxleaf >= 7)
+	{
+		cpuid(7, 0, regs);
+		features.avx2 = avx && (regs[1] & (1u << 5)) != 0;
+		features.sha = (regs[1] & (1u << 29)) != 0;
+	}
+#endif
+	return features;
+}
+
+const CpuFeatures& cpuFeatures()
+{
+	static const CpuFeatures features = detect();
+	return features;
+}
+
+CpuFeatures supportedCpuFeatures(const CpuFeatures& wanted)
+{
+	const CpuFeatures& cpu = cpuFeatures();
+	CpuFeatures features = {
+		wanted.sse2 && cpu.sse2, wanted.ssse3 && cpu.ssse3, wanted.sse41 && cpu.sse41, wanted.sse42 && cpu.sse42,
+		wanted.pclmul && cpu.pclmul, wanted.avx2 && cpu.avx2, wanted.sha && cpu.sha
+	};
+	return features;
+}
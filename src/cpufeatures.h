@@ -0,0 +1,42 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef CPUFEATURES_H
+#define CPUFEATURES_H
+
+// Instruction set extensions the kernels in zerodetect, crc32 and sha can
+// use, read once with CPUID.  Everything is false on other architectures,
+// where the portable code is used.
+struct CpuFeatures
+{
+	bool sse2;
+	bool ssse3;
+	bool sse41;
+	bool sse42;
+	bool pclmul;
+	bool avx2;          // also checks that the OS saves the YMM state
+	bool sha;           // SHA-1 and SHA-256 (SHA-NI)
+};
+
+const CpuFeatures& cpuFeatures();
+// The features both in wanted and on this CPU, for tests and benchmarks
+// that pick the kernels again from a smaller set
+CpuFeatures supportedCpuFeatures(const CpuFeatures& wanted);
+
+#endif // CPUFEATURES_H
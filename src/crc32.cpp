@@ -0,0 +1,261 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include "crc32.h"
+#include "cpufeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE42
+#define TARGET_PCLMUL
+#else
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+#endif
+
+typedef uint32_t (*Crc32Func)(uint32_t crc, const char* data, size_t bytes);
+
+// Slicing-by-8: eight 256-entry tables, eight bytes per step
+struct Crc32Tables
+{
+	uint32_t table[8][256];
+
+	explicit Crc32Tables(uint32_t polynomial)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+			{
+				crc = (crc & 1) ? (crc >> 1) ^ polynomial : (crc >> 1);
+			}
+			table[0][i] = crc;
+		}
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			for (int slice = 1; slice < 8; ++slice)
+			{
+				uint32_t prev = table[slice - 1][i];
+				table[slice][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+			}
+		}
+	}
+};
+
+static uint32_t slicingBy8(const Crc32Tables& tables, uint32_t crc, const char* data, size_t bytes)
+{
+	const uint32_t (*t)[256] = tables.table;
+	const unsigned char* p = (const unsigned char*)data;
+	crc = ~crc;
+	while (bytes >= 8)
+	{
+		uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+		uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+		crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+		p += 8;
+		bytes -= 8;
+	}
+	while (bytes-- > 0)
+	{
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+	}
+	return ~crc;
+}
+
+static const Crc32Tables& ieeeTables()
+{
+	static const Crc32Tables tables(0xEDB88320u);
+	return tables;
+}
+
+static const Crc32Tables& castagnoliTables()
+{
+	static const Crc32Tables tables(0x82F63B78u);
+	return tables;
+}
+
+static uint32_t crc32Portable(uint32_t crc, const char* data, size_t bytes)
+{
+	return slicingBy8(ieeeTables(), crc, data, bytes);
+}
+
+static uint32_t crc32cPortable(uint32_t crc, const char* data, size_t bytes)
+{
+	return slicingBy8(castagnoliTables(), crc, data, bytes);
+}
+
+#ifdef CRC32_X86
+// The CRC32 instruction computes CRC-32C only, eight bytes at a time
+TARGET_SSE42 static uint32_t crc32cSse42(uint32_t crc, const char* data, size_t bytes)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	crc = ~crc;
+#if defined(_M_X64) || defined(__x86_64__)
+	uint64_t crc64 = crc;
+	for (; bytes >= 8; p += 8, bytes -= 8)
+	{
+		uint64_t word;
+		memcpy(&word, p, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t)crc64;
+#else
+	for (; bytes >= 4; p += 4, bytes -= 4)
+	{
+		uint32_t word;
+		memcpy(&word, p, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+	}
+#endif
+	for (; bytes > 0; ++p, --bytes)
+	{
+		crc = _mm_crc32_u8(crc, *p);
+	}
+	return ~crc;
+}
+
+// Folding with carry-less multiplication ("Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ", Intel 2009), as in zlib's SIMD crc32: four
+// 128-bit lanes are folded 64 bytes ahead, then into one lane and reduced
+// to 32 bits with Barrett reduction.  crc is the raw (inverted) register;
+// bytes must be at least 64 and a multiple of 16.
+TARGET_PCLMUL static uint32_t foldPclmul(uint32_t crc, const unsigned char* p, size_t bytes)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ll, 0x0154442bd4ll);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009ell, 0x01751997d0ll);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124ll);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641ll, 0x01db710641ll);
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+
+	__m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128((int)crc));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x4 = _mm_loadu_si128((const __m128i*)(p + 48));
+	p += 64;
+	bytes -= 64;
+	for (; bytes >= 64; p += 64, bytes -= 64)
+	{
+		__m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		__m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		__m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		__m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)p));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(p + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(p + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(p + 48)));
+	}
+
+	// Four lanes into one, then the remaining 16-byte blocks
+	__m128i lanes[3] = { x2, x3, x4 };
+	for (int i = 0; i < 3; ++i)
+	{
+		__m128i lo = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), lo), lanes[i]);
+	}
+	for (; bytes >= 16; p += 16, bytes -= 16)
+	{
+		__m128i lo = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), lo), _mm_loadu_si128((const __m128i*)p));
+	}
+
+	// 128 bits to 64
+	__m128i x = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+	x = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x, mask32), k5k0, 0x00), _mm_srli_si128(x, 4));
+
+	// Barrett reduction to 32 bits
+	__m128i t = _mm_clmulepi64_si128(_mm_and_si128(x, mask32), poly, 0x10);
+	t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+	return (uint32_t)_mm_extract_epi32(_mm_xor_si128(x, t), 1);
+}
+
+TARGET_PCLMUL static uint32_t crc32Pclmul(uint32_t crc, const char* data, size_t bytes)
+{
+	if (bytes >= 64)
+	{
+		size_t folded = bytes & ~(size_t)15;
+		crc = ~foldPclmul(~crc, (const unsigned char*)data, folded);
+		data += folded;
+		bytes -= folded;
+	}
+	return slicingBy8(ieeeTables(), crc, data, bytes);
+}
+#endif // CRC32_X86
+
+struct Crc32Kernels
+{
+	Crc32Func crc32;
+	Crc32Func crc32c;
+	const char* name;
+};
+
+static Crc32Kernels selectKernels(const CpuFeatures& cpu)
+{
+	Crc32Kernels kernels = { crc32Portable, crc32cPortable, "slicing-by-8" };
+#ifdef CRC32_X86
+	if (cpu.pclmul && cpu.sse41)
+	{
+		kernels.crc32 = crc32Pclmul;
+		kernels.name = "pclmul";
+	}
+	if (cpu.sse42)
+	{
+		kernels.crc32c = crc32cSse42;
+		kernels.name = (kernels.crc32 == crc32Pclmul) ? "pclmul+sse4.2" : "sse4.2";
+	}
+#else
+	(void)cpu;
+#endif
+	return kernels;
+}
+
+static Crc32Kernels& kernels()
+{
+	static Crc32Kernels selected = selectKernels(cpuFeatures());
+	return selected;
+}
+
+uint32_t crc32Update(uint32_t crc, const char* data, size_t bytes)
+{
+	return kernels().crc32(crc, data, bytes);
+}
+
+uint32_t crc32cUpdate(uint32_t crc, const char* data, size_t bytes)
+{
+	return kernels().crc32c(crc, data, bytes);
+}
+
+const char* crc32Kernel()
+{
+	return kernels().name;
+}
+
+void selectCrc32Kernels(const CpuFeatures& features)
+{
+	kernels() = selectKernels(supportedCpuFeatures(features));
+}
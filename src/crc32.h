@@ -0,0 +1,41 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+#include "cpufeatures.h"
+
+// The zlib/IEEE CRC-32 (polynomial 0xEDB88320, reflected), chained the way
+// zlib's crc32() is: start from 0 and pass the previous result back in.
+uint32_t crc32Update(uint32_t crc, const char* data, size_t bytes);
+// Same for CRC-32C (Castagnoli, polynomial 0x82F63B78, reflected), as used
+// by VHDX and iSCSI
+uint32_t crc32cUpdate(uint32_t crc, const char* data, size_t bytes);
+// Both use slicing-by-8 tables unless the CPU has PCLMULQDQ (CRC-32) or
+// SSE4.2 (CRC-32C); "pclmul+sse4.2", "pclmul", "sse4.2" or "slicing-by-8",
+// for the debug log
+const char* crc32Kernel();
+// Picks the kernels again as if the CPU had only features (and what it
+// really has), for tests and benchmarks; not while anything is hashing
+void selectCrc32Kernels(const CpuFeatures& features);
+
+#endif // CRC32_H
@@ -0,0 +1,205 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <QCryptographicHash>
+#include <QStringList>
+#include "blake3.h"
+#include "crc32.h"
+#include "digestset.h"
+#include "sha.h"
+#include "xxh3.h"
+
+class DigestSet::Digest
+{
+public:
+	virtual ~Digest() {}
+	virtual void addData(const char* data, size_t bytes) = 0;
+	virtual QByteArray result() = 0;
+};
+
+namespace
+{
+
+class QtDigest : public DigestSet::Digest
+{
+public:
+	explicit QtDigest(int algorithm) : hash((QCryptographicHash::Algorithm)algorithm) {}
+	void addData(const char* data, size_t bytes) { hash.addData(data, (int)bytes); }
+	QByteArray result() { return hash.result(); }
+
+private:
+	QCryptographicHash hash;
+};
+
+// Sha1Hash or Sha256Hash, which use the SHA extensions where the CPU has
+// them; same results as QCryptographicHash
+template <class Hash>
+class ShaDigest : public DigestSet::Digest
+{
+public:
+	void addData(const char* data, size_t bytes) { hash.addData(data, bytes); }
+	QByteArray result()
+	{
+		unsigned char digest[Hash::DIGEST_BYTES];
+		hash.result(digest);
+		return QByteArray((const char*)digest, (int)sizeof(digest));
+	}
+
+private:
+	Hash hash;
+};
+
+class Xxh3Digest : public DigestSet::Digest
+{
+public:
+	void addData(const char* data, size_t bytes) { hash.addData(data, bytes); }
+	QByteArray result()
+	{
+		unsigned char digest[Xxh3Hash::DIGEST_BYTES];
+		hash.result(digest);
+		return QByteArray((const char*)digest, (int)sizeof(digest));
+	}
+
+private:
+	Xxh3Hash hash;
+};
+
+class Crc32cDigest : public DigestSet::Digest
+{
+public:
+	Crc32cDigest() : crc(0) {}
+	void addData(const char* data, size_t bytes) { crc = crc32cUpdate(crc, data, bytes); }
+	// Big-endian, the way CRCs are usually written out
+	QByteArray result()
+	{
+		char digest[4] = { (char)(crc >> 24), (char)(crc >> 16), (char)(crc >> 8), (char)crc };
+		return QByteArray(digest, (int)sizeof(digest));
+	}
+
+private:
+	uint32_t crc;
+};
+
+class Blake3Digest : public DigestSet::Digest
+{
+public:
+	void addData(const char* data, size_t bytes) { hash.addData(data, bytes); }
+	QByteArray result()
+	{
+		unsigned char digest[Blake3Hash::DIGEST_BYTES];
+		hash.result(digest);
+		return QByteArray((const char*)digest, (int)sizeof(digest));
+	}
+
+private:
+	Blake3Hash hash;
+};
+
+}
+
+DigestSet::DigestSet(const QList<int>& algorithms)
+	: algorithms(algorithms), parallel(NULL)
+{
+	std::vector<ParallelHash::AddFunc> feeds;
+	for (int algorithm : algorithms)
+	{
+		Digest* digest;
+		switch (algorithm)
+		{
+		case QCryptographicHash::Sha1:
+			digest = new ShaDigest<Sha1Hash>();
+			break;
+		case QCryptographicHash::Sha256:
+			digest = new ShaDigest<Sha256Hash>();
+			break;
+		case ALGORITHM_XXH3_128:
+			digest = new Xxh3Digest();
+			break;
+		case ALGORITHM_CRC32C:
+			digest = new Crc32cDigest();
+			break;
+		case ALGORITHM_BLAKE3:
+			digest = new Blake3Digest();
+			break;
+		default:
+			digest = new QtDigest(algorithm);
+			break;
+		}
+		digests.append(digest);
+		feeds.push_back([digest](const char* data, size_t bytes) { digest->addData(data, bytes); });
+	}
+	if (digests.size() > 1)
+	{
+		parallel = new ParallelHash(feeds);
+	}
+}
+
+DigestSet::~DigestSet()
+{
+	// The threads go first, they use the digests
+	delete parallel;
+	qDeleteAll(digests);
+}
+
+void DigestSet::addData(const char* data, int bytes)
+{
+	if (parallel != NULL)
+	{
+		parallel->addData(data, (size_t)bytes);
+	}
+	else if (!digests.isEmpty())
+	{
+		digests.first()->addData(data, (size_t)bytes);
+	}
+}
+
+QString DigestSet::result()
+{
+	if (digests.size() == 1)
+	{
+		return QString(digests.first()->result().toHex());
+	}
+	QStringList lines;
+	for (int i = 0; i < digests.size(); ++i)
+	{
+		lines.append(QString("%1: %2").arg(algorithmName(algorithms.at(i))).arg(QString(digests.at(i)->result().toHex())));
+	}
+	return lines.join("\n");
+}
+
+QString DigestSet::algorithmName(int algorithm)
+{
+	switch (algorithm)
+	{
+	case QCryptographicHash::Md5:
+		return "MD5";
+	case QCryptographicHash::Sha1:
+		return "SHA1";
+	case QCryptographicHash::Sha256:
+		return "SHA256";
+	case ALGORITHM_XXH3_128:
+		return "XXH3-128";
+	case ALGORITHM_CRC32C:
+		return "CRC32C";
+	case ALGORITHM_BLAKE3:
+		return "BLAKE3";
+	default:
+		return QString::number(algorithm);
+	}
+}
@@ -0,0 +1,58 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef DIGESTSET_H
+#define DIGESTSET_H
+
+#include <QList>
+#include <QString>
+#include "parallelhash.h"
+
+// The digests shown for an image: one algorithm, or several taken in one
+// pass over the data with each on its own core (see ParallelHash), so
+// MD5, SHA1 and SHA256 together cost about as much as SHA256 alone.
+//
+// An algorithm is a QCryptographicHash::Algorithm or one of the fast
+// digests below, which QCryptographicHash does not have: XXH3-128 and
+// CRC32C only guard against corruption, BLAKE3 is cryptographic and
+// hashes on all cores by itself.  SHA1 and SHA256 are computed by
+// Sha1Hash and Sha256Hash (sha.h), which use SHA-NI where there is one.
+class DigestSet
+{
+public:
+	enum Algorithm { ALGORITHM_XXH3_128 = 100, ALGORITHM_CRC32C, ALGORITHM_BLAKE3 };
+	class Digest;  // one algorithm of the set
+
+	explicit DigestSet(const QList<int>& algorithms);
+	~DigestSet();
+
+	// addData(const char*, int) as HashStage wants it
+	void addData(const char* data, int bytes);
+	// The hex digest, or a "NAME: digest" line per algorithm
+	QString result();
+
+	static QString algorithmName(int algorithm);
+
+private:
+	QList<int> algorithms;
+	QList<Digest*> digests;
+	ParallelHash* parallel;  // with more than one algorithm
+};
+
+#endif // DIGESTSET_H
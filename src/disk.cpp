@@ -28,38 +28,54 @@
 #include <windows.h>
 #include <winioctl.h>
 #include "disk.h"
-#include "mainwindow.h"
 
-HANDLE getHandleOnFile(LPCWSTR filelocation, DWORD access)
+static void setDiskError(DiskError* error, DWORD code, const QString& title, const QString& text)
+{
+	// Callers that do not ask for the details still get them in the debug log
+	DebugToFile(QString("%1: %2").arg(title).arg(text));
+	if (error != NULL)
+	{
+		error->code = code;
+		error->title = title;
+		error->text = text;
+	}
+}
+
+HANDLE getHandleOnFile(LPCWSTR filelocation, DWORD access, bool unbuffered, bool overlapped, DiskError* error, FileCache::Policy cache)
 {
 	HANDLE hFile;
-	hFile = CreateFileW(filelocation, access, (access == GENERIC_READ) ? FILE_SHARE_READ : 0, NULL, (access == GENERIC_READ) ? OPEN_EXISTING : CREATE_ALWAYS, 0, NULL);
+	// Unbuffered handles bypass the system cache; transfers on them must use
+	// DIRECT_IO_ALIGNMENT-aligned buffers, offsets and (padded) lengths
+	DWORD flags = unbuffered ? (FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH) : (DWORD)FileCache::createFlags(cache);
+	// Overlapped handles let AsyncIo keep several requests in flight
+	flags |= overlapped ? FILE_FLAG_OVERLAPPED : 0;
+	hFile = CreateFileW(filelocation, access, (access == GENERIC_READ) ? FILE_SHARE_READ : 0, NULL, (access == GENERIC_READ) ? OPEN_EXISTING : CREATE_ALWAYS, flags, NULL);
 	if (hFile == INVALID_HANDLE_VALUE)
 	{
 		wchar_t* errormessage = NULL;
 		::FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0,
 			(LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("File Error"), QObject::tr("An error occurred when attempting to get a handle on the file.\n"
+		setDiskError(error, GetLastError(), QObject::tr("File Error"), QObject::tr("An error occurred when attempting to get a handle on the file.\n"
 			"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
 	}
 	return hFile;
 }
-DWORD getDeviceID(HANDLE hVolume)
+DWORD getDeviceID(HANDLE hVolume, DiskError* error)
 {
 	VOLUME_DISK_EXTENTS sd;
 	DWORD bytesreturned;
 	// Initialize sd to prevent accessing uninitialized data on failure
 	memset(&sd, 0, sizeof(sd));
 
-	if (!DeviceIoControl(hVolume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, NULL, 0, &sd, sizeof(sd), &bytesreturned, NULL))
+	if (!syncDeviceIoControl(hVolume, IOCTL_VOLUME_GET_VOLUME_DISK_EXTENTS, NULL, 0, &sd, sizeof(sd), &bytesreturned))
 	{
 		wchar_t* errormessage = NULL;
 		::FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0,
 			(LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Volume Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Volume Error"),
 			QObject::tr("An error occurred when attempting to get information on volume.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -88,17 +104,20 @@ void DebugToFile(QString txt)
 #endif
 // When DEBUG_LOGGING is not defined, the inline stub from disk.h is used
 
-HANDLE getHandleOnDevice(int device, DWORD access)
+HANDLE getHandleOnDevice(int device, DWORD access, bool unbuffered, bool overlapped, DiskError* error)
 {
 	HANDLE hDevice;
 	QString devicename = QString("\\\\.\\PhysicalDrive%1").arg(device);
-	hDevice = CreateFile(devicename.toLatin1().data(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	// Write-through also makes verify read back the media, not a cached copy
+	DWORD flags = unbuffered ? (FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH) : 0;
+	flags |= overlapped ? FILE_FLAG_OVERLAPPED : 0;
+	hDevice = CreateFile(devicename.toLatin1().data(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL);
 	if (hDevice == INVALID_HANDLE_VALUE)
 	{
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Device Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Device Error"),
 			QObject::tr("An error occurred when attempting to get a handle on the device.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -106,13 +125,13 @@ HANDLE getHandleOnDevice(int device, DWORD access)
 	return hDevice;
 }
 
-HANDLE getHandleOnVolume(int volume, DWORD access)
+HANDLE getHandleOnVolume(int volume, DWORD access, DiskError* error)
 {
 	HANDLE hVolume;
 	// Validate volume is in valid range (A-Z = 0-25)
 	if (volume < 0 || volume > 25)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Volume Error"),
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Volume Error"),
 			QObject::tr("Invalid volume number: %1. Must be between 0 and 25.").arg(volume));
 		return INVALID_HANDLE_VALUE;
 	}
@@ -124,7 +143,7 @@ HANDLE getHandleOnVolume(int volume, DWORD access)
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Volume Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Volume Error"),
 			QObject::tr("An error occurred when attempting to get a handle on the volume.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -132,17 +151,17 @@ HANDLE getHandleOnVolume(int volume, DWORD access)
 	return hVolume;
 }
 
-bool getLockOnVolume(HANDLE handle)
+bool getLockOnVolume(HANDLE handle, DiskError* error)
 {
 	DWORD bytesreturned;
 	BOOL bResult;
-	bResult = DeviceIoControl(handle, FSCTL_LOCK_VOLUME, NULL, 0, NULL, 0, &bytesreturned, NULL);
+	bResult = syncDeviceIoControl(handle, FSCTL_LOCK_VOLUME, NULL, 0, NULL, 0, &bytesreturned);
 	if (!bResult)
 	{
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Lock Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Lock Error"),
 			QObject::tr("An error occurred when attempting to lock the volume.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -150,17 +169,17 @@ bool getLockOnVolume(HANDLE handle)
 	return (bResult);
 }
 
-bool removeLockOnVolume(HANDLE handle)
+bool removeLockOnVolume(HANDLE handle, DiskError* error)
 {
 	DWORD junk;
 	BOOL bResult;
-	bResult = DeviceIoControl(handle, FSCTL_UNLOCK_VOLUME, NULL, 0, NULL, 0, &junk, NULL);
+	bResult = syncDeviceIoControl(handle, FSCTL_UNLOCK_VOLUME, NULL, 0, NULL, 0, &junk);
 	if (!bResult)
 	{
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Unlock Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Unlock Error"),
 			QObject::tr("An error occurred when attempting to unlock the volume.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -168,17 +187,17 @@ bool removeLockOnVolume(HANDLE handle)
 	return (bResult);
 }
 
-bool unmountVolume(HANDLE handle)
+bool unmountVolume(HANDLE handle, DiskError* error)
 {
 	DWORD junk;
 	BOOL bResult;
-	bResult = DeviceIoControl(handle, FSCTL_DISMOUNT_VOLUME, NULL, 0, NULL, 0, &junk, NULL);
+	bResult = syncDeviceIoControl(handle, FSCTL_DISMOUNT_VOLUME, NULL, 0, NULL, 0, &junk);
 	if (!bResult)
 	{
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Dismount Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Dismount Error"),
 			QObject::tr("An error occurred when attempting to dismount the volume.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -190,69 +209,241 @@ bool isVolumeUnmounted(HANDLE handle)
 {
 	DWORD junk;
 	BOOL bResult;
-	bResult = DeviceIoControl(handle, FSCTL_IS_VOLUME_MOUNTED, NULL, 0, NULL, 0, &junk, NULL);
+	bResult = syncDeviceIoControl(handle, FSCTL_IS_VOLUME_MOUNTED, NULL, 0, NULL, 0, &junk);
 	return (!bResult);
 }
 
-char* readSectorDataFromHandle(HANDLE handle, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize)
+QString getErrorText(DWORD error)
 {
-	// Validate parameters to prevent overflow and buffer issues
-	if (sectorsize == 0 || sectorsize > 65536 || numsectors == 0)
+	wchar_t* errormessage = NULL;
+	FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, error, 0, (LPWSTR)&errormessage, 0, NULL);
+	QString errText = QString::fromUtf16((const ushort*)errormessage);
+	LocalFree(errormessage);
+	return errText;
+}
+
+bool syncDeviceIoControl(HANDLE handle, DWORD code, LPVOID in, DWORD insize, LPVOID out, DWORD outsize, LPDWORD returned)
+{
+	// DeviceIoControl without an OVERLAPPED is undefined on overlapped
+	// handles, so always pass one and wait for it
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (overlapped.hEvent == NULL)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Read Error"),
-			QObject::tr("Invalid sector parameters: sectorsize=%1, numsectors=%2").arg(sectorsize).arg(numsectors));
-		return NULL;
+		return false;
 	}
+	BOOL bResult = DeviceIoControl(handle, code, in, insize, out, outsize, returned, &overlapped);
+	if (!bResult && GetLastError() == ERROR_IO_PENDING)
+	{
+		bResult = GetOverlappedResult(handle, &overlapped, returned, TRUE);
+	}
+	// Keep the error code of the request for the caller's message
+	DWORD err = GetLastError();
+	CloseHandle(overlapped.hEvent);
+	SetLastError(err);
+	return (bResult != FALSE);
+}
 
-	// Check for arithmetic overflow in offset calculation
-	if (startsector > ULLONG_MAX / sectorsize)
+static bool transferAt(HANDLE handle, bool write, char* data, DWORD length, unsigned long long offset, DWORD* transferred, DWORD* error)
+{
+	// Positional I/O through an OVERLAPPED offset: works on both synchronous
+	// and overlapped handles and never touches a shared file pointer
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFull);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (overlapped.hEvent == NULL)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Read Error"),
-			QObject::tr("Sector offset overflow: startsector=%1, sectorsize=%2").arg(startsector).arg(sectorsize));
-		return NULL;
+		*error = GetLastError();
+		return false;
+	}
+	*transferred = 0;
+	BOOL bResult = write ? WriteFile(handle, data, length, transferred, &overlapped)
+		: ReadFile(handle, data, length, transferred, &overlapped);
+	if (!bResult && GetLastError() == ERROR_IO_PENDING)
+	{
+		bResult = GetOverlappedResult(handle, &overlapped, transferred, TRUE);
+	}
+	*error = bResult ? ERROR_SUCCESS : GetLastError();
+	CloseHandle(overlapped.hEvent);
+	// Reading at or past the end of a file is a short read, not an error
+	if (!write && *error == ERROR_HANDLE_EOF)
+	{
+		*error = ERROR_SUCCESS;
+		*transferred = 0;
 	}
+	return (*error == ERROR_SUCCESS);
+}
 
-	// Check for overflow in buffer size calculation
-	if (numsectors > ULLONG_MAX / sectorsize)
+unsigned long long alignedTransferSize(unsigned long long bytes)
+{
+	return (bytes + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+}
+
+bool setFileSize(HANDLE handle, unsigned long long bytes, DWORD* error)
+{
+	// Sets the exact size without touching the file pointer, so it is also
+	// used to trim the padding of the last chunk on unbuffered handles
+	FILE_END_OF_FILE_INFO eof;
+	eof.EndOfFile.QuadPart = (LONGLONG)bytes;
+	if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &eof, sizeof(eof)))
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Read Error"),
-			QObject::tr("Buffer size overflow: numsectors=%1, sectorsize=%2").arg(numsectors).arg(sectorsize));
-		return NULL;
+		*error = GetLastError();
+		return false;
 	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
 
-	unsigned long bytesread = 0;  // Initialize to prevent undefined behavior on error
-	unsigned long long bufferSize = sectorsize * numsectors;
-	char* data = new char[bufferSize];
-	LARGE_INTEGER li;
-	li.QuadPart = startsector * sectorsize;
+// Held by administrators but disabled by default; SetFileValidData needs it
+static bool enableManageVolumePrivilege()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	// AdjustTokenPrivileges succeeds with ERROR_NOT_ALL_ASSIGNED when the
+	// privilege is not held at all
+	bool enabled = LookupPrivilegeValueW(NULL, L"SeManageVolumePrivilege", &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled;
+}
 
-	// Use SetFilePointerEx for better large file support and error handling
-	if (!SetFilePointerEx(handle, li, NULL, FILE_BEGIN))
+bool preallocateFile(HANDLE handle, unsigned long long bytes, bool* validdata, DWORD* error)
+{
+	*validdata = false;
+	// Reserving all clusters at once lets NTFS lay the file out in a few
+	// runs instead of extending it (and its metadata) chunk by chunk
+	FILE_ALLOCATION_INFO allocation;
+	allocation.AllocationSize.QuadPart = (LONGLONG)bytes;
+	if (!SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation)))
 	{
-		DWORD err = GetLastError();
-		wchar_t* errormessage = NULL;
-		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, err, 0, (LPWSTR)&errormessage, 0, NULL);
-		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Seek Error"),
-			QObject::tr("An error occurred when attempting to seek in file.\n"
-				"Error %1: %2").arg(err).arg(errText));
-		LocalFree(errormessage);
-		delete[] data;
-		return NULL;
+		*error = GetLastError();
+		return false;
 	}
+	if (!setFileSize(handle, bytes, error))
+	{
+		return false;
+	}
+	// Moving the valid data length to the end as well saves NTFS zeroing
+	// the clusters ahead of each write.  Their old contents are readable
+	// until overwritten, so the caller must cut the file back to the part
+	// it wrote whatever happens.
+	if (enableManageVolumePrivilege() && SetFileValidData(handle, (LONGLONG)bytes))
+	{
+		*validdata = true;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
 
-	if (!ReadFile(handle, data, (DWORD)bufferSize, &bytesread, NULL))
+bool discardSectors(HANDLE handle, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, bool* readszero, DWORD* error)
+{
+	*readszero = false;
+	if (sectorsize == 0 || startsector > ULLONG_MAX / sectorsize || numsectors > ULLONG_MAX / sectorsize)
 	{
-		DWORD err = GetLastError();
-		wchar_t* errormessage = NULL;
-		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, err, 0, (LPWSTR)&errormessage, 0, NULL);
-		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Read Error"),
-			QObject::tr("An error occurred when attempting to read data from handle.\n"
-				"Error %1: %2").arg(err).arg(errText));
-		LocalFree(errormessage);
-		delete[] data;
-		return NULL;
+		*error = ERROR_INVALID_PARAMETER;
+		return false;
+	}
+
+	// Thin provisioning "read zeros" is the only promise that a trimmed
+	// block reads back as zero; without it TRIM only saves wear
+	STORAGE_PROPERTY_QUERY query;
+	memset(&query, 0, sizeof(query));
+	query.PropertyId = StorageDeviceLBProvisioningProperty;
+	query.QueryType = PropertyStandardQuery;
+	DEVICE_LB_PROVISIONING_DESCRIPTOR provisioning;
+	memset(&provisioning, 0, sizeof(provisioning));
+	DWORD junk = 0;
+	if (syncDeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &provisioning, sizeof(provisioning), &junk) &&
+		junk >= FIELD_OFFSET(DEVICE_LB_PROVISIONING_DESCRIPTOR, Reserved1))
+	{
+		*readszero = (provisioning.ThinProvisioningEnabled != 0 && provisioning.ThinProvisioningReadZeros != 0);
+	}
+
+	// One range per request, in pieces small enough for any driver
+	const unsigned long long maxRange = 256ull * 1024ull * 1024ull;
+	struct
+	{
+		DEVICE_MANAGE_DATA_SET_ATTRIBUTES attributes;
+		DEVICE_DATA_SET_RANGE range;
+	} request;
+	unsigned long long offset = startsector * sectorsize;
+	unsigned long long end = offset + numsectors * sectorsize;
+	while (offset < end)
+	{
+		unsigned long long length = (end - offset > maxRange) ? maxRange : (end - offset);
+		memset(&request, 0, sizeof(request));
+		request.attributes.Size = sizeof(request.attributes);
+		request.attributes.Action = DeviceDsmAction_Trim;
+		request.attributes.DataSetRangesOffset = (DWORD)((char*)&request.range - (char*)&request);
+		request.attributes.DataSetRangesLength = sizeof(request.range);
+		request.range.StartingOffset = (LONGLONG)offset;
+		request.range.LengthInBytes = length;
+		if (!syncDeviceIoControl(handle, IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES, &request, sizeof(request), NULL, 0, &junk))
+		{
+			*error = GetLastError();
+			*readszero = false;
+			return false;
+		}
+		offset += length;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
+
+bool setSparseFile(HANDLE handle, DWORD* error)
+{
+	FILE_SET_SPARSE_BUFFER sparse;
+	sparse.SetSparse = TRUE;
+	DWORD junk = 0;
+	if (!syncDeviceIoControl(handle, FSCTL_SET_SPARSE, &sparse, sizeof(sparse), NULL, 0, &junk))
+	{
+		*error = GetLastError();
+		return false;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
+}
+
+unsigned long long getAllocatedFileSize(LPCWSTR filelocation)
+{
+	// Reports the clusters actually in use for sparse and compressed files
+	DWORD high = 0;
+	DWORD low = GetCompressedFileSizeW(filelocation, &high);
+	if (low == INVALID_FILE_SIZE && GetLastError() != NO_ERROR)
+	{
+		return 0ull;
+	}
+	return ((unsigned long long)high << 32) | low;
+}
+
+bool readSectorsToBuffer(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, DWORD* error, bool padded)
+{
+	// Same limits as readSectorDataFromHandle, but reported as an error code
+	// so this can be called from the transfer pipeline's reader thread
+	if (sectorsize == 0 || sectorsize > 65536 || numsectors == 0 || data == NULL ||
+		startsector > ULLONG_MAX / sectorsize || numsectors > ULLONG_MAX / sectorsize)
+	{
+		*error = ERROR_INVALID_PARAMETER;
+		return false;
+	}
+
+	DWORD bytesread = 0;
+	unsigned long long bufferSize = sectorsize * numsectors;
+	// An unbuffered file only accepts whole volume sectors, so the last
+	// partial chunk is requested padded; the read simply stops at EOF
+	unsigned long long ioSize = padded ? alignedTransferSize(bufferSize) : bufferSize;
+	if (!transferAt(handle, false, data, (DWORD)ioSize, startsector * sectorsize, &bytesread, error))
+	{
+		return false;
 	}
 
 	// Zero-fill any remaining bytes if partial read (e.g., end of file)
@@ -262,23 +453,52 @@ char* readSectorDataFromHandle(HANDLE handle, unsigned long long startsector, un
 		size_t remaining = (size_t)(bufferSize - bytesread);
 		memset(data + bytesread, 0, remaining);
 	}
-	return data;
+	*error = ERROR_SUCCESS;
+	return true;
+}
+
+bool writeSectorsFromBuffer(HANDLE handle, const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, DWORD* error, bool padded)
+{
+	if (sectorsize == 0 || sectorsize > 65536 || numsectors == 0 || data == NULL ||
+		startsector > ULLONG_MAX / sectorsize || numsectors > ULLONG_MAX / sectorsize)
+	{
+		*error = ERROR_INVALID_PARAMETER;
+		return false;
+	}
+
+	DWORD byteswritten = 0;
+	unsigned long long bufferSize = sectorsize * numsectors;
+	// Padding written past the real end is cut off again with setFileSize()
+	unsigned long long ioSize = padded ? alignedTransferSize(bufferSize) : bufferSize;
+	if (!transferAt(handle, true, (char*)data, (DWORD)ioSize, startsector * sectorsize, &byteswritten, error))
+	{
+		return false;
+	}
+
+	// A short write without an error code is still a failed write
+	if (byteswritten != ioSize)
+	{
+		*error = ERROR_WRITE_FAULT;
+		return false;
+	}
+	*error = ERROR_SUCCESS;
+	return true;
 }
 
-bool writeSectorDataToHandle(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize)
+bool readSectorDataFromHandle(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, bool padded, DiskError* error)
 {
 	// Validate parameters to prevent overflow and buffer issues
 	if (sectorsize == 0 || sectorsize > 65536 || numsectors == 0 || data == NULL)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Write Error"),
-			QObject::tr("Invalid write parameters: sectorsize=%1, numsectors=%2").arg(sectorsize).arg(numsectors));
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Read Error"),
+			QObject::tr("Invalid sector parameters: sectorsize=%1, numsectors=%2").arg(sectorsize).arg(numsectors));
 		return false;
 	}
 
 	// Check for arithmetic overflow in offset calculation
 	if (startsector > ULLONG_MAX / sectorsize)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Write Error"),
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Read Error"),
 			QObject::tr("Sector offset overflow: startsector=%1, sectorsize=%2").arg(startsector).arg(sectorsize));
 		return false;
 	}
@@ -286,68 +506,71 @@ bool writeSectorDataToHandle(HANDLE handle, char* data, unsigned long long start
 	// Check for overflow in buffer size calculation
 	if (numsectors > ULLONG_MAX / sectorsize)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Write Error"),
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Read Error"),
 			QObject::tr("Buffer size overflow: numsectors=%1, sectorsize=%2").arg(numsectors).arg(sectorsize));
 		return false;
 	}
 
-	unsigned long byteswritten = 0;
-	BOOL bResult;
-	unsigned long long bufferSize = sectorsize * numsectors;
-	LARGE_INTEGER li;
-	li.QuadPart = startsector * sectorsize;
+	DWORD err;
+	if (!readSectorsToBuffer(handle, data, startsector, numsectors, sectorsize, &err, padded))
+	{
+		setDiskError(error, err, QObject::tr("Read Error"),
+			QObject::tr("An error occurred when attempting to read data from handle.\n"
+				"Error %1: %2").arg(err).arg(getErrorText(err)));
+		return false;
+	}
+	return true;
+}
 
-	// Use SetFilePointerEx for better large file support and error handling
-	if (!SetFilePointerEx(handle, li, NULL, FILE_BEGIN))
+bool writeSectorDataToHandle(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, DiskError* error)
+{
+	// Validate parameters to prevent overflow and buffer issues
+	if (sectorsize == 0 || sectorsize > 65536 || numsectors == 0 || data == NULL)
 	{
-		DWORD err = GetLastError();
-		wchar_t* errormessage = NULL;
-		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, err, 0, (LPWSTR)&errormessage, 0, NULL);
-		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Seek Error"),
-			QObject::tr("An error occurred when attempting to seek in file.\n"
-				"Error %1: %2").arg(err).arg(errText));
-		LocalFree(errormessage);
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Write Error"),
+			QObject::tr("Invalid write parameters: sectorsize=%1, numsectors=%2").arg(sectorsize).arg(numsectors));
 		return false;
 	}
 
-	bResult = WriteFile(handle, data, (DWORD)bufferSize, &byteswritten, NULL);
-	if (!bResult)
+	// Check for arithmetic overflow in offset calculation
+	if (startsector > ULLONG_MAX / sectorsize)
 	{
-		DWORD err = GetLastError();
-		wchar_t* errormessage = NULL;
-		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, err, 0, (LPWSTR)&errormessage, 0, NULL);
-		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Write Error"),
-			QObject::tr("An error occurred when attempting to write data to handle.\n"
-				"Error %1: %2").arg(err).arg(errText));
-		LocalFree(errormessage);
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Write Error"),
+			QObject::tr("Sector offset overflow: startsector=%1, sectorsize=%2").arg(startsector).arg(sectorsize));
 		return false;
 	}
 
-	// Verify all bytes were written
-	if (byteswritten != bufferSize)
+	// Check for overflow in buffer size calculation
+	if (numsectors > ULLONG_MAX / sectorsize)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Write Error"),
-			QObject::tr("Incomplete write: expected %1 bytes, wrote %2 bytes").arg(bufferSize).arg(byteswritten));
+		setDiskError(error, ERROR_INVALID_PARAMETER, QObject::tr("Write Error"),
+			QObject::tr("Buffer size overflow: numsectors=%1, sectorsize=%2").arg(numsectors).arg(sectorsize));
 		return false;
 	}
 
+	DWORD err;
+	if (!writeSectorsFromBuffer(handle, data, startsector, numsectors, sectorsize, &err))
+	{
+		setDiskError(error, err, QObject::tr("Write Error"),
+			QObject::tr("An error occurred when attempting to write data to handle.\n"
+				"Error %1: %2").arg(err).arg(getErrorText(err)));
+		return false;
+	}
 	return true;
 }
 
-unsigned long long getNumberOfSectors(HANDLE handle, unsigned long long* sectorsize)
+unsigned long long getNumberOfSectors(HANDLE handle, unsigned long long* sectorsize, DiskError* error)
 {
 	DWORD junk;
 	DISK_GEOMETRY_EX diskgeometry;
 	BOOL bResult;
-	bResult = DeviceIoControl(handle, IOCTL_DISK_GET_DRIVE_GEOMETRY_EX, NULL, 0, &diskgeometry, sizeof(diskgeometry), &junk, NULL);
+	bResult = syncDeviceIoControl(handle, IOCTL_DISK_GET_DRIVE_GEOMETRY_EX, NULL, 0, &diskgeometry, sizeof(diskgeometry), &junk);
 	if (!bResult)
 	{
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Device Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Device Error"),
 			QObject::tr("An error occurred when attempting to get the device's geometry.\n"
 				"Error %1: %2").arg(GetLastError()).arg(errText));
 		LocalFree(errormessage);
@@ -360,14 +583,14 @@ unsigned long long getNumberOfSectors(HANDLE handle, unsigned long long* sectors
 	// Prevent division by zero
 	if (diskgeometry.Geometry.BytesPerSector == 0)
 	{
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Device Error"),
+		setDiskError(error, ERROR_INVALID_DATA, QObject::tr("Device Error"),
 			QObject::tr("Invalid sector size (0) returned from device."));
 		return 0;
 	}
 	return (unsigned long long)diskgeometry.DiskSize.QuadPart / (unsigned long long)diskgeometry.Geometry.BytesPerSector;
 }
 
-unsigned long long getFileSizeInSectors(HANDLE handle, unsigned long long sectorsize)
+unsigned long long getFileSizeInSectors(HANDLE handle, unsigned long long sectorsize, DiskError* error)
 {
 	unsigned long long retVal = 0;
 	if (sectorsize) // avoid divide by 0
@@ -379,7 +602,7 @@ unsigned long long getFileSizeInSectors(HANDLE handle, unsigned long long sector
 			wchar_t* errormessage = NULL;
 			FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 			QString errText = QString::fromUtf16((const ushort*)errormessage);
-			QMessageBox::critical(MainWindow::getInstance(), QObject::tr("File Error"),
+			setDiskError(error, GetLastError(), QObject::tr("File Error"),
 				QObject::tr("An error occurred while getting the file size.\n"
 					"Error %1: %2").arg(GetLastError()).arg(errText));
 			LocalFree(errormessage);
@@ -393,7 +616,7 @@ unsigned long long getFileSizeInSectors(HANDLE handle, unsigned long long sector
 	return(retVal);
 }
 
-bool spaceAvailable(char* location, unsigned long long spaceneeded)
+bool spaceAvailable(char* location, unsigned long long spaceneeded, DiskError* error)
 {
 	ULARGE_INTEGER freespace;
 	BOOL bResult;
@@ -403,7 +626,7 @@ bool spaceAvailable(char* location, unsigned long long spaceneeded)
 		wchar_t* errormessage = NULL;
 		FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 		QString errText = QString::fromUtf16((const ushort*)errormessage);
-		QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Free Space Error"),
+		setDiskError(error, GetLastError(), QObject::tr("Free Space Error"),
 			QObject::tr("Failed to get the free space on drive %1.\n"
 				"Error %2: %3\n"
 				"Operation cannot continue without verifying free space.").arg(location).arg(GetLastError()).arg(errText));
@@ -444,7 +667,7 @@ QString getDriveLabel(const char* drv)
 }
 
 BOOL GetDisksProperty(HANDLE hDevice, PSTORAGE_DEVICE_DESCRIPTOR pDevDesc,
-	DEVICE_NUMBER* devInfo)
+	DEVICE_NUMBER* devInfo, DiskError* error)
 {
 	STORAGE_PROPERTY_QUERY Query = {0}; // Zero-initialize to avoid garbage in AdditionalParameters
 	DWORD dwOutBytes; // IOCTL output length
@@ -481,7 +704,7 @@ BOOL GetDisksProperty(HANDLE hDevice, PSTORAGE_DEVICE_DESCRIPTOR pDevDesc,
 			wchar_t* errormessage = NULL;
 			FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, devNumError, 0, (LPWSTR)&errormessage, 0, NULL);
 			QString errText = QString::fromUtf16((const ushort*)errormessage);
-			QMessageBox::critical(MainWindow::getInstance(), QObject::tr("File Error"),
+			setDiskError(error, devNumError, QObject::tr("File Error"),
 				QObject::tr("An error occurred while getting the device number.\n"
 					"This usually means something is currently accessing the device;"
 					"please close all applications and try again.\n\nError %1: %2").arg(devNumError).arg(errText));
@@ -503,12 +726,11 @@ BOOL GetDisksProperty(HANDLE hDevice, PSTORAGE_DEVICE_DESCRIPTOR pDevDesc,
 		}
 		else
 		{
-			DebugToFile(QString("  UNEXPECTED error, showing dialog"));
-			// Only show error dialog for truly unexpected failures
+			// Only truly unexpected failures are reported to the caller
 			wchar_t* errormessage = NULL;
 			FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, queryError, 0, (LPWSTR)&errormessage, 0, NULL);
 			QString errText = QString::fromUtf16((const ushort*)errormessage);
-			QMessageBox::critical(MainWindow::getInstance(), QObject::tr("File Error"),
+			setDiskError(error, queryError, QObject::tr("File Error"),
 				QObject::tr("An error occurred while querying the properties.\n"
 					"This usually means something is currently accessing the device;"
 					" please close all applications and try again.\n\nError %1: %2").arg(queryError).arg(errText));
@@ -607,7 +829,7 @@ bool GetMediaType(HANDLE hDevice)
 	return false;
 }
 
-bool checkDriveType(char* name, ULONG* pid)
+bool checkDriveType(char* name, ULONG* pid, DiskError* error)
 {
 	HANDLE hDevice;
 	PSTORAGE_DEVICE_DESCRIPTOR pDevDesc;
@@ -642,7 +864,7 @@ bool checkDriveType(char* name, ULONG* pid)
 			wchar_t* errormessage = NULL;
 			FormatMessageW(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_ALLOCATE_BUFFER, NULL, GetLastError(), 0, (LPWSTR)&errormessage, 0, NULL);
 			QString errText = QString::fromUtf16((const ushort*)errormessage);
-			QMessageBox::critical(MainWindow::getInstance(), QObject::tr("Volume Error"),
+			setDiskError(error, GetLastError(), QObject::tr("Volume Error"),
 				QObject::tr("An error occurred when attempting to get a handle on %3.\n"
 					"Error %1: %2").arg(GetLastError()).arg(errText).arg(nameWithSlash));
 			LocalFree(errormessage);
@@ -661,7 +883,7 @@ bool checkDriveType(char* name, ULONG* pid)
 
 			bool propsOk = false;
 			if (mediaOk) {
-				propsOk = GetDisksProperty(hDevice, pDevDesc, &deviceInfo);
+				propsOk = GetDisksProperty(hDevice, pDevDesc, &deviceInfo, error);
 				DebugToFile(QString("  GetDisksProperty=%1, BusType=%2 (USB=7,SATA=11,SD=12,MMC=13), DevNum=%3")
 					.arg(propsOk).arg(pDevDesc->BusType).arg(deviceInfo.DeviceNumber));
 			}
@@ -30,6 +30,7 @@
 #include <cstdlib>
 #include <windows.h>
 #include <winioctl.h>
+#include "filecache.h"
 #ifndef FSCTL_IS_VOLUME_MOUNTED
 #define FSCTL_IS_VOLUME_MOUNTED  CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 10, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #endif // FSCTL_IS_VOLUME_MOUNTED
@@ -44,21 +45,61 @@ typedef struct _DEVICE_NUMBER
 // IOCTL control code
 #define IOCTL_STORAGE_QUERY_PROPERTY   CTL_CODE(IOCTL_STORAGE_BASE, 0x0500, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
-HANDLE getHandleOnFile(LPCWSTR filelocation, DWORD access);
-HANDLE getHandleOnDevice(int device, DWORD access);
-HANDLE getHandleOnVolume(int volume, DWORD access);
+// Transfer granularity for handles opened unbuffered (FILE_FLAG_NO_BUFFERING):
+// a page covers 512e and 4Kn volume sectors, and matches BufferPool::ALIGNMENT
+#define DIRECT_IO_ALIGNMENT 4096ull
+
+// What went wrong in a disk.cpp call.  disk.cpp never shows dialogs (it is
+// also used off the GUI thread); the caller decides how to present this.
+// Calls made without a DiskError only log the failure.
+struct DiskError
+{
+	DWORD code;
+	QString title;
+	QString text;
+
+	DiskError() : code(ERROR_SUCCESS) {}
+};
+
+// cache only matters for buffered handles
+HANDLE getHandleOnFile(LPCWSTR filelocation, DWORD access, bool unbuffered = false, bool overlapped = false, DiskError* error = NULL,
+	FileCache::Policy cache = FileCache::POLICY_NORMAL);
+HANDLE getHandleOnDevice(int device, DWORD access, bool unbuffered = false, bool overlapped = false, DiskError* error = NULL);
+HANDLE getHandleOnVolume(int volume, DWORD access, DiskError* error = NULL);
 QString getDriveLabel(const char* drv);
-DWORD getDeviceID(HANDLE handle);
-bool getLockOnVolume(HANDLE handle);
-bool removeLockOnVolume(HANDLE handle);
-bool unmountVolume(HANDLE handle);
+DWORD getDeviceID(HANDLE handle, DiskError* error = NULL);
+bool getLockOnVolume(HANDLE handle, DiskError* error = NULL);
+bool removeLockOnVolume(HANDLE handle, DiskError* error = NULL);
+bool unmountVolume(HANDLE handle, DiskError* error = NULL);
 bool isVolumeUnmounted(HANDLE handle);
-char* readSectorDataFromHandle(HANDLE handle, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize);
-bool writeSectorDataToHandle(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize);
-unsigned long long getNumberOfSectors(HANDLE handle, unsigned long long* sectorsize);
-unsigned long long getFileSizeInSectors(HANDLE handle, unsigned long long sectorsize);
-bool spaceAvailable(char* location, unsigned long long spaceneeded);
-bool checkDriveType(char* name, ULONG* pid);
+QString getErrorText(DWORD error);
+// DeviceIoControl that waits for completion, safe on overlapped handles
+bool syncDeviceIoControl(HANDLE handle, DWORD code, LPVOID in, DWORD insize, LPVOID out, DWORD outsize, LPDWORD returned);
+// Non-interactive sector I/O: reports the Win32 error code instead of showing a dialog
+// (padded = round the length up to DIRECT_IO_ALIGNMENT for unbuffered files;
+// the buffer must have room for the padding)
+bool readSectorsToBuffer(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, DWORD* error, bool padded = false);
+bool writeSectorsFromBuffer(HANDLE handle, const char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, DWORD* error, bool padded = false);
+unsigned long long alignedTransferSize(unsigned long long bytes);
+bool setFileSize(HANDLE handle, unsigned long long bytes, DWORD* error);
+// Reserve bytes for a file about to be written and set its size to match;
+// validdata tells whether the valid data length could be moved too (needs
+// SeManageVolumePrivilege), in which case stale clusters show until written
+bool preallocateFile(HANDLE handle, unsigned long long bytes, bool* validdata, DWORD* error);
+// TRIM a range of a device (the volume must be locked); readszero tells
+// whether the device promises that trimmed blocks read back as zero
+bool discardSectors(HANDLE handle, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, bool* readszero, DWORD* error);
+// Mark a file sparse (NTFS, ReFS); ranges that are never written then
+// read as zeros without taking space
+bool setSparseFile(HANDLE handle, DWORD* error);
+// Space the file takes on disk, below its size for sparse files
+unsigned long long getAllocatedFileSize(LPCWSTR filelocation);
+bool readSectorDataFromHandle(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, bool padded = false, DiskError* error = NULL);
+bool writeSectorDataToHandle(HANDLE handle, char* data, unsigned long long startsector, unsigned long long numsectors, unsigned long long sectorsize, DiskError* error = NULL);
+unsigned long long getNumberOfSectors(HANDLE handle, unsigned long long* sectorsize, DiskError* error = NULL);
+unsigned long long getFileSizeInSectors(HANDLE handle, unsigned long long sectorsize, DiskError* error = NULL);
+bool spaceAvailable(char* location, unsigned long long spaceneeded, DiskError* error = NULL);
+bool checkDriveType(char* name, ULONG* pid, DiskError* error = NULL);
 QList<QPair<DWORD, qulonglong>> enumeratePhysicalDrives();  // Get all removable/USB physical drives
 
 // Debug logging (enabled via DEBUG_LOGGING define)
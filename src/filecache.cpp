@@ -0,0 +1,87 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include "filecache.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+unsigned long FileCache::createFlags(Policy policy)
+{
+#ifdef _WIN32
+	return (policy != POLICY_NORMAL) ? FILE_FLAG_SEQUENTIAL_SCAN : 0;
+#else
+	(void)policy;
+	return 0;
+#endif
+}
+
+const char* FileCache::policyName(Policy policy)
+{
+	switch (policy)
+	{
+	case POLICY_SEQUENTIAL:
+		return "sequential";
+	case POLICY_DROP_BEHIND:
+		return "drop-behind";
+	default:
+		return "normal";
+	}
+}
+
+FileCache::FileCache(IoHandle handle, Policy policy, bool writing)
+	: handle(handle), policy(policy), writing(writing), dropped(0ull)
+{
+#ifndef _WIN32
+	// Doubles the read-ahead window on Linux
+	if (policy != POLICY_NORMAL)
+	{
+		posix_fadvise(handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
+}
+
+void FileCache::consumed(unsigned long long offset)
+{
+	if (policy != POLICY_DROP_BEHIND || offset < dropped + DROP_INTERVAL)
+	{
+		return;
+	}
+#ifdef _WIN32
+	if (writing)
+	{
+		FlushFileBuffers(handle);
+	}
+#else
+	// Dirty pages cannot be dropped; write the range out and wait for it
+	if (writing)
+	{
+#ifdef __linux__
+		sync_file_range(handle, (off_t)dropped, (off_t)(offset - dropped),
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+		fdatasync(handle);
+#endif
+	}
+	posix_fadvise(handle, (off_t)dropped, (off_t)(offset - dropped), POSIX_FADV_DONTNEED);
+#endif
+	dropped = offset;
+}
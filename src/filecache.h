@@ -0,0 +1,63 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include "asyncio.h"
+
+// How an image file streamed through once uses the OS file cache, so a
+// long transfer does not push everything else out of memory.
+//
+// POLICY_SEQUENTIAL asks for aggressive read-ahead and early reuse of the
+// pages read (FILE_FLAG_SEQUENTIAL_SCAN / POSIX_FADV_SEQUENTIAL).
+// POLICY_DROP_BEHIND also gives the range behind the transfer back every
+// DROP_INTERVAL: written data is flushed first, then the pages are dropped
+// (POSIX_FADV_DONTNEED).  Windows has no call to drop a range, so there
+// only the writes are flushed, which keeps dirty pages bounded; clean
+// sequential-scan pages already go to the low end of the standby list.
+// Unbuffered handles bypass the cache and need none of this.
+class FileCache
+{
+public:
+	enum Policy { POLICY_NORMAL = 0, POLICY_SEQUENTIAL, POLICY_DROP_BEHIND };
+
+	static const unsigned long long DROP_INTERVAL = 64ull * 1024ull * 1024ull;
+
+	// Extra CreateFile flags for policy (Windows; 0 elsewhere)
+	static unsigned long createFlags(Policy policy);
+	static const char* policyName(Policy policy);
+
+	// Hints the kernel about handle (POSIX); writing tells whether the
+	// transfer writes the file, so consumed ranges are flushed first
+	FileCache(IoHandle handle, Policy policy, bool writing);
+
+	// Everything before offset is done with and will not be touched again
+	void consumed(unsigned long long offset);
+	// Bytes given back so far
+	unsigned long long droppedBytes() const { return dropped; }
+
+private:
+	IoHandle handle;
+	Policy policy;
+	bool writing;
+	unsigned long long dropped;
+};
+
+#endif // FILECACHE_H
@@ -0,0 +1,154 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <QDir>
+#include <QFileInfo>
+#include <windows.h>
+#include "hashcache.h"
+
+bool HashCache::identify(const QString& path, FileId* id)
+{
+	// No access rights needed for the attributes, and nobody is kept
+	// from writing or deleting the file meanwhile
+	QString absolute = QDir::toNativeSeparators(QFileInfo(path).absoluteFilePath());
+	HANDLE handle = CreateFileW(LPCWSTR(absolute.utf16()), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION info;
+	BOOL ok = GetFileInformationByHandle(handle, &info);
+	CloseHandle(handle);
+	if (!ok)
+	{
+		return false;
+	}
+	id->path = absolute;
+	id->size = ((quint64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	id->mtime = ((quint64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	id->volume = info.dwVolumeSerialNumber;
+	id->index = ((quint64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	return true;
+}
+
+void HashCache::load(QSettings& settings)
+{
+	entries.clear();
+	int count = settings.beginReadArray("HashCache");
+	for (int i = 0; i < count && entries.size() < MAX_ENTRIES; ++i)
+	{
+		settings.setArrayIndex(i);
+		Entry entry;
+		entry.id.path = settings.value("Path").toString();
+		entry.id.size = settings.value("Size").toULongLong();
+		entry.id.mtime = settings.value("Modified").toULongLong();
+		entry.id.volume = settings.value("Volume").toUInt();
+		entry.id.index = settings.value("FileId").toULongLong();
+		entry.algorithm = settings.value("Algorithm").toInt();
+		entry.digest = settings.value("Digest").toString();
+		entry.used = settings.value("Used").toULongLong();
+		if (!entry.id.path.isEmpty() && !entry.digest.isEmpty())
+		{
+			entries.append(entry);
+		}
+		if (entry.used > clock)
+		{
+			clock = entry.used;
+		}
+	}
+	settings.endArray();
+}
+
+void HashCache::save(QSettings& settings) const
+{
+	// Rewritten whole, so no stale array elements are left behind
+	settings.remove("HashCache");
+	settings.beginWriteArray("HashCache", entries.size());
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		const Entry& entry = entries.at(i);
+		settings.setArrayIndex(i);
+		settings.setValue("Path", entry.id.path);
+		settings.setValue("Size", entry.id.size);
+		settings.setValue("Modified", entry.id.mtime);
+		settings.setValue("Volume", entry.id.volume);
+		settings.setValue("FileId", entry.id.index);
+		settings.setValue("Algorithm", entry.algorithm);
+		settings.setValue("Digest", entry.digest);
+		settings.setValue("Used", entry.used);
+	}
+	settings.endArray();
+}
+
+bool HashCache::lookup(const FileId& id, int algorithm, QString* digest)
+{
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		Entry& entry = entries[i];
+		if (!samePath(entry.id.path, id.path))
+		{
+			continue;
+		}
+		if (entry.id.size != id.size || entry.id.mtime != id.mtime ||
+			entry.id.volume != id.volume || entry.id.index != id.index)
+		{
+			// The file changed since: nothing cached for it holds any more
+			entries.removeAt(i--);
+			continue;
+		}
+		if (entry.algorithm == algorithm)
+		{
+			entry.used = ++clock;
+			*digest = entry.digest;
+			return true;
+		}
+	}
+	return false;
+}
+
+void HashCache::insert(const FileId& id, int algorithm, const QString& digest)
+{
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		if (samePath(entries.at(i).id.path, id.path) && entries.at(i).algorithm == algorithm)
+		{
+			entries.removeAt(i--);
+		}
+	}
+	Entry entry = { id, algorithm, digest, ++clock };
+	entries.append(entry);
+	while (entries.size() > MAX_ENTRIES)
+	{
+		int oldest = 0;
+		for (int i = 1; i < entries.size(); ++i)
+		{
+			if (entries.at(i).used < entries.at(oldest).used)
+			{
+				oldest = i;
+			}
+		}
+		entries.removeAt(oldest);
+	}
+}
+
+bool HashCache::samePath(const QString& a, const QString& b)
+{
+	return a.compare(b, Qt::CaseInsensitive) == 0;
+}
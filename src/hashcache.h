@@ -0,0 +1,76 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef HASHCACHE_H
+#define HASHCACHE_H
+
+#ifndef WINVER
+#define WINVER 0x0601
+#endif
+
+#include <QList>
+#include <QSettings>
+#include <QString>
+
+// Digests of image files already hashed, kept across runs in the
+// application's settings.  An entry is tied to the file's path, size,
+// last write time, volume serial number and file ID, so it goes stale
+// (and is dropped on the next lookup) as soon as the file is rewritten,
+// replaced or moved to another volume.  The least recently used entries
+// are evicted beyond MAX_ENTRIES.
+class HashCache
+{
+public:
+	static const int MAX_ENTRIES = 64;
+
+	struct FileId
+	{
+		QString path;
+		quint64 size;
+		quint64 mtime;   // FILETIME of the last write
+		quint32 volume;  // volume serial number
+		quint64 index;   // file ID on that volume
+	};
+
+	// False when the file cannot be opened for its attributes
+	static bool identify(const QString& path, FileId* id);
+
+	void load(QSettings& settings);
+	void save(QSettings& settings) const;
+
+	// algorithm is the cboxHashType data the digest was made with
+	bool lookup(const FileId& id, int algorithm, QString* digest);
+	void insert(const FileId& id, int algorithm, const QString& digest);
+
+private:
+	struct Entry
+	{
+		FileId id;
+		int algorithm;
+		QString digest;
+		quint64 used;  // lookups and inserts happen in this order
+	};
+
+	static bool samePath(const QString& a, const QString& b);
+
+	QList<Entry> entries;
+	quint64 clock = 0;
+};
+
+#endif // HASHCACHE_H
@@ -40,6 +40,19 @@
 #include "mainwindow.h"
 #include "elapsedtimer.h"
 #include "driveList.h"
+#include "blockdevice.h"
+#include "bufferpool.h"
+#include "chunkcontroller.h"
+#include "crc32.h"
+#include "digestset.h"
+#include "mappedfile.h"
+#include "sha.h"
+#include "sparseimage.h"
+#include "transferpipeline.h"
+#include "transferstages.h"
+#include "transferworker.h"
+#include "virtualdisk.h"
+#include "zerodetect.h"
 
 TestModel::TestModel(QObject* parent) : QAbstractTableModel(parent)
 {
@@ -47,6 +60,42 @@ TestModel::TestModel(QObject* parent) : QAbstractTableModel(parent)
 
 MainWindow* MainWindow::instance = NULL;
 
+// cboxHashType entry that takes MD5, SHA1 and SHA256 in one pass
+static const int ALL_HASHES = -1;
+
+// "Generate" reads the image in 4 MiB requests, four in flight
+static const unsigned long long HASH_SECTOR_BYTES = DIRECT_IO_ALIGNMENT;
+static const unsigned long long HASH_CHUNK_SECTORS = 1024ull;
+static const unsigned int HASH_QUEUE_DEPTH = 4;
+
+// A hash of the image file running on MainWindow::hashWorker; everything
+// the job touches lives here until the worker is done with it
+struct HashJob
+{
+	HashJob(const QList<int>& algorithms, HANDLE file, unsigned long long filesize, FileCache::Policy cachePolicy)
+		: pipeline(pool, HASH_SECTOR_BYTES, HASH_CHUNK_SECTORS, HASH_QUEUE_DEPTH), digests(algorithms), stage(digests, filesize),
+		cache(file, cachePolicy, false), file(file), numsectors((filesize + HASH_SECTOR_BYTES - 1ull) / HASH_SECTOR_BYTES), lastdone(0ull)
+	{
+	}
+	~HashJob()
+	{
+		CloseHandle(file);
+	}
+
+	BufferPool pool;  // not the transfers' pool, whose buffer size they change
+	TransferPipeline pipeline;
+	DigestSet digests;
+	HashStage<DigestSet> stage;
+	FileCache cache;
+	HANDLE file;
+	unsigned long long numsectors;
+	unsigned long long lastdone;
+	QElapsedTimer rate;
+	HashCache::FileId id;  // taken before the first read
+	bool identified;
+	int hashish;
+};
+
 // Debug logger (enabled via DEBUG_LOGGING define)
 #ifdef DEBUG_LOGGING
 extern void dbgLog(const char* msg);
@@ -66,6 +115,12 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 	dbgLog("MW 3: ElapsedTimer");
 	elapsed_timer = new ElapsedTimer();
 	statusbar->addPermanentWidget(elapsed_timer);   // "addpermanent" puts it on the RHS of the statusbar
+	hashProgress = new QProgressBar();
+	hashProgress->setRange(0, 100);
+	hashProgress->setMaximumWidth(120);
+	hashProgress->setVisible(false);
+	statusbar->addPermanentWidget(hashProgress);
+	connect(&hashTimer, &QTimer::timeout, this, &MainWindow::sampleHash);
 	dbgLog("MW 4: loadDriveIgnoreList");
 	loadDriveIgnoreList();
 	dbgLog("MW 5: getLogicalDrives");
@@ -88,6 +143,11 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 	cboxHashType->addItem("MD5", QVariant(QCryptographicHash::Md5));
 	cboxHashType->addItem("SHA1", QVariant(QCryptographicHash::Sha1));
 	cboxHashType->addItem("SHA256", QVariant(QCryptographicHash::Sha256));
+	cboxHashType->addItem("MD5 + SHA1 + SHA256", QVariant(ALL_HASHES));
+	// Integrity only, for when the hash would be slower than the device
+	cboxHashType->addItem("XXH3-128", QVariant(DigestSet::ALGORITHM_XXH3_128));
+	cboxHashType->addItem("CRC32C", QVariant(DigestSet::ALGORITHM_CRC32C));
+	cboxHashType->addItem("BLAKE3", QVariant(DigestSet::ALGORITHM_BLAKE3));
 	dbgLog("MW 7: hash controls");
 	updateHashControls();
 	setReadWriteButtonState();
@@ -107,6 +167,7 @@ MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent)
 
 MainWindow::~MainWindow()
 {
+	cancelHash();
 	saveSettings();
 	if (hRawDisk != INVALID_HANDLE_VALUE)
 	{
@@ -123,16 +184,10 @@ MainWindow::~MainWindow()
 		CloseHandle(hVolume);
 		hVolume = INVALID_HANDLE_VALUE;
 	}
-	if (sectorData != NULL)
-	{
-		delete[] sectorData;
-		sectorData = NULL;
-	}
-	if (sectorData2 != NULL)
-	{
-		delete[] sectorData2;
-		sectorData2 = NULL;
-	}
+	bufferPool.release(sectorData);
+	bufferPool.release(sectorData2);
+	sectorData = NULL;
+	sectorData2 = NULL;
 	if (elapsed_timer != NULL)
 	{
 		delete elapsed_timer;
@@ -150,6 +205,17 @@ void MainWindow::saveSettings()
 	userSettings.beginGroup("Settings");
 	userSettings.setValue("ImageDir", myHomeDir);
 	userSettings.setValue("WindowGeometry", saveGeometry());
+	userSettings.setValue("DirectIO", directIOCheckBox->isChecked());
+	userSettings.setValue("ZeroSkipWrite", zeroSkipCheckBox->isChecked());
+	userSettings.setValue("SparseRead", sparseCheckBox->isChecked());
+	userSettings.setValue("AndroidSparseRead", androidSparseCheckBox->isChecked());
+	userSettings.setValue("AndroidSparseBlockSize", sparseBlockSize);
+	userSettings.setValue("QueueDepth", queueDepth);
+	userSettings.setValue("AdaptiveTransfer", adaptiveTransfer);
+	userSettings.setValue("FileCachePolicy", (unsigned int)fileCachePolicy);
+	userSettings.setValue("MappedImageSource", mappedSource);
+	userSettings.setValue("MappedWindowMB", (unsigned int)(mappedWindowBytes / 1024ull / 1024ull));
+	hashCache.save(userSettings);
 	userSettings.endGroup();
 }
 
@@ -158,6 +224,24 @@ void MainWindow::loadSettings()
 	QSettings userSettings("HKEY_CURRENT_USER\\Software\\Win32DiskImager", QSettings::NativeFormat);
 	userSettings.beginGroup("Settings");
 	myHomeDir = userSettings.value("ImageDir").toString();
+	directIOCheckBox->setChecked(userSettings.value("DirectIO", false).toBool());
+	zeroSkipCheckBox->setChecked(userSettings.value("ZeroSkipWrite", false).toBool());
+	sparseCheckBox->setChecked(userSettings.value("SparseRead", false).toBool());
+	androidSparseCheckBox->setChecked(userSettings.value("AndroidSparseRead", false).toBool());
+	// Whole sectors, 4 KiB like img2simg unless set otherwise
+	sparseBlockSize = qBound(512u, userSettings.value("AndroidSparseBlockSize", 4096u).toUInt(), 64u * 1024u * 1024u) / 512u * 512u;
+	// Chunks kept in flight by the transfer engine; 1 is a plain serial copy
+	queueDepth = qBound(1u, userSettings.value("QueueDepth", 4u).toUInt(), (unsigned int)MAX_QUEUE_DEPTH);
+	// Let the transfer tune chunk size and depth from there as it runs
+	adaptiveTransfer = userSettings.value("AdaptiveTransfer", true).toBool();
+	// 0 leaves image files to the OS cache, 1 reads them sequentially, 2
+	// also drops them from the cache behind the transfer
+	fileCachePolicy = (FileCache::Policy)qMin(userSettings.value("FileCachePolicy", 1u).toUInt(), (unsigned int)FileCache::POLICY_DROP_BEHIND);
+	// Off by default: an I/O error on a mapped image faults instead of
+	// failing the transfer, so only for images on local disks
+	mappedSource = userSettings.value("MappedImageSource", false).toBool();
+	mappedWindowBytes = (unsigned long long)qBound(16u, userSettings.value("MappedWindowMB", 256u).toUInt(), 4096u) * 1024ull * 1024ull;
+	hashCache.load(userSettings);
 
 	// Restore window geometry if saved
 	QByteArray geometry = userSettings.value("WindowGeometry").toByteArray();
@@ -256,6 +340,7 @@ void MainWindow::closeEvent(QCloseEvent* event)
 			QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
 		{
 			status = STATUS_EXIT;
+			transferWorker.cancel();
 		}
 		event->ignore();
 	}
@@ -266,6 +351,7 @@ void MainWindow::closeEvent(QCloseEvent* event)
 			QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
 		{
 			status = STATUS_EXIT;
+			transferWorker.cancel();
 		}
 		event->ignore();
 	}
@@ -276,6 +362,7 @@ void MainWindow::closeEvent(QCloseEvent* event)
 			QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
 		{
 			status = STATUS_EXIT;
+			transferWorker.cancel();
 		}
 		event->ignore();
 	}
@@ -335,33 +422,159 @@ void MainWindow::on_bHashCopy_clicked()
 	}
 }
 
-// generates the hash
-void MainWindow::generateHash(char* filename, int hashish)
+// The algorithms behind an entry of cboxHashType
+static QList<int> hashAlgorithms(int hashish)
+{
+	QList<int> algorithms;
+	if (hashish == ALL_HASHES)
+	{
+		algorithms << QCryptographicHash::Md5 << QCryptographicHash::Sha1 << QCryptographicHash::Sha256;
+	}
+	else
+	{
+		algorithms << hashish;
+	}
+	return algorithms;
+}
+
+// generates the hash in the background; the result lands in hashLabel
+// once sampleHash() sees the job finish
+void MainWindow::generateHash(const QString& filename, int hashish)
 {
+	cancelHash();
+	HashCache::FileId id;
+	bool identified = HashCache::identify(filename, &id);
+	QString cached;
+	if (identified && hashCache.lookup(id, hashish, &cached))
+	{
+		showHash(cached);
+		return;
+	}
+	// Unbuffered like the transfers when direct I/O is on
+	bool directIO = directIOCheckBox->isChecked();
+	FileCache::Policy cachePolicy = directIO ? FileCache::POLICY_NORMAL : fileCachePolicy;
+	HANDLE file = getHandleOnFile(LPCWSTR(filename.data()), GENERIC_READ, directIO, true, NULL, cachePolicy);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		hashLabel->setText(tr("Error: Cannot open file"));
+		return;
+	}
+
+	// All of them in one pass when several are wanted
+	hashJob = new HashJob(hashAlgorithms(hashish), file, (unsigned long long)QFileInfo(filename).size(), cachePolicy);
+	hashJob->pipeline.setControl(&hashWorker.control());
+	hashJob->id = id;
+	hashJob->identified = identified;
+	hashJob->hashish = hashish;
+	hashJob->rate.start();
+	HashJob* job = hashJob;
+	unsigned long long alignment = directIO ? DIRECT_IO_ALIGNMENT : 1ull;
+	hashWorker.start([job, alignment](TransferPipeline::ProgressFunc progress) {
+		TransferPipeline::ProgressFunc tracked = [job, progress](unsigned long long done) {
+			job->cache.consumed(done * HASH_SECTOR_BYTES);
+			return progress(done);
+		};
+		return job->pipeline.scan(job->numsectors, TransferPipeline::Endpoint(job->file, alignment), job->stage, tracked);
+	});
+
 	hashLabel->setText(tr("Generating..."));
-	QApplication::processEvents();
+	bHashCopy->setEnabled(false);
+	bHashGen->setText(tr("Cancel"));
+	hashProgress->setValue(0);
+	hashProgress->setVisible(true);
+	hashTimer.start(PROGRESS_INTERVAL_MS);
+}
 
-	QCryptographicHash filehash((QCryptographicHash::Algorithm)hashish);
+void MainWindow::sampleHash()
+{
+	if (hashJob == NULL)
+	{
+		return;
+	}
+	unsigned long long done = hashWorker.sectorsDone();
+	if (hashJob->numsectors > 0ull)
+	{
+		hashProgress->setValue((int)(done * 100ull / hashJob->numsectors));
+	}
+	if (hashJob->rate.elapsed() >= ONE_SEC_IN_MS)
+	{
+		double mbpersec = ((double)HASH_SECTOR_BYTES * (done - hashJob->lastdone)) * ((double)ONE_SEC_IN_MS / hashJob->rate.elapsed()) / 1024.0 / 1024.0;
+		hashLabel->setText(tr("Generating... %1 MB/s").arg(mbpersec, 0, 'f', 1));
+		hashJob->rate.start();
+		hashJob->lastdone = done;
+	}
+	if (!hashWorker.finished())
+	{
+		return;
+	}
 
-	// may take a few secs - display a wait cursor
-	QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+	TransferPipeline::Result result = hashWorker.wait();
+	DebugToFile(QString("Hash: %1 engine, %2 MB/s over %3 s, SHA %4, CRC %5").arg(hashJob->pipeline.engineName())
+		.arg(hashJob->pipeline.elapsedSeconds() > 0.0 ? done * HASH_SECTOR_BYTES / hashJob->pipeline.elapsedSeconds() / 1024.0 / 1024.0 : 0.0)
+		.arg(hashJob->pipeline.elapsedSeconds()).arg(shaKernel()).arg(crc32Kernel()));
+	if (result == TransferPipeline::RESULT_OK)
+	{
+		QString digest = hashJob->digests.result();
+		showHash(digest);
+		if (hashJob->identified)
+		{
+			hashCache.insert(hashJob->id, hashJob->hashish, digest);
+		}
+	}
+	else if (result == TransferPipeline::RESULT_READ_ERROR)
+	{
+		DWORD ioError = (DWORD)hashJob->pipeline.ioError();
+		hashLabel->setText(tr("Error %1: %2").arg(ioError).arg(getErrorText(ioError)));
+	}
+	else
+	{
+		hashLabel->clear();
+	}
+	endHash();
+}
 
-	QFile file(filename);
-	if (!file.open(QFile::ReadOnly)) {
-		QApplication::restoreOverrideCursor();
-		hashLabel->setText(tr("Error: Cannot open file"));
+// Stops a running hash, if any, and waits for the worker to let go of it
+void MainWindow::cancelHash()
+{
+	if (hashJob == NULL)
+	{
 		return;
 	}
-	filehash.addData(&file);
-	file.close();  // Explicitly close the file
+	hashWorker.cancel();
+	hashWorker.wait();
+	hashLabel->clear();
+	endHash();
+}
 
-	QByteArray hash = filehash.result();
+void MainWindow::endHash()
+{
+	hashTimer.stop();
+	delete hashJob;
+	hashJob = NULL;
+	hashProgress->setVisible(false);
+	bHashGen->setText(tr("Generate"));
+}
 
-	// display it in the textbox
-	hashLabel->setText(hash.toHex());
+void MainWindow::showHash(const QString& hash)
+{
+	hashLabel->setText(hash);
 	bHashCopy->setEnabled(true);
-	// redisplay the normal cursor
-	QApplication::restoreOverrideCursor();
+}
+
+// Shows a hash taken inline by a transfer and keeps it for the next time
+// path is selected; path must be closed by then.  hashish is the hash type
+// the transfer started with, which may no longer be the one selected.
+void MainWindow::rememberHash(const QString& path, int hashish, const QString& hash)
+{
+	if (hashish == cboxHashType->currentData().toInt())
+	{
+		showHash(hash);
+	}
+	HashCache::FileId id;
+	if (HashCache::identify(path, &id))
+	{
+		hashCache.insert(id, hashish, hash);
+	}
 }
 
 // on an "editingFinished" signal (IE: return press), if the lineedit
@@ -381,6 +594,7 @@ void MainWindow::on_bCancel_clicked()
 			QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
 		{
 			status = STATUS_CANCELED;
+			transferWorker.cancel();
 		}
 	}
 	else if (status == STATUS_VERIFYING)
@@ -390,13 +604,157 @@ void MainWindow::on_bCancel_clicked()
 			QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
 		{
 			status = STATUS_CANCELED;
+			transferWorker.cancel();
 		}
 	}
 }
 
+TransferPipeline::Result MainWindow::runTransfer(TransferWorker::Job job, unsigned long long numsectors)
+{
+	// The job runs flat out on the worker; this thread only spins an event
+	// loop and samples the worker's counters PROGRESS_INTERVAL_MS apart
+	unsigned long long lasti = 0ull;
+	update_timer.start();
+	elapsed_timer->start();
+	transferWorker.start(job);
+	bPause->setText(tr("Pause"));
+	bPause->setEnabled(true);
+
+	QEventLoop loop;
+	QTimer sampler;
+	connect(&sampler, &QTimer::timeout, &loop, [&]() {
+		unsigned long long done = transferWorker.sectorsDone();
+		if (transferWorker.pauseRequested())
+		{
+			statusbar->showMessage(tr("Paused"));
+			update_timer.start();
+			lasti = done;
+		}
+		else if (update_timer.elapsed() >= ONE_SEC_IN_MS)
+		{
+			double mbpersec = (((double)sectorsize * (done - lasti)) * ((float)ONE_SEC_IN_MS / update_timer.elapsed())) / 1024.0 / 1024.0;
+			statusbar->showMessage(QString("%1 MB/s").arg(mbpersec));
+			elapsed_timer->update(done, numsectors);
+			update_timer.start();
+			lasti = done;
+		}
+		progressbar->setValue((int)qMin(done, (unsigned long long)INT_MAX));
+		if (transferWorker.finished())
+		{
+			loop.quit();
+		}
+	});
+	sampler.start(PROGRESS_INTERVAL_MS);
+	loop.exec();
+	bPause->setEnabled(false);
+	bPause->setText(tr("Pause"));
+	TransferPipeline::Result result = transferWorker.wait();
+	if (result == TransferPipeline::RESULT_CANCELED)
+	{
+		DebugToFile(QString("Cancel latency: %1 ms").arg(transferWorker.control().cancelLatencyMs()));
+	}
+	return result;
+}
+
+void MainWindow::on_bPause_clicked()
+{
+	// Chunks already in flight finish first, so the device is idle once
+	// the status bar says so; handles and locks are kept
+	if (transferWorker.pauseRequested())
+	{
+		transferWorker.resume();
+		bPause->setText(tr("Pause"));
+	}
+	else
+	{
+		transferWorker.pause();
+		bPause->setText(tr("Resume"));
+	}
+}
+
+void MainWindow::showDiskError(const DiskError& error)
+{
+	// Nothing to show when the call ran into no error (e.g. a card reader
+	// reporting size 0 after the card was pulled)
+	if (error.code != ERROR_SUCCESS)
+	{
+		QMessageBox::critical(this, error.title, error.text);
+	}
+}
+
+void MainWindow::showSparseImageError(const SparseImage& image)
+{
+	switch (image.error())
+	{
+	case SparseImage::SPARSE_READ_ERROR:
+		QMessageBox::critical(this, tr("Read Error"), tr("An error occurred when attempting to read the sparse image.\n"
+			"Error %1: %2").arg(image.ioError()).arg(getErrorText((DWORD)image.ioError())));
+		break;
+	case SparseImage::SPARSE_BAD_BLOCK_SIZE:
+		QMessageBox::critical(this, tr("Sparse Image Error"), tr("The block size of the sparse image is not a multiple of the device's sector size."));
+		break;
+	case SparseImage::SPARSE_BAD_HEADER:
+		QMessageBox::critical(this, tr("Sparse Image Error"), tr("The sparse image header is damaged or of an unsupported version."));
+		break;
+	default:
+		QMessageBox::critical(this, tr("Sparse Image Error"), tr("The sparse image is damaged at chunk %1.").arg(image.badChunk()));
+		break;
+	}
+}
+
+// Android sparse images are expanded on the fly instead of copied as they are
+static bool isSparseImageFile(const QString& path)
+{
+	QFile file(path);
+	char header[4];
+	return file.open(QIODevice::ReadOnly) && file.read(header, sizeof(header)) == (qint64)sizeof(header) &&
+		SparseImage::hasMagic(header, sizeof(header));
+}
+
+void MainWindow::showVirtualDiskError(const VirtualDisk& disk)
+{
+	switch (disk.error())
+	{
+	case VirtualDisk::VIRTUAL_READ_ERROR:
+		QMessageBox::critical(this, tr("Read Error"), tr("An error occurred when attempting to read the virtual disk.\n"
+			"Error %1: %2").arg(disk.ioError()).arg(getErrorText((DWORD)disk.ioError())));
+		break;
+	case VirtualDisk::VIRTUAL_DIFFERENCING:
+		QMessageBox::critical(this, tr("Virtual Disk Error"), tr("Differencing disks cannot be written. Merge the disk into its parent first."));
+		break;
+	case VirtualDisk::VIRTUAL_NEEDS_REPLAY:
+		QMessageBox::critical(this, tr("Virtual Disk Error"), tr("The VHDX has pending log entries. Attach it once in Windows or Hyper-V so they are applied."));
+		break;
+	case VirtualDisk::VIRTUAL_BAD_BLOCK_SIZE:
+		QMessageBox::critical(this, tr("Virtual Disk Error"), tr("The block size of the virtual disk is not a multiple of the device's sector size."));
+		break;
+	default:
+		QMessageBox::critical(this, tr("Virtual Disk Error"), tr("The virtual disk is damaged or of an unsupported kind."));
+		break;
+	}
+}
+
+// VHD and VHDX are written through their block allocation table
+static bool isVirtualDiskFile(const QString& path)
+{
+	QFile file(path);
+	char head[VirtualDisk::HEAD_BYTES];
+	char tail[VirtualDisk::TAIL_BYTES];
+	if (!file.open(QIODevice::ReadOnly) || file.read(head, sizeof(head)) != (qint64)sizeof(head))
+	{
+		return false;
+	}
+	bool hastail = file.size() >= (qint64)sizeof(tail) && file.seek(file.size() - (qint64)sizeof(tail)) &&
+		file.read(tail, sizeof(tail)) == (qint64)sizeof(tail);
+	return VirtualDisk::detect(head, hastail ? tail : NULL) != VirtualDisk::FORMAT_NONE;
+}
+
 void MainWindow::on_bWrite_clicked()
 {
 	bool passfail = true;
+	unsigned long long zeroBytesSkipped = 0ull;
+	unsigned long long mappedBytesWritten = 0ull;
+	unsigned long long mappedImageBytes = 0ull;
 	if (!leFile->text().isEmpty())
 	{
 		QFileInfo fileinfo(leFile->text());
@@ -432,12 +790,33 @@ void MainWindow::on_bWrite_clicked()
 			bRead->setEnabled(false);
 			bVerify->setEnabled(false);
 			bDetect->setEnabled(false);
-			double mbpersec;
-			unsigned long long i, lasti, availablesectors, numsectors;
+			unsigned long long i, availablesectors, numsectors;
 			DWORD deviceID = cboxDevice->currentData().toUInt();  // Device ID stored as item data
-			hFile = getHandleOnFile(LPCWSTR(leFile->text().data()), GENERIC_READ);
+			bool directIO = directIOCheckBox->isChecked();
+			// Sparse images and virtual disks are expanded through an extent
+			// list; their data sits at unaligned offsets, so the image itself
+			// is read buffered
+			bool sparse = isSparseImageFile(leFile->text());
+			bool virtualDisk = !sparse && isVirtualDiskFile(leFile->text());
+			SparseImage sparseImage;
+			VirtualDisk vhd;
+			const TransferPipeline::ExtentList* layout = NULL;
+			// An image read through an extent list is not read front to
+			// back, so nothing can be dropped behind the transfer
+			FileCache::Policy cachePolicy = fileCachePolicy;
+			if (directIO && !sparse && !virtualDisk)
+			{
+				cachePolicy = FileCache::POLICY_NORMAL;
+			}
+			else if ((sparse || virtualDisk) && cachePolicy == FileCache::POLICY_DROP_BEHIND)
+			{
+				cachePolicy = FileCache::POLICY_SEQUENTIAL;
+			}
+			DiskError diskError;
+			hFile = getHandleOnFile(LPCWSTR(leFile->text().data()), GENERIC_READ, directIO && !sparse && !virtualDisk, true, &diskError, cachePolicy);
 			if (hFile == INVALID_HANDLE_VALUE)
 			{
+				showDiskError(diskError);
 				removeLockOnVolume(hVolume);
 				CloseHandle(hVolume);
 				status = STATUS_IDLE;
@@ -446,10 +825,11 @@ void MainWindow::on_bWrite_clicked()
 				setReadWriteButtonState();
 				return;
 			}
-			hRawDisk = getHandleOnDevice(deviceID, GENERIC_WRITE);
+			hRawDisk = getHandleOnDevice(deviceID, GENERIC_WRITE, directIO, true, &diskError);
 
-			if (!getLockOnVolume(hRawDisk))
+			if (hRawDisk == INVALID_HANDLE_VALUE || !getLockOnVolume(hRawDisk, &diskError))
 			{
+				showDiskError(diskError);
 				// Close both hFile (opened above) and hRawDisk to prevent handle leaks
 				CloseHandle(hFile);
 				hFile = INVALID_HANDLE_VALUE;
@@ -460,8 +840,9 @@ void MainWindow::on_bWrite_clicked()
 				setReadWriteButtonState();
 				return;
 			}
-			if (!unmountVolume(hRawDisk))
+			if (!unmountVolume(hRawDisk, &diskError))
 			{
+				showDiskError(diskError);
 				// Close both handles to prevent leaks
 				CloseHandle(hFile);
 				hFile = INVALID_HANDLE_VALUE;
@@ -490,9 +871,10 @@ void MainWindow::on_bWrite_clicked()
 				setReadWriteButtonState();
 				return;
 			}
-			availablesectors = getNumberOfSectors(hRawDisk, &sectorsize);
+			availablesectors = getNumberOfSectors(hRawDisk, &sectorsize, &diskError);
 			if (!availablesectors)
 			{
+				showDiskError(diskError);
 				//For external card readers you may not get device change notification when you remove the card/flash.
 				//(So no WM_DEVICECHANGE signal). Device stays but size goes to 0. [Is there special event for this on Windows??]
 				removeLockOnVolume(hRawDisk);
@@ -505,9 +887,53 @@ void MainWindow::on_bWrite_clicked()
 				status = STATUS_IDLE;
 				return;
 			}
-			numsectors = getFileSizeInSectors(hFile, sectorsize);
+			if (sparse)
+			{
+				if (!sparseImage.open(hFile, sectorsize))
+				{
+					showSparseImageError(sparseImage);
+					removeLockOnVolume(hRawDisk);
+					CloseHandle(hRawDisk);
+					CloseHandle(hFile);
+					hRawDisk = INVALID_HANDLE_VALUE;
+					hFile = INVALID_HANDLE_VALUE;
+					status = STATUS_IDLE;
+					bCancel->setEnabled(false);
+					setReadWriteButtonState();
+					return;
+				}
+				numsectors = sparseImage.numSectors();
+				layout = &sparseImage.extents();
+				DebugToFile(QString("Sparse image: %1 sectors expanded, %2 bytes of data in %3 extents, %4 CRC32 chunks")
+					.arg(numsectors).arg(sparseImage.dataBytes()).arg(sparseImage.extents().size()).arg(sparseImage.checksums().size()));
+			}
+			else if (virtualDisk)
+			{
+				if (!vhd.open(hFile, (unsigned long long)QFileInfo(leFile->text()).size(), sectorsize))
+				{
+					showVirtualDiskError(vhd);
+					removeLockOnVolume(hRawDisk);
+					CloseHandle(hRawDisk);
+					CloseHandle(hFile);
+					hRawDisk = INVALID_HANDLE_VALUE;
+					hFile = INVALID_HANDLE_VALUE;
+					status = STATUS_IDLE;
+					bCancel->setEnabled(false);
+					setReadWriteButtonState();
+					return;
+				}
+				numsectors = vhd.numSectors();
+				layout = &vhd.extents();
+				DebugToFile(QString("Virtual disk: %1, %2 sectors, %3 bytes allocated in %4 extents, block size %5")
+					.arg(vhd.formatName()).arg(numsectors).arg(vhd.dataBytes()).arg(vhd.extents().size()).arg(vhd.blockSize()));
+			}
+			else
+			{
+				numsectors = getFileSizeInSectors(hFile, sectorsize, &diskError);
+			}
 			if (!numsectors)
 			{
+				showDiskError(diskError);
 				//For external card readers you may not get device change notification when you remove the card/flash.
 				//(So no WM_DEVICECHANGE signal). Device stays but size goes to 0. [Is there special event for this on Windows??]
 				removeLockOnVolume(hRawDisk);
@@ -523,31 +949,26 @@ void MainWindow::on_bWrite_clicked()
 				bool datafound = false;
 				i = availablesectors;
 				unsigned long nextchunksize = 0;
-				while ((i < numsectors) && (datafound == false))
+				bufferPool.reserve(1024ul * sectorsize);
+				// Sparse images and virtual disks know from their extents
+				datafound = (layout != NULL) && TransferPipeline::hasDataFrom(*layout, availablesectors);
+				sectorData = (layout != NULL) ? NULL : bufferPool.acquire();
+				while ((sectorData != NULL) && (i < numsectors) && (datafound == false))
 				{
 					nextchunksize = ((numsectors - i) >= 1024ul) ? 1024ul : (numsectors - i);
-					sectorData = readSectorDataFromHandle(hFile, i, nextchunksize, sectorsize);
-					if (sectorData == NULL)
+					if (!readSectorDataFromHandle(hFile, sectorData, i, nextchunksize, sectorsize, directIO))
 					{
 						// if there's an error verifying the truncated data, just move on to the
 						//  write, as we don't care about an error in a section that we're not writing...
 						i = numsectors + 1;
 					}
 					else {
-						unsigned int j = 0;
-						unsigned limit = nextchunksize * sectorsize;
-						while ((datafound == false) && (j < limit))
-						{
-							if (sectorData[j++] != 0)
-							{
-								datafound = true;
-							}
-						}
+						datafound = !isZeroFilled(sectorData, (size_t)(nextchunksize * sectorsize));
 						i += nextchunksize;
 					}
 				}
-				// delete the allocated sectorData
-				delete[] sectorData;
+				// return the borrowed sectorData
+				bufferPool.release(sectorData);
 				sectorData = NULL;
 				// build the string for the warning dialog
 				std::ostringstream msg;
@@ -577,54 +998,125 @@ void MainWindow::on_bWrite_clicked()
 				}
 			}
 
+			// Trim the target first; zero chunks of the image then only need
+			// writing when the device does not promise to read trimmed blocks
+			// back as zeros
+			bool zeroSkip = false;
+			if (zeroSkipCheckBox->isChecked())
+			{
+				bool readszero = false;
+				unsigned long discardError = ERROR_SUCCESS;
+				BlockDevice* device = BlockDevice::attach(hRawDisk, false, directIO, &discardError);
+				if (device != NULL && device->discard(0ull, numsectors, &readszero, &discardError))
+				{
+					zeroSkip = readszero;
+					DebugToFile(QString("Discard: %1 sectors trimmed, %2").arg(numsectors)
+						.arg(readszero ? "read back as zeros, skipping zero chunks" : "no zero guarantee, writing zero chunks"));
+				}
+				else
+				{
+					DebugToFile(QString("Discard: failed with error %1, writing zero chunks").arg(discardError));
+				}
+				delete device;
+			}
+
 			// Cap numsectors at INT_MAX to prevent overflow when casting to int
 			progressbar->setRange(0, (numsectors == 0ul) ? 100 : (int)qMin(numsectors, (unsigned long long)INT_MAX));
-			lasti = 0ul;
-			update_timer.start();
-			elapsed_timer->start();
-			for (i = 0ul; i < numsectors && status == STATUS_WRITING; i += 1024ul)
+			// Up to queueDepth chunks are read from the image and written to
+			// the device at the same time
+			TransferPipeline pipeline(bufferPool, sectorsize, 1024ull, queueDepth);
+			ChunkController controller(sectorsize, 1024ull, queueDepth, MAX_QUEUE_DEPTH,
+				[](const std::string& message) { DebugToFile(QString::fromStdString(message)); });
+			pipeline.setControl(&transferWorker.control());
+			pipeline.setZeroSkip(zeroSkip);
+			if (adaptiveTransfer)
 			{
-				sectorData = readSectorDataFromHandle(hFile, i, (numsectors - i >= 1024ul) ? 1024ul : (numsectors - i), sectorsize);
-				if (sectorData == NULL)
+				pipeline.setController(&controller);
+			}
+			FileCache fileCache(hFile, cachePolicy, false);
+			// Chunks of a buffered image are written straight from a mapping
+			// where they can be; a size of 0 leaves it unmapped
+			bool useMapping = mappedSource && !(directIO && layout == NULL);
+			MappedFile mapping(hFile, useMapping ? (unsigned long long)QFileInfo(leFile->text()).size() : 0ull, mappedWindowBytes);
+			MappedFile* mapped = mapping.isValid() ? &mapping : NULL;
+			// A plain image is hashed on its way to the device, which saves
+			// generateHash() a pass of its own over the file (unless the
+			// device is too small to take all of it)
+			bool hashing = (layout == NULL) && cboxHashType->currentIndex() != 0 &&
+				numsectors * sectorsize >= (unsigned long long)fileinfo.size();
+			// The hash type may be changed while the transfer runs
+			int hashish = cboxHashType->currentData().toInt();
+			DigestSet imageHash(hashing ? hashAlgorithms(hashish) : QList<int>());
+			HashStage<DigestSet> hashStage(imageHash, (unsigned long long)fileinfo.size());
+			TransferPipeline::Result result = runTransfer([&](TransferPipeline::ProgressFunc progress) {
+				TransferPipeline::Endpoint source(hFile, (directIO && layout == NULL) ? DIRECT_IO_ALIGNMENT : 1ull, mapped);
+				if (sparse && !sparseImage.checksums().empty())
 				{
-					removeLockOnVolume(hRawDisk);
-					CloseHandle(hRawDisk);
-					CloseHandle(hFile);
-					status = STATUS_IDLE;
-					hFile = INVALID_HANDLE_VALUE;
-					hVolume = INVALID_HANDLE_VALUE;
-					bCancel->setEnabled(false);
-					setReadWriteButtonState();
-					return;
+					SparseChecksumStage checksums(sparseImage);
+					return pipeline.copy(numsectors, *layout, source, TransferPipeline::Endpoint(hRawDisk), checksums, progress);
 				}
-				if (!writeSectorDataToHandle(hRawDisk, sectorData, i, (numsectors - i >= 1024ul) ? 1024ul : (numsectors - i), sectorsize))
+				if (layout != NULL)
 				{
-					delete[] sectorData;
-					removeLockOnVolume(hRawDisk);
-					CloseHandle(hRawDisk);
-					CloseHandle(hFile);
-					status = STATUS_IDLE;
-					sectorData = NULL;
-					hRawDisk = INVALID_HANDLE_VALUE;
-					hFile = INVALID_HANDLE_VALUE;
-					bCancel->setEnabled(false);
-					setReadWriteButtonState();
-					return;
+					return pipeline.copy(numsectors, *layout, source, TransferPipeline::Endpoint(hRawDisk), progress);
 				}
-				delete[] sectorData;
-				sectorData = NULL;
-				QCoreApplication::processEvents();
-				if (update_timer.elapsed() >= ONE_SEC_IN_MS)
+				// The image is done with up to the prefix of the transfer done
+				TransferPipeline::ProgressFunc tracked = [&](unsigned long long done) {
+					fileCache.consumed(done * sectorsize);
+					return progress(done);
+				};
+				if (hashing)
 				{
-					mbpersec = (((double)sectorsize * (i - lasti)) * ((float)ONE_SEC_IN_MS / update_timer.elapsed())) / 1024.0 / 1024.0;
-					statusbar->showMessage(QString("%1 MB/s").arg(mbpersec));
-					update_timer.start();
-					elapsed_timer->update(i, numsectors);
-					update_timer.start();
-					lasti = i;
+					return pipeline.copy(numsectors, source, TransferPipeline::Endpoint(hRawDisk), hashStage, tracked);
 				}
-				progressbar->setValue(i);
-				QCoreApplication::processEvents();
+				return pipeline.copy(numsectors, source, TransferPipeline::Endpoint(hRawDisk), tracked);
+			}, numsectors);
+			DebugToFile(QString("Transfer: %1 engine, queue depth %2; buffer pool: %3 allocations avoided, peak %4 bytes")
+				.arg(pipeline.engineName()).arg(queueDepth).arg(bufferPool.allocationsAvoided()).arg(bufferPool.peakBytes()));
+			DebugToFile(QString("File cache: %1, %2 bytes dropped").arg(FileCache::policyName(cachePolicy)).arg(fileCache.droppedBytes()));
+			DebugToFile(QString("Throughput: %1 MB/s over %2 s").arg(pipeline.elapsedSeconds() > 0.0 ?
+				transferWorker.sectorsDone() * sectorsize / pipeline.elapsedSeconds() / 1024.0 / 1024.0 : 0.0).arg(pipeline.elapsedSeconds()));
+			if (mapped != NULL)
+			{
+				DebugToFile(QString("Mapped image: %1 windows of %2 bytes").arg(mapping.mapCount()).arg(mapping.windowSize()));
+			}
+			zeroBytesSkipped = pipeline.skippedBytes();
+			if (zeroSkip)
+			{
+				DebugToFile(QString("Zero skip: %1 bytes not written").arg(zeroBytesSkipped));
+			}
+			if (layout != NULL)
+			{
+				mappedBytesWritten = pipeline.writtenBytes();
+				mappedImageBytes = numsectors * sectorsize;
+			}
+			if (result == TransferPipeline::RESULT_STAGE_ERROR)
+			{
+				QMessageBox::critical(this, tr("Sparse Image Error"), tr("The sparse image is damaged: a CRC32 chunk does not match "
+					"the data written before sector %1.").arg(pipeline.failedSector()));
+				passfail = false;
+			}
+			if (result == TransferPipeline::RESULT_READ_ERROR || result == TransferPipeline::RESULT_WRITE_ERROR)
+			{
+				DWORD ioError = (pipeline.ioError() != 0) ? (DWORD)pipeline.ioError() : (DWORD)ERROR_WRITE_FAULT;
+				if (result == TransferPipeline::RESULT_READ_ERROR)
+				{
+					QMessageBox::critical(this, tr("Read Error"), tr("An error occurred when attempting to read data from handle.\n"
+						"Error %1: %2").arg(ioError).arg(getErrorText(ioError)));
+				}
+				else
+				{
+					QMessageBox::critical(this, tr("Write Error"), tr("An error occurred when attempting to write data to handle.\n"
+						"Error %1: %2").arg(ioError).arg(getErrorText(ioError)));
+				}
+				removeLockOnVolume(hRawDisk);
+				CloseHandle(hRawDisk);
+				CloseHandle(hFile);
+				status = STATUS_IDLE;
+				hRawDisk = INVALID_HANDLE_VALUE;
+				hFile = INVALID_HANDLE_VALUE;
+				bCancel->setEnabled(false);
+				setReadWriteButtonState();
+				return;
 			}
 			removeLockOnVolume(hRawDisk);
 			CloseHandle(hRawDisk);
@@ -634,6 +1126,10 @@ void MainWindow::on_bWrite_clicked()
 			if (status == STATUS_CANCELED) {
 				passfail = false;
 			}
+			if (hashing && result == TransferPipeline::RESULT_OK && status != STATUS_CANCELED)
+			{
+				rememberHash(leFile->text(), hashish, imageHash.result());
+			}
 		}
 		else if (!fileinfo.exists() || !fileinfo.isFile())
 		{
@@ -654,7 +1150,15 @@ void MainWindow::on_bWrite_clicked()
 		statusbar->showMessage(tr("Done."));
 		bCancel->setEnabled(false);
 		setReadWriteButtonState();
-		if (passfail) {
+		if (passfail && mappedImageBytes > 0ull) {
+			QMessageBox::information(this, tr("Complete"), tr("Write Successful.\n%1 MB of the %2 MB image needed writing.")
+				.arg(mappedBytesWritten / 1024ull / 1024ull).arg(mappedImageBytes / 1024ull / 1024ull));
+		}
+		else if (passfail && zeroBytesSkipped > 0ull) {
+			QMessageBox::information(this, tr("Complete"), tr("Write Successful.\n%1 MB of zero blocks did not need writing.")
+				.arg(zeroBytesSkipped / 1024ull / 1024ull));
+		}
+		else if (passfail) {
 			QMessageBox::information(this, tr("Complete"), tr("Write Successful."));
 		}
 	}
@@ -698,18 +1202,35 @@ void MainWindow::on_bRead_clicked()
 				return;
 			}
 		}
+		// The file is about to be rewritten under a running hash
+		cancelHash();
 		bCancel->setEnabled(true);
 		bWrite->setEnabled(false);
 		bRead->setEnabled(false);
 		bVerify->setEnabled(false);
 		bDetect->setEnabled(false);
 		status = STATUS_READING;
-		double mbpersec;
-		unsigned long long i, lasti, numsectors, filesize, spaceneeded = 0ull;
+		unsigned long long i, numsectors, filesize, spaceneeded = 0ull;
 		DWORD deviceID = cboxDevice->currentData().toUInt();  // Device ID stored as item data
-		hFile = getHandleOnFile(LPCWSTR(myFile.data()), GENERIC_WRITE);
+		bool directIO = directIOCheckBox->isChecked();
+		// Android sparse output is a stream of variable sized chunks, so the
+		// image file is written buffered
+		bool androidSparse = androidSparseCheckBox->isChecked();
+		DiskError diskError;
+		// The Android sparse writer does not write in step with the transfer
+		FileCache::Policy cachePolicy = fileCachePolicy;
+		if (directIO && !androidSparse)
+		{
+			cachePolicy = FileCache::POLICY_NORMAL;
+		}
+		else if (androidSparse && cachePolicy == FileCache::POLICY_DROP_BEHIND)
+		{
+			cachePolicy = FileCache::POLICY_SEQUENTIAL;
+		}
+		hFile = getHandleOnFile(LPCWSTR(myFile.data()), GENERIC_WRITE, directIO && !androidSparse, true, &diskError, cachePolicy);
 		if (hFile == INVALID_HANDLE_VALUE)
 		{
+			showDiskError(diskError);
 			removeLockOnVolume(hVolume);
 			CloseHandle(hVolume);
 			status = STATUS_IDLE;
@@ -718,9 +1239,10 @@ void MainWindow::on_bRead_clicked()
 			setReadWriteButtonState();
 			return;
 		}
-		hRawDisk = getHandleOnDevice(deviceID, GENERIC_READ);
+		hRawDisk = getHandleOnDevice(deviceID, GENERIC_READ, directIO, true, &diskError);
 		if (hRawDisk == INVALID_HANDLE_VALUE)
 		{
+			showDiskError(diskError);
 			// Close hFile (opened above) to prevent handle leak
 			CloseHandle(hFile);
 			hFile = INVALID_HANDLE_VALUE;
@@ -729,8 +1251,9 @@ void MainWindow::on_bRead_clicked()
 			setReadWriteButtonState();
 			return;
 		}
-		if (!getLockOnVolume(hRawDisk))
+		if (!getLockOnVolume(hRawDisk, &diskError))
 		{
+			showDiskError(diskError);
 			// Close both handles to prevent leaks
 			CloseHandle(hFile);
 			hFile = INVALID_HANDLE_VALUE;
@@ -741,8 +1264,9 @@ void MainWindow::on_bRead_clicked()
 			setReadWriteButtonState();
 			return;
 		}
-		if (!unmountVolume(hRawDisk))
+		if (!unmountVolume(hRawDisk, &diskError))
 		{
+			showDiskError(diskError);
 			// Close both handles to prevent leaks
 			CloseHandle(hFile);
 			hFile = INVALID_HANDLE_VALUE;
@@ -776,8 +1300,9 @@ void MainWindow::on_bRead_clicked()
 		if (partitionCheckBox->isChecked())
 		{
 			// Read MBR partition table
-			sectorData = readSectorDataFromHandle(hRawDisk, 0, 1ul, 512ul);
-			if (sectorData != NULL)
+			bufferPool.reserve(1024ul * sectorsize);
+			sectorData = bufferPool.acquire();
+			if (sectorData != NULL && readSectorDataFromHandle(hRawDisk, sectorData, 0, 1ul, 512ul))
 			{
 				numsectors = 1ul;
 				// Read partition information - verify buffer has enough data for MBR partition table
@@ -796,10 +1321,10 @@ void MainWindow::on_bRead_clicked()
 						numsectors = partitionStartSector + partitionNumSectors;
 					}
 				}
-				// Clean up after MBR read - sectorData will be reallocated in main read loop
-				delete[] sectorData;
-				sectorData = NULL;
 			}
+			// Return the MBR buffer - the main read loop borrows its own
+			bufferPool.release(sectorData);
+			sectorData = NULL;
 		}
 		filesize = getFileSizeInSectors(hFile, sectorsize);
 		if (filesize >= numsectors)
@@ -813,11 +1338,6 @@ void MainWindow::on_bRead_clicked()
 		if (!spaceAvailable(myFile.left(3).replace(QChar('/'), QChar('\\')).toLatin1().data(), spaceneeded))
 		{
 			QMessageBox::critical(this, tr("Write Error"), tr("Disk is not large enough for the specified image."));
-			// Clean up sectorData if allocated during partition check
-			if (sectorData != NULL) {
-				delete[] sectorData;
-				sectorData = NULL;
-			}
 			removeLockOnVolume(hRawDisk);
 			CloseHandle(hRawDisk);
 			CloseHandle(hFile);
@@ -841,67 +1361,178 @@ void MainWindow::on_bRead_clicked()
 			// Cap numsectors at INT_MAX to prevent overflow when casting to int
 			progressbar->setRange(0, (int)qMin(numsectors, (unsigned long long)INT_MAX));
 		}
-		lasti = 0ul;
-		update_timer.start();
-		elapsed_timer->start();
-		for (i = 0ul; i < numsectors && status == STATUS_READING; i += 1024ul)
+		// The image was just created empty, so in a sparse file every chunk
+		// of zeros that is not written is a hole that reads back as zeros
+		bool sparse = false;
+		if (sparseCheckBox->isChecked() && !androidSparse)
 		{
-			sectorData = readSectorDataFromHandle(hRawDisk, i, (numsectors - i >= 1024ul) ? 1024ul : (numsectors - i), sectorsize);
-			if (sectorData == NULL)
+			DWORD sparseError = ERROR_SUCCESS;
+			sparse = setSparseFile(hFile, &sparseError);
+			if (!sparse)
 			{
-				removeLockOnVolume(hRawDisk);
-				CloseHandle(hRawDisk);
-				CloseHandle(hFile);
-				status = STATUS_IDLE;
-				hRawDisk = INVALID_HANDLE_VALUE;
-				hFile = INVALID_HANDLE_VALUE;
-				bCancel->setEnabled(false);
-				setReadWriteButtonState();
-				return;
+				DebugToFile(QString("Sparse image: not supported here (error %1), writing zero chunks").arg(sparseError));
 			}
-			if (!writeSectorDataToHandle(hFile, sectorData, i, (numsectors - i >= 1024ul) ? 1024ul : (numsectors - i), sectorsize))
+		}
+		// Otherwise the whole image is reserved up front rather than grown
+		// chunk by chunk; whatever happens the file is cut back below to the
+		// sectors actually read (the size of an Android sparse image is not
+		// known in advance, and a sparse file must keep its holes)
+		unsigned long fileError = ERROR_SUCCESS;
+		BlockDevice* imageFile = BlockDevice::attach(hFile, true, directIO && !androidSparse, &fileError);
+		bool preallocated = false;
+		if (imageFile != NULL && !sparse && !androidSparse && numsectors > 0ull)
+		{
+			preallocated = imageFile->preallocate(numsectors * sectorsize, &fileError);
+			if (preallocated)
 			{
-				delete[] sectorData;
-				removeLockOnVolume(hRawDisk);
-				CloseHandle(hRawDisk);
-				CloseHandle(hFile);
-				status = STATUS_IDLE;
-				sectorData = NULL;
-				hFile = INVALID_HANDLE_VALUE;
-				hVolume = INVALID_HANDLE_VALUE;
-				bCancel->setEnabled(false);
-				setReadWriteButtonState();
-				return;
+				DebugToFile(QString("Preallocated %1 bytes").arg(numsectors * sectorsize));
 			}
-			delete[] sectorData;
-			sectorData = NULL;
-			if (update_timer.elapsed() >= ONE_SEC_IN_MS)
+			else
 			{
-				mbpersec = (((double)sectorsize * (i - lasti)) * ((float)ONE_SEC_IN_MS / update_timer.elapsed())) / 1024.0 / 1024.0;
-				statusbar->showMessage(QString("%1MB/s").arg(mbpersec));
-				update_timer.start();
-				elapsed_timer->update(i, numsectors);
-				lasti = i;
-			}
-			progressbar->setValue(i);
-			QCoreApplication::processEvents();
+				DebugToFile(QString("Preallocation failed (error %1), growing the image as it is written").arg(fileError));
+			}
+		}
+		// Up to queueDepth chunks are read from the device and written to
+		// the image file at the same time
+		TransferPipeline pipeline(bufferPool, sectorsize, 1024ull, queueDepth);
+		ChunkController controller(sectorsize, 1024ull, queueDepth, MAX_QUEUE_DEPTH,
+			[](const std::string& message) { DebugToFile(QString::fromStdString(message)); });
+		pipeline.setControl(&transferWorker.control());
+		pipeline.setZeroSkip(sparse);
+		if (adaptiveTransfer)
+		{
+			pipeline.setController(&controller);
 		}
+		// Sparse blocks are whole sectors of this device
+		SparseImageWriter simgWriter(hFile, (uint32_t)qMax((unsigned long long)sparseBlockSize / sectorsize * sectorsize, sectorsize));
+		FileCache fileCache(hFile, cachePolicy, true);
+		// The image is hashed as it is read, rather than read back for
+		// generateHash(); an Android sparse file holds other bytes
+		bool hashing = !androidSparse && cboxHashType->currentIndex() != 0;
+		// The hash type may be changed while the transfer runs
+		int hashish = cboxHashType->currentData().toInt();
+		DigestSet imageHash(hashing ? hashAlgorithms(hashish) : QList<int>());
+		HashStage<DigestSet> hashStage(imageHash);
+		TransferPipeline::Result result = runTransfer([&](TransferPipeline::ProgressFunc progress) {
+			if (androidSparse)
+			{
+				// The part read is still a valid image after a cancel
+				TransferPipeline::Result scanned = pipeline.scan(numsectors, TransferPipeline::Endpoint(hRawDisk), simgWriter, progress);
+				if ((scanned == TransferPipeline::RESULT_OK || scanned == TransferPipeline::RESULT_CANCELED) && !simgWriter.finish())
+				{
+					return TransferPipeline::RESULT_STAGE_ERROR;
+				}
+				return scanned;
+			}
+			// Written image data is flushed and dropped behind the transfer
+			TransferPipeline::ProgressFunc tracked = [&](unsigned long long done) {
+				fileCache.consumed(done * sectorsize);
+				return progress(done);
+			};
+			TransferPipeline::Endpoint image(hFile, directIO ? DIRECT_IO_ALIGNMENT : 1ull);
+			if (hashing)
+			{
+				return pipeline.copy(numsectors, TransferPipeline::Endpoint(hRawDisk), image, hashStage, tracked);
+			}
+			return pipeline.copy(numsectors, TransferPipeline::Endpoint(hRawDisk), image, tracked);
+		}, numsectors);
+		unsigned long long sectorsDone = transferWorker.sectorsDone();
+		DebugToFile(QString("Transfer: %1 engine, queue depth %2; buffer pool: %3 allocations avoided, peak %4 bytes")
+			.arg(pipeline.engineName()).arg(queueDepth).arg(bufferPool.allocationsAvoided()).arg(bufferPool.peakBytes()));
+		DebugToFile(QString("File cache: %1, %2 bytes dropped").arg(FileCache::policyName(cachePolicy)).arg(fileCache.droppedBytes()));
+		DebugToFile(QString("Throughput: %1 MB/s over %2 s").arg(pipeline.elapsedSeconds() > 0.0 ?
+			transferWorker.sectorsDone() * sectorsize / pipeline.elapsedSeconds() / 1024.0 / 1024.0 : 0.0).arg(pipeline.elapsedSeconds()));
+		if (result == TransferPipeline::RESULT_STAGE_ERROR)
+		{
+			// Writing the sparse image failed
+			result = TransferPipeline::RESULT_WRITE_ERROR;
+		}
+		if (result == TransferPipeline::RESULT_READ_ERROR || result == TransferPipeline::RESULT_WRITE_ERROR)
+		{
+			DWORD ioError = (pipeline.ioError() != 0) ? (DWORD)pipeline.ioError() : (DWORD)ERROR_WRITE_FAULT;
+			if (androidSparse && result == TransferPipeline::RESULT_WRITE_ERROR)
+			{
+				ioError = (simgWriter.ioError() != 0) ? (DWORD)simgWriter.ioError() : (DWORD)ERROR_WRITE_FAULT;
+			}
+			if (result == TransferPipeline::RESULT_READ_ERROR)
+			{
+				QMessageBox::critical(this, tr("Read Error"), tr("An error occurred when attempting to read data from handle.\n"
+					"Error %1: %2").arg(ioError).arg(getErrorText(ioError)));
+			}
+			else
+			{
+				QMessageBox::critical(this, tr("Write Error"), tr("An error occurred when attempting to write data to handle.\n"
+					"Error %1: %2").arg(ioError).arg(getErrorText(ioError)));
+			}
+			if (imageFile != NULL && !androidSparse)
+			{
+				// Keep the part read, drop the reserved or padded rest
+				imageFile->setSize(sectorsDone * sectorsize, &fileError);
+			}
+			delete imageFile;
+			removeLockOnVolume(hRawDisk);
+			CloseHandle(hRawDisk);
+			CloseHandle(hFile);
+			status = STATUS_IDLE;
+			hRawDisk = INVALID_HANDLE_VALUE;
+			hFile = INVALID_HANDLE_VALUE;
+			bCancel->setEnabled(false);
+			setReadWriteButtonState();
+			return;
+		}
+		// The file then holds exactly the sectors that were hashed
+		bool exactSize = androidSparse;
+		if (!androidSparse)
+		{
+			// The last chunk was written padded to DIRECT_IO_ALIGNMENT, or not
+			// written at all when it was a hole, or the read was canceled short
+			// of the preallocated size or in the middle of the chunks in
+			// flight; set the image to the exact size of the sectors read
+			exactSize = (imageFile != NULL && imageFile->setSize(sectorsDone * sectorsize, &fileError));
+			if (!exactSize)
+			{
+				QMessageBox::critical(this, tr("File Error"), tr("An error occurred while setting the image file size.\n"
+					"Error %1: %2").arg(fileError).arg(getErrorText(fileError)));
+			}
+		}
+		delete imageFile;
 		removeLockOnVolume(hRawDisk);
 		CloseHandle(hRawDisk);
 		CloseHandle(hFile);
 		hRawDisk = INVALID_HANDLE_VALUE;
 		hFile = INVALID_HANDLE_VALUE;
+		QString sizeReport;
+		if (sparse)
+		{
+			unsigned long long logical = sectorsDone * sectorsize;
+			unsigned long long allocated = getAllocatedFileSize(LPCWSTR(myFile.data()));
+			DebugToFile(QString("Sparse image: %1 bytes, %2 allocated, %3 bytes of zeros left as holes")
+				.arg(logical).arg(allocated).arg(pipeline.skippedBytes()));
+			sizeReport = tr("\nImage size: %1 MB, allocated on disk: %2 MB.").arg(logical / 1024ull / 1024ull).arg(allocated / 1024ull / 1024ull);
+		}
+		if (androidSparse)
+		{
+			DebugToFile(QString("Android sparse image: %1 bytes, %2 blocks of %3 bytes in %4 chunks")
+				.arg(simgWriter.imageBytes()).arg(simgWriter.totalBlocks()).arg(simgWriter.blockSize()).arg(simgWriter.totalChunks()));
+			sizeReport = tr("\nAndroid sparse image: %1 MB for %2 MB read.")
+				.arg(simgWriter.imageBytes() / 1024ull / 1024ull).arg(sectorsDone * sectorsize / 1024ull / 1024ull);
+		}
 		progressbar->reset();
 		statusbar->showMessage(tr("Done."));
 		bCancel->setEnabled(false);
 		setReadWriteButtonState();
 		if (status == STATUS_CANCELED) {
-			QMessageBox::information(this, tr("Complete"), tr("Read Canceled."));
+			QMessageBox::information(this, tr("Complete"), tr("Read Canceled.") + sizeReport);
 		}
 		else {
-			QMessageBox::information(this, tr("Complete"), tr("Read Successful."));
+			QMessageBox::information(this, tr("Complete"), tr("Read Successful.") + sizeReport);
 		}
 		updateHashControls();
+		// A canceled read hashed exactly the sectors the file was cut to
+		if (hashing && exactSize && (result == TransferPipeline::RESULT_OK || result == TransferPipeline::RESULT_CANCELED))
+		{
+			rememberHash(myFile, hashish, imageHash.result());
+		}
 	}
 	else
 	{
@@ -939,13 +1570,31 @@ void MainWindow::on_bVerify_clicked()
 			bRead->setEnabled(false);
 			bVerify->setEnabled(false);
 			bDetect->setEnabled(false);
-			double mbpersec;
-			unsigned long long i, lasti, availablesectors, numsectors;
-			int memcmpResult;  // memcmp returns int, not unsigned long long
+			unsigned long long i, availablesectors, numsectors;
 			DWORD deviceID = cboxDevice->currentData().toUInt();  // Device ID stored as item data
-			hFile = getHandleOnFile(LPCWSTR(leFile->text().data()), GENERIC_READ);
+			// Unbuffered reads make verify compare against the media itself
+			bool directIO = directIOCheckBox->isChecked();
+			bool sparse = isSparseImageFile(leFile->text());
+			bool virtualDisk = !sparse && isVirtualDiskFile(leFile->text());
+			SparseImage sparseImage;
+			VirtualDisk vhd;
+			const TransferPipeline::ExtentList* layout = NULL;
+			// An image read through an extent list is not read front to
+			// back, so nothing can be dropped behind the transfer
+			FileCache::Policy cachePolicy = fileCachePolicy;
+			if (directIO && !sparse && !virtualDisk)
+			{
+				cachePolicy = FileCache::POLICY_NORMAL;
+			}
+			else if ((sparse || virtualDisk) && cachePolicy == FileCache::POLICY_DROP_BEHIND)
+			{
+				cachePolicy = FileCache::POLICY_SEQUENTIAL;
+			}
+			DiskError diskError;
+			hFile = getHandleOnFile(LPCWSTR(leFile->text().data()), GENERIC_READ, directIO && !sparse && !virtualDisk, true, &diskError, cachePolicy);
 			if (hFile == INVALID_HANDLE_VALUE)
 			{
+				showDiskError(diskError);
 				removeLockOnVolume(hVolume);
 				CloseHandle(hVolume);
 				status = STATUS_IDLE;
@@ -954,9 +1603,10 @@ void MainWindow::on_bVerify_clicked()
 				setReadWriteButtonState();
 				return;
 			}
-			hRawDisk = getHandleOnDevice(deviceID, GENERIC_READ);
-			if (!getLockOnVolume(hRawDisk))
+			hRawDisk = getHandleOnDevice(deviceID, GENERIC_READ, directIO, true, &diskError);
+			if (hRawDisk == INVALID_HANDLE_VALUE || !getLockOnVolume(hRawDisk, &diskError))
 			{
+				showDiskError(diskError);
 				// Close hFile (opened above) to prevent handle leak
 				CloseHandle(hFile);
 				hFile = INVALID_HANDLE_VALUE;
@@ -967,8 +1617,9 @@ void MainWindow::on_bVerify_clicked()
 				setReadWriteButtonState();
 				return;
 			}
-			if (!unmountVolume(hRawDisk))
+			if (!unmountVolume(hRawDisk, &diskError))
 			{
+				showDiskError(diskError);
 				// Close hFile to prevent handle leak
 				CloseHandle(hFile);
 				hFile = INVALID_HANDLE_VALUE;
@@ -1002,9 +1653,10 @@ void MainWindow::on_bVerify_clicked()
 				setReadWriteButtonState();
 				return;
 			}
-			availablesectors = getNumberOfSectors(hRawDisk, &sectorsize);
+			availablesectors = getNumberOfSectors(hRawDisk, &sectorsize, &diskError);
 			if (!availablesectors)
 			{
+				showDiskError(diskError);
 				//For external card readers you may not get device change notification when you remove the card/flash.
 				//(So no WM_DEVICECHANGE signal). Device stays but size goes to 0. [Is there special event for this on Windows??]
 				removeLockOnVolume(hRawDisk);
@@ -1016,9 +1668,53 @@ void MainWindow::on_bVerify_clicked()
 				status = STATUS_IDLE;
 				return;
 			}
-			numsectors = getFileSizeInSectors(hFile, sectorsize);
+			if (sparse)
+			{
+				if (!sparseImage.open(hFile, sectorsize))
+				{
+					showSparseImageError(sparseImage);
+					removeLockOnVolume(hRawDisk);
+					CloseHandle(hRawDisk);
+					CloseHandle(hFile);
+					hRawDisk = INVALID_HANDLE_VALUE;
+					hFile = INVALID_HANDLE_VALUE;
+					status = STATUS_IDLE;
+					bCancel->setEnabled(false);
+					setReadWriteButtonState();
+					return;
+				}
+				numsectors = sparseImage.numSectors();
+				layout = &sparseImage.extents();
+				DebugToFile(QString("Sparse image: %1 sectors expanded, %2 bytes of data in %3 extents, %4 CRC32 chunks")
+					.arg(numsectors).arg(sparseImage.dataBytes()).arg(sparseImage.extents().size()).arg(sparseImage.checksums().size()));
+			}
+			else if (virtualDisk)
+			{
+				if (!vhd.open(hFile, (unsigned long long)QFileInfo(leFile->text()).size(), sectorsize))
+				{
+					showVirtualDiskError(vhd);
+					removeLockOnVolume(hRawDisk);
+					CloseHandle(hRawDisk);
+					CloseHandle(hFile);
+					hRawDisk = INVALID_HANDLE_VALUE;
+					hFile = INVALID_HANDLE_VALUE;
+					status = STATUS_IDLE;
+					bCancel->setEnabled(false);
+					setReadWriteButtonState();
+					return;
+				}
+				numsectors = vhd.numSectors();
+				layout = &vhd.extents();
+				DebugToFile(QString("Virtual disk: %1, %2 sectors, %3 bytes allocated in %4 extents, block size %5")
+					.arg(vhd.formatName()).arg(numsectors).arg(vhd.dataBytes()).arg(vhd.extents().size()).arg(vhd.blockSize()));
+			}
+			else
+			{
+				numsectors = getFileSizeInSectors(hFile, sectorsize, &diskError);
+			}
 			if (!numsectors)
 			{
+				showDiskError(diskError);
 				//For external card readers you may not get device change notification when you remove the card/flash.
 				//(So no WM_DEVICECHANGE signal). Device stays but size goes to 0. [Is there special event for this on Windows??]
 				removeLockOnVolume(hRawDisk);
@@ -1034,31 +1730,26 @@ void MainWindow::on_bVerify_clicked()
 				bool datafound = false;
 				i = availablesectors;
 				unsigned long nextchunksize = 0;
-				while ((i < numsectors) && (datafound == false))
+				bufferPool.reserve(1024ul * sectorsize);
+				// Sparse images and virtual disks know from their extents
+				datafound = (layout != NULL) && TransferPipeline::hasDataFrom(*layout, availablesectors);
+				sectorData = (layout != NULL) ? NULL : bufferPool.acquire();
+				while ((sectorData != NULL) && (i < numsectors) && (datafound == false))
 				{
 					nextchunksize = ((numsectors - i) >= 1024ul) ? 1024ul : (numsectors - i);
-					sectorData = readSectorDataFromHandle(hFile, i, nextchunksize, sectorsize);
-					if (sectorData == NULL)
+					if (!readSectorDataFromHandle(hFile, sectorData, i, nextchunksize, sectorsize, directIO))
 					{
 						// if there's an error verifying the truncated data, just move on to the
 						//  write, as we don't care about an error in a section that we're not writing...
 						i = numsectors + 1;
 					}
 					else {
-						unsigned int j = 0;
-						unsigned limit = nextchunksize * sectorsize;
-						while ((datafound == false) && (j < limit))
-						{
-							if (sectorData[j++] != 0)
-							{
-								datafound = true;
-							}
-						}
+						datafound = !isZeroFilled(sectorData, (size_t)(nextchunksize * sectorsize));
 						i += nextchunksize;
 					}
 				}
-				// delete the allocated sectorData
-				delete[] sectorData;
+				// return the borrowed sectorData
+				bufferPool.release(sectorData);
 				sectorData = NULL;
 				// build the string for the warning dialog
 				std::ostringstream msg;
@@ -1089,75 +1780,81 @@ void MainWindow::on_bVerify_clicked()
 			}
 			// Cap numsectors at INT_MAX to prevent overflow when casting to int
 			progressbar->setRange(0, (numsectors == 0ul) ? 100 : (int)qMin(numsectors, (unsigned long long)INT_MAX));
-			update_timer.start();
-			elapsed_timer->start();
-			lasti = 0ul;
-			for (i = 0ul; i < numsectors && status == STATUS_VERIFYING; i += 1024ul)
+			// Up to queueDepth chunks of the image and the device are read at
+			// the same time and compared as each pair arrives
+			TransferPipeline pipeline(bufferPool, sectorsize, 1024ull, queueDepth);
+			ChunkController controller(sectorsize, 1024ull, queueDepth, MAX_QUEUE_DEPTH,
+				[](const std::string& message) { DebugToFile(QString::fromStdString(message)); });
+			pipeline.setControl(&transferWorker.control());
+			if (adaptiveTransfer)
 			{
-				sectorData = readSectorDataFromHandle(hFile, i, (numsectors - i >= 1024ul) ? 1024ul : (numsectors - i), sectorsize);
-				if (sectorData == NULL)
-				{
-					removeLockOnVolume(hRawDisk);
-					CloseHandle(hRawDisk);
-					CloseHandle(hFile);
-					status = STATUS_IDLE;
-					hRawDisk = INVALID_HANDLE_VALUE;
-					hFile = INVALID_HANDLE_VALUE;
-					bCancel->setEnabled(false);
-					setReadWriteButtonState();
-					return;
-				}
-				sectorData2 = readSectorDataFromHandle(hRawDisk, i, (numsectors - i >= 1024ul) ? 1024ul : (numsectors - i), sectorsize);
-				if (sectorData2 == NULL)
-				{
-					// Clean up sectorData before returning to prevent memory leak
-					delete[] sectorData;
-					sectorData = NULL;
-					QMessageBox::critical(this, tr("Verify Failure"), tr("Verification failed at sector: %1").arg(i));
-					removeLockOnVolume(hRawDisk);
-					CloseHandle(hRawDisk);
-					CloseHandle(hFile);
-					status = STATUS_IDLE;
-					hRawDisk = INVALID_HANDLE_VALUE;
-					hFile = INVALID_HANDLE_VALUE;
-					bCancel->setEnabled(false);
-					setReadWriteButtonState();
-					return;
-				}
-				memcmpResult = memcmp(sectorData, sectorData2, ((numsectors - i >= 1024ul) ? 1024ul : (numsectors - i)) * sectorsize);
-				if (memcmpResult != 0)
+				pipeline.setController(&controller);
+			}
+			FileCache fileCache(hFile, cachePolicy, false);
+			bool useMapping = mappedSource && !(directIO && layout == NULL);
+			MappedFile mapping(hFile, useMapping ? (unsigned long long)QFileInfo(leFile->text()).size() : 0ull, mappedWindowBytes);
+			MappedFile* mapped = mapping.isValid() ? &mapping : NULL;
+			bool hashing = (layout == NULL) && cboxHashType->currentIndex() != 0 &&
+				numsectors * sectorsize >= (unsigned long long)fileinfo.size();
+			// The hash type may be changed while the transfer runs
+			int hashish = cboxHashType->currentData().toInt();
+			DigestSet imageHash(hashing ? hashAlgorithms(hashish) : QList<int>());
+			HashStage<DigestSet> hashStage(imageHash, (unsigned long long)fileinfo.size());
+			TransferPipeline::Result result = runTransfer([&](TransferPipeline::ProgressFunc progress) {
+				// DONT_CARE ranges of a sparse image are not compared,
+				// unallocated blocks of a virtual disk are compared with zeros
+				if (layout != NULL)
 				{
-					QMessageBox::critical(this, tr("Verify Failure"), tr("Verification failed at sector: %1").arg(i));
-					passfail = false;
-					break;
+					return pipeline.compare(numsectors, *layout,
+						TransferPipeline::Endpoint(hFile, 1ull, mapped), TransferPipeline::Endpoint(hRawDisk), progress);
 				}
-				if (update_timer.elapsed() >= ONE_SEC_IN_MS)
+				TransferPipeline::ProgressFunc tracked = [&](unsigned long long done) {
+					fileCache.consumed(done * sectorsize);
+					return progress(done);
+				};
+				TransferPipeline::Endpoint image(hFile, directIO ? DIRECT_IO_ALIGNMENT : 1ull, mapped);
+				if (hashing)
 				{
-					mbpersec = (((double)sectorsize * (i - lasti)) * ((float)ONE_SEC_IN_MS / update_timer.elapsed())) / 1024.0 / 1024.0;
-					statusbar->showMessage(QString("%1MB/s").arg(mbpersec));
-					update_timer.start();
-					elapsed_timer->update(i, numsectors);
-					lasti = i;
+					return pipeline.compare(numsectors, image, TransferPipeline::Endpoint(hRawDisk), hashStage, tracked);
 				}
-				delete[] sectorData;
-				delete[] sectorData2;
-				sectorData = NULL;
-				sectorData2 = NULL;
-				progressbar->setValue(i);
-				QCoreApplication::processEvents();
-			}
+				return pipeline.compare(numsectors, image, TransferPipeline::Endpoint(hRawDisk), tracked);
+			}, numsectors);
 			removeLockOnVolume(hRawDisk);
 			CloseHandle(hRawDisk);
 			CloseHandle(hFile);
-			delete[] sectorData;
-			delete[] sectorData2;
-			sectorData = NULL;
-			sectorData2 = NULL;
 			hRawDisk = INVALID_HANDLE_VALUE;
 			hFile = INVALID_HANDLE_VALUE;
+			DebugToFile(QString("Verify: %1 engine, queue depth %2; buffer pool: %3 allocations avoided, peak %4 bytes")
+				.arg(pipeline.engineName()).arg(queueDepth).arg(bufferPool.allocationsAvoided()).arg(bufferPool.peakBytes()));
+			DebugToFile(QString("File cache: %1, %2 bytes dropped").arg(FileCache::policyName(cachePolicy)).arg(fileCache.droppedBytes()));
+			DebugToFile(QString("Throughput: %1 MB/s over %2 s").arg(pipeline.elapsedSeconds() > 0.0 ?
+				transferWorker.sectorsDone() * sectorsize / pipeline.elapsedSeconds() / 1024.0 / 1024.0 : 0.0).arg(pipeline.elapsedSeconds()));
+			if (mapped != NULL)
+			{
+				DebugToFile(QString("Mapped image: %1 windows of %2 bytes").arg(mapping.mapCount()).arg(mapping.windowSize()));
+			}
+			if (result == TransferPipeline::RESULT_READ_ERROR)
+			{
+				DWORD ioError = (DWORD)pipeline.ioError();
+				QMessageBox::critical(this, tr("Read Error"), tr("An error occurred when attempting to read data from handle.\n"
+					"Error %1: %2").arg(ioError).arg(getErrorText(ioError)));
+				status = STATUS_IDLE;
+				bCancel->setEnabled(false);
+				setReadWriteButtonState();
+				return;
+			}
+			if (result == TransferPipeline::RESULT_MISMATCH)
+			{
+				QMessageBox::critical(this, tr("Verify Failure"), tr("Verification failed at sector: %1").arg(pipeline.failedSector()));
+				passfail = false;
+			}
 			if (status == STATUS_CANCELED) {
 				passfail = false;
 			}
+			if (hashing && result == TransferPipeline::RESULT_OK && status != STATUS_CANCELED)
+			{
+				rememberHash(leFile->text(), hashish, imageHash.result());
+			}
 		}
 		else if (!fileinfo.exists() || !fileinfo.isFile())
 		{
@@ -1369,6 +2066,8 @@ void MainWindow::updateHashControls()
 	bool validFile = (fileinfo.exists() && fileinfo.isFile() &&
 		fileinfo.isReadable() && (fileinfo.size() > 0));
 
+	// The file or the algorithm changed: a hash still running is stale
+	cancelHash();
 	bHashCopy->setEnabled(false);
 	hashLabel->clear();
 
@@ -1394,19 +2093,19 @@ void MainWindow::on_cboxHashType_currentIndexChanged(int)
 		fileinfo.isReadable() && (fileinfo.size() > 0));
 	if (cboxHashType->currentIndex() != 0 && !leFile->text().isEmpty() && validFile)
 	{
-		// Store QByteArray in local variable to prevent use-after-free
-		// (toLatin1().data() returns pointer to temporary that would be destroyed)
-		QByteArray filename = leFile->text().toLatin1();
-		generateHash(filename.data(), cboxHashType->currentData().toInt());
+		generateHash(leFile->text(), cboxHashType->currentData().toInt());
 	}
 }
 
 void MainWindow::on_bHashGen_clicked()
 {
-	// Store QByteArray in local variable to prevent use-after-free
-	// (toLatin1().data() returns pointer to temporary that would be destroyed)
-	QByteArray filename = leFile->text().toLatin1();
-	generateHash(filename.data(), cboxHashType->currentData().toInt());
+	// Doubles as the cancel button while a hash runs
+	if (hashJob != NULL)
+	{
+		cancelHash();
+		return;
+	}
+	generateHash(leFile->text(), cboxHashType->currentData().toInt());
 }
 
 void MainWindow::on_bDetect_clicked()
@@ -1418,15 +2117,16 @@ void MainWindow::on_bDetect_clicked()
 	bVerify->setEnabled(false);
 	status = STATUS_READING;
     int FLASHTYPE; //= 0x1024; // Default to UFS
-	double mbpersec;
-	unsigned long long i, lasti, numsectors = 0ull;
+	unsigned long long i, numsectors = 0ull;
 	// changes ..
 	DWORD deviceID = cboxDevice->currentData().toUInt();  // Device ID stored as item data
-	hRawDisk = getHandleOnDevice(deviceID, GENERIC_READ);
+	DiskError diskError;
+	hRawDisk = getHandleOnDevice(deviceID, GENERIC_READ, false, false, &diskError);
 
 	// addition
-	if (!getLockOnVolume(hRawDisk))
+	if (hRawDisk == INVALID_HANDLE_VALUE || !getLockOnVolume(hRawDisk, &diskError))
 	{
+		showDiskError(diskError);
 		CloseHandle(hRawDisk);
 		status = STATUS_IDLE;
 		hRawDisk = INVALID_HANDLE_VALUE;
@@ -1434,8 +2134,9 @@ void MainWindow::on_bDetect_clicked()
 		setReadWriteButtonState();
 		return;
 	}
-	if (!unmountVolume(hRawDisk))
+	if (!unmountVolume(hRawDisk, &diskError))
 	{
+		showDiskError(diskError);
 		removeLockOnVolume(hRawDisk);
 		CloseHandle(hRawDisk);
 		status = STATUS_IDLE;
@@ -1454,8 +2155,9 @@ void MainWindow::on_bDetect_clicked()
 	if (partitionCheckBox->isChecked())
 	{
 		// Read MBR partition table
-		sectorData = readSectorDataFromHandle(hRawDisk, 0, 1ul, 512ul);
-		if (sectorData != NULL)
+		bufferPool.reserve(1024ul * sectorsize);
+		sectorData = bufferPool.acquire();
+		if (sectorData != NULL && readSectorDataFromHandle(hRawDisk, sectorData, 0, 1ul, 512ul))
 		{
 			numsectors = 1ul;
 			// Read partition information - verify buffer has enough data for MBR partition table
@@ -1473,10 +2175,10 @@ void MainWindow::on_bDetect_clicked()
 					numsectors = partitionStartSector + partitionNumSectors;
 				}
 			}
-			// Clean up MBR sectorData before it gets overwritten by detection read
-			delete[] sectorData;
-			sectorData = NULL;
 		}
+		// Return the MBR buffer before the detection read borrows one
+		bufferPool.release(sectorData);
+		sectorData = NULL;
 	}
 	if (numsectors == 0ul)
 	{
@@ -1487,19 +2189,34 @@ void MainWindow::on_bDetect_clicked()
 		// Cap numsectors at INT_MAX to prevent overflow when casting to int
 			progressbar->setRange(0, (int)qMin(numsectors, (unsigned long long)INT_MAX));
 	}
-	lasti = 0ul;
-	update_timer.start();
-	elapsed_timer->start();
 	const unsigned long long sectorsToRead = 64;
-	// Note: Loop intentionally executes exactly once (i < 1) to read first sector block for detection
-	// The status check allows cancellation during the read operation
+	// The first sectors (protective MBR, GPT header and entries) are read on
+	// the transfer worker like any other transfer
 	if (status == STATUS_READING)
 	{
-		i = 0ul;
-		sectorData = readSectorDataFromHandle(hRawDisk, i, sectorsToRead, sectorsize);
-
-		if (sectorData == NULL)
+		bufferPool.reserve(1024ul * sectorsize);
+		sectorData = bufferPool.acquire();
+		DiskError readError;
+		TransferPipeline::Result result = TransferPipeline::RESULT_READ_ERROR;
+		if (sectorData != NULL)
+		{
+			result = runTransfer([&](TransferPipeline::ProgressFunc progress) {
+				if (!readSectorDataFromHandle(hRawDisk, sectorData, 0ull, sectorsToRead, sectorsize, false, &readError))
+				{
+					return TransferPipeline::RESULT_READ_ERROR;
+				}
+				progress(sectorsToRead);
+				return TransferPipeline::RESULT_OK;
+			}, numsectors);
+		}
+		if (result != TransferPipeline::RESULT_OK)
 		{
+			if (sectorData != NULL)
+			{
+				showDiskError(readError);
+			}
+			bufferPool.release(sectorData);
+			sectorData = NULL;
 			removeLockOnVolume(hRawDisk);
 			CloseHandle(hRawDisk);
 			// Note: hFile is not opened in on_bDetect_clicked, so only close if valid
@@ -1517,8 +2234,13 @@ void MainWindow::on_bDetect_clicked()
 	// Use calculated size instead of hard-coded value (was 32678, typo for 32768 = 64*512)
 	int actualBlobSize = (int)(sectorsToRead * sectorsize);
 	// Use QByteArray constructor for DEEP COPY instead of fromRawData() which creates shallow copy
-	// This prevents use-after-free when sectorData is deleted later
-	blob.append(QByteArray(sectorData, actualBlobSize));
+	// This prevents use-after-free when sectorData is returned to the pool below
+	if (sectorData != NULL)
+	{
+		blob.append(QByteArray(sectorData, actualBlobSize));
+	}
+	bufferPool.release(sectorData);
+	sectorData = NULL;
 
 	// do something with sectorData
 	//
@@ -1652,17 +2374,6 @@ void MainWindow::on_bDetect_clicked()
 				// Hit the White space
 				break;
 			}
-
-			if (update_timer.elapsed() >= ONE_SEC_IN_MS)
-			{
-				mbpersec = (((double)sectorsize * (i - lasti)) * ((float)ONE_SEC_IN_MS / update_timer.elapsed())) / 1024.0 / 1024.0;
-				statusbar->showMessage(QString("%1MB/s").arg(mbpersec));
-				update_timer.start();
-				elapsed_timer->update(i, numsectors);
-				lasti = i;
-			}
-			progressbar->setValue(i);
-			QCoreApplication::processEvents();
 		}
 
 		// Create model ONCE after collecting all partition data (moved out of loop to prevent memory leak)
@@ -1686,10 +2397,6 @@ void MainWindow::on_bDetect_clicked()
 		this->PartView->horizontalHeader()->setVisible(true);
 		this->PartView->horizontalHeader()->setStretchLastSection(true);
 		this->PartView->show();
-
-		// Clean up sectorData after processing
-		delete[] sectorData;
-		sectorData = NULL;
 	}
 
 	removeLockOnVolume(hRawDisk);
@@ -1706,7 +2413,7 @@ void MainWindow::on_bDetect_clicked()
 	setReadWriteButtonState();
 	bDetect->setEnabled(true);
 
-	updateHashControls();
+	// Detect touches only the device; a hash of the image file keeps running
 	if (status == STATUS_EXIT)
 	{
 		close();
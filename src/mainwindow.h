@@ -30,6 +30,14 @@
 #include <QElapsedTimer>
 //#include <memory>
 #include "ui_mainwindow.h"
+#include "bufferpool.h"
+#include "filecache.h"
+#include "hashcache.h"
+#include "transferworker.h"
+
+struct DiskError;
+class SparseImage;
+class VirtualDisk;
 
 class QClipboard;
 class ElapsedTimer;
@@ -56,6 +64,8 @@ private:
 	QList<QString> tm_partition_end;
 	QList<QString> tm_partition_size;
 };
+struct HashJob;
+
 class MainWindow : public QMainWindow, public Ui::MainWindow
 {
 	Q_OBJECT
@@ -75,6 +85,7 @@ public:
 protected slots:
 	void on_tbBrowse_clicked();
 	void on_bCancel_clicked();
+	void on_bPause_clicked();
 	void on_bWrite_clicked();
 	void on_bRead_clicked();
 	void on_bVerify_clicked();
@@ -98,19 +109,45 @@ private:
 	void initializeHomeDir();
 	void updateHashControls();
 	void adjustWindowToScreen();
+	TransferPipeline::Result runTransfer(TransferWorker::Job job, unsigned long long numsectors);
+	void showDiskError(const DiskError& error);
+	void showSparseImageError(const SparseImage& image);
+	void showVirtualDiskError(const VirtualDisk& disk);
 
 	HANDLE hVolume;
 	HANDLE hFile;
 	HANDLE hRawDisk;
 	static const unsigned short ONE_SEC_IN_MS = 1000;
+	static const int PROGRESS_INTERVAL_MS = 100;  // how often the UI samples a running transfer
 	unsigned long long sectorsize;
 	int status;
 	char* sectorData;
 	char* sectorData2 = nullptr; //for verify - initialized to prevent use of uninitialized pointer in destructor
+	BufferPool bufferPool;  // sectorData/sectorData2 and the transfer pipeline borrow from here
+	// Verify keeps two requests per chunk in flight, which must stay within
+	// the 64 handles WaitForMultipleObjects accepts
+	static const unsigned int MAX_QUEUE_DEPTH = 32;
+	unsigned int queueDepth = 4;  // chunks in flight during read/write/verify
+	bool adaptiveTransfer = true;  // ChunkController tunes chunk size and depth
+	unsigned int sparseBlockSize = 4096;  // block size of Android sparse images read
+	FileCache::Policy fileCachePolicy = FileCache::POLICY_SEQUENTIAL;  // for buffered image files
+	bool mappedSource = false;  // write and verify map buffered images instead of reading them
+	unsigned long long mappedWindowBytes = 256ull * 1024ull * 1024ull;
+	TransferWorker transferWorker;  // read/write/verify/detect I/O runs here, off the GUI thread
 	QElapsedTimer update_timer;
 	ElapsedTimer* elapsed_timer = NULL;
 	QClipboard* clipboard;
-	void generateHash(char* filename, int hashish);
+	TransferWorker hashWorker;  // "Generate" hashing runs here, next to any transfer
+	HashJob* hashJob = NULL;
+	QTimer hashTimer;
+	QProgressBar* hashProgress = NULL;
+	HashCache hashCache;  // digests of files hashed before, saved with the settings
+	void generateHash(const QString& filename, int hashish);
+	void sampleHash();
+	void cancelHash();
+	void endHash();
+	void showHash(const QString& hash);
+	void rememberHash(const QString& path, int hashish, const QString& hash);
 	QString myHomeDir;
 	QByteArray swapper(QByteArray input);
 };
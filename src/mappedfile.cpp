@@ -0,0 +1,192 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include "mappedfile.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#ifdef _WIN32
+// PrefetchVirtualMemory is Windows 8+, looked up at run time
+struct PrefetchRange
+{
+	PVOID address;
+	SIZE_T bytes;
+};
+typedef BOOL (WINAPI *PrefetchVirtualMemoryFunc)(HANDLE process, ULONG_PTR count, PrefetchRange* ranges, ULONG flags);
+#endif
+
+MappedFile::MappedFile(IoHandle handle, unsigned long long filesize, unsigned long long windowsize)
+	: handle(handle), filesize(filesize), windowsize(windowsize), valid(false), current(0ull), maps(0ull)
+{
+	const unsigned long long granularity = 1024ull * 1024ull;
+	this->windowsize = std::max(granularity, (windowsize + granularity - 1) / granularity * granularity);
+#ifdef _WIN32
+	mapping = NULL;
+	if (filesize > 0ull)
+	{
+		mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	valid = (mapping != NULL);
+#else
+	valid = (filesize > 0ull);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	for (auto& entry : windows)
+	{
+		unmapView(entry.second.data, entry.second.bytes);
+	}
+#ifdef _WIN32
+	if (mapping != NULL)
+	{
+		CloseHandle(mapping);
+	}
+#endif
+}
+
+const char* MappedFile::acquire(unsigned long long offset, size_t bytes, size_t alignment)
+{
+	unsigned long long index = offset / windowsize;
+	unsigned long long base = index * windowsize;
+	if (!valid || bytes == 0 || offset + bytes > filesize || offset + bytes > base + windowsize)
+	{
+		return NULL;
+	}
+	auto found = windows.find(index);
+	if (found == windows.end())
+	{
+		Window window;
+		window.bytes = (size_t)std::min(windowsize, filesize - base);
+		window.data = mapView(base, window.bytes);
+		window.users = 0;
+		window.prefetched = 0;
+		if (window.data == NULL)
+		{
+			return NULL;
+		}
+		found = windows.insert(std::make_pair(index, window)).first;
+		++maps;
+	}
+	Window& window = found->second;
+	const char* data = window.data + (size_t)(offset - base);
+	if (alignment > 1 && (uintptr_t)data % alignment != 0)
+	{
+		return NULL;
+	}
+	++window.users;
+	if (index != current)
+	{
+		current = index;
+		unmapIdle();
+	}
+	// Keep the pages ahead of the cursor coming in
+	size_t ahead = std::min(window.bytes, (size_t)(offset - base) + bytes + PREFETCH_BYTES);
+	while (window.prefetched < ahead)
+	{
+		size_t length = std::min(PREFETCH_BYTES, window.bytes - window.prefetched);
+		prefetch(window.data + window.prefetched, length);
+		window.prefetched += length;
+	}
+	return data;
+}
+
+void MappedFile::release(unsigned long long offset)
+{
+	auto found = windows.find(offset / windowsize);
+	if (found == windows.end() || found->second.users == 0)
+	{
+		return;
+	}
+	if (--found->second.users == 0 && found->first != current)
+	{
+		unmapView(found->second.data, found->second.bytes);
+		windows.erase(found);
+	}
+}
+
+void MappedFile::unmapIdle()
+{
+	for (auto entry = windows.begin(); entry != windows.end();)
+	{
+		if (entry->second.users == 0 && entry->first != current)
+		{
+			unmapView(entry->second.data, entry->second.bytes);
+			entry = windows.erase(entry);
+		}
+		else
+		{
+			++entry;
+		}
+	}
+}
+
+#ifdef _WIN32
+
+char* MappedFile::mapView(unsigned long long offset, size_t bytes)
+{
+	return (char*)MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)(offset & 0xFFFFFFFFull), bytes);
+}
+
+void MappedFile::unmapView(char* data, size_t bytes)
+{
+	(void)bytes;
+	UnmapViewOfFile(data);
+}
+
+void MappedFile::prefetch(char* data, size_t bytes)
+{
+	static PrefetchVirtualMemoryFunc prefetchVirtualMemory =
+		(PrefetchVirtualMemoryFunc)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory");
+	if (prefetchVirtualMemory != NULL)
+	{
+		PrefetchRange range = { data, bytes };
+		prefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+	}
+}
+
+#else // POSIX
+
+char* MappedFile::mapView(unsigned long long offset, size_t bytes)
+{
+	void* data = mmap(NULL, bytes, PROT_READ, MAP_SHARED, handle, (off_t)offset);
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+	madvise(data, bytes, MADV_SEQUENTIAL);
+	return (char*)data;
+}
+
+void MappedFile::unmapView(char* data, size_t bytes)
+{
+	munmap(data, bytes);
+}
+
+void MappedFile::prefetch(char* data, size_t bytes)
+{
+	madvise(data, bytes, MADV_WILLNEED);
+}
+
+#endif // _WIN32
@@ -0,0 +1,88 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <map>
+#include "asyncio.h"
+
+// A read-only file mapped in windows of windowSize() bytes, so the
+// transfer pipeline can hand chunks of an image straight to the device
+// write or the compare instead of reading them into a buffer first.
+//
+// Windows are mapped as chunks first reach them and unmapped once no chunk
+// uses them and the transfer has moved on, so only a window or two is
+// mapped at a time however large the file.  Pages up to PREFETCH_BYTES
+// ahead of the last chunk are faulted in asynchronously (MADV_WILLNEED /
+// PrefetchVirtualMemory on Windows 8 and later).
+//
+// acquire() returns NULL for anything it cannot map (a chunk straddling
+// two windows, past the end of the file, or address space running out);
+// the caller then reads that chunk as usual.  A read error on a mapped
+// page is not reported but faults, so this is for local image files only.
+class MappedFile
+{
+public:
+	static const unsigned long long DEFAULT_WINDOW = 256ull * 1024ull * 1024ull;
+	static const size_t PREFETCH_BYTES = 16 * 1024 * 1024;
+
+	// windowsize is rounded up to a whole MiB (a multiple of the mapping
+	// granularity everywhere)
+	MappedFile(IoHandle handle, unsigned long long filesize, unsigned long long windowsize = DEFAULT_WINDOW);
+	~MappedFile();
+
+	bool isValid() const { return valid; }
+	unsigned long long windowSize() const { return windowsize; }
+	// Windows mapped so far, for the debug log
+	unsigned long long mapCount() const { return maps; }
+
+	// The bytes at offset, with the pointer aligned to alignment, valid
+	// until release(offset); NULL when they cannot be used in place
+	const char* acquire(unsigned long long offset, size_t bytes, size_t alignment = 1);
+	void release(unsigned long long offset);
+
+private:
+	struct Window
+	{
+		char* data;
+		size_t bytes;
+		unsigned int users;
+		size_t prefetched;  // faulted in up to here
+	};
+
+	char* mapView(unsigned long long offset, size_t bytes);
+	void unmapView(char* data, size_t bytes);
+	void prefetch(char* data, size_t bytes);
+	void unmapIdle();
+
+	IoHandle handle;
+	unsigned long long filesize;
+	unsigned long long windowsize;
+	bool valid;
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+	std::map<unsigned long long, Window> windows;  // by window index
+	unsigned long long current;                     // window of the last chunk
+	unsigned long long maps;
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,97 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include "parallelhash.h"
+
+ParallelHash::ParallelHash(const std::vector<AddFunc>& hashes)
+	: hashes(hashes), data(NULL), bytes(0), generation(0ull), pending(0), stopping(false)
+{
+	// The first hash runs on the caller's thread
+	for (size_t hash = 1; hash < hashes.size(); ++hash)
+	{
+		workers.push_back(std::thread(&ParallelHash::workerLoop, this, hash));
+	}
+}
+
+ParallelHash::~ParallelHash()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	work.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void ParallelHash::addData(const char* data, size_t bytes)
+{
+	if (bytes == 0 || hashes.empty())
+	{
+		return;
+	}
+	if (!workers.empty())
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			this->data = data;
+			this->bytes = bytes;
+			pending = (unsigned int)workers.size();
+			++generation;
+		}
+		work.notify_all();
+	}
+	hashes[0](data, bytes);
+	// The caller may overwrite the block as soon as this returns
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [this]() { return pending == 0; });
+}
+
+void ParallelHash::workerLoop(size_t hash)
+{
+	unsigned long long seen = 0ull;
+	for (;;)
+	{
+		const char* block;
+		size_t length;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			work.wait(guard, [&]() { return stopping || generation > seen; });
+			if (generation == seen)
+			{
+				return;
+			}
+			seen = generation;
+			block = data;
+			length = bytes;
+		}
+		hashes[hash](block, length);
+		bool last;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			last = (--pending == 0);
+		}
+		if (last)
+		{
+			done.notify_one();
+		}
+	}
+}
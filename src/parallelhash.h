@@ -0,0 +1,61 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef PARALLELHASH_H
+#define PARALLELHASH_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Feeds one stream of data to several hashes at once, each on its own
+// thread, so hashing with all of them takes about as long as the slowest
+// alone.  The hashes read the caller's buffer in place (the first one on
+// the calling thread); addData() returns once all of them are through it,
+// so nothing is copied and the buffer, e.g. a TransferPipeline chunk, can
+// be reused right away.
+class ParallelHash
+{
+public:
+	typedef std::function<void(const char* data, size_t bytes)> AddFunc;
+
+	explicit ParallelHash(const std::vector<AddFunc>& hashes);
+	~ParallelHash();
+
+	void addData(const char* data, size_t bytes);
+
+private:
+	void workerLoop(size_t hash);
+
+	std::vector<AddFunc> hashes;
+	const char* data;               // the block being hashed
+	size_t bytes;
+	unsigned long long generation;  // blocks handed out so far
+	unsigned int pending;           // worker hashes still going through it
+	bool stopping;
+	std::mutex lock;
+	std::condition_variable work;
+	std::condition_variable done;
+	std::vector<std::thread> workers;
+};
+
+#endif // PARALLELHASH_H
@@ -0,0 +1,430 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include "cpufeatures.h"
+#include "sha.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SHA_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define TARGET_SHA
+#else
+#define TARGET_SHA __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+static const size_t BLOCK_BYTES = 64;
+
+// Compresses whole 64-byte blocks into state
+typedef void (*ShaBlockFunc)(uint32_t* state, const unsigned char* data, size_t blocks);
+
+static const uint32_t K256[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static uint32_t load32be(const unsigned char* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void store32be(unsigned char* p, uint32_t value)
+{
+	p[0] = (unsigned char)(value >> 24);
+	p[1] = (unsigned char)(value >> 16);
+	p[2] = (unsigned char)(value >> 8);
+	p[3] = (unsigned char)value;
+}
+
+static uint32_t rotl(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+static uint32_t rotr(uint32_t value, int bits)
+{
+	return (value >> bits) | (value << (32 - bits));
+}
+
+// The message schedule, kept as a ring of the last 16 words
+static uint32_t sha1Word(uint32_t* w, int i)
+{
+	if (i >= 16)
+	{
+		w[i & 15] = rotl(w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15], 1);
+	}
+	return w[i & 15];
+}
+
+// fkw is the round function plus the constant and the message word
+static void sha1Round(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d, uint32_t& e, uint32_t fkw)
+{
+	uint32_t t = rotl(a, 5) + e + fkw;
+	e = d;
+	d = c;
+	c = rotl(b, 30);
+	b = a;
+	a = t;
+}
+
+static void sha1Portable(uint32_t* state, const unsigned char* p, size_t blocks)
+{
+	for (; blocks > 0; --blocks, p += BLOCK_BYTES)
+	{
+		uint32_t w[16];
+		for (int i = 0; i < 16; ++i)
+		{
+			w[i] = load32be(p + 4 * i);
+		}
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+		// One loop per round function keeps the branches out of the rounds
+		for (int i = 0; i < 20; ++i)
+		{
+			sha1Round(a, b, c, d, e, ((b & c) | (~b & d)) + 0x5a827999 + sha1Word(w, i));
+		}
+		for (int i = 20; i < 40; ++i)
+		{
+			sha1Round(a, b, c, d, e, (b ^ c ^ d) + 0x6ed9eba1 + sha1Word(w, i));
+		}
+		for (int i = 40; i < 60; ++i)
+		{
+			sha1Round(a, b, c, d, e, ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc + sha1Word(w, i));
+		}
+		for (int i = 60; i < 80; ++i)
+		{
+			sha1Round(a, b, c, d, e, (b ^ c ^ d) + 0xca62c1d6 + sha1Word(w, i));
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+static uint32_t sha256Word(uint32_t* w, int i)
+{
+	if (i >= 16)
+	{
+		uint32_t w15 = w[(i - 15) & 15];
+		uint32_t w2 = w[(i - 2) & 15];
+		w[i & 15] += (rotr(w15, 7) ^ rotr(w15, 18) ^ (w15 >> 3)) + w[(i - 7) & 15] + (rotr(w2, 17) ^ rotr(w2, 19) ^ (w2 >> 10));
+	}
+	return w[i & 15];
+}
+
+static void sha256Portable(uint32_t* state, const unsigned char* p, size_t blocks)
+{
+	for (; blocks > 0; --blocks, p += BLOCK_BYTES)
+	{
+		uint32_t w[16];
+		for (int i = 0; i < 16; ++i)
+		{
+			w[i] = load32be(p + 4 * i);
+		}
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; ++i)
+		{
+			uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + sha256Word(w, i);
+			uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef SHA_X86
+// After Intel's SHA extensions reference code, unrolled so the message
+// schedule stays in registers.  Each SHA1RNDS4 does four rounds, taking
+// the round function as an immediate, and SHA1NEXTE derives their E from
+// the state four rounds back.
+TARGET_SHA static inline __m128i sha1Schedule(__m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+	return _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(m0, m1), m2), m3);
+}
+
+template <int func>
+TARGET_SHA static inline void sha1Rounds(__m128i& abcd, __m128i& prev, __m128i msg)
+{
+	__m128i e = _mm_sha1nexte_epu32(prev, msg);
+	prev = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e, func);
+}
+
+TARGET_SHA static void sha1Ni(uint32_t* state, const unsigned char* p, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ll, 0x08090a0b0c0d0e0fll);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+	__m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+	for (; blocks > 0; --blocks, p += BLOCK_BYTES)
+	{
+		const __m128i abcdsave = abcd;
+		__m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), mask);
+		__m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), mask);
+		__m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), mask);
+		__m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), mask);
+		__m128i prev = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, _mm_add_epi32(e0, m0), 0);
+		sha1Rounds<0>(abcd, prev, m1);
+		sha1Rounds<0>(abcd, prev, m2);
+		sha1Rounds<0>(abcd, prev, m3);
+		m0 = sha1Schedule(m0, m1, m2, m3);
+		sha1Rounds<0>(abcd, prev, m0);
+		m1 = sha1Schedule(m1, m2, m3, m0);
+		sha1Rounds<1>(abcd, prev, m1);
+		m2 = sha1Schedule(m2, m3, m0, m1);
+		sha1Rounds<1>(abcd, prev, m2);
+		m3 = sha1Schedule(m3, m0, m1, m2);
+		sha1Rounds<1>(abcd, prev, m3);
+		m0 = sha1Schedule(m0, m1, m2, m3);
+		sha1Rounds<1>(abcd, prev, m0);
+		m1 = sha1Schedule(m1, m2, m3, m0);
+		sha1Rounds<1>(abcd, prev, m1);
+		m2 = sha1Schedule(m2, m3, m0, m1);
+		sha1Rounds<2>(abcd, prev, m2);
+		m3 = sha1Schedule(m3, m0, m1, m2);
+		sha1Rounds<2>(abcd, prev, m3);
+		m0 = sha1Schedule(m0, m1, m2, m3);
+		sha1Rounds<2>(abcd, prev, m0);
+		m1 = sha1Schedule(m1, m2, m3, m0);
+		sha1Rounds<2>(abcd, prev, m1);
+		m2 = sha1Schedule(m2, m3, m0, m1);
+		sha1Rounds<2>(abcd, prev, m2);
+		m3 = sha1Schedule(m3, m0, m1, m2);
+		sha1Rounds<3>(abcd, prev, m3);
+		m0 = sha1Schedule(m0, m1, m2, m3);
+		sha1Rounds<3>(abcd, prev, m0);
+		m1 = sha1Schedule(m1, m2, m3, m0);
+		sha1Rounds<3>(abcd, prev, m1);
+		m2 = sha1Schedule(m2, m3, m0, m1);
+		sha1Rounds<3>(abcd, prev, m2);
+		m3 = sha1Schedule(m3, m0, m1, m2);
+		sha1Rounds<3>(abcd, prev, m3);
+		e0 = _mm_sha1nexte_epu32(prev, e0);
+		abcd = _mm_add_epi32(abcd, abcdsave);
+	}
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+TARGET_SHA static inline __m128i sha256Schedule(__m128i m0, __m128i m1, __m128i m2, __m128i m3)
+{
+	return _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3);
+}
+
+// Four rounds: SHA256RNDS2 does two on the state split as ABEF and CDGH
+TARGET_SHA static inline void sha256Rounds(__m128i& abef, __m128i& cdgh, __m128i msg, const uint32_t* k)
+{
+	__m128i wk = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)k));
+	cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+	abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0E));
+}
+
+TARGET_SHA static void sha256Ni(uint32_t* state, const unsigned char* p, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bll, 0x0405060700010203ll);
+	__m128i dcba = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xB1);
+	__m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1B);
+	__m128i abef = _mm_alignr_epi8(dcba, efgh, 8);
+	__m128i cdgh = _mm_blend_epi16(efgh, dcba, 0xF0);
+	for (; blocks > 0; --blocks, p += BLOCK_BYTES)
+	{
+		const __m128i abefsave = abef;
+		const __m128i cdghsave = cdgh;
+		__m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), mask);
+		__m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), mask);
+		__m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), mask);
+		__m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), mask);
+		sha256Rounds(abef, cdgh, m0, K256);
+		sha256Rounds(abef, cdgh, m1, K256 + 4);
+		sha256Rounds(abef, cdgh, m2, K256 + 8);
+		sha256Rounds(abef, cdgh, m3, K256 + 12);
+		for (int i = 16; i < 64; i += 16)
+		{
+			m0 = sha256Schedule(m0, m1, m2, m3);
+			sha256Rounds(abef, cdgh, m0, K256 + i);
+			m1 = sha256Schedule(m1, m2, m3, m0);
+			sha256Rounds(abef, cdgh, m1, K256 + i + 4);
+			m2 = sha256Schedule(m2, m3, m0, m1);
+			sha256Rounds(abef, cdgh, m2, K256 + i + 8);
+			m3 = sha256Schedule(m3, m0, m1, m2);
+			sha256Rounds(abef, cdgh, m3, K256 + i + 12);
+		}
+		abef = _mm_add_epi32(abef, abefsave);
+		cdgh = _mm_add_epi32(cdgh, cdghsave);
+	}
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+	__m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i*)state, _mm_blend_epi16(feba, dchg, 0xF0));
+	_mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif // SHA_X86
+
+struct ShaKernels
+{
+	ShaBlockFunc sha1;
+	ShaBlockFunc sha256;
+	const char* name;
+};
+
+static ShaKernels selectKernels(const CpuFeatures& cpu)
+{
+	ShaKernels kernels = { sha1Portable, sha256Portable, "portable" };
+#ifdef SHA_X86
+	if (cpu.sha && cpu.sse41 && cpu.ssse3)
+	{
+		kernels.sha1 = sha1Ni;
+		kernels.sha256 = sha256Ni;
+		kernels.name = "sha-ni";
+	}
+#else
+	(void)cpu;
+#endif
+	return kernels;
+}
+
+static ShaKernels& kernels()
+{
+	static ShaKernels selected = selectKernels(cpuFeatures());
+	return selected;
+}
+
+// Whole blocks go straight from data, only the ends through buffer
+static void absorb(ShaBlockFunc compress, uint32_t* state, unsigned char* buffer, size_t& buffered, unsigned long long& total, const char* data, size_t bytes)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	total += bytes;
+	if (buffered > 0)
+	{
+		size_t take = (bytes < BLOCK_BYTES - buffered) ? bytes : BLOCK_BYTES - buffered;
+		memcpy(buffer + buffered, p, take);
+		buffered += take;
+		p += take;
+		bytes -= take;
+		if (buffered < BLOCK_BYTES)
+		{
+			return;
+		}
+		compress(state, buffer, 1);
+		buffered = 0;
+	}
+	if (bytes >= BLOCK_BYTES)
+	{
+		compress(state, p, bytes / BLOCK_BYTES);
+		p += bytes - bytes % BLOCK_BYTES;
+		bytes %= BLOCK_BYTES;
+	}
+	memcpy(buffer, p, bytes);
+	buffered = bytes;
+}
+
+// The 0x80 byte, zeros and the length in bits, big-endian
+static void finish(ShaBlockFunc compress, uint32_t* state, const unsigned char* buffer, size_t buffered, unsigned long long total)
+{
+	unsigned char last[2 * BLOCK_BYTES];
+	memcpy(last, buffer, buffered);
+	last[buffered] = 0x80;
+	size_t bytes = (buffered + 1 + 8 <= BLOCK_BYTES) ? BLOCK_BYTES : 2 * BLOCK_BYTES;
+	memset(last + buffered + 1, 0, bytes - buffered - 1);
+	unsigned long long bits = total * 8;
+	store32be(last + bytes - 8, (uint32_t)(bits >> 32));
+	store32be(last + bytes - 4, (uint32_t)bits);
+	compress(state, last, bytes / BLOCK_BYTES);
+}
+
+Sha1Hash::Sha1Hash()
+	: buffered(0), total(0)
+{
+	static const uint32_t initial[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+	memcpy(state, initial, sizeof(state));
+}
+
+void Sha1Hash::addData(const char* data, size_t bytes)
+{
+	absorb(kernels().sha1, state, buffer, buffered, total, data, bytes);
+}
+
+void Sha1Hash::result(unsigned char digest[DIGEST_BYTES]) const
+{
+	uint32_t words[5];
+	memcpy(words, state, sizeof(words));
+	finish(kernels().sha1, words, buffer, buffered, total);
+	for (int i = 0; i < 5; ++i)
+	{
+		store32be(digest + 4 * i, words[i]);
+	}
+}
+
+Sha256Hash::Sha256Hash()
+	: buffered(0), total(0)
+{
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(state, initial, sizeof(state));
+}
+
+void Sha256Hash::addData(const char* data, size_t bytes)
+{
+	absorb(kernels().sha256, state, buffer, buffered, total, data, bytes);
+}
+
+void Sha256Hash::result(unsigned char digest[DIGEST_BYTES]) const
+{
+	uint32_t words[8];
+	memcpy(words, state, sizeof(words));
+	finish(kernels().sha256, words, buffer, buffered, total);
+	for (int i = 0; i < 8; ++i)
+	{
+		store32be(digest + 4 * i, words[i]);
+	}
+}
+
+const char* shaKernel()
+{
+	return kernels().name;
+}
+
+void selectShaKernels(const CpuFeatures& features)
+{
+	kernels() = selectKernels(supportedCpuFeatures(features));
+}
@@ -0,0 +1,71 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef SHA_H
+#define SHA_H
+
+#include <cstddef>
+#include <cstdint>
+#include "cpufeatures.h"
+
+// SHA-1 and SHA-256 (FIPS 180-4), streaming, with the same results as
+// QCryptographicHash.  The block function runs on the SHA extensions
+// (SHA-NI) when the CPU has them, several times faster than the portable
+// code used otherwise.
+class Sha1Hash
+{
+public:
+	static const size_t DIGEST_BYTES = 20;
+
+	Sha1Hash();
+
+	void addData(const char* data, size_t bytes);
+	void result(unsigned char digest[DIGEST_BYTES]) const;
+
+private:
+	uint32_t state[5];
+	unsigned char buffer[64];
+	size_t buffered;
+	unsigned long long total;
+};
+
+class Sha256Hash
+{
+public:
+	static const size_t DIGEST_BYTES = 32;
+
+	Sha256Hash();
+
+	void addData(const char* data, size_t bytes);
+	void result(unsigned char digest[DIGEST_BYTES]) const;
+
+private:
+	uint32_t state[8];
+	unsigned char buffer[64];
+	size_t buffered;
+	unsigned long long total;
+};
+
+// "sha-ni" or "portable", for the debug log
+const char* shaKernel();
+// Picks the block functions again as if the CPU had only features, for
+// tests and benchmarks; not while anything is hashing
+void selectShaKernels(const CpuFeatures& features);
+
+#endif // SHA_H
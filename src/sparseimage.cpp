@@ -0,0 +1,500 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include "crc32.h"
+#include "sparseimage.h"
+#include "zerodetect.h"
+
+// On-disk layout, all little endian (system/core/libsparse/sparse_format.h)
+static const size_t FILE_HEADER_BYTES = 28;
+static const size_t CHUNK_HEADER_BYTES = 12;
+static const uint16_t CHUNK_TYPE_RAW = 0xCAC1;
+static const uint16_t CHUNK_TYPE_FILL = 0xCAC2;
+static const uint16_t CHUNK_TYPE_DONT_CARE = 0xCAC3;
+static const uint16_t CHUNK_TYPE_CRC32 = 0xCAC4;
+static const size_t WINDOW_BYTES = 64 * 1024;
+
+static uint16_t le16(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static uint32_t le32(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void putLe16(char* p, uint16_t value)
+{
+	p[0] = (char)(value & 0xFF);
+	p[1] = (char)(value >> 8);
+}
+
+static void putLe32(char* p, uint32_t value)
+{
+	putLe16(p, (uint16_t)(value & 0xFFFF));
+	putLe16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void putChunkHeader(char* p, uint16_t type, uint32_t chunkblocks, uint32_t totalbytes)
+{
+	putLe16(p, type);
+	putLe16(p + 2, 0);
+	putLe32(p + 4, chunkblocks);
+	putLe32(p + 8, totalbytes);
+}
+
+bool SparseImage::hasMagic(const char* header, size_t bytes)
+{
+	return bytes >= 4 && le32(header) == MAGIC;
+}
+
+SparseImage::SparseImage()
+	: sectorsize(512ull), numsectors(0ull), databytes(0ull), windowoffset(0ull), windowbytes(0),
+	err(SPARSE_OK), ioerror(0), badchunk(0)
+{
+}
+
+bool SparseImage::open(IoHandle handle, unsigned long long sectorsize)
+{
+	this->sectorsize = sectorsize;
+	numsectors = 0ull;
+	databytes = 0ull;
+	extentlist.clear();
+	checksumlist.clear();
+	window.resize(WINDOW_BYTES);
+	windowbytes = 0;
+	err = SPARSE_OK;
+	ioerror = 0;
+	badchunk = 0;
+
+	AsyncIo* io = AsyncIo::create(1);
+	char header[FILE_HEADER_BYTES];
+	bool ok = readAt(io, handle, 0ull, header, sizeof(header));
+	if (!ok)
+	{
+		delete io;
+		return fail((err == SPARSE_READ_ERROR) ? err : SPARSE_BAD_HEADER, 0);
+	}
+	uint16_t major = le16(header + 4);
+	uint16_t fileheaderbytes = le16(header + 8);
+	uint16_t chunkheaderbytes = le16(header + 10);
+	uint32_t blocksize = le32(header + 12);
+	uint32_t totalblocks = le32(header + 16);
+	uint32_t totalchunks = le32(header + 20);
+	if (!hasMagic(header, sizeof(header)) || major != 1 || fileheaderbytes < FILE_HEADER_BYTES || chunkheaderbytes < CHUNK_HEADER_BYTES ||
+		blocksize == 0 || blocksize % 4 != 0)
+	{
+		delete io;
+		return fail(SPARSE_BAD_HEADER, 0);
+	}
+	// Extents are counted in sectors of the sink
+	if (blocksize % sectorsize != 0)
+	{
+		delete io;
+		return fail(SPARSE_BAD_BLOCK_SIZE, 0);
+	}
+	unsigned long long sectorsperblock = blocksize / sectorsize;
+
+	unsigned long long offset = fileheaderbytes;
+	unsigned long long blocks = 0ull;
+	uint32_t chunk;
+	for (chunk = 0; chunk < totalchunks; ++chunk)
+	{
+		char chunkheader[CHUNK_HEADER_BYTES];
+		if (!readAt(io, handle, offset, chunkheader, sizeof(chunkheader)))
+		{
+			ok = false;
+			break;
+		}
+		uint16_t type = le16(chunkheader);
+		unsigned long long chunkblocks = le32(chunkheader + 4);
+		unsigned long long totalbytes = le32(chunkheader + 8);
+		unsigned long long payload = offset + chunkheaderbytes;
+		unsigned long long expanded = chunkblocks * blocksize;
+		switch (type)
+		{
+		case CHUNK_TYPE_RAW:
+			ok = (totalbytes == chunkheaderbytes + expanded);
+			TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_DATA, chunkblocks * sectorsperblock, payload, 0, sectorsize);
+			databytes += expanded;
+			break;
+		case CHUNK_TYPE_FILL:
+		{
+			char pattern[4] = { 0 };
+			ok = (totalbytes == chunkheaderbytes + sizeof(pattern)) && readAt(io, handle, payload, pattern, sizeof(pattern));
+			uint32_t fill;
+			memcpy(&fill, pattern, sizeof(fill));
+			TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_FILL, chunkblocks * sectorsperblock, 0ull, fill, sectorsize);
+			databytes += expanded;
+			break;
+		}
+		case CHUNK_TYPE_DONT_CARE:
+			ok = (totalbytes == chunkheaderbytes);
+			TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_SKIP, chunkblocks * sectorsperblock, 0ull, 0, sectorsize);
+			break;
+		case CHUNK_TYPE_CRC32:
+		{
+			char crc[4] = { 0 };
+			ok = (chunkblocks == 0 && totalbytes == chunkheaderbytes + sizeof(crc)) && readAt(io, handle, payload, crc, sizeof(crc));
+			Checksum checksum = { blocks * blocksize, le32(crc) };
+			checksumlist.push_back(checksum);
+			break;
+		}
+		default:
+			ok = false;
+			break;
+		}
+		if (!ok)
+		{
+			break;
+		}
+		blocks += chunkblocks;
+		offset += totalbytes;
+	}
+	delete io;
+	if (!ok)
+	{
+		return fail((err == SPARSE_OK) ? SPARSE_BAD_CHUNK : err, chunk);
+	}
+	if (blocks != totalblocks)
+	{
+		return fail(SPARSE_BAD_CHUNK, totalchunks);
+	}
+	numsectors = blocks * sectorsperblock;
+	return true;
+}
+
+bool SparseImage::readAt(AsyncIo* io, IoHandle handle, unsigned long long offset, char* data, size_t bytes)
+{
+	if (offset < windowoffset || offset + bytes > windowoffset + windowbytes)
+	{
+		IoRequest request;
+		request.op = IoRequest::OP_READ;
+		request.handle = handle;
+		request.offset = offset;
+		request.data = window.data();
+		request.length = (unsigned long)window.size();
+		request.context = NULL;
+		request.transferred = 0;
+		request.error = 0;
+		io->submit(&request);
+		io->wait();
+		windowoffset = offset;
+		windowbytes = request.transferred;
+		if (request.error != 0)
+		{
+			windowbytes = 0;
+			ioerror = request.error;
+			err = SPARSE_READ_ERROR;
+			return false;
+		}
+		// Short only at the end of the file: the image is cut off
+		if (bytes > windowbytes)
+		{
+			err = SPARSE_BAD_CHUNK;
+			return false;
+		}
+	}
+	memcpy(data, window.data() + (offset - windowoffset), bytes);
+	return true;
+}
+
+bool SparseImage::fail(Error error, unsigned long chunk)
+{
+	err = error;
+	badchunk = chunk;
+	extentlist.clear();
+	checksumlist.clear();
+	return false;
+}
+
+SparseImageWriter::SparseImageWriter(IoHandle handle, uint32_t blocksize)
+	: handle(handle), blocksize(blocksize), io(NULL), writing(false), current(0), used(0), partialbytes(0),
+	kind(CHUNK_NONE), fill(0), chunkblocks(0), rawheader(0), fileoffset(0ull), totalblocks(0ull), totalchunks(0), ioerror(0)
+{
+	memset(&request, 0, sizeof(request));
+}
+
+SparseImageWriter::~SparseImageWriter()
+{
+	if (io != NULL)
+	{
+		waitForWrite();
+		delete io;
+	}
+}
+
+void SparseImageWriter::start()
+{
+	// Room for at least one RAW block with its header
+	size_t size = BUFFER_BYTES;
+	if (size < blocksize + FILE_HEADER_BYTES + 2 * CHUNK_HEADER_BYTES)
+	{
+		size = blocksize + FILE_HEADER_BYTES + 2 * CHUNK_HEADER_BYTES;
+	}
+	io = AsyncIo::create(1);
+	buffers[0].resize(size);
+	buffers[1].resize(size);
+	partial.resize(blocksize);
+	// Placeholder, finish() writes the real header once the counts are known
+	memset(buffers[current].data(), 0, FILE_HEADER_BYTES);
+	used = FILE_HEADER_BYTES;
+}
+
+bool SparseImageWriter::process(const char* data, size_t bytes)
+{
+	if (io == NULL)
+	{
+		start();
+	}
+	if (partialbytes > 0)
+	{
+		size_t take = (bytes < blocksize - partialbytes) ? bytes : (blocksize - partialbytes);
+		memcpy(partial.data() + partialbytes, data, take);
+		partialbytes += take;
+		data += take;
+		bytes -= take;
+		if (partialbytes < blocksize)
+		{
+			return true;
+		}
+		partialbytes = 0;
+		if (!addBlock(partial.data()))
+		{
+			return false;
+		}
+	}
+	for (; bytes >= blocksize; data += blocksize, bytes -= blocksize)
+	{
+		if (!addBlock(data))
+		{
+			return false;
+		}
+	}
+	memcpy(partial.data(), data, bytes);
+	partialbytes = bytes;
+	return true;
+}
+
+bool SparseImageWriter::finish()
+{
+	if (io == NULL)
+	{
+		start();
+	}
+	if (partialbytes > 0)
+	{
+		memset(partial.data() + partialbytes, 0, blocksize - partialbytes);
+		partialbytes = 0;
+		if (!addBlock(partial.data()))
+		{
+			return false;
+		}
+	}
+	if (!endChunk() || !flush() || !waitForWrite())
+	{
+		return false;
+	}
+	char header[FILE_HEADER_BYTES];
+	putLe32(header, SparseImage::MAGIC);
+	putLe16(header + 4, 1);
+	putLe16(header + 6, 0);
+	putLe16(header + 8, (uint16_t)FILE_HEADER_BYTES);
+	putLe16(header + 10, (uint16_t)CHUNK_HEADER_BYTES);
+	putLe32(header + 12, blocksize);
+	putLe32(header + 16, (uint32_t)totalblocks);
+	putLe32(header + 20, (uint32_t)totalchunks);
+	putLe32(header + 24, 0);
+	return writeAt(0ull, header, sizeof(header));
+}
+
+bool SparseImageWriter::addBlock(const char* data)
+{
+	ChunkKind blockkind = CHUNK_RAW;
+	uint32_t pattern = 0;
+	if (isZeroFilled(data, blocksize))
+	{
+		blockkind = CHUNK_DONT_CARE;
+	}
+	else if (memcmp(data, data + sizeof(pattern), blocksize - sizeof(pattern)) == 0)
+	{
+		// Every word equals the one before it
+		blockkind = CHUNK_FILL;
+		memcpy(&pattern, data, sizeof(pattern));
+	}
+	if (blockkind != kind || pattern != fill || chunkblocks == 0xFFFFFFFFu ||
+		(kind == CHUNK_RAW && used + blocksize > buffers[current].size()))
+	{
+		if (!endChunk())
+		{
+			return false;
+		}
+		kind = blockkind;
+		fill = pattern;
+		if (kind == CHUNK_RAW)
+		{
+			// The data follows the header, which endChunk() fills in
+			if (used + CHUNK_HEADER_BYTES + blocksize > buffers[current].size() && !flush())
+			{
+				return false;
+			}
+			rawheader = used;
+			used += CHUNK_HEADER_BYTES;
+		}
+	}
+	if (kind == CHUNK_RAW)
+	{
+		memcpy(buffers[current].data() + used, data, blocksize);
+		used += blocksize;
+	}
+	++chunkblocks;
+	++totalblocks;
+	return true;
+}
+
+bool SparseImageWriter::endChunk()
+{
+	ChunkKind ended = kind;
+	uint32_t blocks = chunkblocks;
+	kind = CHUNK_NONE;
+	chunkblocks = 0;
+	if (ended == CHUNK_NONE)
+	{
+		return true;
+	}
+	++totalchunks;
+	if (ended == CHUNK_RAW)
+	{
+		putChunkHeader(buffers[current].data() + rawheader, CHUNK_TYPE_RAW, blocks, (uint32_t)(CHUNK_HEADER_BYTES + (size_t)blocks * blocksize));
+		return true;
+	}
+	char header[CHUNK_HEADER_BYTES + sizeof(uint32_t)];
+	if (ended == CHUNK_FILL)
+	{
+		putChunkHeader(header, CHUNK_TYPE_FILL, blocks, (uint32_t)sizeof(header));
+		memcpy(header + CHUNK_HEADER_BYTES, &fill, sizeof(fill));
+		return append(header, sizeof(header));
+	}
+	putChunkHeader(header, CHUNK_TYPE_DONT_CARE, blocks, (uint32_t)CHUNK_HEADER_BYTES);
+	return append(header, CHUNK_HEADER_BYTES);
+}
+
+bool SparseImageWriter::append(const char* data, size_t bytes)
+{
+	if (used + bytes > buffers[current].size() && !flush())
+	{
+		return false;
+	}
+	memcpy(buffers[current].data() + used, data, bytes);
+	used += bytes;
+	return true;
+}
+
+bool SparseImageWriter::flush()
+{
+	if (used == 0)
+	{
+		return true;
+	}
+	// One write in flight while the other buffer fills
+	if (!waitForWrite())
+	{
+		return false;
+	}
+	request.op = IoRequest::OP_WRITE;
+	request.handle = handle;
+	request.offset = fileoffset;
+	request.data = buffers[current].data();
+	request.length = (unsigned long)used;
+	request.context = NULL;
+	request.transferred = 0;
+	request.error = 0;
+	io->submit(&request);
+	writing = true;
+	fileoffset += used;
+	current ^= 1;
+	used = 0;
+	return true;
+}
+
+bool SparseImageWriter::waitForWrite()
+{
+	if (!writing)
+	{
+		return true;
+	}
+	io->wait();
+	writing = false;
+	if (request.error != 0 || request.transferred < request.length)
+	{
+		ioerror = request.error;
+		return false;
+	}
+	return true;
+}
+
+bool SparseImageWriter::writeAt(unsigned long long offset, char* data, size_t bytes)
+{
+	request.op = IoRequest::OP_WRITE;
+	request.handle = handle;
+	request.offset = offset;
+	request.data = data;
+	request.length = (unsigned long)bytes;
+	request.context = NULL;
+	request.transferred = 0;
+	request.error = 0;
+	io->submit(&request);
+	writing = true;
+	return waitForWrite();
+}
+
+SparseChecksumStage::SparseChecksumStage(const SparseImage& image)
+	: checksums(image.checksums()), nextchecksum(0), position(0ull), crc(0)
+{
+}
+
+bool SparseChecksumStage::process(const char* data, size_t bytes)
+{
+	while (bytes > 0 || (nextchecksum < checksums.size() && checksums[nextchecksum].offset == position))
+	{
+		// Up to the next checkpoint, which may fall inside this block
+		size_t length = bytes;
+		if (nextchecksum < checksums.size() && checksums[nextchecksum].offset - position < length)
+		{
+			length = (size_t)(checksums[nextchecksum].offset - position);
+		}
+		crc = crc32Update(crc, data, length);
+		data += length;
+		bytes -= length;
+		position += length;
+		if (nextchecksum < checksums.size() && checksums[nextchecksum].offset == position)
+		{
+			if (checksums[nextchecksum].crc != crc)
+			{
+				return false;
+			}
+			++nextchecksum;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,173 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef SPARSEIMAGE_H
+#define SPARSEIMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "asyncio.h"
+#include "transferpipeline.h"
+
+// Android sparse image (simg, what img2simg writes and fastboot flashes): a
+// file header followed by chunks, each a header and its payload.  RAW chunks
+// carry data, FILL chunks a 32-bit pattern, DONT_CARE chunks nothing, and
+// CRC32 chunks the CRC-32 of everything expanded so far.
+//
+// open() walks the chunk headers only (payloads are seeked over) and turns
+// them into a TransferPipeline::ExtentList, so the image is written or
+// verified in one streaming pass: RAW data is read straight from its offset
+// in the file, FILL is expanded in memory and DONT_CARE is never touched.
+// Payloads sit at arbitrary offsets, so the handle must not be unbuffered.
+class SparseImage
+{
+public:
+	enum Error { SPARSE_OK = 0, SPARSE_READ_ERROR, SPARSE_BAD_HEADER, SPARSE_BAD_CHUNK, SPARSE_BAD_BLOCK_SIZE };
+
+	// A CRC32 chunk: crc of the first offset bytes of the expanded image
+	struct Checksum
+	{
+		unsigned long long offset;
+		uint32_t crc;
+	};
+
+	static const uint32_t MAGIC = 0xED26FF3Au;
+
+	// True when header (the first bytes of a file) starts with the magic
+	static bool hasMagic(const char* header, size_t bytes);
+
+	SparseImage();
+
+	// False on a damaged image, or one whose block size is not a multiple
+	// of sectorsize; see error() and ioError()
+	bool open(IoHandle handle, unsigned long long sectorsize);
+	Error error() const { return err; }
+	// Win32 error code / errno for SPARSE_READ_ERROR
+	unsigned long ioError() const { return ioerror; }
+	// Chunk the error was found in, counting from 0
+	unsigned long badChunk() const { return badchunk; }
+
+	// Size of the expanded image
+	unsigned long long numSectors() const { return numsectors; }
+	// Bytes that actually go to the sink: RAW and FILL, not DONT_CARE
+	unsigned long long dataBytes() const { return databytes; }
+	const TransferPipeline::ExtentList& extents() const { return extentlist; }
+	const std::vector<Checksum>& checksums() const { return checksumlist; }
+
+private:
+	bool readAt(AsyncIo* io, IoHandle handle, unsigned long long offset, char* data, size_t bytes);
+	bool fail(Error error, unsigned long chunk);
+
+	unsigned long long sectorsize;
+	unsigned long long numsectors;
+	unsigned long long databytes;
+	TransferPipeline::ExtentList extentlist;
+	std::vector<Checksum> checksumlist;
+	std::vector<char> window;       // read-ahead over the chunk headers
+	unsigned long long windowoffset;
+	size_t windowbytes;
+	Error err;
+	unsigned long ioerror;
+	unsigned long badchunk;
+};
+
+// Writes the data of a scan (TransferPipeline::scan(), in sector order) to
+// handle as a sparse image in one streaming pass: blocks of zeros become
+// DONT_CARE chunks, blocks repeating one 32-bit pattern FILL chunks, and
+// everything else RAW chunks; runs of the same kind share a chunk.  Note
+// that DONT_CARE leaves a target's old contents in place when flashed, so
+// the result restores exactly onto blank or trimmed media.
+//
+// Chunks are assembled in one buffer while the previous one is written, and
+// finish() back-patches the block and chunk counts into the file header.  A
+// partial last block is padded with zeros, as simg sizes are whole blocks.
+class SparseImageWriter
+{
+public:
+	static const bool IN_ORDER = true;
+	static const size_t BUFFER_BYTES = 4 * 1024 * 1024;
+
+	// blocksize must be a multiple of 4
+	SparseImageWriter(IoHandle handle, uint32_t blocksize);
+	~SparseImageWriter();
+
+	bool process(const char* data, size_t bytes);
+	// Closes the last chunk and writes the file header; call once, also
+	// after a cancel so the part read is a valid image
+	bool finish();
+
+	// Win32 error code / errno of the failed write
+	unsigned long ioError() const { return ioerror; }
+	uint32_t blockSize() const { return blocksize; }
+	unsigned long long imageBytes() const { return fileoffset + used; }
+	unsigned long long totalBlocks() const { return totalblocks; }
+	unsigned long totalChunks() const { return totalchunks; }
+
+private:
+	enum ChunkKind { CHUNK_NONE = 0, CHUNK_RAW, CHUNK_FILL, CHUNK_DONT_CARE };
+
+	void start();
+	bool addBlock(const char* data);
+	bool endChunk();
+	bool append(const char* data, size_t bytes);
+	bool flush();
+	bool waitForWrite();
+	bool writeAt(unsigned long long offset, char* data, size_t bytes);
+
+	IoHandle handle;
+	uint32_t blocksize;
+	AsyncIo* io;
+	IoRequest request;
+	bool writing;
+	std::vector<char> buffers[2];
+	int current;                    // buffer being filled
+	size_t used;
+	std::vector<char> partial;      // start of a block split across two calls
+	size_t partialbytes;
+	ChunkKind kind;
+	uint32_t fill;
+	uint32_t chunkblocks;
+	size_t rawheader;               // RAW: where its header goes in the buffer
+	unsigned long long fileoffset;  // of the start of the buffer being filled
+	unsigned long long totalblocks;
+	unsigned long totalchunks;
+	unsigned long ioerror;
+};
+
+// Checks the CRC32 chunks of a sparse image against the expanded data as
+// it goes out (DONT_CARE counts as zeros, as in libsparse).  A mismatch
+// fails the transfer with RESULT_STAGE_ERROR at the offending chunk.
+class SparseChecksumStage
+{
+public:
+	static const bool IN_ORDER = true;
+
+	explicit SparseChecksumStage(const SparseImage& image);
+
+	bool process(const char* data, size_t bytes);
+
+private:
+	const std::vector<SparseImage::Checksum>& checksums;
+	size_t nextchecksum;
+	unsigned long long position;
+	uint32_t crc;
+};
+
+#endif // SPARSEIMAGE_H
@@ -0,0 +1,84 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include "transfercontrol.h"
+
+TransferControl::TransferControl() : canceling(false), pausing(false), latencyms(-1)
+{
+}
+
+void TransferControl::reset()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	canceling.store(false);
+	pausing.store(false);
+	latencyms = -1;
+}
+
+void TransferControl::cancel()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (canceling.load())
+		{
+			return;
+		}
+		canceledAt = std::chrono::steady_clock::now();
+		canceling.store(true);
+	}
+	// Wake a paused transfer so it can wind down
+	changed.notify_all();
+}
+
+void TransferControl::pause()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	pausing.store(true);
+}
+
+void TransferControl::resume()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pausing.store(false);
+	}
+	changed.notify_all();
+}
+
+bool TransferControl::waitWhilePaused()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] { return canceling.load() || !pausing.load(); });
+	return !canceling.load();
+}
+
+void TransferControl::canceled()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (canceling.load() && latencyms < 0)
+	{
+		latencyms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - canceledAt).count();
+	}
+}
+
+long long TransferControl::cancelLatencyMs() const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return latencyms;
+}
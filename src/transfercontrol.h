@@ -0,0 +1,69 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef TRANSFERCONTROL_H
+#define TRANSFERCONTROL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+// Cancel and pause requests from the GUI thread to a running transfer.
+// The transfer polls cancelRequested()/pauseRequested() at least every
+// POLL_MS while it waits for I/O, aborts whatever is in flight on cancel,
+// and parks in waitWhilePaused() once its in-flight requests have drained
+// on pause.  Handles, locks and the transfer offset are left alone while
+// paused.  The time from cancel() to the transfer acknowledging it with
+// canceled() is kept as the cancel latency.
+class TransferControl
+{
+public:
+	static const unsigned int POLL_MS = 50;
+
+	TransferControl();
+
+	// Clears all requests, before a new transfer starts
+	void reset();
+
+	// Any thread
+	void cancel();
+	void pause();
+	void resume();
+	bool cancelRequested() const { return canceling.load(std::memory_order_relaxed); }
+	bool pauseRequested() const { return pausing.load(std::memory_order_relaxed); }
+
+	// Transfer thread: blocks until resume() or cancel(); false when canceled
+	bool waitWhilePaused();
+	// Transfer thread: nothing of the canceled transfer is in flight any more
+	void canceled();
+
+	// Milliseconds from cancel() to canceled(), -1 if there was no cancel
+	long long cancelLatencyMs() const;
+
+private:
+	std::atomic<bool> canceling;
+	std::atomic<bool> pausing;
+	mutable std::mutex lock;
+	std::condition_variable changed;
+	std::chrono::steady_clock::time_point canceledAt;
+	long long latencyms;
+};
+
+#endif // TRANSFERCONTROL_H
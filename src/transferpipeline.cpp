@@ -0,0 +1,396 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "bufferpool.h"
+#include "chunkcontroller.h"
+#include "transferpipeline.h"
+
+TransferPipeline::TransferPipeline(BufferPool& pool, unsigned long long sectorsize, unsigned long long chunksectors, unsigned int depth)
+	: pool(pool), sectorsize(sectorsize), chunksectors(chunksectors), depth(depth), controller(NULL), control(NULL),
+	zeroskip(false), kernelcopy(true), skippedbytes(0ull), writtenbytes(0ull), bufferbytes(0ull), failure(RESULT_OK), failedsector(0ull), ioerror(0), enginename(""),
+	elapsed(0.0)
+{
+	// A depth of one is a plain serial copy
+	if (this->depth < 1)
+	{
+		this->depth = 1;
+	}
+}
+
+TransferPipeline::Result TransferPipeline::copy(unsigned long long numsectors, Endpoint source, Endpoint sink, ProgressFunc progress)
+{
+	Result result;
+	if (kernelcopy && !zeroskip && copyInKernel(numsectors, source, sink, progress, &result))
+	{
+		return result;
+	}
+	NoStage stage;
+	return run<MODE_COPY>(numsectors, NULL, source, sink, stage, progress);
+}
+
+TransferPipeline::Result TransferPipeline::compare(unsigned long long numsectors, Endpoint image, Endpoint device, ProgressFunc progress)
+{
+	NoStage stage;
+	return run<MODE_COMPARE>(numsectors, NULL, image, device, stage, progress);
+}
+
+TransferPipeline::Result TransferPipeline::copy(unsigned long long numsectors, const ExtentList& extents, Endpoint source, Endpoint sink, ProgressFunc progress)
+{
+	NoStage stage;
+	return run<MODE_COPY>(numsectors, &extents, source, sink, stage, progress);
+}
+
+TransferPipeline::Result TransferPipeline::compare(unsigned long long numsectors, const ExtentList& extents, Endpoint image, Endpoint device, ProgressFunc progress)
+{
+	NoStage stage;
+	return run<MODE_COMPARE>(numsectors, &extents, image, device, stage, progress);
+}
+
+void TransferPipeline::addExtent(ExtentList& extents, Extent::Kind kind, unsigned long long numsectors, unsigned long long sourceoffset,
+	uint32_t fill, unsigned long long sectorsize)
+{
+	if (numsectors == 0)
+	{
+		return;
+	}
+	unsigned long long start = 0ull;
+	if (!extents.empty())
+	{
+		Extent& last = extents.back();
+		start = last.startsector + last.numsectors;
+		bool contiguous = (kind != Extent::EXTENT_DATA) || (last.sourceoffset + last.numsectors * sectorsize == sourceoffset);
+		if (last.kind == kind && last.fill == fill && contiguous)
+		{
+			last.numsectors += numsectors;
+			return;
+		}
+	}
+	Extent extent = { kind, start, numsectors, sourceoffset, fill };
+	extents.push_back(extent);
+}
+
+bool TransferPipeline::hasDataFrom(const ExtentList& extents, unsigned long long sector)
+{
+	for (const Extent& extent : extents)
+	{
+		if (extent.startsector + extent.numsectors <= sector)
+		{
+			continue;
+		}
+		if (extent.kind == Extent::EXTENT_DATA || (extent.kind == Extent::EXTENT_FILL && extent.fill != 0))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef __linux__
+
+bool TransferPipeline::copyInKernel(unsigned long long numsectors, const Endpoint& source, const Endpoint& sink, ProgressFunc progress, Result* result)
+{
+	// Unbuffered sides want aligned, padded requests, and a mapped source is
+	// cheaper to write from directly
+	if (source.alignment > 1 || sink.alignment > 1 || source.mapping != NULL || numsectors == 0)
+	{
+		return false;
+	}
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	const unsigned long long total = numsectors * sectorsize;
+	const size_t step = (size_t)((KERNEL_COPY_BYTES + sectorsize - 1) / sectorsize * sectorsize);
+	int pipefd[2] = { -1, -1 };
+	unsigned long long offset = 0ull;
+	bool canceled = false;
+	failure = RESULT_OK;
+	failedsector = 0ull;
+	ioerror = 0;
+	skippedbytes = 0ull;
+	writtenbytes = 0ull;
+	enginename = "copy_file_range";
+
+	while (offset < total && failure == RESULT_OK)
+	{
+		if (control != NULL)
+		{
+			if (control->cancelRequested())
+			{
+				canceled = true;
+				break;
+			}
+			// Nothing is in flight between two steps
+			if (control->pauseRequested())
+			{
+				control->waitWhilePaused();
+				continue;
+			}
+		}
+		size_t want = (size_t)std::min<unsigned long long>(step, total - offset);
+		ssize_t moved;
+		if (pipefd[0] < 0)
+		{
+			loff_t in = (loff_t)offset;
+			loff_t out = (loff_t)offset;
+			moved = copy_file_range(source.handle, &in, sink.handle, &out, want, 0);
+			if (moved < 0 && offset == 0ull && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+			{
+				// Not between these two (a block device, an old kernel):
+				// splice through a pipe instead
+				if (pipe(pipefd) != 0)
+				{
+					return false;
+				}
+				fcntl(pipefd[1], F_SETPIPE_SZ, (int)KERNEL_PIPE_BYTES);
+				enginename = "splice";
+				continue;
+			}
+			if (moved < 0)
+			{
+				// One call does both sides; the sink is the likelier culprit
+				fail(RESULT_WRITE_ERROR, offset / sectorsize, (unsigned long)errno);
+				break;
+			}
+		}
+		else
+		{
+			loff_t in = (loff_t)offset;
+			moved = splice(source.handle, &in, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (moved < 0)
+			{
+				if (offset == 0ull)
+				{
+					close(pipefd[0]);
+					close(pipefd[1]);
+					return false;
+				}
+				fail(RESULT_READ_ERROR, offset / sectorsize, (unsigned long)errno);
+				break;
+			}
+			loff_t out = (loff_t)offset;
+			for (ssize_t left = moved; left > 0;)
+			{
+				ssize_t written = splice(pipefd[0], NULL, sink.handle, &out, (size_t)left, SPLICE_F_MOVE | SPLICE_F_MORE);
+				if (written < 0 && offset == 0ull && left == moved && errno == EINVAL)
+				{
+					// The sink takes no splice (O_DIRECT, say); nothing is written yet
+					close(pipefd[0]);
+					close(pipefd[1]);
+					return false;
+				}
+				if (written <= 0)
+				{
+					fail(RESULT_WRITE_ERROR, offset / sectorsize, (written < 0) ? (unsigned long)errno : 0);
+					break;
+				}
+				left -= written;
+			}
+			if (failure != RESULT_OK)
+			{
+				break;
+			}
+		}
+		if (moved == 0)
+		{
+			// The source ends inside its last sector: the rest reads as zeros
+			std::vector<char> zeros(want, 0);
+			ssize_t written = pwrite(sink.handle, zeros.data(), zeros.size(), (off_t)offset);
+			if (written != (ssize_t)zeros.size())
+			{
+				fail(RESULT_WRITE_ERROR, offset / sectorsize, (written < 0) ? (unsigned long)errno : 0);
+				break;
+			}
+			moved = written;
+		}
+		unsigned long long before = offset / sectorsize;
+		offset += (unsigned long long)moved;
+		writtenbytes += (unsigned long long)moved;
+		unsigned long long done = std::min(offset, total) / sectorsize;
+		if (done != before && progress && !progress(done))
+		{
+			canceled = true;
+		}
+		if (canceled)
+		{
+			break;
+		}
+	}
+
+	if (pipefd[0] >= 0)
+	{
+		close(pipefd[0]);
+		close(pipefd[1]);
+	}
+	if (canceled && control != NULL)
+	{
+		control->canceled();
+	}
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	*result = (failure != RESULT_OK) ? failure : (canceled ? RESULT_CANCELED : RESULT_OK);
+	return true;
+}
+
+#else
+
+bool TransferPipeline::copyInKernel(unsigned long long, const Endpoint&, const Endpoint&, ProgressFunc, Result*)
+{
+	return false;
+}
+
+#endif // __linux__
+
+void TransferPipeline::setupSlots()
+{
+	// Buffers come later, as slots are used
+	slots.resize((controller != NULL) ? controller->maxQueueDepth() : depth);
+	for (Slot& slot : slots)
+	{
+		slot.data[0] = NULL;
+		slot.data[1] = NULL;
+		slot.capacity = 0;
+		slot.source = NULL;
+		slot.mapped = false;
+	}
+	bufferbytes = 0ull;
+}
+
+bool TransferPipeline::slotBuffers(Slot& slot, size_t bytes, int perslot, const std::vector<Slot*>& idle, unsigned long long sector)
+{
+	if (slot.capacity >= bytes && (perslot < 2 || slot.data[1] != NULL))
+	{
+		return true;
+	}
+	// Too small for the current chunk size: regrow, making room under the
+	// cap from slots that are idle
+	freeSlotBuffers(slot);
+	// The pool hands out buffers of its largest size so far
+	pool.reserve(bytes);
+	size_t actual = (pool.bufferSize() + BufferPool::ALIGNMENT - 1) / BufferPool::ALIGNMENT * BufferPool::ALIGNMENT;
+	unsigned long long needed = (unsigned long long)actual * perslot;
+	for (Slot* other : idle)
+	{
+		if (bufferbytes + needed <= MAX_BUFFER_BYTES)
+		{
+			break;
+		}
+		freeSlotBuffers(*other);
+	}
+	if (bufferbytes > 0ull && bufferbytes + needed > MAX_BUFFER_BYTES)
+	{
+		return false;
+	}
+	slot.capacity = actual;
+	for (int i = 0; i < perslot; ++i)
+	{
+		slot.data[i] = pool.acquire();
+		if (slot.data[i] == NULL)
+		{
+			freeSlotBuffers(slot);
+			fail(RESULT_READ_ERROR, sector, 0);
+			return false;
+		}
+		bufferbytes += actual;
+	}
+	return true;
+}
+
+void TransferPipeline::freeSlotBuffers(Slot& slot)
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (slot.data[i] != NULL)
+		{
+			pool.release(slot.data[i]);
+			slot.data[i] = NULL;
+			bufferbytes -= slot.capacity;
+		}
+	}
+	slot.capacity = 0;
+}
+
+void TransferPipeline::releaseBuffers()
+{
+	for (Slot& slot : slots)
+	{
+		freeSlotBuffers(slot);
+	}
+}
+
+void TransferPipeline::prepare(IoRequest& request, IoRequest::Op op, const Endpoint& endpoint, Slot& slot, char* data, unsigned long long offset)
+{
+	unsigned long long bytes = slot.numsectors * sectorsize;
+	if (endpoint.alignment > 1)
+	{
+		bytes = (bytes + endpoint.alignment - 1) / endpoint.alignment * endpoint.alignment;
+	}
+	request.op = op;
+	request.handle = endpoint.handle;
+	request.offset = offset;
+	request.data = data;
+	request.length = (unsigned long)bytes;
+	request.context = &slot;
+	request.transferred = 0;
+	request.error = 0;
+}
+
+void TransferPipeline::fillPattern(char* data, size_t bytes, uint32_t fill) const
+{
+	// Sector sizes are multiples of four, so the pattern never gets cut
+	for (size_t offset = 0; offset + sizeof(fill) <= bytes; offset += sizeof(fill))
+	{
+		memcpy(data + offset, &fill, sizeof(fill));
+	}
+}
+
+void TransferPipeline::submit(AsyncIo* io, IoRequest& request)
+{
+	((Slot*)request.context)->submitted = std::chrono::steady_clock::now();
+	io->submit(&request);
+}
+
+void TransferPipeline::fail(Result result, unsigned long long sector, unsigned long error)
+{
+	// Completions arrive in any order; report the lowest failing chunk
+	if (failure == RESULT_OK || sector < failedsector)
+	{
+		failure = result;
+		failedsector = sector;
+		ioerror = error;
+	}
+}
+
+unsigned long long TransferPipeline::mismatchSector(const Slot& slot) const
+{
+	unsigned long long sector = 0ull;
+	while (memcmp(slot.source + sector * sectorsize, slot.data[1] + sector * sectorsize, (size_t)sectorsize) == 0)
+	{
+		++sector;
+	}
+	return slot.startsector + sector;
+}
+
+double TransferPipeline::latency(const Slot& slot) const
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - slot.submitted).count();
+}
@@ -0,0 +1,609 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef TRANSFERPIPELINE_H
+#define TRANSFERPIPELINE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <type_traits>
+#include <vector>
+#include "asyncio.h"
+#include "bufferpool.h"
+#include "chunkcontroller.h"
+#include "mappedfile.h"
+#include "transfercontrol.h"
+#include "transferstages.h"
+#include "zerodetect.h"
+
+// Sector copy/compare on top of AsyncIo: up to queueDepth() chunks are in
+// flight at once, each going through read -> write (or read both sides ->
+// compare) in its own slot.  Chunks complete in any order, but progress
+// and errors are reported in sector order: progress only covers the
+// contiguous prefix that is done, and a failure reports the lowest failing
+// chunk.  Chunk buffers are borrowed from a BufferPool as slots are first
+// used, sized for the chunk size at the time, and the pool is trimmed when
+// the run returns.  With a ChunkController attached, the chunk size and the
+// number of chunks in flight follow the controller instead of the fixed
+// values, within MAX_BUFFER_BYTES of buffers.
+//
+// Read, write and verify all go through the same run() loop, which is a
+// template on the mode (copy, compare, or scan: read the source and hand
+// it to the stage only) and on a per-chunk stage from
+// transferstages.h, so each combination is compiled as its own loop with
+// the stage inlined.
+//
+// With a TransferControl attached the loop never blocks on I/O for more
+// than TransferControl::POLL_MS: a cancel aborts everything in flight at
+// once, and a pause lets the chunks in flight finish (reads still get
+// written) before parking until resume, then carries on from the same
+// sector.
+//
+// A source that is not a plain sector-for-sector image (an Android sparse
+// image, say) is described by an ExtentList: each range of sink sectors is
+// either read from an offset in the source, filled with a 32-bit pattern,
+// or skipped.  Chunks never straddle two extents.
+//
+// On Linux a plain copy() that needs to see none of the data (no stage, no
+// zero skip, no extents, no mapping, buffered on both sides) is left to the
+// kernel: copy_file_range(), or splice() through a pipe where that is not
+// supported (e.g. a block device as the sink).  engineName() then says which
+// one ran; if neither can start, the usual engine runs instead.
+class TransferPipeline
+{
+public:
+	enum Result { RESULT_OK = 0, RESULT_READ_ERROR, RESULT_WRITE_ERROR, RESULT_CANCELED, RESULT_MISMATCH, RESULT_STAGE_ERROR };
+
+	// Chunk buffers a run holds at most; fewer chunks go in flight than the
+	// controller asks for when they would not fit
+	static const unsigned long long MAX_BUFFER_BYTES = 64ull * 1024ull * 1024ull;
+
+	// One side of a transfer.  alignment > 1 rounds every request up to a
+	// multiple of it (unbuffered files); reads stopping short are zero-filled.
+	// A source with a mapping (not owned) is not read where the mapping
+	// can serve a chunk in place: the mapped bytes are written or compared
+	// directly.
+	struct Endpoint
+	{
+		IoHandle handle;
+		unsigned long long alignment;
+		MappedFile* mapping;
+
+		Endpoint(IoHandle handle, unsigned long long alignment = 1ull, MappedFile* mapping = NULL)
+			: handle(handle), alignment(alignment), mapping(mapping) {}
+	};
+
+	// Where the data of a range of sink sectors comes from
+	struct Extent
+	{
+		enum Kind { EXTENT_DATA = 0, EXTENT_FILL, EXTENT_SKIP };
+
+		Kind kind;
+		unsigned long long startsector;   // first sink sector
+		unsigned long long numsectors;
+		unsigned long long sourceoffset;  // EXTENT_DATA: byte offset of the data in the source
+		uint32_t fill;                    // EXTENT_FILL: pattern repeated over the range
+	};
+	// In sink order, back to back from sector 0 and covering every sector copied
+	typedef std::vector<Extent> ExtentList;
+
+	// Appends a range to extents, merged into the last extent when the two
+	// are one run (DATA contiguous in the source, the same FILL, or SKIP)
+	static void addExtent(ExtentList& extents, Extent::Kind kind, unsigned long long numsectors, unsigned long long sourceoffset,
+		uint32_t fill, unsigned long long sectorsize);
+	// True when anything but zeros or SKIP lies at or past sector, i.e.
+	// cutting the source off there would lose data
+	static bool hasDataFrom(const ExtentList& extents, unsigned long long sector);
+
+	// Called on the calling thread whenever the done prefix grows; return false to cancel
+	typedef std::function<bool(unsigned long long sectorsdone)> ProgressFunc;
+
+	TransferPipeline(BufferPool& pool, unsigned long long sectorsize, unsigned long long chunksectors = 1024ull, unsigned int depth = 4);
+
+	// Optional, not owned; NULL keeps the fixed chunk size and depth
+	void setController(ChunkController* controller) { this->controller = controller; }
+	// Optional, not owned; NULL leaves cancelling to the progress callback
+	void setControl(TransferControl* control) { this->control = control; }
+	// copy() only: chunks that are all zero are not written.  Only for a
+	// sink that already reads as zeros, e.g. after BlockDevice::discard().
+	void setZeroSkip(bool skip) { zeroskip = skip; }
+	// Let the kernel do plain copies where it can (on by default)
+	void setKernelCopy(bool allow) { kernelcopy = allow; }
+	// Bytes of zero chunks the last copy() did not write
+	unsigned long long skippedBytes() const { return skippedbytes; }
+	// Bytes the last copy() actually wrote to the sink
+	unsigned long long writtenBytes() const { return writtenbytes; }
+
+	Result copy(unsigned long long numsectors, Endpoint source, Endpoint sink, ProgressFunc progress);
+	Result compare(unsigned long long numsectors, Endpoint image, Endpoint device, ProgressFunc progress);
+	// Same for a source laid out by extents
+	Result copy(unsigned long long numsectors, const ExtentList& extents, Endpoint source, Endpoint sink, ProgressFunc progress);
+	Result compare(unsigned long long numsectors, const ExtentList& extents, Endpoint image, Endpoint device, ProgressFunc progress);
+	// Same, running stage over the data of every chunk that is done.  A
+	// stage returning false stops the transfer with RESULT_STAGE_ERROR.
+	template <class Stage>
+	Result copy(unsigned long long numsectors, Endpoint source, Endpoint sink, Stage& stage, ProgressFunc progress)
+	{
+		return run<MODE_COPY>(numsectors, NULL, source, sink, stage, progress);
+	}
+	template <class Stage>
+	Result compare(unsigned long long numsectors, Endpoint image, Endpoint device, Stage& stage, ProgressFunc progress)
+	{
+		return run<MODE_COMPARE>(numsectors, NULL, image, device, stage, progress);
+	}
+	// Only reads the source, for a stage that consumes the data itself
+	template <class Stage>
+	Result scan(unsigned long long numsectors, Endpoint source, Stage& stage, ProgressFunc progress)
+	{
+		return run<MODE_SCAN>(numsectors, NULL, source, source, stage, progress);
+	}
+	template <class Stage>
+	Result copy(unsigned long long numsectors, const ExtentList& extents, Endpoint source, Endpoint sink, Stage& stage, ProgressFunc progress)
+	{
+		return run<MODE_COPY>(numsectors, &extents, source, sink, stage, progress);
+	}
+	template <class Stage>
+	Result compare(unsigned long long numsectors, const ExtentList& extents, Endpoint image, Endpoint device, Stage& stage, ProgressFunc progress)
+	{
+		return run<MODE_COMPARE>(numsectors, &extents, image, device, stage, progress);
+	}
+	// First sector of the chunk that failed (valid after an error or mismatch)
+	unsigned long long failedSector() const { return failedsector; }
+	// Win32 error code / errno of the failed request (0 for short writes)
+	unsigned long ioError() const { return ioerror; }
+	// Name of the AsyncIo engine (or kernel copy) used by the last run, for
+	// the debug log
+	const char* engineName() const { return enginename; }
+	// Wall time of the last run, for its throughput
+	double elapsedSeconds() const { return elapsed; }
+
+private:
+	enum Mode { MODE_COPY = 0, MODE_COMPARE, MODE_SCAN };
+
+	// Bytes per kernel copy step (progress and cancel granularity) and the
+	// pipe size asked for when splicing
+	static const unsigned long long KERNEL_COPY_BYTES = 8ull * 1024ull * 1024ull;
+	static const unsigned int KERNEL_PIPE_BYTES = 1024u * 1024u;
+
+	struct Slot
+	{
+		char* data[2];
+		size_t capacity;     // bytes in each buffer of data, 0 before first use
+		const char* source;  // the chunk's source data: data[0] or mapped
+		bool mapped;
+		IoRequest request[2];
+		unsigned long long startsector;
+		unsigned long long numsectors;
+		unsigned long long sourceoffset;
+		int pending;        // requests of this slot still in flight
+		std::chrono::steady_clock::time_point submitted;
+	};
+
+	// A chunk that is done but not yet part of the contiguous prefix; slot
+	// is still held (data intact) when the stage wants chunks in order
+	struct Finished
+	{
+		unsigned long long numsectors;
+		Slot* slot;
+	};
+
+	template <Mode mode, class Stage>
+	Result run(unsigned long long numsectors, const ExtentList* extents, const Endpoint& source, const Endpoint& sink, Stage& stage, ProgressFunc progress);
+	// False when the kernel cannot do this copy; nothing was written then
+	bool copyInKernel(unsigned long long numsectors, const Endpoint& source, const Endpoint& sink, ProgressFunc progress, Result* result);
+	void setupSlots();
+	bool slotBuffers(Slot& slot, size_t bytes, int perslot, const std::vector<Slot*>& idle, unsigned long long sector);
+	void freeSlotBuffers(Slot& slot);
+	void releaseBuffers();
+	void prepare(IoRequest& request, IoRequest::Op op, const Endpoint& endpoint, Slot& slot, char* data, unsigned long long offset);
+	void fillPattern(char* data, size_t bytes, uint32_t fill) const;
+	void submit(AsyncIo* io, IoRequest& request);
+	void fail(Result result, unsigned long long sector, unsigned long error);
+	unsigned long long mismatchSector(const Slot& slot) const;
+	double latency(const Slot& slot) const;
+
+	BufferPool& pool;
+	unsigned long long sectorsize;
+	unsigned long long chunksectors;
+	unsigned int depth;
+	ChunkController* controller;
+	TransferControl* control;
+	bool zeroskip;
+	bool kernelcopy;
+	unsigned long long skippedbytes;
+	unsigned long long writtenbytes;
+	std::vector<Slot> slots;
+	unsigned long long bufferbytes;  // held by slots, at most MAX_BUFFER_BYTES
+	std::map<unsigned long long, Finished> finished;  // chunks done beyond the prefix, by start sector
+	Result failure;
+	unsigned long long failedsector;
+	unsigned long ioerror;
+	const char* enginename;
+	double elapsed;
+};
+
+template <TransferPipeline::Mode mode, class Stage>
+TransferPipeline::Result TransferPipeline::run(unsigned long long numsectors, const ExtentList* extents, const Endpoint& source, const Endpoint& sink, Stage& stage, ProgressFunc progress)
+{
+	const bool comparing = (mode == MODE_COMPARE);
+	const int perslot = comparing ? 2 : 1;
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	failure = RESULT_OK;
+	failedsector = 0ull;
+	ioerror = 0;
+	skippedbytes = 0ull;
+	writtenbytes = 0ull;
+	elapsed = 0.0;
+	finished.clear();
+	setupSlots();
+
+	AsyncIo* io = AsyncIo::create((unsigned int)slots.size() * perslot);
+	enginename = io->name();
+	std::vector<Slot*> idle;
+	std::vector<bool> slotFailed(slots.size(), false);
+	for (Slot& slot : slots)
+	{
+		idle.push_back(&slot);
+	}
+
+	if (controller != NULL)
+	{
+		controller->start();
+	}
+	unsigned long long next = 0ull;
+	unsigned long long done = 0ull;
+	unsigned long long staged = 0ull;  // an IN_ORDER stage has seen everything before this
+	size_t extent = 0;
+	bool canceled = false;
+	bool paused = false;
+
+	// A chunk is done: hand it to the stage (now, or once every chunk before
+	// it is done too) and report the contiguous prefix
+	auto complete = [&](Slot* slot) {
+		Finished entry = { slot->numsectors, NULL };
+		if (Stage::IN_ORDER)
+		{
+			entry.slot = slot;
+		}
+		else
+		{
+			if (failure == RESULT_OK && !stage.process(slot->source, (size_t)(slot->numsectors * sectorsize)))
+			{
+				fail(RESULT_STAGE_ERROR, slot->startsector, 0);
+			}
+			idle.push_back(slot);
+		}
+		finished[slot->startsector] = entry;
+
+		unsigned long long before = done;
+		while (!finished.empty() && finished.begin()->first == done)
+		{
+			const Finished& first = finished.begin()->second;
+			if (first.slot != NULL)
+			{
+				// Unless the zero check took it along already
+				if (done >= staged)
+				{
+					if (failure == RESULT_OK && !stage.process(first.slot->source, (size_t)(first.numsectors * sectorsize)))
+					{
+						fail(RESULT_STAGE_ERROR, done, 0);
+					}
+					staged = done + first.numsectors;
+				}
+				idle.push_back(first.slot);
+			}
+			done += first.numsectors;
+			finished.erase(finished.begin());
+		}
+		if (done != before && failure == RESULT_OK && !canceled && progress && !progress(done))
+		{
+			canceled = true;
+			io->cancel();
+		}
+	};
+
+	// Whether a chunk to copy is all zeros, for the zero skip.  When an
+	// IN_ORDER stage is due to see the chunk next anyway, it goes over the
+	// data in the same pass (FusedStage), while the chunk is in the cache,
+	// and is not run again when the chunk completes.
+	auto zeroChunk = [&](Slot* slot, size_t bytes) {
+		if (Stage::IN_ORDER && slot->startsector == staged)
+		{
+			ZeroCheckStage zeros;
+			FusedStage<ZeroCheckStage, Stage> fused(zeros, stage);
+			if (!fused.process(slot->source, bytes))
+			{
+				fail(RESULT_STAGE_ERROR, slot->startsector, 0);
+			}
+			staged += slot->numsectors;
+			return zeros.allZero();
+		}
+		return isZeroFilled(slot->source, bytes);
+	};
+
+	for (;;)
+	{
+		if (control != NULL)
+		{
+			if (!canceled && control->cancelRequested())
+			{
+				canceled = true;
+				io->cancel();
+			}
+			paused = !canceled && control->pauseRequested();
+			if (paused && io->inFlight() == 0)
+			{
+				// Drained; handles, locks and next stay as they are
+				if (control->waitWhilePaused() && controller != NULL)
+				{
+					controller->resumed();
+				}
+				continue;
+			}
+		}
+
+		// Keep up to the current depth of slots busy with the next chunks
+		size_t limit = (controller != NULL) ? controller->queueDepth() : slots.size();
+		unsigned long long chunk = (controller != NULL) ? controller->chunkSectors() : chunksectors;
+		// Whole pages, for padded unbuffered requests
+		size_t chunkbytes = (size_t)((chunk * sectorsize + BufferPool::ALIGNMENT - 1) / BufferPool::ALIGNMENT * BufferPool::ALIGNMENT);
+		size_t fit = (size_t)(MAX_BUFFER_BYTES / (chunkbytes * perslot));
+		if (limit > fit)
+		{
+			limit = (fit > 0) ? fit : 1;
+		}
+		while (failure == RESULT_OK && !canceled && !paused && next < numsectors && !idle.empty() && slots.size() - idle.size() < limit)
+		{
+			Extent::Kind kind = Extent::EXTENT_DATA;
+			unsigned long long end = numsectors;
+			uint32_t fill = 0;
+			Slot* slot = idle.back();
+			if (!slotBuffers(*slot, chunkbytes, perslot, idle, next))
+			{
+				// Out of memory, or the buffers of chunks in flight must come back first
+				break;
+			}
+			idle.pop_back();
+			slotFailed[slot - slots.data()] = false;
+			if (slot->mapped)
+			{
+				source.mapping->release(slot->sourceoffset);
+				slot->mapped = false;
+			}
+			slot->source = slot->data[0];
+			slot->startsector = next;
+			slot->sourceoffset = next * sectorsize;
+			if (extents != NULL)
+			{
+				while ((*extents)[extent].startsector + (*extents)[extent].numsectors <= next)
+				{
+					++extent;
+				}
+				const Extent& current = (*extents)[extent];
+				kind = current.kind;
+				fill = current.fill;
+				slot->sourceoffset = current.sourceoffset + (next - current.startsector) * sectorsize;
+				if (current.startsector + current.numsectors < end)
+				{
+					end = current.startsector + current.numsectors;
+				}
+			}
+			slot->numsectors = (end - next >= chunk) ? chunk : (end - next);
+			next += slot->numsectors;
+			size_t bytes = (size_t)(slot->numsectors * sectorsize);
+			// Padded writes would run past the mapped bytes
+			const char* view = NULL;
+			if (kind == Extent::EXTENT_DATA && source.mapping != NULL && (comparing || sink.alignment <= 1))
+			{
+				view = source.mapping->acquire(slot->sourceoffset, bytes, (size_t)sectorsize);
+			}
+			if (view != NULL)
+			{
+				// Mapped: nothing to read, the chunk is used in place
+				slot->source = view;
+				slot->mapped = true;
+				if (comparing)
+				{
+					slot->pending = 1;
+					prepare(slot->request[1], IoRequest::OP_READ, sink, *slot, slot->data[1], slot->startsector * sectorsize);
+					submit(io, slot->request[1]);
+				}
+				else if (mode == MODE_COPY && (!zeroskip || !zeroChunk(slot, bytes)))
+				{
+					slot->pending = 1;
+					prepare(slot->request[0], IoRequest::OP_WRITE, sink, *slot, const_cast<char*>(view), slot->startsector * sectorsize);
+					submit(io, slot->request[0]);
+				}
+				else
+				{
+					// Scanned, or zeros the sink reads as already
+					if (mode == MODE_COPY)
+					{
+						skippedbytes += bytes;
+					}
+					complete(slot);
+				}
+			}
+			else if (kind == Extent::EXTENT_DATA)
+			{
+				slot->pending = perslot;
+				prepare(slot->request[0], IoRequest::OP_READ, source, *slot, slot->data[0], slot->sourceoffset);
+				submit(io, slot->request[0]);
+				if (comparing)
+				{
+					prepare(slot->request[1], IoRequest::OP_READ, sink, *slot, slot->data[1], slot->startsector * sectorsize);
+					io->submit(&slot->request[1]);
+				}
+			}
+			else if (kind == Extent::EXTENT_FILL)
+			{
+				// Expanded in memory; only the sink is touched
+				fillPattern(slot->data[0], bytes, fill);
+				if (mode == MODE_SCAN)
+				{
+					complete(slot);
+					continue;
+				}
+				if (!comparing && zeroskip && fill == 0)
+				{
+					skippedbytes += bytes;
+					complete(slot);
+					continue;
+				}
+				slot->pending = 1;
+				if (comparing)
+				{
+					prepare(slot->request[1], IoRequest::OP_READ, sink, *slot, slot->data[1], slot->startsector * sectorsize);
+					submit(io, slot->request[1]);
+				}
+				else
+				{
+					prepare(slot->request[0], IoRequest::OP_WRITE, sink, *slot, slot->data[0], slot->startsector * sectorsize);
+					submit(io, slot->request[0]);
+				}
+			}
+			else
+			{
+				// Don't care: nothing to write or compare, a stage sees zeros
+				if (!std::is_same<Stage, NoStage>::value)
+				{
+					memset(slot->data[0], 0, bytes);
+				}
+				complete(slot);
+			}
+		}
+
+		IoRequest* request = io->wait((control != NULL) ? TransferControl::POLL_MS : AsyncIo::WAIT_FOREVER);
+		if (request == NULL)
+		{
+			// Timed out: go round again to look at the control
+			if (io->inFlight() > 0 || paused)
+			{
+				continue;
+			}
+			break;
+		}
+		Slot* slot = (Slot*)request->context;
+		size_t index = slot - slots.data();
+		unsigned long long bytes = slot->numsectors * sectorsize;
+		--slot->pending;
+		if (controller != NULL)
+		{
+			controller->requestDone(latency(*slot));
+		}
+		if (request->error != 0)
+		{
+			// Once canceled, aborted requests are expected
+			if (!canceled)
+			{
+				fail((request->op == IoRequest::OP_READ) ? RESULT_READ_ERROR : RESULT_WRITE_ERROR, slot->startsector, request->error);
+			}
+			slotFailed[index] = true;
+		}
+		else if (request->op == IoRequest::OP_READ)
+		{
+			// Short only at the end of the source (e.g. a partial last sector)
+			if (request->transferred < bytes)
+			{
+				memset(request->data + request->transferred, 0, (size_t)(bytes - request->transferred));
+			}
+		}
+		else if (request->transferred < request->length)
+		{
+			fail(RESULT_WRITE_ERROR, slot->startsector, 0);
+			slotFailed[index] = true;
+		}
+		else
+		{
+			writtenbytes += bytes;
+		}
+		if (slot->pending > 0)
+		{
+			continue;
+		}
+		if (slotFailed[index])
+		{
+			idle.push_back(slot);
+			continue;
+		}
+		if (mode == MODE_COPY && request->op == IoRequest::OP_READ)
+		{
+			if (failure != RESULT_OK || canceled)
+			{
+				idle.push_back(slot);
+				continue;
+			}
+			bool zero = zeroskip && zeroChunk(slot, (size_t)bytes);
+			if (failure != RESULT_OK)
+			{
+				idle.push_back(slot);
+				continue;
+			}
+			if (!zero)
+			{
+				slot->pending = 1;
+				prepare(slot->request[0], IoRequest::OP_WRITE, sink, *slot, slot->data[0], slot->startsector * sectorsize);
+				submit(io, slot->request[0]);
+				continue;
+			}
+			// The sink reads as zeros already: done without writing
+			skippedbytes += bytes;
+		}
+		if (comparing && memcmp(slot->source, slot->data[1], (size_t)bytes) != 0)
+		{
+			fail(RESULT_MISMATCH, mismatchSector(*slot), 0);
+			idle.push_back(slot);
+			continue;
+		}
+
+		if (controller != NULL)
+		{
+			controller->chunkDone(bytes);
+		}
+		complete(slot);
+	}
+
+	// Nothing is in flight any more, the buffers and views can go back
+	delete io;
+	for (Slot& slot : slots)
+	{
+		if (slot.mapped)
+		{
+			source.mapping->release(slot.sourceoffset);
+			slot.mapped = false;
+		}
+	}
+	if (canceled && control != NULL)
+	{
+		control->canceled();
+	}
+	releaseBuffers();
+	pool.trim();
+	elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	if (failure != RESULT_OK)
+	{
+		return failure;
+	}
+	return canceled ? RESULT_CANCELED : RESULT_OK;
+}
+
+#endif // TRANSFERPIPELINE_H
@@ -0,0 +1,162 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef TRANSFERSTAGES_H
+#define TRANSFERSTAGES_H
+
+#include <cstddef>
+#include "zerodetect.h"
+
+// Per-chunk stages for TransferPipeline::copy()/compare().  A stage is any
+// type with
+//
+//     static const bool IN_ORDER;
+//     bool process(const char* data, size_t bytes);
+//
+// process() is called once a chunk is fully done (written, or compared
+// equal), with the source data of that chunk; returning false fails the
+// transfer, e.g. on a checksum mismatch.  With IN_ORDER the pipeline
+// holds on to finished chunks until every chunk before them is done, so
+// the stage sees the whole transfer front to back exactly once, e.g. for
+// a hash.  Stages are template parameters, so the calls are inlined into
+// the completion path of the pipeline.
+
+// The default: nothing to do, slots go back as soon as their chunk is done
+struct NoStage
+{
+	static const bool IN_ORDER = false;
+	bool process(const char*, size_t) { return true; }
+};
+
+// Counts the sectors that are all zero, e.g. to tell how much of a device
+// a sparse image would save
+class ZeroDetectStage
+{
+public:
+	static const bool IN_ORDER = false;
+
+	explicit ZeroDetectStage(unsigned long long sectorsize) : sectorsize((size_t)sectorsize), zerosectors(0ull) {}
+
+	bool process(const char* data, size_t bytes)
+	{
+		for (size_t offset = 0; offset < bytes; offset += sectorsize)
+		{
+			size_t length = (bytes - offset < sectorsize) ? (bytes - offset) : sectorsize;
+			if (isZeroFilled(data + offset, length))
+			{
+				++zerosectors;
+			}
+		}
+		return true;
+	}
+
+	unsigned long long zeroSectors() const { return zerosectors; }
+
+private:
+	size_t sectorsize;
+	unsigned long long zerosectors;
+};
+
+// Tells whether everything it was given is zero, e.g. a chunk the zero
+// skip need not write.  Stops looking at the first non-zero block, so
+// alongside a stage that reads all the data (FusedStage) it costs next
+// to nothing on data that is not zero.
+class ZeroCheckStage
+{
+public:
+	static const bool IN_ORDER = false;
+
+	ZeroCheckStage() : zero(true) {}
+
+	bool process(const char* data, size_t bytes)
+	{
+		if (zero)
+		{
+			zero = isZeroFilled(data, bytes);
+		}
+		return true;
+	}
+
+	bool allZero() const { return zero; }
+
+private:
+	bool zero;
+};
+
+// Feeds every chunk to a hash in sector order.  Hash is anything with
+// addData(const char*, int), such as QCryptographicHash.  Only the first
+// limit bytes are hashed, for an image file that ends inside its last
+// sector (the rest of which the pipeline pads with zeros).
+template <class Hash>
+class HashStage
+{
+public:
+	static const bool IN_ORDER = true;
+
+	explicit HashStage(Hash& hash, unsigned long long limit = ~0ull) : hash(hash), left(limit) {}
+
+	bool process(const char* data, size_t bytes)
+	{
+		if (bytes > left)
+		{
+			bytes = (size_t)left;
+		}
+		hash.addData(data, (int)bytes);
+		left -= bytes;
+		return true;
+	}
+
+private:
+	Hash& hash;
+	unsigned long long left;
+};
+
+// Runs two stages over a chunk in one pass: the chunk is walked in blocks
+// small enough to stay in the cache, and each block goes through both
+// stages before moving on.  Nest FusedStage for more than two.
+template <class First, class Second>
+class FusedStage
+{
+public:
+	static const bool IN_ORDER = First::IN_ORDER || Second::IN_ORDER;
+	// A multiple of every sector size in use, so sector based stages see
+	// whole sectors
+	static const size_t BLOCK = 64 * 1024;
+
+	FusedStage(First& first, Second& second) : first(first), second(second) {}
+
+	bool process(const char* data, size_t bytes)
+	{
+		for (size_t offset = 0; offset < bytes; offset += BLOCK)
+		{
+			size_t length = (bytes - offset < BLOCK) ? (bytes - offset) : BLOCK;
+			if (!first.process(data + offset, length) || !second.process(data + offset, length))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	First& first;
+	Second& second;
+};
+
+#endif // TRANSFERSTAGES_H
@@ -0,0 +1,65 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include "transferworker.h"
+
+TransferWorker::TransferWorker()
+	: sectors(0ull), done(true), result(TransferPipeline::RESULT_OK)
+{
+}
+
+TransferWorker::~TransferWorker()
+{
+	if (thread.joinable())
+	{
+		cancel();
+		thread.join();
+	}
+}
+
+void TransferWorker::start(Job job)
+{
+	// A previous job must have been collected with wait()
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+	sectors.store(0ull);
+	transferControl.reset();
+	done.store(false);
+	thread = std::thread(&TransferWorker::runJob, this, job);
+}
+
+void TransferWorker::runJob(Job job)
+{
+	result = job([this](unsigned long long sectorsdone) {
+		sectors.store(sectorsdone, std::memory_order_relaxed);
+		return !transferControl.cancelRequested();
+	});
+	done.store(true, std::memory_order_release);
+}
+
+TransferPipeline::Result TransferWorker::wait()
+{
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+	return result;
+}
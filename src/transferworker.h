@@ -0,0 +1,67 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef TRANSFERWORKER_H
+#define TRANSFERWORKER_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "transfercontrol.h"
+#include "transferpipeline.h"
+
+// Runs one transfer job on its own thread.  The job reports progress
+// through the ProgressFunc it is given, which only stores an atomic
+// counter; the GUI samples sectorsDone()/finished() on a timer instead of
+// being called back.  cancel(), pause() and resume() go through control(),
+// which the job hands to its TransferPipeline so in-flight I/O is aborted
+// or drained without waiting for the next progress report.  The job must
+// not touch widgets.
+class TransferWorker
+{
+public:
+	typedef std::function<TransferPipeline::Result(TransferPipeline::ProgressFunc progress)> Job;
+
+	TransferWorker();
+	~TransferWorker();
+
+	void start(Job job);
+	// Blocks until the job is done and returns its result
+	TransferPipeline::Result wait();
+
+	void cancel() { transferControl.cancel(); }
+	void pause() { transferControl.pause(); }
+	void resume() { transferControl.resume(); }
+	bool cancelRequested() const { return transferControl.cancelRequested(); }
+	bool pauseRequested() const { return transferControl.pauseRequested(); }
+	TransferControl& control() { return transferControl; }
+	bool finished() const { return done.load(std::memory_order_acquire); }
+	unsigned long long sectorsDone() const { return sectors.load(std::memory_order_relaxed); }
+
+private:
+	void runJob(Job job);
+
+	std::thread thread;
+	std::atomic<unsigned long long> sectors;
+	TransferControl transferControl;
+	std::atomic<bool> done;
+	TransferPipeline::Result result;
+};
+
+#endif // TRANSFERWORKER_H
@@ -0,0 +1,473 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include <vector>
+#include "crc32.h"
+#include "virtualdisk.h"
+
+// VHD: Virtual Hard Disk Image Format Specification 1.0, big endian.
+// VHDX: [MS-VHDX] 1.0, little endian.
+static const size_t VHD_FOOTER_BYTES = 512;
+static const size_t VHD_DYNAMIC_HEADER_BYTES = 1024;
+static const uint32_t VHD_TYPE_FIXED = 2;
+static const uint32_t VHD_TYPE_DYNAMIC = 3;
+static const uint32_t VHD_TYPE_DIFFERENCING = 4;
+static const uint32_t VHD_BAT_UNUSED = 0xFFFFFFFFu;
+
+static const unsigned long long VHDX_HEADER_OFFSETS[2] = { 64ull * 1024ull, 128ull * 1024ull };
+static const size_t VHDX_HEADER_BYTES = 4096;
+static const unsigned long long VHDX_REGION_TABLE_OFFSETS[2] = { 192ull * 1024ull, 256ull * 1024ull };
+static const size_t VHDX_REGION_TABLE_BYTES = 64 * 1024;
+static const uint32_t VHDX_MAX_REGIONS = 2047;
+static const unsigned long long VHDX_MB = 1024ull * 1024ull;
+// Payload block states in the BAT
+static const unsigned int VHDX_BLOCK_FULLY_PRESENT = 6;
+static const unsigned int VHDX_BLOCK_PARTIALLY_PRESENT = 7;
+static const uint32_t VHDX_HAS_PARENT = 0x2;
+// GUIDs as they are stored (first three fields little endian)
+static const unsigned char VHDX_BAT_REGION[16] = { 0x66, 0x77, 0xC2, 0x2D, 0x23, 0xF6, 0x00, 0x42, 0x9D, 0x64, 0x11, 0x5E, 0x9B, 0xFD, 0x4A, 0x08 };
+static const unsigned char VHDX_METADATA_REGION[16] = { 0x06, 0xA2, 0x7C, 0x8B, 0x90, 0x47, 0x9A, 0x4B, 0xB8, 0xFE, 0x57, 0x5F, 0x05, 0x0F, 0x88, 0x6E };
+static const unsigned char VHDX_FILE_PARAMETERS[16] = { 0x37, 0x67, 0xA1, 0xCA, 0x36, 0xFA, 0x43, 0x4D, 0xB3, 0xB6, 0x33, 0xF0, 0xAA, 0x44, 0xE7, 0x6B };
+static const unsigned char VHDX_VIRTUAL_DISK_SIZE[16] = { 0x24, 0x42, 0xA5, 0x2F, 0x1B, 0xCD, 0x76, 0x48, 0xB2, 0x11, 0x5D, 0xBE, 0xD8, 0x3B, 0xF4, 0xB8 };
+static const unsigned char VHDX_LOGICAL_SECTOR_SIZE[16] = { 0x1D, 0xBF, 0x41, 0x81, 0x6F, 0xA9, 0x09, 0x47, 0xBA, 0x47, 0xF2, 0x33, 0xA8, 0xFA, 0xAB, 0x5F };
+
+// Reads are split so a large BAT does not need one huge request
+static const size_t MAX_READ_BYTES = 1024 * 1024;
+
+static uint32_t be32(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+static unsigned long long be64(const char* p)
+{
+	return ((unsigned long long)be32(p) << 32) | be32(p + 4);
+}
+
+static uint16_t le16(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static uint32_t le32(const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static unsigned long long le64(const char* p)
+{
+	return ((unsigned long long)le32(p + 4) << 32) | le32(p);
+}
+
+static bool isPowerOfTwo(unsigned long long value)
+{
+	return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Cookie, and the one's complement of the byte sum with the checksum left out
+static bool vhdFooterValid(const char* footer)
+{
+	if (memcmp(footer, "conectix", 8) != 0)
+	{
+		return false;
+	}
+	uint32_t sum = 0;
+	for (size_t i = 0; i < VHD_FOOTER_BYTES; ++i)
+	{
+		if (i < 64 || i >= 68)
+		{
+			sum += (unsigned char)footer[i];
+		}
+	}
+	return ~sum == be32(footer + 64);
+}
+
+// CRC-32C over the structure with its checksum field (at offset 4) as zero
+static bool vhdxChecksumValid(const char* data, size_t bytes)
+{
+	static const char zero[4] = { 0, 0, 0, 0 };
+	uint32_t crc = crc32cUpdate(0, data, 4);
+	crc = crc32cUpdate(crc, zero, sizeof(zero));
+	crc = crc32cUpdate(crc, data + 8, bytes - 8);
+	return crc == le32(data + 4);
+}
+
+VirtualDisk::Format VirtualDisk::detect(const char* head, const char* tail)
+{
+	if (memcmp(head, "vhdxfile", 8) == 0)
+	{
+		return FORMAT_VHDX;
+	}
+	// Dynamic and differencing disks start with a copy of the footer
+	if (memcmp(head, "conectix", 8) == 0)
+	{
+		return FORMAT_VHD_DYNAMIC;
+	}
+	if (tail != NULL && vhdFooterValid(tail) && be32(tail + 60) == VHD_TYPE_FIXED)
+	{
+		return FORMAT_VHD_FIXED;
+	}
+	return FORMAT_NONE;
+}
+
+VirtualDisk::VirtualDisk()
+	: fmt(FORMAT_NONE), sectorsize(512ull), disksize(0ull), numsectors(0ull), databytes(0ull), blocksize(0ull),
+	err(VIRTUAL_OK), ioerror(0)
+{
+}
+
+const char* VirtualDisk::formatName() const
+{
+	switch (fmt)
+	{
+	case FORMAT_VHD_FIXED:
+		return "fixed VHD";
+	case FORMAT_VHD_DYNAMIC:
+		return "dynamic VHD";
+	case FORMAT_VHDX:
+		return "VHDX";
+	default:
+		return "none";
+	}
+}
+
+bool VirtualDisk::open(IoHandle handle, unsigned long long filesize, unsigned long long sectorsize)
+{
+	this->sectorsize = sectorsize;
+	fmt = FORMAT_NONE;
+	disksize = 0ull;
+	numsectors = 0ull;
+	databytes = 0ull;
+	blocksize = 0ull;
+	extentlist.clear();
+	err = VIRTUAL_OK;
+	ioerror = 0;
+
+	AsyncIo* io = AsyncIo::create(1);
+	char head[HEAD_BYTES];
+	char footer[VHD_FOOTER_BYTES];
+	bool hastail = (filesize >= VHD_FOOTER_BYTES);
+	bool ok = readAt(io, handle, 0ull, head, sizeof(head)) &&
+		(!hastail || readAt(io, handle, filesize - VHD_FOOTER_BYTES, footer, sizeof(footer)));
+	if (ok)
+	{
+		fmt = detect(head, hastail ? footer : NULL);
+		switch (fmt)
+		{
+		case FORMAT_VHD_FIXED:
+			ok = openVhdFixed(footer, filesize);
+			break;
+		case FORMAT_VHD_DYNAMIC:
+			// The copy at the start is the one that counts
+			ok = readAt(io, handle, 0ull, footer, sizeof(footer)) && openVhdDynamic(io, handle, footer);
+			break;
+		case FORMAT_VHDX:
+			ok = openVhdx(io, handle);
+			break;
+		default:
+			ok = fail(VIRTUAL_DAMAGED);
+			break;
+		}
+	}
+	delete io;
+	if (!ok)
+	{
+		extentlist.clear();
+		return false;
+	}
+	return true;
+}
+
+bool VirtualDisk::openVhdFixed(const char* footer, unsigned long long filesize)
+{
+	disksize = be64(footer + 48);
+	if (disksize > filesize - VHD_FOOTER_BYTES)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	// The data is the disk itself, in front of the footer; a partial last
+	// sector would take in the footer, so it is left to read as zeros
+	numsectors = (disksize + sectorsize - 1) / sectorsize;
+	unsigned long long whole = disksize / sectorsize;
+	TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_DATA, whole, 0ull, 0, sectorsize);
+	TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_FILL, numsectors - whole, 0ull, 0, sectorsize);
+	databytes = disksize;
+	blocksize = disksize;
+	return true;
+}
+
+bool VirtualDisk::openVhdDynamic(AsyncIo* io, IoHandle handle, const char* footer)
+{
+	if (!vhdFooterValid(footer))
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	uint32_t type = be32(footer + 60);
+	if (type == VHD_TYPE_DIFFERENCING)
+	{
+		return fail(VIRTUAL_DIFFERENCING);
+	}
+	if (type != VHD_TYPE_DYNAMIC)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	disksize = be64(footer + 48);
+	char header[VHD_DYNAMIC_HEADER_BYTES];
+	if (!readAt(io, handle, be64(footer + 16), header, sizeof(header)))
+	{
+		return false;
+	}
+	unsigned long long tableoffset = be64(header + 16);
+	unsigned long long entries = be32(header + 28);
+	blocksize = be32(header + 32);
+	if (memcmp(header, "cxsparse", 8) != 0 || blocksize == 0 || blocksize % 512 != 0 || entries * blocksize < disksize)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	if (blocksize % sectorsize != 0)
+	{
+		return fail(VIRTUAL_BAD_BLOCK_SIZE);
+	}
+	numsectors = (disksize + sectorsize - 1) / sectorsize;
+
+	// Each block starts with a bitmap of its sectors, padded to whole sectors
+	unsigned long long bitmapbytes = (blocksize / 512 / 8 + 511) / 512 * 512;
+	unsigned long long blocks = (disksize + blocksize - 1) / blocksize;
+	std::vector<char> bat((size_t)(blocks * 4));
+	if (!readAt(io, handle, tableoffset, bat.data(), bat.size()))
+	{
+		return false;
+	}
+	for (unsigned long long block = 0; block < blocks; ++block)
+	{
+		uint32_t entry = be32(bat.data() + block * 4);
+		addBlock(block, entry != VHD_BAT_UNUSED, (unsigned long long)entry * 512ull + bitmapbytes);
+	}
+	return true;
+}
+
+bool VirtualDisk::openVhdx(AsyncIo* io, IoHandle handle)
+{
+	// Two headers; the valid one with the higher sequence number is current
+	char headers[2][VHDX_HEADER_BYTES];
+	int current = -1;
+	for (int i = 0; i < 2; ++i)
+	{
+		if (!readAt(io, handle, VHDX_HEADER_OFFSETS[i], headers[i], VHDX_HEADER_BYTES))
+		{
+			return false;
+		}
+		if (memcmp(headers[i], "head", 4) == 0 && vhdxChecksumValid(headers[i], VHDX_HEADER_BYTES) &&
+			(current < 0 || le64(headers[i] + 8) > le64(headers[current] + 8)))
+		{
+			current = i;
+		}
+	}
+	if (current < 0 || le16(headers[current] + 66) != 1)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	// A non-zero log GUID means the log holds updates not yet in place
+	static const char NO_LOG[16] = { 0 };
+	if (memcmp(headers[current] + 48, NO_LOG, sizeof(NO_LOG)) != 0)
+	{
+		return fail(VIRTUAL_NEEDS_REPLAY);
+	}
+
+	std::vector<char> regions(VHDX_REGION_TABLE_BYTES);
+	bool regionsvalid = false;
+	for (int i = 0; i < 2 && !regionsvalid; ++i)
+	{
+		if (!readAt(io, handle, VHDX_REGION_TABLE_OFFSETS[i], regions.data(), regions.size()))
+		{
+			return false;
+		}
+		regionsvalid = memcmp(regions.data(), "regi", 4) == 0 && vhdxChecksumValid(regions.data(), regions.size()) &&
+			le32(regions.data() + 8) <= VHDX_MAX_REGIONS;
+	}
+	if (!regionsvalid)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	unsigned long long batoffset = 0ull, batbytes = 0ull, metaoffset = 0ull, metabytes = 0ull;
+	uint32_t regioncount = le32(regions.data() + 8);
+	for (uint32_t i = 0; i < regioncount; ++i)
+	{
+		const char* entry = regions.data() + 16 + 32 * i;
+		if (memcmp(entry, VHDX_BAT_REGION, 16) == 0)
+		{
+			batoffset = le64(entry + 16);
+			batbytes = le32(entry + 24);
+		}
+		else if (memcmp(entry, VHDX_METADATA_REGION, 16) == 0)
+		{
+			metaoffset = le64(entry + 16);
+			metabytes = le32(entry + 24);
+		}
+	}
+	if (batbytes == 0 || metabytes < 64 * 1024)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+
+	// Metadata table: a 32-byte header, then 32-byte entries pointing into
+	// the region
+	std::vector<char> metadata((size_t)metabytes);
+	if (!readAt(io, handle, metaoffset, metadata.data(), metadata.size()))
+	{
+		return false;
+	}
+	if (memcmp(metadata.data(), "metadata", 8) != 0)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	uint32_t flags = 0;
+	unsigned long long logicalsector = 0ull;
+	bool haveparameters = false, havesize = false;
+	uint16_t itemcount = le16(metadata.data() + 10);
+	for (uint16_t i = 0; i < itemcount && 32 + 32 * (size_t)(i + 1) <= metadata.size(); ++i)
+	{
+		const char* entry = metadata.data() + 32 + 32 * i;
+		unsigned long long offset = le32(entry + 16);
+		unsigned long long length = le32(entry + 20);
+		if (offset + length > metadata.size())
+		{
+			return fail(VIRTUAL_DAMAGED);
+		}
+		const char* item = metadata.data() + offset;
+		if (memcmp(entry, VHDX_FILE_PARAMETERS, 16) == 0 && length >= 8)
+		{
+			blocksize = le32(item);
+			flags = le32(item + 4);
+			haveparameters = true;
+		}
+		else if (memcmp(entry, VHDX_VIRTUAL_DISK_SIZE, 16) == 0 && length >= 8)
+		{
+			disksize = le64(item);
+			havesize = true;
+		}
+		else if (memcmp(entry, VHDX_LOGICAL_SECTOR_SIZE, 16) == 0 && length >= 4)
+		{
+			logicalsector = le32(item);
+		}
+	}
+	if (!haveparameters || !havesize || !isPowerOfTwo(blocksize) || blocksize < VHDX_MB || blocksize > 256ull * VHDX_MB ||
+		(logicalsector != 512 && logicalsector != 4096))
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	if (flags & VHDX_HAS_PARENT)
+	{
+		return fail(VIRTUAL_DIFFERENCING);
+	}
+	if (blocksize % sectorsize != 0)
+	{
+		return fail(VIRTUAL_BAD_BLOCK_SIZE);
+	}
+	numsectors = (disksize + sectorsize - 1) / sectorsize;
+
+	// After every chunkratio payload entries comes one sector bitmap entry
+	unsigned long long chunkratio = (8388608ull * logicalsector) / blocksize;
+	unsigned long long blocks = (disksize + blocksize - 1) / blocksize;
+	unsigned long long batentries = (blocks == 0) ? 0 : blocks + (blocks - 1) / chunkratio;
+	if (batentries * 8 > batbytes)
+	{
+		return fail(VIRTUAL_DAMAGED);
+	}
+	std::vector<char> bat((size_t)(batentries * 8));
+	if (!readAt(io, handle, batoffset, bat.data(), bat.size()))
+	{
+		return false;
+	}
+	for (unsigned long long block = 0; block < blocks; ++block)
+	{
+		unsigned long long entry = le64(bat.data() + (block + block / chunkratio) * 8);
+		unsigned int state = (unsigned int)(entry & 0x7);
+		// NOT_PRESENT, UNDEFINED, ZERO and UNMAPPED all read as zeros
+		bool present = (state == VHDX_BLOCK_FULLY_PRESENT || state == VHDX_BLOCK_PARTIALLY_PRESENT);
+		if (state == 4 || state == 5)
+		{
+			return fail(VIRTUAL_DAMAGED);
+		}
+		addBlock(block, present, (entry >> 20) * VHDX_MB);
+	}
+	return true;
+}
+
+bool VirtualDisk::readAt(AsyncIo* io, IoHandle handle, unsigned long long offset, char* data, size_t bytes)
+{
+	while (bytes > 0)
+	{
+		IoRequest request;
+		request.op = IoRequest::OP_READ;
+		request.handle = handle;
+		request.offset = offset;
+		request.data = data;
+		request.length = (unsigned long)((bytes < MAX_READ_BYTES) ? bytes : MAX_READ_BYTES);
+		request.context = NULL;
+		request.transferred = 0;
+		request.error = 0;
+		io->submit(&request);
+		io->wait();
+		if (request.error != 0)
+		{
+			ioerror = request.error;
+			return fail(VIRTUAL_READ_ERROR);
+		}
+		// Short only at the end of the file: the image is cut off
+		if (request.transferred < request.length)
+		{
+			return fail(VIRTUAL_DAMAGED);
+		}
+		offset += request.transferred;
+		data += request.transferred;
+		bytes -= request.transferred;
+	}
+	return true;
+}
+
+void VirtualDisk::addBlock(unsigned long long block, bool present, unsigned long long fileoffset)
+{
+	unsigned long long sectorsperblock = blocksize / sectorsize;
+	unsigned long long start = block * sectorsperblock;
+	if (start >= numsectors)
+	{
+		return;
+	}
+	unsigned long long count = (numsectors - start < sectorsperblock) ? (numsectors - start) : sectorsperblock;
+	if (present)
+	{
+		TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_DATA, count, fileoffset, 0, sectorsize);
+		databytes += count * sectorsize;
+	}
+	else
+	{
+		TransferPipeline::addExtent(extentlist, TransferPipeline::Extent::EXTENT_FILL, count, 0ull, 0, sectorsize);
+	}
+}
+
+bool VirtualDisk::fail(Error error)
+{
+	err = error;
+	return false;
+}
@@ -0,0 +1,89 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef VIRTUALDISK_H
+#define VIRTUALDISK_H
+
+#include <cstddef>
+#include <cstdint>
+#include "asyncio.h"
+#include "transferpipeline.h"
+
+// VHD (fixed and dynamic) and VHDX disk images as a source for the
+// transfer pipeline.  open() reads the metadata and the whole block
+// allocation table once and turns it into a TransferPipeline::ExtentList:
+// allocated blocks are DATA extents at their offset in the file (runs of
+// blocks stored back to back become one extent, so the disk is read in
+// long sequential requests), and unallocated or zeroed blocks are zero
+// fills, which cost no I/O at all once the target is trimmed.
+//
+// Differencing disks and VHDX files with a log still to replay are
+// refused.  Block data sits at 512-byte offsets in a VHD, so the file
+// handle must not be unbuffered.
+class VirtualDisk
+{
+public:
+	enum Format { FORMAT_NONE = 0, FORMAT_VHD_FIXED, FORMAT_VHD_DYNAMIC, FORMAT_VHDX };
+	enum Error { VIRTUAL_OK = 0, VIRTUAL_READ_ERROR, VIRTUAL_DAMAGED, VIRTUAL_DIFFERENCING, VIRTUAL_NEEDS_REPLAY, VIRTUAL_BAD_BLOCK_SIZE };
+
+	// Bytes detect() wants from the start and from the end of the file
+	static const size_t HEAD_BYTES = 8;
+	static const size_t TAIL_BYTES = 512;
+
+	// Tells the format from the first HEAD_BYTES and last TAIL_BYTES of a
+	// file (tail may be NULL when the file is shorter)
+	static Format detect(const char* head, const char* tail);
+
+	VirtualDisk();
+
+	// filesize is the size of the image file
+	bool open(IoHandle handle, unsigned long long filesize, unsigned long long sectorsize);
+	Error error() const { return err; }
+	// Win32 error code / errno for VIRTUAL_READ_ERROR
+	unsigned long ioError() const { return ioerror; }
+
+	Format format() const { return fmt; }
+	const char* formatName() const;
+	// Size of the virtual disk
+	unsigned long long numSectors() const { return numsectors; }
+	// Bytes of allocated blocks, the data actually stored in the file
+	unsigned long long dataBytes() const { return databytes; }
+	unsigned long long blockSize() const { return blocksize; }
+	const TransferPipeline::ExtentList& extents() const { return extentlist; }
+
+private:
+	bool openVhdFixed(const char* footer, unsigned long long filesize);
+	bool openVhdDynamic(AsyncIo* io, IoHandle handle, const char* footer);
+	bool openVhdx(AsyncIo* io, IoHandle handle);
+	bool readAt(AsyncIo* io, IoHandle handle, unsigned long long offset, char* data, size_t bytes);
+	void addBlock(unsigned long long block, bool present, unsigned long long fileoffset);
+	bool fail(Error error);
+
+	Format fmt;
+	unsigned long long sectorsize;
+	unsigned long long disksize;
+	unsigned long long numsectors;
+	unsigned long long databytes;
+	unsigned long long blocksize;
+	TransferPipeline::ExtentList extentlist;
+	Error err;
+	unsigned long ioerror;
+};
+
+#endif // VIRTUALDISK_H
@@ -0,0 +1,412 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstring>
+#include "xxh3.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define XXH3_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+// Straight from the xxHash specification
+static const uint64_t PRIME32_1 = 0x9E3779B1ull;
+static const uint64_t PRIME32_2 = 0x85EBCA77ull;
+static const uint64_t PRIME32_3 = 0xC2B2AE3Dull;
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ull;
+static const uint64_t PRIME_MX1 = 0x165667919E3779F9ull;
+static const uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ull;
+
+static const size_t SECRET_BYTES = 192;
+static const size_t STRIPES_PER_BLOCK = (SECRET_BYTES - 64) / 8;
+static const size_t SECRET_LASTACC_START = 7;
+static const size_t SECRET_MERGEACCS_START = 11;
+static const size_t SECRET_SIZE_MIN = 136;
+static const size_t MIDSIZE_MAX = 240;
+static const size_t MIDSIZE_STARTOFFSET = 3;
+static const size_t MIDSIZE_LASTOFFSET = 17;
+
+alignas(16) static const unsigned char SECRET[SECRET_BYTES] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct Hash128
+{
+	uint64_t low;
+	uint64_t high;
+};
+
+// Little-endian loads; x86 and ARM Windows are little-endian throughout
+static uint32_t read32(const unsigned char* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t read64(const unsigned char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t swap32(uint32_t x)
+{
+	return ((x << 24) & 0xff000000u) | ((x << 8) & 0x00ff0000u) | ((x >> 8) & 0x0000ff00u) | ((x >> 24) & 0x000000ffu);
+}
+
+static uint64_t swap64(uint64_t x)
+{
+	return ((uint64_t)swap32((uint32_t)x) << 32) | swap32((uint32_t)(x >> 32));
+}
+
+static uint32_t rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static Hash128 mult64to128(uint64_t lhs, uint64_t rhs)
+{
+	Hash128 product;
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 full = (unsigned __int128)lhs * rhs;
+	product.low = (uint64_t)full;
+	product.high = (uint64_t)(full >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	product.low = _umul128(lhs, rhs, &product.high);
+#else
+	uint64_t lolo = (lhs & 0xFFFFFFFFull) * (rhs & 0xFFFFFFFFull);
+	uint64_t hilo = (lhs >> 32) * (rhs & 0xFFFFFFFFull);
+	uint64_t lohi = (lhs & 0xFFFFFFFFull) * (rhs >> 32);
+	uint64_t hihi = (lhs >> 32) * (rhs >> 32);
+	uint64_t cross = (lolo >> 32) + (hilo & 0xFFFFFFFFull) + lohi;
+	product.high = (hilo >> 32) + (cross >> 32) + hihi;
+	product.low = (cross << 32) | (lolo & 0xFFFFFFFFull);
+#endif
+	return product;
+}
+
+static uint64_t mul128Fold64(uint64_t lhs, uint64_t rhs)
+{
+	Hash128 product = mult64to128(lhs, rhs);
+	return product.low ^ product.high;
+}
+
+static uint64_t xxh64Avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t mix16(const unsigned char* input, const unsigned char* secret)
+{
+	return mul128Fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+static Hash128 mix32(Hash128 acc, const unsigned char* input1, const unsigned char* input2, const unsigned char* secret)
+{
+	acc.low += mix16(input1, secret);
+	acc.low ^= read64(input2) + read64(input2 + 8);
+	acc.high += mix16(input2, secret + 16);
+	acc.high ^= read64(input1) + read64(input1 + 8);
+	return acc;
+}
+
+static Hash128 finishMid(Hash128 acc, size_t len)
+{
+	Hash128 h;
+	h.low = avalanche(acc.low + acc.high);
+	h.high = 0ull - avalanche(acc.low * PRIME64_1 + acc.high * PRIME64_4 + (uint64_t)len * PRIME64_2);
+	return h;
+}
+
+// Inputs of at most MIDSIZE_MAX bytes are hashed whole
+static Hash128 hashShort(const unsigned char* input, size_t len)
+{
+	const unsigned char* secret = SECRET;
+	Hash128 h;
+	if (len == 0)
+	{
+		h.low = xxh64Avalanche(read64(secret + 64) ^ read64(secret + 72));
+		h.high = xxh64Avalanche(read64(secret + 80) ^ read64(secret + 88));
+		return h;
+	}
+	if (len <= 3)
+	{
+		uint32_t combinedl = ((uint32_t)input[0] << 16) | ((uint32_t)input[len >> 1] << 24) | (uint32_t)input[len - 1] | ((uint32_t)len << 8);
+		uint32_t combinedh = rotl32(swap32(combinedl), 13);
+		h.low = xxh64Avalanche((uint64_t)combinedl ^ (uint64_t)(read32(secret) ^ read32(secret + 4)));
+		h.high = xxh64Avalanche((uint64_t)combinedh ^ (uint64_t)(read32(secret + 8) ^ read32(secret + 12)));
+		return h;
+	}
+	if (len <= 8)
+	{
+		uint64_t input64 = read32(input) + ((uint64_t)read32(input + len - 4) << 32);
+		uint64_t keyed = input64 ^ (read64(secret + 16) ^ read64(secret + 24));
+		Hash128 m = mult64to128(keyed, PRIME64_1 + ((uint64_t)len << 2));
+		m.high += m.low << 1;
+		m.low ^= m.high >> 3;
+		m.low ^= m.low >> 35;
+		m.low *= PRIME_MX2;
+		m.low ^= m.low >> 28;
+		m.high = avalanche(m.high);
+		return m;
+	}
+	if (len <= 16)
+	{
+		uint64_t bitflipl = read64(secret + 32) ^ read64(secret + 40);
+		uint64_t bitfliph = read64(secret + 48) ^ read64(secret + 56);
+		uint64_t inputlo = read64(input);
+		uint64_t inputhi = read64(input + len - 8);
+		Hash128 m = mult64to128(inputlo ^ inputhi ^ bitflipl, PRIME64_1);
+		m.low += (uint64_t)(len - 1) << 54;
+		inputhi ^= bitfliph;
+		m.high += inputhi + (inputhi & 0xFFFFFFFFull) * (PRIME32_2 - 1);
+		m.low ^= swap64(m.high);
+		h = mult64to128(m.low, PRIME64_2);
+		h.high += m.high * PRIME64_2;
+		h.low = avalanche(h.low);
+		h.high = avalanche(h.high);
+		return h;
+	}
+
+	Hash128 acc = { (uint64_t)len * PRIME64_1, 0ull };
+	if (len <= 128)
+	{
+		if (len > 32)
+		{
+			if (len > 64)
+			{
+				if (len > 96)
+				{
+					acc = mix32(acc, input + 48, input + len - 64, secret + 96);
+				}
+				acc = mix32(acc, input + 32, input + len - 48, secret + 64);
+			}
+			acc = mix32(acc, input + 16, input + len - 32, secret + 32);
+		}
+		acc = mix32(acc, input, input + len - 16, secret);
+		return finishMid(acc, len);
+	}
+	size_t i;
+	for (i = 32; i < 160; i += 32)
+	{
+		acc = mix32(acc, input + i - 32, input + i - 16, secret + i - 32);
+	}
+	acc.low = avalanche(acc.low);
+	acc.high = avalanche(acc.high);
+	for (i = 160; i <= len; i += 32)
+	{
+		acc = mix32(acc, input + i - 32, input + i - 16, secret + MIDSIZE_STARTOFFSET + i - 160);
+	}
+	acc = mix32(acc, input + len - 16, input + len - 32, secret + SECRET_SIZE_MIN - MIDSIZE_LASTOFFSET - 16);
+	return finishMid(acc, len);
+}
+
+#ifdef XXH3_SSE2
+static void accumulate512(uint64_t* acc, const unsigned char* input, const unsigned char* secret)
+{
+	__m128i* xacc = (__m128i*)acc;
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128i data = _mm_loadu_si128((const __m128i*)input + i);
+		__m128i key = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)secret + i));
+		__m128i product = _mm_mul_epu32(key, _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m128i sum = _mm_add_epi64(_mm_loadu_si128(xacc + i), _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_si128(xacc + i, _mm_add_epi64(product, sum));
+	}
+}
+
+static void scramble(uint64_t* acc, const unsigned char* secret)
+{
+	__m128i* xacc = (__m128i*)acc;
+	const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128i current = _mm_loadu_si128(xacc + i);
+		__m128i value = _mm_xor_si128(current, _mm_srli_epi64(current, 47));
+		__m128i key = _mm_xor_si128(value, _mm_loadu_si128((const __m128i*)secret + i));
+		__m128i productlo = _mm_mul_epu32(key, prime);
+		__m128i producthi = _mm_mul_epu32(_mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+		_mm_storeu_si128(xacc + i, _mm_add_epi64(productlo, _mm_slli_epi64(producthi, 32)));
+	}
+}
+#else
+static void accumulate512(uint64_t* acc, const unsigned char* input, const unsigned char* secret)
+{
+	for (int lane = 0; lane < 8; ++lane)
+	{
+		uint64_t data = read64(input + lane * 8);
+		uint64_t key = data ^ read64(secret + lane * 8);
+		acc[lane ^ 1] += data;
+		acc[lane] += (key & 0xFFFFFFFFull) * (key >> 32);
+	}
+}
+
+static void scramble(uint64_t* acc, const unsigned char* secret)
+{
+	for (int lane = 0; lane < 8; ++lane)
+	{
+		uint64_t value = acc[lane] ^ (acc[lane] >> 47);
+		acc[lane] = (value ^ read64(secret + lane * 8)) * PRIME32_1;
+	}
+}
+#endif
+
+static uint64_t mergeAccs(const uint64_t* acc, const unsigned char* secret, uint64_t start)
+{
+	uint64_t result = start;
+	for (int i = 0; i < 4; ++i)
+	{
+		result += mul128Fold64(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+	}
+	return avalanche(result);
+}
+
+Xxh3Hash::Xxh3Hash()
+	: buffered(0), stripesSoFar(0), total(0ull)
+{
+	static const uint64_t init[8] = { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+	memcpy(acc, init, sizeof(acc));
+}
+
+void Xxh3Hash::consumeStripes(const unsigned char* data, size_t stripes)
+{
+	while (stripes > 0)
+	{
+		size_t now = STRIPES_PER_BLOCK - stripesSoFar;
+		if (now > stripes)
+		{
+			now = stripes;
+		}
+		for (size_t i = 0; i < now; ++i)
+		{
+			accumulate512(acc, data + i * STRIPE_BYTES, SECRET + (stripesSoFar + i) * 8);
+		}
+		data += now * STRIPE_BYTES;
+		stripes -= now;
+		stripesSoFar += now;
+		if (stripesSoFar == STRIPES_PER_BLOCK)
+		{
+			scramble(acc, SECRET + SECRET_BYTES - STRIPE_BYTES);
+			stripesSoFar = 0;
+		}
+	}
+}
+
+void Xxh3Hash::addData(const char* data, size_t bytes)
+{
+	const unsigned char* input = (const unsigned char*)data;
+	total += bytes;
+	if (bytes <= BUFFER_BYTES - buffered)
+	{
+		memcpy(buffer + buffered, input, bytes);
+		buffered += bytes;
+		return;
+	}
+	// The buffer always keeps the last bytes back: the final stripe is
+	// accumulated with another part of the secret in result()
+	if (buffered > 0)
+	{
+		size_t fill = BUFFER_BYTES - buffered;
+		memcpy(buffer + buffered, input, fill);
+		input += fill;
+		bytes -= fill;
+		consumeStripes(buffer, BUFFER_BYTES / STRIPE_BYTES);
+		buffered = 0;
+	}
+	if (bytes > BUFFER_BYTES)
+	{
+		size_t stripes = (bytes - 1) / STRIPE_BYTES;
+		consumeStripes(input, stripes);
+		input += stripes * STRIPE_BYTES;
+		bytes -= stripes * STRIPE_BYTES;
+		// The stripe before the rest, in case the rest is less than one
+		memcpy(buffer + BUFFER_BYTES - STRIPE_BYTES, input - STRIPE_BYTES, STRIPE_BYTES);
+	}
+	memcpy(buffer, input, bytes);
+	buffered = bytes;
+}
+
+void Xxh3Hash::result(unsigned char digest[DIGEST_BYTES]) const
+{
+	Hash128 h;
+	if (total <= MIDSIZE_MAX)
+	{
+		h = hashShort(buffer, (size_t)total);
+	}
+	else
+	{
+		// On a copy, so more data could still follow
+		Xxh3Hash copy(*this);
+		const unsigned char* last;
+		unsigned char stripe[STRIPE_BYTES];
+		if (buffered >= STRIPE_BYTES)
+		{
+			copy.consumeStripes(buffer, (buffered - 1) / STRIPE_BYTES);
+			last = buffer + buffered - STRIPE_BYTES;
+		}
+		else
+		{
+			size_t catchup = STRIPE_BYTES - buffered;
+			memcpy(stripe, buffer + BUFFER_BYTES - catchup, catchup);
+			memcpy(stripe + catchup, buffer, buffered);
+			last = stripe;
+		}
+		accumulate512(copy.acc, last, SECRET + SECRET_BYTES - STRIPE_BYTES - SECRET_LASTACC_START);
+		h.low = mergeAccs(copy.acc, SECRET + SECRET_MERGEACCS_START, total * PRIME64_1);
+		h.high = mergeAccs(copy.acc, SECRET + SECRET_BYTES - 64 - SECRET_MERGEACCS_START, ~(total * PRIME64_2));
+	}
+	for (int i = 0; i < 8; ++i)
+	{
+		digest[i] = (unsigned char)(h.high >> (56 - 8 * i));
+		digest[8 + i] = (unsigned char)(h.low >> (56 - 8 * i));
+	}
+}
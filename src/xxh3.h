@@ -0,0 +1,54 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef XXH3_H
+#define XXH3_H
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH3-128 (xxHash 0.8, seed 0, default secret), streaming.  A fast
+// non-cryptographic digest for integrity checks: it catches corruption
+// but not tampering.  The accumulator loop runs on SSE2 where the target
+// has it, otherwise in plain 64-bit arithmetic.
+class Xxh3Hash
+{
+public:
+	static const size_t DIGEST_BYTES = 16;
+
+	Xxh3Hash();
+
+	void addData(const char* data, size_t bytes);
+	// Canonical form (big-endian, high half first), as xxhsum -H2 prints it
+	void result(unsigned char digest[DIGEST_BYTES]) const;
+
+private:
+	static const size_t STRIPE_BYTES = 64;
+	static const size_t BUFFER_BYTES = 256;
+
+	void consumeStripes(const unsigned char* data, size_t stripes);
+
+	uint64_t acc[8];
+	unsigned char buffer[BUFFER_BYTES];
+	size_t buffered;
+	size_t stripesSoFar;     // in the current block
+	unsigned long long total;
+};
+
+#endif // XXH3_H
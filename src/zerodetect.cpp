@@ -0,0 +1,181 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#include <cstdint>
+#include <cstring>
+#include "zerodetect.h"
+#include "cpufeatures.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define ZERODETECT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC accepts any intrinsic without per-function target flags
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+typedef size_t (*FirstNonZeroFunc)(const char* data, size_t bytes);
+
+static size_t firstNonZeroFrom(const char* data, size_t bytes, size_t offset)
+{
+	for (; offset + sizeof(uint64_t) <= bytes; offset += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, data + offset, sizeof(word));
+		if (word != 0)
+		{
+			break;
+		}
+	}
+	for (; offset < bytes; ++offset)
+	{
+		if (data[offset] != 0)
+		{
+			return offset;
+		}
+	}
+	return bytes;
+}
+
+static size_t firstNonZeroScalar(const char* data, size_t bytes)
+{
+	return firstNonZeroFrom(data, bytes, 0);
+}
+
+#ifdef ZERODETECT_X86
+static unsigned int lowestSetBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+TARGET_SSE2 static size_t firstNonZeroSse2(const char* data, size_t bytes)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t offset = 0;
+	// 64 bytes per round while everything is zero, the common case
+	for (; offset + 64 <= bytes; offset += 64)
+	{
+		const __m128i* p = (const __m128i*)(data + offset);
+		__m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1)),
+			_mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+		{
+			break;
+		}
+	}
+	for (; offset + 16 <= bytes; offset += 16)
+	{
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + offset)), zero));
+		if (mask != 0xFFFF)
+		{
+			return offset + lowestSetBit(~mask & 0xFFFF);
+		}
+	}
+	return firstNonZeroFrom(data, bytes, offset);
+}
+
+TARGET_AVX2 static size_t firstNonZeroAvx2(const char* data, size_t bytes)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	size_t offset = 0;
+	for (; offset + 128 <= bytes; offset += 128)
+	{
+		const __m256i* p = (const __m256i*)(data + offset);
+		__m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+			_mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+		if (!_mm256_testz_si256(any, any))
+		{
+			break;
+		}
+	}
+	for (; offset + 32 <= bytes; offset += 32)
+	{
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + offset)), zero));
+		if (mask != 0xFFFFFFFFu)
+		{
+			return offset + lowestSetBit(~mask);
+		}
+	}
+	return firstNonZeroFrom(data, bytes, offset);
+}
+#endif // ZERODETECT_X86
+
+struct ZeroDetectKernel
+{
+	FirstNonZeroFunc func;
+	const char* name;
+};
+
+static ZeroDetectKernel selectKernel(const CpuFeatures& cpu)
+{
+	ZeroDetectKernel kernel = { firstNonZeroScalar, "scalar" };
+#ifdef ZERODETECT_X86
+	if (cpu.avx2)
+	{
+		kernel.func = firstNonZeroAvx2;
+		kernel.name = "avx2";
+	}
+	else if (cpu.sse2)
+	{
+		kernel.func = firstNonZeroSse2;
+		kernel.name = "sse2";
+	}
+#else
+	(void)cpu;
+#endif
+	return kernel;
+}
+
+static ZeroDetectKernel& kernel()
+{
+	static ZeroDetectKernel selected = selectKernel(cpuFeatures());
+	return selected;
+}
+
+size_t firstNonZeroByte(const char* data, size_t bytes)
+{
+	return kernel().func(data, bytes);
+}
+
+bool isZeroFilled(const char* data, size_t bytes)
+{
+	return kernel().func(data, bytes) == bytes;
+}
+
+const char* zeroDetectKernel()
+{
+	return kernel().name;
+}
+
+void selectZeroDetectKernel(const CpuFeatures& features)
+{
+	kernel() = selectKernel(supportedCpuFeatures(features));
+}
@@ -0,0 +1,39 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef ZERODETECT_H
+#define ZERODETECT_H
+
+#include <cstddef>
+#include "cpufeatures.h"
+
+// Finding zero-filled ranges in sector data, for the trailing data check
+// and for stages that skip or punch out zeros.  The kernel (AVX2, SSE2 or
+// a word-at-a-time scalar loop) is picked once from what the CPU supports.
+
+// Offset of the first non-zero byte, or bytes when the range is all zero
+size_t firstNonZeroByte(const char* data, size_t bytes);
+bool isZeroFilled(const char* data, size_t bytes);
+// "avx2", "sse2" or "scalar", for the debug log
+const char* zeroDetectKernel();
+// Picks the kernel again as if the CPU had only features (and what it
+// really has), for tests and benchmarks; not while anything is scanning
+void selectZeroDetectKernel(const CpuFeatures& features);
+
+#endif // ZERODETECT_H
@@ -0,0 +1,206 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// AsyncIo: requests complete with the right data and byte counts, reads
+// stop short at the end of the file, and a request that cannot be started
+// still comes back through wait() with an error instead of hanging, also
+// when the io_uring ring itself stops working.
+
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "asyncio.h"
+#include "testutil.h"
+
+namespace
+{
+
+const unsigned long CHUNK = 64u * 1024u;
+const unsigned int COUNT = 8u;
+
+void roundTrip(int fd)
+{
+	AsyncIo* io = AsyncIo::create(4u);
+	std::vector<char> written(CHUNK * COUNT);
+	for (size_t i = 0; i < written.size(); ++i)
+	{
+		written[i] = (char)(i * 7 + i / CHUNK);
+	}
+	std::vector<IoRequest> requests(COUNT);
+	unsigned int submitted = 0;
+	unsigned int completed = 0;
+	while (completed < COUNT)
+	{
+		while (submitted < COUNT && !io->full())
+		{
+			IoRequest& request = requests[submitted];
+			request.op = IoRequest::OP_WRITE;
+			request.handle = fd;
+			request.offset = submitted * CHUNK;
+			request.data = written.data() + submitted * CHUNK;
+			request.length = CHUNK;
+			request.context = NULL;
+			io->submit(&request);
+			++submitted;
+		}
+		IoRequest* request = io->wait();
+		check(request != NULL, "write completes");
+		if (request == NULL)
+		{
+			break;
+		}
+		check(request->error == 0 && request->transferred == CHUNK, "whole write");
+		++completed;
+	}
+
+	// The last read runs past the end of the file
+	std::vector<char> read(CHUNK * COUNT + CHUNK, 'x');
+	IoRequest request;
+	request.op = IoRequest::OP_READ;
+	request.handle = fd;
+	request.offset = (COUNT - 1) * CHUNK + CHUNK / 2;
+	request.data = read.data();
+	request.length = CHUNK;
+	request.context = NULL;
+	io->submit(&request);
+	check(io->wait() == &request, "read completes");
+	check(request.error == 0 && request.transferred == CHUNK / 2, "short read at the end");
+	check(memcmp(read.data(), written.data() + request.offset, CHUNK / 2) == 0, "read data");
+	check(io->wait() == NULL && io->inFlight() == 0, "nothing left in flight");
+	printf("%s: round trip done\n", io->name());
+	delete io;
+}
+
+void badHandle()
+{
+	AsyncIo* io = AsyncIo::create(2u);
+	char buffer[512];
+	IoRequest request;
+	request.op = IoRequest::OP_READ;
+	request.handle = -1;
+	request.offset = 0;
+	request.data = buffer;
+	request.length = sizeof(buffer);
+	request.context = NULL;
+	io->submit(&request);
+	check(io->wait(1000u) == &request, "failed request comes back");
+	check(request.error != 0, "failed request has an error");
+	check(io->inFlight() == 0, "failed request is not in flight");
+	delete io;
+}
+
+// The descriptor of the io_uring ring this process has open, -1 if none
+int ringDescriptor()
+{
+	int found = -1;
+	DIR* fds = opendir("/proc/self/fd");
+	if (fds == NULL)
+	{
+		return -1;
+	}
+	while (struct dirent* entry = readdir(fds))
+	{
+		char path[PATH_MAX];
+		char target[PATH_MAX];
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+		ssize_t length = readlink(path, target, sizeof(target) - 1);
+		if (length > 0)
+		{
+			target[length] = 0;
+			if (strcmp(target, "anon_inode:[io_uring]") == 0)
+			{
+				found = atoi(entry->d_name);
+			}
+		}
+	}
+	closedir(fds);
+	return found;
+}
+
+// A read that never completes is in flight when io_uring_enter() starts
+// failing (the ring descriptor is replaced): wait() must fail it rather
+// than report timeouts forever, and later requests must fail at once
+void brokenRing()
+{
+	int pipefds[2];
+	if (pipe(pipefds) != 0)
+	{
+		check(false, "pipe");
+		return;
+	}
+	AsyncIo* io = AsyncIo::create(2u);
+	int ringfd = ringDescriptor();
+	if (strcmp(io->name(), "io_uring") != 0 || ringfd < 0)
+	{
+		printf("%s: no io_uring ring, broken ring test skipped\n", io->name());
+		delete io;
+		close(pipefds[0]);
+		close(pipefds[1]);
+		return;
+	}
+	// The kernel may still write into it after the ring is torn down
+	static char buffer[512];
+	IoRequest request;
+	request.op = IoRequest::OP_READ;
+	request.handle = pipefds[0];
+	request.offset = 0;
+	request.data = buffer;
+	request.length = sizeof(buffer);
+	request.context = NULL;
+	io->submit(&request);
+	check(io->wait(10u) == NULL && io->inFlight() == 1, "pipe read pending");
+
+	int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	check(devnull >= 0 && dup2(devnull, ringfd) == ringfd, "replace ring descriptor");
+	close(devnull);
+	check(io->wait() == &request, "pending read comes back");
+	check(request.error != 0, "pending read has an error");
+	check(io->inFlight() == 0 && io->wait() == NULL, "nothing left in flight after the failure");
+	IoRequest later = request;
+	io->submit(&later);
+	check(io->wait(1000u) == &later && later.error != 0, "later request fails");
+	delete io;
+	check(write(pipefds[1], "x", 1) == 1, "finish pipe read");
+	close(pipefds[0]);
+	close(pipefds[1]);
+}
+
+} // namespace
+
+int main()
+{
+	int fd = open("asynciotest.bin", O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		fprintf(stderr, "FAIL: cannot create asynciotest.bin\n");
+		return 1;
+	}
+	roundTrip(fd);
+	badHandle();
+	brokenRing();
+	close(fd);
+	unlink("asynciotest.bin");
+	return testResult("asynciotest");
+}
@@ -0,0 +1,311 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// TransferPipeline over BlockDevice on image files: copies and compares
+// come out byte for byte, buffered and unbuffered, with fixed and tuned
+// chunking and from a mapped source, and a changed byte is reported in
+// the right sector.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "blockdevice.h"
+#include "bufferpool.h"
+#include "chunkcontroller.h"
+#include "mappedfile.h"
+#include "sha.h"
+#include "testutil.h"
+#include "transferpipeline.h"
+#include "transferstages.h"
+
+namespace
+{
+
+// Random data with runs of zeros, ending inside a sector
+std::vector<char> makeImage(size_t bytes)
+{
+	std::vector<char> data(bytes);
+	TestRandom random(12345u);
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		char byte = random.next();
+		data[i] = ((i / (256 * 1024)) % 3 == 1) ? 0 : byte;
+	}
+	return data;
+}
+
+TransferPipeline::Endpoint endpoint(const BlockDevice* device)
+{
+	return TransferPipeline::Endpoint(device->handle(), (device->isUnbuffered() && device->isRegularFile()) ? (unsigned long long)BufferPool::ALIGNMENT : 1ull);
+}
+
+void copyAndCompare(const std::vector<char>& image, bool direct, bool adaptive, unsigned int depth)
+{
+	std::string name = std::string(direct ? "direct" : "buffered") + (adaptive ? " adaptive" : " fixed") + " depth " + std::to_string(depth);
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("source.img", BlockDevice::ACCESS_READ, direct, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, direct, &error);
+	check(source != NULL && sink != NULL, "open", name);
+	if (source == NULL || sink == NULL)
+	{
+		delete source;
+		delete sink;
+		return;
+	}
+	check(source->isRegularFile() && source->size() == image.size(), "geometry", name);
+	check(sink->lock(&error), "lock", name);
+
+	unsigned long long sectorsize = source->sectorSize();
+	unsigned long long numsectors = source->numberOfSectors();
+	BufferPool pool;
+	TransferPipeline pipeline(pool, sectorsize, 64ull, depth);
+	ChunkController controller(sectorsize, 128ull, depth, 8u);
+	if (adaptive)
+	{
+		pipeline.setController(&controller);
+	}
+	unsigned long long done = 0ull;
+	TransferPipeline::ProgressFunc progress = [&done](unsigned long long sectors) {
+		done = sectors;
+		return true;
+	};
+	check(pipeline.copy(numsectors, endpoint(source), endpoint(sink), progress) == TransferPipeline::RESULT_OK, "copy", name);
+	check(done == numsectors, "copy progress", name);
+	check(sink->setSize(image.size(), &error), "set size", name);
+	check(pipeline.compare(numsectors, endpoint(source), endpoint(sink), progress) == TransferPipeline::RESULT_OK, "compare", name);
+	check(sink->unlock(&error), "unlock", name);
+	delete sink;
+	delete source;
+	check(readFile("sink.img") == image, "copied bytes", name);
+}
+
+void mismatch(std::vector<char> image)
+{
+	size_t changed = image.size() / 2 + 1234;
+	image[changed] ^= 0x55;
+	check(writeFile("sink.img", image), "write changed image", "");
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("source.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_READ, false, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", "mismatch");
+		delete source;
+		delete sink;
+		return;
+	}
+	BufferPool pool;
+	TransferPipeline pipeline(pool, source->sectorSize(), 64ull, 4u);
+	TransferPipeline::Result result = pipeline.compare(source->numberOfSectors(), endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc());
+	check(result == TransferPipeline::RESULT_MISMATCH, "mismatch found", "");
+	check(pipeline.failedSector() == changed / source->sectorSize(), "mismatch sector", std::to_string(pipeline.failedSector()));
+	delete sink;
+	delete source;
+}
+
+// With zero skip and a hash, the zero check and the hash share one pass
+// over each chunk: the hash must still see every byte once, in order,
+// whether a chunk is written or skipped
+void fusedHash(const std::vector<char>& image, bool direct, unsigned int depth)
+{
+	std::string name = std::string(direct ? "direct" : "buffered") + " depth " + std::to_string(depth);
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("source.img", BlockDevice::ACCESS_READ, direct, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, direct, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", name);
+		delete source;
+		delete sink;
+		return;
+	}
+	// A fresh file reads as zeros, so zero chunks need not be written
+	unsigned long long numsectors = source->numberOfSectors();
+	check(sink->setSize(numsectors * source->sectorSize(), &error), "size sink", name);
+	BufferPool pool;
+	TransferPipeline pipeline(pool, source->sectorSize(), 128ull, depth);
+	pipeline.setZeroSkip(true);
+	Sha256Hash hash;
+	HashStage<Sha256Hash> stage(hash, source->size());
+	check(pipeline.copy(numsectors, endpoint(source), endpoint(sink), stage, TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK, "fused copy", name);
+	check(pipeline.skippedBytes() > 0ull, "zero chunks skipped", name);
+	check(sink->setSize(image.size(), &error), "set size", name);
+	delete sink;
+	delete source;
+	check(readFile("sink.img") == image, "fused copy bytes", name);
+
+	Sha256Hash expected;
+	expected.addData(image.data(), image.size());
+	unsigned char want[Sha256Hash::DIGEST_BYTES];
+	unsigned char got[Sha256Hash::DIGEST_BYTES];
+	expected.result(want);
+	hash.result(got);
+	check(memcmp(want, got, sizeof(want)) == 0, "fused hash", name);
+}
+
+// Chunks served from a mapping of the source, with 1 MiB windows so some
+// chunks straddle two and are read instead, must copy and compare the same
+void mappedSource(const std::vector<char>& image, unsigned int depth)
+{
+	std::string name = "depth " + std::to_string(depth);
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("source.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", name);
+		delete source;
+		delete sink;
+		return;
+	}
+	MappedFile mapping(source->handle(), source->size(), 1024ull * 1024ull);
+	check(mapping.isValid(), "map source", name);
+	TransferPipeline::Endpoint mapped(source->handle(), 1ull, &mapping);
+	BufferPool pool;
+	TransferPipeline pipeline(pool, source->sectorSize(), 768ull, depth);
+	pipeline.setKernelCopy(false);
+	unsigned long long numsectors = source->numberOfSectors();
+	check(pipeline.copy(numsectors, mapped, endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK, "mapped copy", name);
+	check(sink->setSize(image.size(), &error), "set size", name);
+	check(pipeline.compare(numsectors, mapped, endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK, "mapped compare", name);
+	check(mapping.mapCount() >= 5ull, "windows mapped", std::to_string(mapping.mapCount()));
+	delete sink;
+	delete source;
+	check(readFile("sink.img") == image, "mapped copy bytes", name);
+}
+
+// Blocks the file has allocated, in bytes
+unsigned long long allocatedBytes(const char* path)
+{
+	struct stat info;
+	return (stat(path, &info) == 0) ? (unsigned long long)info.st_blocks * 512ull : 0ull;
+}
+
+// The zero skip on a sink full of old data: discard() punches the whole
+// file out (FALLOC_FL_PUNCH_HOLE) and promises zeros, the copy then leaves
+// the zero chunks unwritten, and they stay holes that read as zeros
+void discardAndSkip(const std::vector<char>& image, bool direct)
+{
+	std::string name = direct ? "direct" : "buffered";
+	check(writeFile("sink.img", std::vector<char>(image.size(), (char)0xa5)), "write old data", name);
+	check(allocatedBytes("sink.img") >= image.size(), "old data allocated", std::to_string(allocatedBytes("sink.img")));
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("source.img", BlockDevice::ACCESS_READ, direct, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_WRITE, direct, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", name);
+		delete source;
+		delete sink;
+		return;
+	}
+	unsigned long long numsectors = sink->numberOfSectors();
+	bool readszero = false;
+	bool discarded = sink->discard(0ull, numsectors, &readszero, &error);
+	if (!discarded && error == (unsigned long)EOPNOTSUPP)
+	{
+		printf("blockdevicetest: no hole punching here, discard test skipped\n");
+		delete sink;
+		delete source;
+		return;
+	}
+	check(discarded && readszero, "discard reads as zeros", name + ", error " + std::to_string(error));
+	check(allocatedBytes("sink.img") < image.size() / 8, "discard punched the file", std::to_string(allocatedBytes("sink.img")));
+
+	BufferPool pool;
+	TransferPipeline pipeline(pool, source->sectorSize(), 64ull, 4u);
+	pipeline.setZeroSkip(readszero);
+	check(pipeline.copy(source->numberOfSectors(), endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK,
+		"zero skip copy", name);
+	check(pipeline.skippedBytes() > 0ull, "zero chunks skipped", name + ", " + std::to_string(pipeline.skippedBytes()));
+	check(pipeline.writtenBytes() + pipeline.skippedBytes() >= image.size(), "every chunk written or skipped", name);
+	check(sink->setSize(image.size(), &error), "set size", name);
+	delete sink;
+	delete source;
+	check(readFile("sink.img") == image, "zero skip copy bytes", name);
+	// The skipped chunks are still holes
+	check(allocatedBytes("sink.img") + pipeline.skippedBytes() <= image.size() + 64ull * 1024ull, "skipped chunks not allocated",
+		std::to_string(allocatedBytes("sink.img")));
+}
+
+// Deep queues of large chunks stay within the buffer cap, and the pool
+// holds nothing once the run is over
+void bufferCap()
+{
+	std::vector<char> image = makeImage(96u * 1024u * 1024u);
+	check(writeFile("large.img", image), "write large image", "");
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("large.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", "buffer cap");
+		delete source;
+		delete sink;
+		return;
+	}
+	BufferPool pool;
+	// 32 chunks of 8 MiB would be 256 MiB, twice that for compare
+	TransferPipeline pipeline(pool, source->sectorSize(), 16384ull, 32u);
+	pipeline.setKernelCopy(false);
+	unsigned long long numsectors = source->numberOfSectors();
+	check(pipeline.copy(numsectors, endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK, "large copy", "");
+	check(pool.peakBytes() <= TransferPipeline::MAX_BUFFER_BYTES, "copy within the cap", std::to_string(pool.peakBytes()));
+	check(pool.bufferSize() == 0, "trimmed after copy", std::to_string(pool.bufferSize()));
+	check(pipeline.compare(numsectors, endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK, "large compare", "");
+	check(pool.peakBytes() <= TransferPipeline::MAX_BUFFER_BYTES, "compare within the cap", std::to_string(pool.peakBytes()));
+	check(pool.bufferSize() == 0, "trimmed after compare", std::to_string(pool.bufferSize()));
+	delete sink;
+	delete source;
+	remove("large.img");
+}
+
+} // namespace
+
+int main()
+{
+	std::vector<char> image = makeImage(5u * 1024u * 1024u + 300u);
+	if (!writeFile("source.img", image))
+	{
+		fprintf(stderr, "FAIL: cannot create source.img\n");
+		return 1;
+	}
+	for (int direct = 0; direct < 2; ++direct)
+	{
+		copyAndCompare(image, direct != 0, false, 1u);
+		copyAndCompare(image, direct != 0, false, 4u);
+		copyAndCompare(image, direct != 0, true, 4u);
+	}
+	mismatch(image);
+	fusedHash(image, false, 1u);
+	fusedHash(image, false, 8u);
+	fusedHash(image, true, 8u);
+	discardAndSkip(image, false);
+	discardAndSkip(image, true);
+	mappedSource(image, 1u);
+	mappedSource(image, 8u);
+	bufferCap();
+	remove("source.img");
+	remove("sink.img");
+	return testResult("blockdevicetest");
+}
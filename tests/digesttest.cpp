@@ -0,0 +1,217 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// Sha1Hash, Sha256Hash, crc32Update() and crc32cUpdate() on every kernel
+// this CPU can run, forced in turn: published test vectors, a long vector
+// of odd length, and data at every alignment and length up to a few
+// blocks, fed whole and in odd pieces, which must hash the same on the
+// accelerated and the portable code (and as QCryptographicHash, where the
+// build has Qt).
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "cpufeatures.h"
+#include "crc32.h"
+#include "sha.h"
+#include "testutil.h"
+#ifdef DIGESTTEST_QT
+#include <QByteArray>
+#include <QCryptographicHash>
+#endif
+
+namespace
+{
+
+std::string hex(const unsigned char* data, size_t bytes)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string text;
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		text += digits[data[i] >> 4];
+		text += digits[data[i] & 0xf];
+	}
+	return text;
+}
+
+// Digests of data fed in pieces of step bytes (all at once for 0)
+struct Digests
+{
+	std::string sha1;
+	std::string sha256;
+	uint32_t crc32;
+	uint32_t crc32c;
+
+	bool operator==(const Digests& other) const
+	{
+		return sha1 == other.sha1 && sha256 == other.sha256 && crc32 == other.crc32 && crc32c == other.crc32c;
+	}
+};
+
+Digests digest(const char* data, size_t bytes, size_t step = 0)
+{
+	Sha1Hash sha1;
+	Sha256Hash sha256;
+	Digests result;
+	result.crc32 = 0;
+	result.crc32c = 0;
+	size_t done = 0;
+	do
+	{
+		size_t piece = (step == 0 || bytes - done < step) ? bytes - done : step;
+		sha1.addData(data + done, piece);
+		sha256.addData(data + done, piece);
+		result.crc32 = crc32Update(result.crc32, data + done, piece);
+		result.crc32c = crc32cUpdate(result.crc32c, data + done, piece);
+		done += piece;
+	}
+	while (done < bytes);
+	unsigned char sha1digest[Sha1Hash::DIGEST_BYTES];
+	unsigned char sha256digest[Sha256Hash::DIGEST_BYTES];
+	sha1.result(sha1digest);
+	sha256.result(sha256digest);
+	result.sha1 = hex(sha1digest, sizeof(sha1digest));
+	result.sha256 = hex(sha256digest, sizeof(sha256digest));
+	return result;
+}
+
+std::string kernels()
+{
+	return std::string(shaKernel()) + ", " + crc32Kernel();
+}
+
+void select(const CpuFeatures& features)
+{
+	selectShaKernels(features);
+	selectCrc32Kernels(features);
+}
+
+// FIPS 180 examples and the CRC check values
+void knownVectors()
+{
+	struct Vector
+	{
+		const char* text;
+		size_t repeat;
+		const char* sha1;
+		const char* sha256;
+	};
+	static const Vector vectors[] = {
+		{ "", 1, "da39a3ee5e6b4b0d3255bfef95601890afd80709", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "abc", 1, "a9993e364706816aba3e25717850c26c9cd0d89d", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+			"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "a", 1000000, "34aa973cd4c4daa4f61eeb2bdbad27316534016f", "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+	};
+	for (const Vector& vector : vectors)
+	{
+		std::string data;
+		for (size_t i = 0; i < vector.repeat; ++i)
+		{
+			data += vector.text;
+		}
+		const size_t steps[] = { 0, 1, 63, 64, 65, 4099 };
+		for (size_t step : steps)
+		{
+			Digests got = digest(data.data(), data.size(), step);
+			std::string detail = kernels() + ", \"" + vector.text + "\" x " + std::to_string(vector.repeat) + ", step " + std::to_string(step);
+			check(got.sha1 == vector.sha1, "SHA-1 vector", detail + ": " + got.sha1);
+			check(got.sha256 == vector.sha256, "SHA-256 vector", detail + ": " + got.sha256);
+		}
+	}
+	const char* check9 = "123456789";
+	check(crc32Update(0, check9, 9) == 0xCBF43926u, "CRC-32 check value", kernels());
+	check(crc32cUpdate(0, check9, 9) == 0xE3069283u, "CRC-32C check value", kernels());
+	check(crc32Update(0, check9, 0) == 0u && crc32cUpdate(0, check9, 0) == 0u, "empty CRC", kernels());
+
+	// A million and three bytes of a pattern, digests from Python's zlib,
+	// google_crc32c and hashlib
+	std::vector<char> data(1000003);
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		data[i] = (char)(((i * i + 7 * i) >> 3) & 0xff);
+	}
+	const size_t steps[] = { 0, 4097, 65535 };
+	for (size_t step : steps)
+	{
+		Digests got = digest(data.data(), data.size(), step);
+		std::string detail = kernels() + ", step " + std::to_string(step);
+		check(got.sha1 == "fd2197a7c21cee092e1fd7f60c3e8bb92fc665cd", "long SHA-1", detail);
+		check(got.sha256 == "22d31f57b0ad0a04caea1de0bc82c1f795c9f73fe11613ad4b6021919d09958e", "long SHA-256", detail);
+		check(got.crc32 == 0x26FEF4ADu, "long CRC-32", detail);
+		check(got.crc32c == 0xB9675F81u, "long CRC-32C", detail);
+	}
+}
+
+// Every length up to a few SHA blocks and PCLMUL folds, at every offset
+// within 16 bytes, against the portable code
+void againstPortable(const CpuFeatures& features)
+{
+	std::vector<char> buffer(1100 + 16);
+	TestRandom(77u).fill(buffer.data(), buffer.size());
+	const CpuFeatures none = { false, false, false, false, false, false, false };
+	for (size_t offset = 0; offset < 16; ++offset)
+	{
+		for (size_t bytes = 0; bytes <= 1100; bytes += (bytes < 300) ? 1 : 37)
+		{
+			const char* data = buffer.data() + offset;
+			select(none);
+			Digests want = digest(data, bytes);
+			select(features);
+			std::string detail = kernels() + ", offset " + std::to_string(offset) + ", " + std::to_string(bytes) + " bytes";
+			check(digest(data, bytes) == want, "whole", detail);
+			check(digest(data, bytes, 13) == want, "13 byte pieces", detail);
+			check(digest(data, bytes, 67) == want, "67 byte pieces", detail);
+#ifdef DIGESTTEST_QT
+			QByteArray bytearray = QByteArray::fromRawData(data, (int)bytes);
+			check(QCryptographicHash::hash(bytearray, QCryptographicHash::Sha1).toHex().toStdString() == want.sha1, "QCryptographicHash SHA-1", detail);
+			check(QCryptographicHash::hash(bytearray, QCryptographicHash::Sha256).toHex().toStdString() == want.sha256, "QCryptographicHash SHA-256", detail);
+#endif
+		}
+	}
+}
+
+} // namespace
+
+int main()
+{
+	// The best kernels, then each extension alone, then the portable code
+	CpuFeatures all = { true, true, true, true, true, true, true };
+	CpuFeatures pclmulonly = { true, true, true, false, true, false, false };
+	CpuFeatures sse42only = { true, true, true, true, false, false, false };
+	CpuFeatures none = { false, false, false, false, false, false, false };
+	const CpuFeatures sets[] = { all, pclmulonly, sse42only, none };
+	std::string tested;
+	for (const CpuFeatures& set : sets)
+	{
+		select(set);
+		std::string name = kernels();
+		if (tested.find("[" + name + "]") != std::string::npos)
+		{
+			continue;
+		}
+		tested += "[" + name + "]";
+		knownVectors();
+		againstPortable(set);
+		printf("digesttest: %s tested\n", name.c_str());
+	}
+	return testResult("digesttest");
+}
@@ -0,0 +1,117 @@
+# Runs imagetool read, verify and write on files and checks the copies
+
+string(RANDOM LENGTH 4096 block)
+set(content "")
+foreach(i RANGE 255)
+	string(APPEND content "${block}")
+endforeach()
+# Ends inside a sector
+string(APPEND content "tail")
+file(WRITE imagetool-device.img "${content}")
+
+function(run)
+	execute_process(COMMAND ${IMAGETOOL} ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+	message(STATUS "imagetool ${ARGN}: ${output}")
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "imagetool ${ARGN} failed")
+	endif()
+	set(output "${output}" PARENT_SCOPE)
+endfunction()
+
+# The digest printed by the last run must be the file's
+function(digest algorithm file)
+	file(${algorithm} ${file} expected)
+	string(TOLOWER ${algorithm} name)
+	if(NOT output MATCHES "${name} ${expected}")
+		message(FATAL_ERROR "${name} of ${file} is not ${expected}")
+	endif()
+endfunction()
+
+function(same first second)
+	execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${first} ${second} RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "${first} and ${second} differ")
+	endif()
+endfunction()
+
+run(read imagetool-device.img imagetool-read.img --fixed)
+same(imagetool-device.img imagetool-read.img)
+run(verify imagetool-read.img imagetool-device.img)
+file(WRITE imagetool-written.img "")
+run(write imagetool-read.img imagetool-written.img --depth 8 --direct)
+same(imagetool-device.img imagetool-written.img)
+
+# A plain buffered copy goes through the kernel unless told otherwise
+run(read imagetool-device.img imagetool-read.img)
+same(imagetool-device.img imagetool-read.img)
+if(NOT output MATCHES "copy_file_range engine|splice engine")
+	message(FATAL_ERROR "buffered read did not copy in the kernel: ${output}")
+endif()
+run(read imagetool-device.img imagetool-read.img --no-kernel-copy)
+same(imagetool-device.img imagetool-read.img)
+if(output MATCHES "copy_file_range engine|splice engine")
+	message(FATAL_ERROR "--no-kernel-copy still copied in the kernel: ${output}")
+endif()
+
+# Hashed on the way, with and without the zero skip
+run(read imagetool-device.img imagetool-read.img --zero-skip --hash sha256)
+same(imagetool-device.img imagetool-read.img)
+digest(SHA256 imagetool-device.img)
+run(write imagetool-device.img imagetool-written.img --zero-skip --hash sha1)
+same(imagetool-device.img imagetool-written.img)
+digest(SHA1 imagetool-device.img)
+run(verify imagetool-device.img imagetool-written.img --hash sha256)
+digest(SHA256 imagetool-device.img)
+run(scan imagetool-device.img --hash sha256)
+digest(SHA256 imagetool-device.img)
+if(NOT output MATCHES "0 of 2049 sectors are zero")
+	message(FATAL_ERROR "scan found zero sectors in random data")
+endif()
+
+# Zero runs and a zero tail, read with the zero skip: the zero chunks,
+# the last one included, must become holes of an image of exactly the
+# source's size.  The zeros are grown with truncate, so this needs Linux
+# coreutils.
+find_program(TRUNCATE truncate)
+find_program(STAT stat)
+if(TRUNCATE AND STAT)
+	string(RANDOM LENGTH 65536 block)
+	set(data "")
+	foreach(i RANGE 3)
+		string(APPEND data "${block}")
+	endforeach()
+	# 256 KiB of data, 2 MiB of zeros, 256 KiB of data, 2 MiB and 1000 bytes of zeros
+	file(WRITE imagetool-zeros.img "${data}")
+	execute_process(COMMAND ${TRUNCATE} -s 2359296 imagetool-zeros.img)
+	file(APPEND imagetool-zeros.img "${data}")
+	execute_process(COMMAND ${TRUNCATE} -s 4719592 imagetool-zeros.img)
+	run(read imagetool-zeros.img imagetool-holes.img --zero-skip --hash sha256)
+	same(imagetool-zeros.img imagetool-holes.img)
+	digest(SHA256 imagetool-zeros.img)
+	if(NOT output MATCHES "([0-9]+) bytes of zero chunks not written" OR CMAKE_MATCH_1 LESS 3145728)
+		message(FATAL_ERROR "zero chunks were written: ${output}")
+	endif()
+	execute_process(COMMAND ${STAT} -c "%s %b %B" imagetool-holes.img OUTPUT_VARIABLE stat OUTPUT_STRIP_TRAILING_WHITESPACE)
+	separate_arguments(stat)
+	list(GET stat 0 size)
+	list(GET stat 1 blocks)
+	list(GET stat 2 blockbytes)
+	math(EXPR allocated "${blocks} * ${blockbytes}")
+	if(NOT size EQUAL 4719592)
+		message(FATAL_ERROR "zero skip read left ${size} bytes, not 4719592")
+	endif()
+	if(NOT allocated LESS 2097152)
+		message(FATAL_ERROR "zero skip read allocated ${allocated} bytes")
+	endif()
+	file(REMOVE imagetool-zeros.img imagetool-holes.img)
+endif()
+
+# A changed copy must fail verification
+file(READ imagetool-device.img original)
+string(SUBSTRING "${original}" 0 1000 head)
+file(WRITE imagetool-changed.img "${head}X")
+execute_process(COMMAND ${IMAGETOOL} verify imagetool-device.img imagetool-changed.img RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(result EQUAL 0)
+	message(FATAL_ERROR "verify passed on a different image")
+endif()
+file(REMOVE imagetool-device.img imagetool-read.img imagetool-written.img imagetool-changed.img)
@@ -0,0 +1,102 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// ParallelHash: several hashes fed in place give the same digests as each
+// fed on its own, even when the caller overwrites its buffer as soon as
+// addData() returns.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "crc32.h"
+#include "parallelhash.h"
+#include "sha.h"
+#include "testutil.h"
+#include "xxh3.h"
+
+namespace
+{
+
+// SHA256, XXH3-128 and CRC32 of a stream, in one string
+struct Digests
+{
+	Sha256Hash sha;
+	Xxh3Hash xxh3;
+	uint32_t crc;
+
+	Digests() : crc(0) {}
+
+	std::string result() const
+	{
+		unsigned char sha256[Sha256Hash::DIGEST_BYTES];
+		unsigned char xxh128[Xxh3Hash::DIGEST_BYTES];
+		sha.result(sha256);
+		xxh3.result(xxh128);
+		return std::string((const char*)sha256, sizeof(sha256)) + std::string((const char*)xxh128, sizeof(xxh128)) +
+			std::string((const char*)&crc, sizeof(crc));
+	}
+};
+
+std::string serial(const std::vector<char>& data, size_t total)
+{
+	Digests digests;
+	digests.sha.addData(data.data(), total);
+	digests.xxh3.addData(data.data(), total);
+	digests.crc = crc32Update(0, data.data(), total);
+	return digests.result();
+}
+
+std::string parallel(const std::vector<char>& data, size_t total, size_t chunk)
+{
+	Digests digests;
+	std::vector<ParallelHash::AddFunc> feeds;
+	feeds.push_back([&digests](const char* block, size_t bytes) { digests.sha.addData(block, bytes); });
+	feeds.push_back([&digests](const char* block, size_t bytes) { digests.xxh3.addData(block, bytes); });
+	feeds.push_back([&digests](const char* block, size_t bytes) { digests.crc = crc32Update(digests.crc, block, bytes); });
+	ParallelHash hash(feeds);
+	std::vector<char> buffer(chunk);
+	for (size_t offset = 0; offset < total; offset += chunk)
+	{
+		size_t bytes = (total - offset < chunk) ? (total - offset) : chunk;
+		memcpy(buffer.data(), data.data() + offset, bytes);
+		hash.addData(buffer.data(), bytes);
+		// Reused at once, as TransferPipeline reuses a slot
+		memset(buffer.data(), 0xAA, bytes);
+	}
+	return digests.result();
+}
+
+} // namespace
+
+int main()
+{
+	std::vector<char> data(40u * 1024u * 1024u + 777u);
+	TestRandom(99u).fill(data.data(), data.size());
+
+	std::string whole = serial(data, data.size());
+	for (size_t chunk : { (size_t)4095, (size_t)65536, (size_t)1048576 + 13 })
+	{
+		check(parallel(data, data.size(), chunk) == whole, "chunks", std::to_string(chunk) + " bytes");
+	}
+	// Byte by byte over a shorter stream
+	size_t total = 256u * 1024u + 3u;
+	check(parallel(data, total, 1) == serial(data, total), "single bytes");
+	return testResult("parallelhashtest");
+}
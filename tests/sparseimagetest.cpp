@@ -0,0 +1,410 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// Android sparse images built chunk by chunk here: SparseImage must lay
+// them out as extents that copy and compare to the expanded image, the
+// CRC32 chunks must be checked on the way, and damaged headers and chunk
+// lists must be refused.  Images SparseImageWriter saves from a scan must
+// expand back to the data scanned.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "blockdevice.h"
+#include "bufferpool.h"
+#include "crc32.h"
+#include "sparseimage.h"
+#include "testutil.h"
+#include "transferpipeline.h"
+
+namespace
+{
+
+void put16(std::vector<char>& out, uint16_t value)
+{
+	out.push_back((char)(value & 0xff));
+	out.push_back((char)(value >> 8));
+}
+
+void put32(std::vector<char>& out, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		out.push_back((char)((value >> (8 * i)) & 0xff));
+	}
+}
+
+void set32(std::vector<char>& out, size_t offset, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		out[offset + i] = (char)((value >> (8 * i)) & 0xff);
+	}
+}
+
+// An image in simg format and what it expands to, built as img2simg would
+struct Simg
+{
+	uint32_t blocksize;
+	uint32_t blocks;
+	uint32_t chunks;
+	std::vector<char> file;
+	std::vector<char> expanded;
+	size_t lastcrc;       // offset of the payload of the last CRC32 chunk
+
+	explicit Simg(uint32_t blocksize) : blocksize(blocksize), blocks(0), chunks(0), lastcrc(0)
+	{
+		put32(file, SparseImage::MAGIC);
+		put16(file, 1);
+		put16(file, 0);
+		put16(file, 28);
+		put16(file, 12);
+		put32(file, blocksize);
+		put32(file, 0);
+		put32(file, 0);
+		put32(file, 0);
+	}
+
+	void chunk(uint16_t type, uint32_t chunkblocks, uint32_t payload)
+	{
+		put16(file, type);
+		put16(file, 0);
+		put32(file, chunkblocks);
+		put32(file, 12 + payload);
+		blocks += chunkblocks;
+		++chunks;
+		set32(file, 16, blocks);
+		set32(file, 20, chunks);
+	}
+
+	void raw(uint32_t chunkblocks, unsigned int seed)
+	{
+		chunk(0xCAC1, chunkblocks, chunkblocks * blocksize);
+		TestRandom random(seed);
+		for (size_t i = 0; i < (size_t)chunkblocks * blocksize; ++i)
+		{
+			file.push_back(random.next());
+			expanded.push_back(file.back());
+		}
+	}
+
+	void fill(uint32_t chunkblocks, uint32_t pattern)
+	{
+		chunk(0xCAC2, chunkblocks, 4);
+		put32(file, pattern);
+		for (size_t i = 0; i < (size_t)chunkblocks * blocksize; ++i)
+		{
+			expanded.push_back((char)((pattern >> (8 * (i % 4))) & 0xff));
+		}
+	}
+
+	void dontCare(uint32_t chunkblocks)
+	{
+		chunk(0xCAC3, chunkblocks, 0);
+		expanded.insert(expanded.end(), (size_t)chunkblocks * blocksize, 0);
+	}
+
+	void crc()
+	{
+		chunk(0xCAC4, 0, 4);
+		lastcrc = file.size();
+		put32(file, crc32Update(0, expanded.data(), expanded.size()));
+	}
+};
+
+Simg sample()
+{
+	Simg image(4096);
+	image.raw(3, 1u);
+	image.fill(2, 0xDEADBEEFu);
+	image.dontCare(4);
+	image.crc();
+	image.raw(1, 2u);
+	image.fill(1, 0u);
+	image.raw(2, 3u);
+	image.crc();
+	return image;
+}
+
+TransferPipeline::Endpoint endpoint(const BlockDevice* device)
+{
+	return TransferPipeline::Endpoint(device->handle());
+}
+
+// Opens sparse.img as written from image, false when that fails
+bool parse(const Simg& image, SparseImage& sparse, const std::string& name)
+{
+	check(writeFile("sparse.img", image.file), "write sparse image", name);
+	unsigned long error = 0;
+	BlockDevice* file = BlockDevice::open("sparse.img", BlockDevice::ACCESS_READ, false, &error);
+	if (file == NULL)
+	{
+		check(false, "open sparse image", name);
+		return false;
+	}
+	bool ok = sparse.open(file->handle(), file->sectorSize());
+	delete file;
+	return ok;
+}
+
+void layout()
+{
+	Simg image = sample();
+	SparseImage sparse;
+	check(SparseImage::hasMagic(image.file.data(), image.file.size()), "magic", "");
+	if (!parse(image, sparse, "layout"))
+	{
+		check(false, "parse", std::to_string(sparse.error()));
+		return;
+	}
+	check(sparse.numSectors() * 512ull == image.expanded.size(), "expanded size", std::to_string(sparse.numSectors()));
+	check(sparse.dataBytes() == 9ull * 4096ull, "data bytes", std::to_string(sparse.dataBytes()));
+	check(sparse.checksums().size() == 2, "checksums", std::to_string(sparse.checksums().size()));
+	// RAW, FILL, DONT_CARE, RAW, FILL, RAW
+	check(sparse.extents().size() == 6, "extents", std::to_string(sparse.extents().size()));
+	if (sparse.extents().size() == 6)
+	{
+		check(sparse.extents()[1].kind == TransferPipeline::Extent::EXTENT_FILL && sparse.extents()[1].fill == 0xDEADBEEFu, "fill extent", "");
+		check(sparse.extents()[2].kind == TransferPipeline::Extent::EXTENT_SKIP && sparse.extents()[2].numsectors == 32ull, "skip extent", "");
+		check(sparse.extents()[3].sourceoffset == 28ull + 12ull + 3ull * 4096ull + 16ull + 12ull + 16ull + 12ull, "raw offset",
+			std::to_string(sparse.extents()[3].sourceoffset));
+	}
+}
+
+void copyAndCompare(unsigned int depth, unsigned long long chunksectors)
+{
+	std::string name = "depth " + std::to_string(depth) + ", " + std::to_string(chunksectors) + " sector chunks";
+	Simg image = sample();
+	SparseImage sparse;
+	if (!parse(image, sparse, name))
+	{
+		check(false, "parse", name);
+		return;
+	}
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("sparse.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", name);
+		delete source;
+		delete sink;
+		return;
+	}
+	// A fresh file reads as zeros, as DONT_CARE expands in the CRCs
+	check(sink->setSize(image.expanded.size(), &error), "size sink", name);
+	BufferPool pool;
+	TransferPipeline pipeline(pool, 512ull, chunksectors, depth);
+	SparseChecksumStage checksums(sparse);
+	TransferPipeline::Result result = pipeline.copy(sparse.numSectors(), sparse.extents(), endpoint(source), endpoint(sink), checksums, TransferPipeline::ProgressFunc());
+	check(result == TransferPipeline::RESULT_OK, "copy", name);
+	check(pipeline.writtenBytes() == sparse.dataBytes(), "only data written", std::to_string(pipeline.writtenBytes()));
+	result = pipeline.compare(sparse.numSectors(), sparse.extents(), endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc());
+	check(result == TransferPipeline::RESULT_OK, "compare", name);
+	delete sink;
+	delete source;
+	check(readFile("sink.img") == image.expanded, "expanded bytes", name);
+
+	// A changed byte in the second RAW chunk, and one under DONT_CARE
+	std::vector<char> changed = image.expanded;
+	changed[9 * 4096 + 100] ^= 1;
+	changed[6 * 4096] = 1;
+	check(writeFile("sink.img", changed), "write changed sink", name);
+	source = BlockDevice::open("sparse.img", BlockDevice::ACCESS_READ, false, &error);
+	sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_READ, false, &error);
+	if (source != NULL && sink != NULL)
+	{
+		result = pipeline.compare(sparse.numSectors(), sparse.extents(), endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc());
+		check(result == TransferPipeline::RESULT_MISMATCH, "mismatch found", name);
+		unsigned long long sector = 9ull * 4096ull / 512ull;
+		check(pipeline.failedSector() <= sector && sector < pipeline.failedSector() + chunksectors, "mismatch chunk",
+			std::to_string(pipeline.failedSector()));
+	}
+	delete sink;
+	delete source;
+}
+
+void badChecksum()
+{
+	Simg image = sample();
+	set32(image.file, image.lastcrc, 0x12345678u);
+	SparseImage sparse;
+	if (!parse(image, sparse, "bad checksum"))
+	{
+		check(false, "parse", "bad checksum");
+		return;
+	}
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("sparse.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source != NULL && sink != NULL)
+	{
+		BufferPool pool;
+		TransferPipeline pipeline(pool, 512ull, 8ull, 4u);
+		SparseChecksumStage checksums(sparse);
+		TransferPipeline::Result result = pipeline.copy(sparse.numSectors(), sparse.extents(), endpoint(source), endpoint(sink), checksums, TransferPipeline::ProgressFunc());
+		check(result == TransferPipeline::RESULT_STAGE_ERROR, "checksum mismatch fails", std::to_string(result));
+	}
+	else
+	{
+		check(false, "open", "bad checksum");
+	}
+	delete sink;
+	delete source;
+}
+
+void damaged()
+{
+	SparseImage sparse;
+	Simg image = sample();
+	image.file[0] ^= 1;
+	check(!parse(image, sparse, "magic") && sparse.error() == SparseImage::SPARSE_BAD_HEADER, "bad magic", std::to_string(sparse.error()));
+
+	image = sample();
+	image.file.resize(20);
+	check(!parse(image, sparse, "short header") && sparse.error() == SparseImage::SPARSE_BAD_HEADER, "short header", std::to_string(sparse.error()));
+
+	// Whole blocks must be whole sectors
+	Simg odd(1036);
+	odd.raw(1, 4u);
+	check(!parse(odd, sparse, "block size") && sparse.error() == SparseImage::SPARSE_BAD_BLOCK_SIZE, "block size", std::to_string(sparse.error()));
+
+	// The chunk list ends before the header says it does
+	image = sample();
+	set32(image.file, 20, image.chunks + 1);
+	check(!parse(image, sparse, "missing chunk") && sparse.error() == SparseImage::SPARSE_BAD_CHUNK && sparse.badChunk() == image.chunks,
+		"missing chunk", std::to_string(sparse.badChunk()));
+
+	// Block count in the header disagrees with the chunks
+	image = sample();
+	set32(image.file, 16, image.blocks + 1);
+	check(!parse(image, sparse, "block count") && sparse.error() == SparseImage::SPARSE_BAD_CHUNK, "block count", std::to_string(sparse.error()));
+
+	// Unknown chunk type, in the second chunk
+	image = sample();
+	image.file[28 + 12 + 3 * 4096] = 0x7f;
+	check(!parse(image, sparse, "chunk type") && sparse.error() == SparseImage::SPARSE_BAD_CHUNK && sparse.badChunk() == 1,
+		"chunk type", std::to_string(sparse.badChunk()));
+}
+
+// Zeros, a repeated word, random data and runs of each, in blocks of
+// blocksize, ending halfway into a block
+std::vector<char> makeDevice(size_t blocksize)
+{
+	std::vector<char> data;
+	TestRandom random(99u);
+	const char* kinds = "rrzzzfrfzzrffz";
+	for (size_t block = 0; kinds[block] != 0; ++block)
+	{
+		for (size_t i = 0; i < blocksize; ++i)
+		{
+			char byte = random.next();
+			if (kinds[block] == 'z')
+			{
+				byte = 0;
+			}
+			else if (kinds[block] == 'f')
+			{
+				byte = "\x11\x22\x33\x44"[i % 4];
+			}
+			data.push_back(byte);
+		}
+	}
+	data.resize(data.size() + blocksize / 2, (char)0x5a);
+	return data;
+}
+
+// Saves a scan of device.img to sparse.img and reads it back through
+// SparseImage; chunks of the scan split blocks where chunksectors is not
+// a multiple of the block size
+void roundTrip(uint32_t blocksize, unsigned long long chunksectors, unsigned int depth)
+{
+	std::string name = std::to_string(blocksize) + " byte blocks, " + std::to_string(chunksectors) + " sector chunks, depth " + std::to_string(depth);
+	std::vector<char> device = makeDevice(blocksize);
+	check(writeFile("device.img", device), "write device", name);
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("device.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* file = BlockDevice::open("sparse.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source == NULL || file == NULL)
+	{
+		check(false, "open", name);
+		delete source;
+		delete file;
+		return;
+	}
+	BufferPool pool;
+	TransferPipeline pipeline(pool, 512ull, chunksectors, depth);
+	SparseImageWriter writer(file->handle(), blocksize);
+	TransferPipeline::Result result = pipeline.scan(source->numberOfSectors(), endpoint(source), writer, TransferPipeline::ProgressFunc());
+	check(result == TransferPipeline::RESULT_OK, "scan", name);
+	check(writer.finish(), "finish", name);
+	unsigned long long blocks = (device.size() + blocksize - 1) / blocksize;
+	check(writer.totalBlocks() == blocks, "blocks", std::to_string(writer.totalBlocks()));
+	// r, z, f, r, f, z, r, f, z, then the partial block
+	check(writer.totalChunks() == 10ul, "chunks", std::to_string(writer.totalChunks()));
+	check(file->setSize(writer.imageBytes(), &error), "size sparse image", name);
+	delete file;
+	delete source;
+
+	std::vector<char> saved = readFile("sparse.img");
+	check(saved.size() == writer.imageBytes(), "image bytes", std::to_string(saved.size()));
+	check(saved.size() < device.size(), "smaller than the device", std::to_string(saved.size()));
+	SparseImage sparse;
+	source = BlockDevice::open("sparse.img", BlockDevice::ACCESS_READ, false, &error);
+	file = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source == NULL || file == NULL || !sparse.open(source->handle(), 512ull))
+	{
+		check(false, "reopen", name);
+		delete source;
+		delete file;
+		return;
+	}
+	check(sparse.numSectors() * 512ull == blocks * blocksize, "expanded size", std::to_string(sparse.numSectors()));
+	check(file->setSize(blocks * blocksize, &error), "size sink", name);
+	result = pipeline.copy(sparse.numSectors(), sparse.extents(), endpoint(source), endpoint(file), TransferPipeline::ProgressFunc());
+	check(result == TransferPipeline::RESULT_OK, "copy", name);
+	delete file;
+	delete source;
+	// The partial last block comes back padded with zeros
+	device.resize(blocks * blocksize, 0);
+	check(readFile("sink.img") == device, "round trip bytes", name);
+}
+
+} // namespace
+
+int main()
+{
+	layout();
+	copyAndCompare(1u, 8ull);
+	copyAndCompare(4u, 8ull);
+	copyAndCompare(8u, 3ull);
+	copyAndCompare(4u, 1024ull);
+	badChecksum();
+	damaged();
+	roundTrip(4096u, 8ull, 1u);
+	roundTrip(4096u, 3ull, 4u);
+	roundTrip(4096u, 1024ull, 4u);
+	roundTrip(512u, 7ull, 8u);
+	remove("device.img");
+	remove("sparse.img");
+	remove("sink.img");
+	return testResult("sparseimagetest");
+}
@@ -0,0 +1,116 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+// Scaffolding shared by the engine tests and benchmarks: failure counting,
+// whole-file helpers and repeatable pseudo-random data.
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// The same bytes for the same seed on every platform (the example rand()
+// of the C standard)
+class TestRandom
+{
+public:
+	explicit TestRandom(unsigned int seed) : seed(seed) {}
+
+	char next()
+	{
+		seed = seed * 1103515245u + 12345u;
+		return (char)(seed >> 16);
+	}
+	void fill(char* data, size_t bytes)
+	{
+		for (size_t i = 0; i < bytes; ++i)
+		{
+			data[i] = next();
+		}
+	}
+
+private:
+	unsigned int seed;
+};
+
+inline int& testFailures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+inline void check(bool condition, const char* what, const std::string& detail = std::string())
+{
+	if (!condition)
+	{
+		if (detail.empty())
+		{
+			fprintf(stderr, "FAIL: %s\n", what);
+		}
+		else
+		{
+			fprintf(stderr, "FAIL: %s (%s)\n", what, detail.c_str());
+		}
+		++testFailures();
+	}
+}
+
+// Reports the outcome of test name, for main() to return
+inline int testResult(const char* name)
+{
+	if (testFailures() == 0)
+	{
+		printf("%s: all passed\n", name);
+	}
+	return (testFailures() == 0) ? 0 : 1;
+}
+
+inline bool writeFile(const std::string& path, const std::vector<char>& data)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && ok;
+}
+
+inline std::vector<char> readFile(const std::string& path)
+{
+	std::vector<char> data;
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		return data;
+	}
+	char buffer[65536];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		data.insert(data.end(), buffer, buffer + n);
+	}
+	fclose(file);
+	return data;
+}
+
+#endif // TESTUTIL_H
@@ -0,0 +1,386 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// Fixed and dynamic VHD and VHDX images built here from known disk
+// contents: VirtualDisk must detect each, lay it out as extents that copy
+// and compare to the disk contents (unallocated blocks as zeros), and
+// refuse damaged, differencing and unreplayed images.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "blockdevice.h"
+#include "bufferpool.h"
+#include "crc32.h"
+#include "testutil.h"
+#include "transferpipeline.h"
+#include "virtualdisk.h"
+
+namespace
+{
+
+void putBe32(std::vector<char>& out, size_t offset, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		out[offset + i] = (char)((value >> (24 - 8 * i)) & 0xff);
+	}
+}
+
+void putBe64(std::vector<char>& out, size_t offset, unsigned long long value)
+{
+	putBe32(out, offset, (uint32_t)(value >> 32));
+	putBe32(out, offset + 4, (uint32_t)value);
+}
+
+void putLe(std::vector<char>& out, size_t offset, unsigned long long value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+	{
+		out[offset + i] = (char)((value >> (8 * i)) & 0xff);
+	}
+}
+
+// Disk contents: random data, except for the blocks listed as zero
+std::vector<char> makeDisk(size_t bytes, size_t blocksize, const char* zeroblocks)
+{
+	std::vector<char> disk(bytes);
+	TestRandom random(4242u);
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		char byte = random.next();
+		disk[i] = (strchr(zeroblocks, (int)('0' + i / blocksize)) != NULL) ? 0 : byte;
+	}
+	return disk;
+}
+
+const size_t VHD_SECTOR = 512;
+
+// VHD footer: cookie, big endian sizes and type, one's complement checksum
+std::vector<char> vhdFooter(unsigned long long disksize, uint32_t type, unsigned long long dataoffset)
+{
+	std::vector<char> footer(512, 0);
+	memcpy(footer.data(), "conectix", 8);
+	putBe32(footer, 8, 2);
+	putBe32(footer, 12, 0x00010000u);
+	putBe64(footer, 16, dataoffset);
+	putBe64(footer, 40, disksize);
+	putBe64(footer, 48, disksize);
+	putBe32(footer, 60, type);
+	uint32_t sum = 0;
+	for (char c : footer)
+	{
+		sum += (unsigned char)c;
+	}
+	putBe32(footer, 64, ~sum);
+	return footer;
+}
+
+std::vector<char> vhdFixed(const std::vector<char>& disk)
+{
+	std::vector<char> file = disk;
+	std::vector<char> footer = vhdFooter(disk.size(), 2, ~0ull);
+	file.insert(file.end(), footer.begin(), footer.end());
+	return file;
+}
+
+// Blocks in the file in the order of stored, each a sector bitmap and the
+// data; blocks not listed are unallocated
+std::vector<char> vhdDynamic(const std::vector<char>& disk, uint32_t blocksize, const std::vector<unsigned int>& stored, uint32_t type = 3)
+{
+	size_t blocks = (disk.size() + blocksize - 1) / blocksize;
+	size_t bitmapbytes = (blocksize / VHD_SECTOR / 8 + VHD_SECTOR - 1) / VHD_SECTOR * VHD_SECTOR;
+	std::vector<char> footer = vhdFooter(disk.size(), type, 512);
+	std::vector<char> file(footer);
+	// Dynamic header at 512, the BAT at 1536 padded to whole sectors
+	file.resize(512 + 1024, 0);
+	memcpy(file.data() + 512, "cxsparse", 8);
+	putBe64(file, 512 + 8, ~0ull);
+	putBe64(file, 512 + 16, 1536);
+	putBe32(file, 512 + 24, 0x00010000u);
+	putBe32(file, 512 + 28, (uint32_t)blocks);
+	putBe32(file, 512 + 32, blocksize);
+	size_t batbytes = (blocks * 4 + VHD_SECTOR - 1) / VHD_SECTOR * VHD_SECTOR;
+	file.resize(1536 + batbytes, (char)0xff);
+	for (unsigned int block : stored)
+	{
+		putBe32(file, 1536 + block * 4, (uint32_t)(file.size() / VHD_SECTOR));
+		file.insert(file.end(), bitmapbytes, (char)0xff);
+		size_t start = block * blocksize;
+		size_t end = (start + blocksize < disk.size()) ? start + blocksize : disk.size();
+		file.insert(file.end(), disk.begin() + start, disk.begin() + end);
+		file.resize(file.size() + (blocksize - (end - start)), 0);
+	}
+	file.insert(file.end(), footer.begin(), footer.end());
+	return file;
+}
+
+const unsigned long long MB = 1024ull * 1024ull;
+const unsigned char BAT_REGION[16] = { 0x66, 0x77, 0xC2, 0x2D, 0x23, 0xF6, 0x00, 0x42, 0x9D, 0x64, 0x11, 0x5E, 0x9B, 0xFD, 0x4A, 0x08 };
+const unsigned char METADATA_REGION[16] = { 0x06, 0xA2, 0x7C, 0x8B, 0x90, 0x47, 0x9A, 0x4B, 0xB8, 0xFE, 0x57, 0x5F, 0x05, 0x0F, 0x88, 0x6E };
+const unsigned char FILE_PARAMETERS[16] = { 0x37, 0x67, 0xA1, 0xCA, 0x36, 0xFA, 0x43, 0x4D, 0xB3, 0xB6, 0x33, 0xF0, 0xAA, 0x44, 0xE7, 0x6B };
+const unsigned char VIRTUAL_DISK_SIZE[16] = { 0x24, 0x42, 0xA5, 0x2F, 0x1B, 0xCD, 0x76, 0x48, 0xB2, 0x11, 0x5D, 0xBE, 0xD8, 0x3B, 0xF4, 0xB8 };
+const unsigned char LOGICAL_SECTOR_SIZE[16] = { 0x1D, 0xBF, 0x41, 0x81, 0x6F, 0xA9, 0x09, 0x47, 0xBA, 0x47, 0xF2, 0x33, 0xA8, 0xFA, 0xAB, 0x5F };
+
+// CRC-32C of a header or region table into its checksum field
+void vhdxChecksum(std::vector<char>& file, size_t offset, size_t bytes)
+{
+	putLe(file, offset + 4, 0, 4);
+	putLe(file, offset + 4, crc32cUpdate(0, file.data() + offset, bytes), 4);
+}
+
+void vhdxHeader(std::vector<char>& file, size_t offset, unsigned long long sequence)
+{
+	memcpy(file.data() + offset, "head", 4);
+	putLe(file, offset + 8, sequence, 8);
+	putLe(file, offset + 66, 1, 2);
+	putLe(file, offset + 68, MB, 4);
+	putLe(file, offset + 72, MB, 8);
+	vhdxChecksum(file, offset, 4096);
+}
+
+// 1 MiB blocks; metadata at 1 MiB, the BAT at 2 MiB, then the blocks in
+// the order of stored.  Entries of blocks not stored get state.
+std::vector<char> vhdx(const std::vector<char>& disk, const std::vector<unsigned int>& stored, unsigned int state = 0,
+	unsigned long long disksize = 0ull, uint32_t flags = 0)
+{
+	if (disksize == 0ull)
+	{
+		disksize = disk.size();
+	}
+	std::vector<char> file(3 * MB, 0);
+	memcpy(file.data(), "vhdxfile", 8);
+	vhdxHeader(file, 64 * 1024, 1);
+	vhdxHeader(file, 128 * 1024, 2);
+	for (size_t table = 192 * 1024; table <= 256 * 1024; table += 64 * 1024)
+	{
+		memcpy(file.data() + table, "regi", 4);
+		putLe(file, table + 8, 2, 4);
+		memcpy(file.data() + table + 16, BAT_REGION, 16);
+		putLe(file, table + 32, 2 * MB, 8);
+		putLe(file, table + 40, MB, 4);
+		putLe(file, table + 44, 1, 4);
+		memcpy(file.data() + table + 48, METADATA_REGION, 16);
+		putLe(file, table + 64, MB, 8);
+		putLe(file, table + 72, MB, 4);
+		putLe(file, table + 76, 1, 4);
+		vhdxChecksum(file, table, 64 * 1024);
+	}
+	size_t meta = MB;
+	memcpy(file.data() + meta, "metadata", 8);
+	putLe(file, meta + 10, 3, 2);
+	const unsigned char* ids[3] = { FILE_PARAMETERS, VIRTUAL_DISK_SIZE, LOGICAL_SECTOR_SIZE };
+	for (int i = 0; i < 3; ++i)
+	{
+		memcpy(file.data() + meta + 32 + 32 * i, ids[i], 16);
+		putLe(file, meta + 32 + 32 * i + 16, 64 * 1024 + 8 * i, 4);
+		putLe(file, meta + 32 + 32 * i + 20, (i == 2) ? 4 : 8, 4);
+	}
+	putLe(file, meta + 64 * 1024, MB, 4);
+	putLe(file, meta + 64 * 1024 + 4, flags, 4);
+	putLe(file, meta + 64 * 1024 + 8, disksize, 8);
+	putLe(file, meta + 64 * 1024 + 16, 512, 4);
+
+	// A sector bitmap entry follows every 4096 payload entries at 1 MiB
+	// blocks and 512 byte sectors
+	unsigned long long blocks = (disksize + MB - 1) / MB;
+	for (unsigned long long block = 0; block < blocks; ++block)
+	{
+		putLe(file, 2 * MB + (block + block / 4096) * 8, state, 8);
+	}
+	for (unsigned int block : stored)
+	{
+		putLe(file, 2 * MB + (block + block / 4096) * 8, 6 | ((file.size() / MB) << 20), 8);
+		size_t start = (size_t)(block * MB);
+		size_t end = (start + MB < disk.size()) ? start + MB : disk.size();
+		if (start < disk.size())
+		{
+			file.insert(file.end(), disk.begin() + start, disk.begin() + end);
+		}
+		file.resize((file.size() + MB - 1) / MB * MB, 0);
+	}
+	return file;
+}
+
+TransferPipeline::Endpoint endpoint(const BlockDevice* device)
+{
+	return TransferPipeline::Endpoint(device->handle());
+}
+
+// Writes image to disk.img and opens it as a VirtualDisk
+bool parse(const std::vector<char>& image, VirtualDisk& disk, unsigned long long sectorsize = 512ull)
+{
+	if (!writeFile("disk.img", image))
+	{
+		check(false, "write image", "");
+		return false;
+	}
+	unsigned long error = 0;
+	BlockDevice* file = BlockDevice::open("disk.img", BlockDevice::ACCESS_READ, false, &error);
+	if (file == NULL)
+	{
+		check(false, "open image", "");
+		return false;
+	}
+	char head[VirtualDisk::HEAD_BYTES];
+	memcpy(head, image.data(), sizeof(head));
+	const char* tail = (image.size() >= VirtualDisk::TAIL_BYTES) ? image.data() + image.size() - VirtualDisk::TAIL_BYTES : NULL;
+	VirtualDisk::Format detected = VirtualDisk::detect(head, tail);
+	bool ok = disk.open(file->handle(), file->size(), sectorsize);
+	check(!ok || detected == disk.format(), "detected format", disk.formatName());
+	delete file;
+	return ok;
+}
+
+// Opens image and copies and compares it to a fresh sink, which must then
+// hold contents
+void expand(const std::vector<char>& image, const std::vector<char>& contents, VirtualDisk::Format format, unsigned long long databytes,
+	const std::string& name)
+{
+	VirtualDisk disk;
+	if (!parse(image, disk))
+	{
+		check(false, "parse", name + ", error " + std::to_string(disk.error()));
+		return;
+	}
+	check(disk.format() == format, "format", name + ", " + disk.formatName());
+	check(disk.numSectors() * 512ull == contents.size(), "disk size", name + ", " + std::to_string(disk.numSectors()));
+	check(disk.dataBytes() == databytes, "data bytes", name + ", " + std::to_string(disk.dataBytes()));
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open("disk.img", BlockDevice::ACCESS_READ, false, &error);
+	BlockDevice* sink = BlockDevice::open("sink.img", BlockDevice::ACCESS_CREATE, false, &error);
+	if (source == NULL || sink == NULL)
+	{
+		check(false, "open", name);
+		delete source;
+		delete sink;
+		return;
+	}
+	// Old contents under the unallocated blocks must be overwritten
+	check(writeFile("sink.img", std::vector<char>(contents.size(), (char)0xa5)), "fill sink", name);
+	BufferPool pool;
+	TransferPipeline pipeline(pool, 512ull, 96ull, 4u);
+	check(pipeline.copy(disk.numSectors(), disk.extents(), endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK,
+		"copy", name);
+	check(pipeline.compare(disk.numSectors(), disk.extents(), endpoint(source), endpoint(sink), TransferPipeline::ProgressFunc()) == TransferPipeline::RESULT_OK,
+		"compare", name);
+	delete sink;
+	delete source;
+	check(readFile("sink.img") == contents, "expanded bytes", name);
+}
+
+void vhdFormats()
+{
+	std::vector<char> disk = makeDisk(MB + 3 * VHD_SECTOR, 64 * 1024, "");
+	expand(vhdFixed(disk), disk, VirtualDisk::FORMAT_VHD_FIXED, disk.size(), "fixed VHD");
+
+	// 64 KiB blocks, 1 and 3 unallocated, 4 stored before 2, the last one partial
+	const uint32_t blocksize = 64 * 1024;
+	disk = makeDisk(5 * blocksize + 3 * VHD_SECTOR, blocksize, "13");
+	std::vector<unsigned int> stored = { 0, 4, 2, 5 };
+	expand(vhdDynamic(disk, blocksize, stored), disk, VirtualDisk::FORMAT_VHD_DYNAMIC, 3ull * blocksize + 3 * VHD_SECTOR, "dynamic VHD");
+}
+
+void vhdxFormats()
+{
+	// 1 and 3 not present, 4 stored before 2, the last block partial
+	std::vector<char> disk = makeDisk((size_t)(5 * MB + 100 * 512), (size_t)MB, "13");
+	std::vector<unsigned int> stored = { 0, 4, 2, 5 };
+	expand(vhdx(disk, stored), disk, VirtualDisk::FORMAT_VHDX, 3ull * MB + 100 * 512, "VHDX");
+	// ZERO and UNMAPPED read as zeros like NOT_PRESENT
+	expand(vhdx(disk, stored, 2), disk, VirtualDisk::FORMAT_VHDX, 3ull * MB + 100 * 512, "VHDX zero blocks");
+	expand(vhdx(disk, stored, 3), disk, VirtualDisk::FORMAT_VHDX, 3ull * MB + 100 * 512, "VHDX unmapped blocks");
+
+	// Past 4096 blocks the BAT has a sector bitmap entry in between
+	std::vector<char> block = makeDisk((size_t)MB, (size_t)MB, "");
+	VirtualDisk large;
+	std::vector<char> image = vhdx(std::vector<char>(), std::vector<unsigned int>(), 0, 4097ull * MB);
+	size_t at = image.size();
+	putLe(image, 2 * MB + (4096 + 1) * 8, 6 | ((at / MB) << 20), 8);
+	image.insert(image.end(), block.begin(), block.end());
+	if (parse(image, large))
+	{
+		const TransferPipeline::ExtentList& extents = large.extents();
+		check(extents.size() == 2 && extents[0].kind == TransferPipeline::Extent::EXTENT_FILL && extents[0].numsectors == 4096ull * 2048ull,
+			"extents before the bitmap entry", std::to_string(extents.size()));
+		check(extents.size() == 2 && extents[1].kind == TransferPipeline::Extent::EXTENT_DATA && extents[1].sourceoffset == at,
+			"block after the bitmap entry", (extents.size() == 2) ? std::to_string(extents[1].sourceoffset) : "");
+	}
+	else
+	{
+		check(false, "parse large VHDX", std::to_string(large.error()));
+	}
+}
+
+void refused()
+{
+	const uint32_t blocksize = 64 * 1024;
+	std::vector<char> disk = makeDisk(2 * blocksize, blocksize, "");
+	std::vector<unsigned int> stored = { 0, 1 };
+	VirtualDisk vd;
+
+	std::vector<char> image = vhdDynamic(disk, blocksize, stored);
+	image[100] ^= 1;
+	check(!parse(image, vd) && vd.error() == VirtualDisk::VIRTUAL_DAMAGED, "VHD footer checksum", std::to_string(vd.error()));
+	image = vhdDynamic(disk, blocksize, stored, 4);
+	check(!parse(image, vd) && vd.error() == VirtualDisk::VIRTUAL_DIFFERENCING, "VHD differencing", std::to_string(vd.error()));
+	image = vhdDynamic(disk, blocksize, stored);
+	check(parse(image, vd, 4096ull) && vd.numSectors() == disk.size() / 4096, "VHD on 4K sectors", std::to_string(vd.error()));
+	image = vhdDynamic(disk, 1536, std::vector<unsigned int>());
+	check(!parse(image, vd, 4096ull) && vd.error() == VirtualDisk::VIRTUAL_BAD_BLOCK_SIZE, "VHD block size", std::to_string(vd.error()));
+	image = vhdFixed(disk);
+	image.resize(image.size() - 1);
+	check(!parse(image, vd), "truncated fixed VHD", std::to_string(vd.error()));
+
+	disk = makeDisk((size_t)(2 * MB), (size_t)MB, "");
+	// The newer header is damaged, so the older one counts
+	image = vhdx(disk, stored);
+	image[128 * 1024 + 200] ^= 1;
+	check(parse(image, vd), "older VHDX header", std::to_string(vd.error()));
+	image = vhdx(disk, stored);
+	image[64 * 1024 + 200] ^= 1;
+	image[128 * 1024 + 200] ^= 1;
+	check(!parse(image, vd) && vd.error() == VirtualDisk::VIRTUAL_DAMAGED, "VHDX headers", std::to_string(vd.error()));
+	// A log still to replay, in the current header
+	image = vhdx(disk, stored);
+	image[128 * 1024 + 48] = 1;
+	vhdxChecksum(image, 128 * 1024, 4096);
+	check(!parse(image, vd) && vd.error() == VirtualDisk::VIRTUAL_NEEDS_REPLAY, "VHDX log", std::to_string(vd.error()));
+	image = vhdx(disk, stored, 0, 0ull, 0x2);
+	check(!parse(image, vd) && vd.error() == VirtualDisk::VIRTUAL_DIFFERENCING, "VHDX parent", std::to_string(vd.error()));
+	// Both region tables damaged
+	image = vhdx(disk, stored);
+	image[192 * 1024 + 100] ^= 1;
+	image[256 * 1024 + 100] ^= 1;
+	check(!parse(image, vd) && vd.error() == VirtualDisk::VIRTUAL_DAMAGED, "VHDX region tables", std::to_string(vd.error()));
+}
+
+} // namespace
+
+int main()
+{
+	vhdFormats();
+	vhdxFormats();
+	refused();
+	remove("disk.img");
+	remove("sink.img");
+	return testResult("virtualdisktest");
+}
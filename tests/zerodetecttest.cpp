@@ -0,0 +1,91 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// firstNonZeroByte() and isZeroFilled() on every kernel this CPU can run:
+// the first non-zero byte at each position of short, odd-length and
+// unaligned ranges, and ranges that are zero up to their last byte.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "cpufeatures.h"
+#include "testutil.h"
+#include "zerodetect.h"
+
+namespace
+{
+
+void testKernel()
+{
+	std::string kernel = zeroDetectKernel();
+	// Room for every start offset within a 64 byte line past the longest range
+	std::vector<char> buffer(4096 + 64 + 64, 0);
+	for (size_t offset = 0; offset < 64; ++offset)
+	{
+		char* data = buffer.data() + offset;
+		for (size_t bytes = 0; bytes <= 300; ++bytes)
+		{
+			std::string detail = kernel + ", offset " + std::to_string(offset) + ", " + std::to_string(bytes) + " bytes";
+			check(firstNonZeroByte(data, bytes) == bytes && isZeroFilled(data, bytes), "zero range", detail);
+			for (size_t at = 0; at < bytes; ++at)
+			{
+				data[at] = (char)0x80;
+				// A non-zero byte right past the range must not count
+				data[bytes] = 1;
+				check(firstNonZeroByte(data, bytes) == at, "first non-zero byte", detail + ", at " + std::to_string(at));
+				check(!isZeroFilled(data, bytes), "not zero filled", detail + ", at " + std::to_string(at));
+				data[at] = 0;
+				data[bytes] = 0;
+			}
+		}
+	}
+	// Long ranges, non-zero only in the last byte or the last word
+	for (size_t bytes = 4096 - 33; bytes <= 4096 + 33; ++bytes)
+	{
+		char* data = buffer.data() + (bytes % 7);
+		std::string detail = kernel + ", " + std::to_string(bytes) + " bytes";
+		check(isZeroFilled(data, bytes), "long zero range", detail);
+		data[bytes - 1] = 1;
+		check(firstNonZeroByte(data, bytes) == bytes - 1, "last byte", detail);
+		data[bytes - 1] = 0;
+		data[bytes - 8] = 1;
+		check(firstNonZeroByte(data, bytes) == bytes - 8, "last word", detail);
+		data[bytes - 8] = 0;
+	}
+}
+
+} // namespace
+
+int main()
+{
+	// Every kernel the CPU can run: the best, without AVX2, and scalar
+	CpuFeatures all = { true, true, true, true, true, true, true };
+	CpuFeatures noavx2 = all;
+	noavx2.avx2 = false;
+	CpuFeatures none = { false, false, false, false, false, false, false };
+	const CpuFeatures sets[] = { all, noavx2, none };
+	for (const CpuFeatures& set : sets)
+	{
+		selectZeroDetectKernel(set);
+		testKernel();
+		printf("zerodetecttest: %s tested\n", zeroDetectKernel());
+	}
+	return testResult("zerodetecttest");
+}
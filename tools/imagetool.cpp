@@ -0,0 +1,463 @@
+/**********************************************************************
+ *  This program is free software; you can redistribute it and/or     *
+ *  modify it under the terms of the GNU General Public License       *
+ *  as published by the Free Software Foundation; either version 2    *
+ *  of the License, or (at your option) any later version.            *
+ *                                                                    *
+ *  This program is distributed in the hope that it will be useful,   *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of    *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the     *
+ *  GNU General Public License for more details.                      *
+ *                                                                    *
+ *  You should have received a copy of the GNU General Public License *
+ *  along with this program; if not, see http://gnu.org/licenses/     *
+ *  ---                                                               *
+ *  Copyright (C) 2009, Justin Davis <tuxdavis@gmail.com>             *
+ *  Copyright (C) 2009-2017 ImageWriter developers                    *
+ *                 https://sourceforge.net/projects/win32diskimager/  *
+ **********************************************************************/
+
+// Command line front end to the transfer engine for Linux and other POSIX
+// systems: writes, reads or verifies an image through TransferPipeline over
+// BlockDevice, the same way the GUI does on Windows, and reports the
+// engine used and the throughput.  scan reads a device or image only, and
+// counts the zero sectors a sparse image would leave out.
+//
+//     imagetool write IMAGE DEVICE [options]
+//     imagetool read DEVICE IMAGE [options]
+//     imagetool verify IMAGE DEVICE [options]
+//     imagetool scan DEVICE [options]
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "blockdevice.h"
+#include "bufferpool.h"
+#include "chunkcontroller.h"
+#include "crc32.h"
+#include "sha.h"
+#include "transferpipeline.h"
+#include "transferstages.h"
+#include "xxh3.h"
+
+namespace
+{
+
+const unsigned int MAX_QUEUE_DEPTH = 32;
+
+struct Options
+{
+	bool direct;
+	bool adaptive;
+	unsigned int depth;
+	unsigned long long chunksectors;
+	bool zeroskip;
+	bool kernelcopy;
+	std::string hash;
+	bool verbose;
+};
+
+// The digest of the image asked for with --hash, taken as it goes through
+class Digest
+{
+public:
+	enum Kind { KIND_NONE = 0, KIND_SHA1, KIND_SHA256, KIND_XXH3, KIND_CRC32, KIND_CRC32C };
+
+	explicit Digest(const std::string& name) : crc(0)
+	{
+		kind = (name == "sha1") ? KIND_SHA1 : (name == "sha256") ? KIND_SHA256 : (name == "xxh3") ? KIND_XXH3 :
+			(name == "crc32") ? KIND_CRC32 : (name == "crc32c") ? KIND_CRC32C : KIND_NONE;
+	}
+
+	Kind type() const { return kind; }
+
+	void addData(const char* data, size_t bytes)
+	{
+		switch (kind)
+		{
+		case KIND_SHA1:
+			sha1.addData(data, bytes);
+			break;
+		case KIND_SHA256:
+			sha256.addData(data, bytes);
+			break;
+		case KIND_XXH3:
+			xxh3.addData(data, bytes);
+			break;
+		case KIND_CRC32:
+			crc = crc32Update(crc, data, bytes);
+			break;
+		case KIND_CRC32C:
+			crc = crc32cUpdate(crc, data, bytes);
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::string result() const
+	{
+		unsigned char digest[Sha256Hash::DIGEST_BYTES];
+		size_t length = 4;
+		switch (kind)
+		{
+		case KIND_SHA1:
+			sha1.result(digest);
+			length = Sha1Hash::DIGEST_BYTES;
+			break;
+		case KIND_SHA256:
+			sha256.result(digest);
+			length = Sha256Hash::DIGEST_BYTES;
+			break;
+		case KIND_XXH3:
+			xxh3.result(digest);
+			length = Xxh3Hash::DIGEST_BYTES;
+			break;
+		default:
+			// Big-endian, as crc32 and zlib print it
+			for (int i = 0; i < 4; ++i)
+			{
+				digest[i] = (unsigned char)(crc >> (24 - 8 * i));
+			}
+			break;
+		}
+		std::string hex;
+		char byte[3];
+		for (size_t i = 0; i < length; ++i)
+		{
+			snprintf(byte, sizeof(byte), "%02x", digest[i]);
+			hex += byte;
+		}
+		return hex;
+	}
+
+private:
+	Kind kind;
+	Sha1Hash sha1;
+	Sha256Hash sha256;
+	Xxh3Hash xxh3;
+	uint32_t crc;
+};
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: imagetool write IMAGE DEVICE [options]\n"
+		"       imagetool read DEVICE IMAGE [options]\n"
+		"       imagetool verify IMAGE DEVICE [options]\n"
+		"       imagetool scan DEVICE [options]\n"
+		"options:\n"
+		"  --direct          unbuffered I/O (O_DIRECT) on both sides\n"
+		"  --depth N         chunks in flight (default 4)\n"
+		"  --chunk SECTORS   sectors per chunk (default 1024)\n"
+		"  --fixed           keep depth and chunk size, no adaptive tuning\n"
+		"  --zero-skip       write: discard the device and skip zero chunks\n"
+		"                    read: leave zero chunks as holes in the image\n"
+		"  --hash NAME       sha1, sha256, xxh3, crc32 or crc32c of the image\n"
+		"  --no-kernel-copy  copy through the chunk buffers even where\n"
+		"                    copy_file_range() or splice() could do it\n"
+		"  --verbose         log the tuning decisions\n");
+}
+
+void report(const char* what, const std::string& path, unsigned long error)
+{
+	fprintf(stderr, "imagetool: %s %s: %s\n", what, path.c_str(), strerror((int)error));
+}
+
+const char* resultText(TransferPipeline::Result result)
+{
+	switch (result)
+	{
+	case TransferPipeline::RESULT_OK:
+		return "ok";
+	case TransferPipeline::RESULT_READ_ERROR:
+		return "read error";
+	case TransferPipeline::RESULT_WRITE_ERROR:
+		return "write error";
+	case TransferPipeline::RESULT_CANCELED:
+		return "canceled";
+	case TransferPipeline::RESULT_MISMATCH:
+		return "mismatch";
+	default:
+		return "stage error";
+	}
+}
+
+// Requests to an unbuffered regular file are padded like DIRECT_IO_ALIGNMENT
+TransferPipeline::Endpoint endpoint(const BlockDevice* device)
+{
+	return TransferPipeline::Endpoint(device->handle(), (device->isUnbuffered() && device->isRegularFile()) ? (unsigned long long)BufferPool::ALIGNMENT : 1ull);
+}
+
+void summary(const std::string& command, TransferPipeline::Result result, unsigned long long bytesdone, const TransferPipeline& pipeline)
+{
+	double seconds = pipeline.elapsedSeconds();
+	printf("%s: %s, %llu bytes in %.3f s, %.1f MB/s, %s engine\n", command.c_str(), resultText(result),
+		bytesdone, seconds, (seconds > 0.0) ? (double)bytesdone / seconds / 1024.0 / 1024.0 : 0.0, pipeline.engineName());
+	if (result == TransferPipeline::RESULT_MISMATCH)
+	{
+		printf("first mismatch in sector %llu\n", pipeline.failedSector());
+	}
+	else if (result != TransferPipeline::RESULT_OK && pipeline.ioError() != 0)
+	{
+		printf("sector %llu: %s\n", pipeline.failedSector(), strerror((int)pipeline.ioError()));
+	}
+}
+
+// Zero sectors of a device or image, and its digest in the same pass
+int scan(const std::string& path, const Options& options)
+{
+	unsigned long error = 0;
+	BlockDevice* device = BlockDevice::open(path, BlockDevice::ACCESS_READ, options.direct, &error);
+	if (device == NULL)
+	{
+		report("cannot open", path, error);
+		return 1;
+	}
+	unsigned long long sectorsize = device->sectorSize();
+	BufferPool pool;
+	TransferPipeline pipeline(pool, sectorsize, options.chunksectors, options.depth);
+	ZeroDetectStage zeros(sectorsize);
+	Digest digest(options.hash);
+	HashStage<Digest> hashStage(digest, device->size());
+	FusedStage<ZeroDetectStage, HashStage<Digest> > both(zeros, hashStage);
+	unsigned long long sectorsdone = 0ull;
+	TransferPipeline::ProgressFunc progress = [&sectorsdone](unsigned long long done) {
+		sectorsdone = done;
+		return true;
+	};
+	TransferPipeline::Result result;
+	if (digest.type() != Digest::KIND_NONE)
+	{
+		result = pipeline.scan(device->numberOfSectors(), endpoint(device), both, progress);
+	}
+	else
+	{
+		result = pipeline.scan(device->numberOfSectors(), endpoint(device), zeros, progress);
+	}
+	unsigned long long bytesdone = sectorsdone * sectorsize;
+	summary("scan", result, (bytesdone < device->size()) ? bytesdone : device->size(), pipeline);
+	printf("%llu of %llu sectors are zero\n", zeros.zeroSectors(), sectorsdone);
+	if (result == TransferPipeline::RESULT_OK && digest.type() != Digest::KIND_NONE)
+	{
+		printf("%s %s\n", options.hash.c_str(), digest.result().c_str());
+	}
+	delete device;
+	return (result == TransferPipeline::RESULT_OK) ? 0 : 1;
+}
+
+int transfer(const std::string& command, const std::string& sourcepath, const std::string& sinkpath, const Options& options)
+{
+	bool reading = (command == "read");
+	bool verifying = (command == "verify");
+	unsigned long error = 0;
+	BlockDevice* source = BlockDevice::open(sourcepath, BlockDevice::ACCESS_READ, options.direct, &error);
+	if (source == NULL)
+	{
+		report("cannot open", sourcepath, error);
+		return 1;
+	}
+	BlockDevice::Access access = verifying ? BlockDevice::ACCESS_READ : (reading ? BlockDevice::ACCESS_CREATE : BlockDevice::ACCESS_WRITE);
+	BlockDevice* sink = BlockDevice::open(sinkpath, access, options.direct, &error);
+	if (sink == NULL)
+	{
+		report("cannot open", sinkpath, error);
+		delete source;
+		return 1;
+	}
+	// The device side is locked; an image file is only ever the other side
+	BlockDevice* device = reading ? source : sink;
+	if (!device->lock(&error))
+	{
+		report("cannot lock", reading ? sourcepath : sinkpath, error);
+		delete sink;
+		delete source;
+		return 1;
+	}
+
+	unsigned long long sectorsize = device->sectorSize();
+	unsigned long long imagebytes = reading ? device->size() : source->size();
+	unsigned long long sinkbytes = sink->size();
+	unsigned long long numsectors = (imagebytes + sectorsize - 1) / sectorsize;
+	if (!reading && !device->isRegularFile() && numsectors > device->numberOfSectors())
+	{
+		fprintf(stderr, "imagetool: %s is smaller than %s\n", sinkpath.c_str(), sourcepath.c_str());
+		device->unlock(&error);
+		delete sink;
+		delete source;
+		return 1;
+	}
+	// Zero chunks need no writing where the sink reads as zeros already: a
+	// discarded device that says so, or the new image file grown to size
+	// (the chunks left out become holes)
+	bool zeroskip = false;
+	if (options.zeroskip && !verifying && numsectors > 0ull)
+	{
+		bool readszero = false;
+		if (reading)
+		{
+			zeroskip = sink->setSize(numsectors * sectorsize, &error);
+		}
+		else if (sink->discard(0ull, numsectors, &readszero, &error))
+		{
+			zeroskip = readszero;
+		}
+		if (!zeroskip)
+		{
+			fprintf(stderr, "imagetool: %s does not read as zeros, writing zero chunks\n", sinkpath.c_str());
+		}
+	}
+	else if (reading && numsectors > 0ull && !sink->preallocate(numsectors * sectorsize, &error))
+	{
+		// Only a layout hint; the image grows as it is written instead
+		error = 0;
+	}
+
+	BufferPool pool;
+	TransferPipeline pipeline(pool, sectorsize, options.chunksectors, options.depth);
+	ChunkController controller(sectorsize, options.chunksectors, options.depth, MAX_QUEUE_DEPTH,
+		[&options](const std::string& message) {
+			if (options.verbose)
+			{
+				fprintf(stderr, "%s\n", message.c_str());
+			}
+		});
+	if (options.adaptive)
+	{
+		pipeline.setController(&controller);
+	}
+	pipeline.setZeroSkip(zeroskip);
+	// A plain buffered copy is left to the kernel unless told otherwise
+	pipeline.setKernelCopy(options.kernelcopy);
+	unsigned long long sectorsdone = 0ull;
+	TransferPipeline::ProgressFunc progress = [&sectorsdone](unsigned long long done) {
+		sectorsdone = done;
+		return true;
+	};
+	// With zero skip on as well, the pipeline takes the hash along with
+	// its zero check of each chunk
+	Digest digest(options.hash);
+	HashStage<Digest> hashStage(digest, imagebytes);
+	bool hashing = (digest.type() != Digest::KIND_NONE);
+	TransferPipeline::Result result;
+	if (verifying)
+	{
+		result = hashing ? pipeline.compare(numsectors, endpoint(source), endpoint(sink), hashStage, progress) :
+			pipeline.compare(numsectors, endpoint(source), endpoint(sink), progress);
+	}
+	else
+	{
+		result = hashing ? pipeline.copy(numsectors, endpoint(source), endpoint(sink), hashStage, progress) :
+			pipeline.copy(numsectors, endpoint(source), endpoint(sink), progress);
+	}
+
+	int status = (result == TransferPipeline::RESULT_OK) ? 0 : 1;
+	// The last sector may only be partly the image's
+	unsigned long long bytesdone = sectorsdone * sectorsize;
+	if (bytesdone > imagebytes)
+	{
+		bytesdone = imagebytes;
+	}
+	if (!verifying && sink->isRegularFile())
+	{
+		// Padded or preallocated past the data: cut back to what was copied,
+		// or to the size a file written to had before
+		unsigned long long end = (reading || bytesdone > sinkbytes) ? bytesdone : sinkbytes;
+		if (!sink->setSize(end, &error))
+		{
+			report("cannot set the size of", sinkpath, error);
+			status = 1;
+		}
+	}
+	if (!verifying && !sink->flush(&error))
+	{
+		report("cannot flush", sinkpath, error);
+		status = 1;
+	}
+	device->unlock(&error);
+
+	summary(command, result, bytesdone, pipeline);
+	if (zeroskip)
+	{
+		printf("%llu bytes of zero chunks not written\n", pipeline.skippedBytes());
+	}
+	if (hashing && result == TransferPipeline::RESULT_OK)
+	{
+		printf("%s %s\n", options.hash.c_str(), digest.result().c_str());
+	}
+	delete sink;
+	delete source;
+	return status;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	std::string command = (argc > 1) ? argv[1] : "";
+	int paths = (command == "scan") ? 1 : 2;
+	if ((command != "write" && command != "read" && command != "verify" && command != "scan") || argc < 2 + paths)
+	{
+		usage();
+		return 2;
+	}
+	Options options = { false, true, 4u, 1024ull, false, true, "", false };
+	for (int i = 2 + paths; i < argc; ++i)
+	{
+		std::string option = argv[i];
+		if (option == "--direct")
+		{
+			options.direct = true;
+		}
+		else if (option == "--fixed")
+		{
+			options.adaptive = false;
+		}
+		else if (option == "--zero-skip")
+		{
+			options.zeroskip = true;
+		}
+		else if (option == "--no-kernel-copy")
+		{
+			options.kernelcopy = false;
+		}
+		else if (option == "--verbose")
+		{
+			options.verbose = true;
+		}
+		else if (option == "--hash" && i + 1 < argc && Digest(argv[i + 1]).type() != Digest::KIND_NONE)
+		{
+			options.hash = argv[++i];
+		}
+		else if (option == "--depth" && i + 1 < argc)
+		{
+			options.depth = (unsigned int)strtoul(argv[++i], NULL, 10);
+			if (options.depth < 1u || options.depth > MAX_QUEUE_DEPTH)
+			{
+				usage();
+				return 2;
+			}
+		}
+		else if (option == "--chunk" && i + 1 < argc)
+		{
+			options.chunksectors = strtoull(argv[++i], NULL, 10);
+			if (options.chunksectors < 1ull)
+			{
+				usage();
+				return 2;
+			}
+		}
+		else
+		{
+			usage();
+			return 2;
+		}
+	}
+	if (command == "scan")
+	{
+		return scan(argv[2], options);
+	}
+	return transfer(command, argv[2], argv[3], options);
+}